@@ -30,9 +30,267 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <spawn.h>
+
+/**
+ * Number of iterations for the system call benchmark.
+ */
+#define	BENCH_SYSCALL_ITER				100000
+
+/**
+ * Number of processes, and pages touched by each process, in the page fault benchmark.
+ */
+#define	BENCH_FAULT_PROCS				4
+#define	BENCH_FAULT_PAGES				2048
+
+/**
+ * Size of the area touched by the large page benchmark.
+ */
+#define	BENCH_LARGE_SIZE				(32 * 1024 * 1024)
+
+/**
+ * Size of the heap touched before the spawn benchmark, and number of children started.
+ */
+#define	BENCH_SPAWN_HEAP				(64 * 1024 * 1024)
+#define	BENCH_SPAWN_ITER				32
+
+/**
+ * Read the timestamp counter.
+ */
+static uint64_t rdtsc()
+{
+	uint32_t low, high;
+	__asm__ __volatile__ ("rdtsc" : "=a"(low), "=d"(high));
+	return ((uint64_t)high << 32) | low;
+};
+
+/**
+ * Get the value of the field `key` (such as "LockAcquires:") in `/proc/meminfo`, or 0 if it can't
+ * be read.
+ */
+static uint64_t readMemInfo(const char *key)
+{
+	char buf[2048];
+	int fd = open("/proc/meminfo", O_RDONLY);
+	if (fd == -1)
+	{
+		return 0;
+	};
+
+	ssize_t size = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+
+	if (size <= 0)
+	{
+		return 0;
+	};
+
+	buf[size] = 0;
+	char *line = strstr(buf, key);
+	if (line == NULL)
+	{
+		return 0;
+	};
+
+	return strtoull(line + strlen(key), NULL, 10);
+};
+
+/**
+ * Measure the cost of a trivial system call (`getpid()`).
+ */
+static void benchSyscall()
+{
+	int i;
+	uint64_t start = rdtsc();
+	for (i=0; i<BENCH_SYSCALL_ITER; i++)
+	{
+		getpid();
+	};
+	uint64_t end = rdtsc();
+
+	printf("getpid() benchmark: %lu cycles per call\n", (end - start) / BENCH_SYSCALL_ITER);
+};
+
+/**
+ * Measure page fault throughput with several processes faulting in anonymous memory at the
+ * same time, which stresses the page allocator from all CPUs at once.
+ */
+static void benchPageFault()
+{
+	int i;
+	int numStarted = 0;
+	uint64_t lockAcquires = readMemInfo("LockAcquires:");
+	uint64_t lockContended = readMemInfo("LockContended:");
+	uint64_t start = rdtsc();
+	for (i=0; i<BENCH_FAULT_PROCS; i++)
+	{
+		pid_t pid = fork();
+		if (pid == -1)
+		{
+			printf("Page fault benchmark: fork() failed\n");
+			break;
+		};
+
+		if (pid == 0)
+		{
+			char *area = (char*) mmap(NULL, BENCH_FAULT_PAGES * 4096, PROT_READ | PROT_WRITE,
+							MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (area == MAP_FAILED)
+			{
+				_exit(1);
+			};
+
+			int j;
+			for (j=0; j<BENCH_FAULT_PAGES; j++)
+			{
+				area[j * 4096] = 1;
+			};
+
+			_exit(0);
+		};
+
+		numStarted++;
+	};
+
+	for (i=0; i<numStarted; i++)
+	{
+		int wstatus;
+		waitpid(-1, &wstatus, 0);
+	};
+	uint64_t end = rdtsc();
+
+	// the allocator lock is global, so this includes anything else which ran meanwhile
+	lockAcquires = readMemInfo("LockAcquires:") - lockAcquires;
+	lockContended = readMemInfo("LockContended:") - lockContended;
+
+	if (numStarted != 0)
+	{
+		printf("Page fault benchmark: %d processes, %lu cycles per fault\n", numStarted,
+			(end - start) / (numStarted * BENCH_FAULT_PAGES));
+		printf("Page fault benchmark: allocator lock taken %lu times, %lu contended\n",
+			lockAcquires, lockContended);
+	};
+};
+
+/**
+ * Time touching every page of a fresh anonymous area, with the specified `madvise()` advice.
+ */
+static uint64_t benchTouchArea(int advice)
+{
+	char *area = (char*) mmap(NULL, BENCH_LARGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (area == MAP_FAILED)
+	{
+		return 0;
+	};
+
+	madvise(area, BENCH_LARGE_SIZE, advice);
+
+	uint64_t start = rdtsc();
+	size_t i;
+	for (i=0; i<BENCH_LARGE_SIZE; i+=4096)
+	{
+		area[i] = 1;
+	};
+	uint64_t end = rdtsc();
+
+	munmap(area, BENCH_LARGE_SIZE);
+	return end - start;
+};
+
+/**
+ * Large page benchmark: compare faulting in anonymous memory with and without large pages.
+ */
+static void benchLargePages()
+{
+	uint64_t small = benchTouchArea(MADV_NOHUGEPAGE);
+	uint64_t large = benchTouchArea(MADV_HUGEPAGE);
+	printf("Large page benchmark: %lu cycles per MB with 4 KB pages, %lu with 2 MB pages\n",
+		small / (BENCH_LARGE_SIZE >> 20), large / (BENCH_LARGE_SIZE >> 20));
+};
+
+/**
+ * Spawn benchmark: compare starting a child with `fork()` and with `posix_spawn()` from a process with a
+ * large heap. There is no exec for userspace yet, so the forked child just exits; that is less than a
+ * fork followed by exec would cost. The spawned child is init itself, which exits right away when it is
+ * not PID 1.
+ */
+static void benchSpawn()
+{
+	char *heap = (char*) mmap(NULL, BENCH_SPAWN_HEAP, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (heap == MAP_FAILED)
+	{
+		printf("Spawn benchmark: mmap() failed\n");
+		return;
+	};
+
+	// 4 KB pages, as a heap built up by malloc() would have
+	madvise(heap, BENCH_SPAWN_HEAP, MADV_NOHUGEPAGE);
+
+	size_t i;
+	for (i=0; i<BENCH_SPAWN_HEAP; i+=4096)
+	{
+		heap[i] = 1;
+	};
+
+	int j;
+	int wstatus;
+	uint64_t start = rdtsc();
+	for (j=0; j<BENCH_SPAWN_ITER; j++)
+	{
+		pid_t pid = fork();
+		if (pid == 0)
+		{
+			_exit(0);
+		};
+
+		if (pid == -1)
+		{
+			printf("Spawn benchmark: fork() failed\n");
+			munmap(heap, BENCH_SPAWN_HEAP);
+			return;
+		};
+
+		waitpid(pid, &wstatus, 0);
+	};
+	uint64_t forkTime = rdtsc() - start;
+
+	char *argv[] = {"init", NULL};
+	char *envp[] = {NULL};
+
+	start = rdtsc();
+	for (j=0; j<BENCH_SPAWN_ITER; j++)
+	{
+		pid_t pid;
+		int error = posix_spawn(&pid, "/initrd/init", NULL, NULL, argv, envp);
+		if (error != 0)
+		{
+			printf("Spawn benchmark: posix_spawn() failed: %s\n", strerror(error));
+			munmap(heap, BENCH_SPAWN_HEAP);
+			return;
+		};
+
+		waitpid(pid, &wstatus, 0);
+	};
+	uint64_t spawnTime = rdtsc() - start;
+
+	munmap(heap, BENCH_SPAWN_HEAP);
+	printf("Spawn benchmark: %lu cycles per fork(), %lu per posix_spawn() with a %d MB heap\n",
+		forkTime / BENCH_SPAWN_ITER, spawnTime / BENCH_SPAWN_ITER, BENCH_SPAWN_HEAP >> 20);
+};
 
 int main()
 {
+	// when started again by the spawn benchmark, do nothing (arguments are not passed to new
+	// programs yet, so tell by the PID)
+	if (getpid() != 1)
+	{
+		return 0;
+	};
+
 	// open the initrd console, and make it stdin, stdout and stderr
 	int fd = open("/initrd-console", O_RDWR);
 	if (fd != 0)
@@ -83,6 +341,11 @@ int main()
 
 	close(fd);
 
+	benchSyscall();
+	benchPageFault();
+	benchLargePages();
+	benchSpawn();
+
 	printf("Tests ended.\n");
 	printf("Still working?\n");
 	return 0x45;
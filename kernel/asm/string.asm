@@ -35,41 +35,17 @@ global memcmp
 global strcmp
 global strcat
 global memZeroPage
+global memZeroPageNT
 
+; NOTE: nothing in here may touch the FPU/SSE registers, as the syscall path does not
+; save the userspace FPU state (see syscall.asm).
 memcpy:
-.copy16:
-	cmp	rdx,	16
-	jb	.copy8
-	movups	xmm0,	[rsi]
-	movups	[rdi],	xmm0
-	add	rdi,	16
-	add	rsi,	16
-	sub	rdx,	16
-	jmp	.copy16
-.copy8:
-	cmp	rdx,	8
-	jb	.copy4
-	mov	rax,	[rsi]
-	mov	[rdi],	rax
-	add	rdi,	8
-	add	rsi,	8
-	sub	rdx,	8
-	jmp	.copy8
-.copy4:
-	cmp	rdx,	4
-	jb	.copy2
-	mov	eax,	[rsi]
-	mov	[rdi],	eax
-	add	rdi,	4
-	add	rsi,	4
-	sub	rdx,	4
-	jmp	.copy4
-.copy2:
 	mov	rcx,	rdx
-	test	rcx,	rcx
-	jz	.return
+	shr	rcx,	3
+	rep	movsq
+	mov	rcx,	rdx
+	and	rcx,	7
 	rep	movsb
-.return:
 	ret
 
 memset:
@@ -154,10 +130,27 @@ strcat:
 	jmp	.next
 
 memZeroPage:
-	xorps	xmm0,	xmm0
-	mov	rcx,	256
-.loop:
-	movaps	[rdi],	xmm0
-	add	rdi,	16
-	loop	.loop
+	xor	rax,	rax
+	mov	rcx,	512
+	rep	stosq
+	ret
+
+; zero a page with non-temporal stores, so that the zeroes do not evict anything from the
+; cache; used for pages which will not be touched again soon
+memZeroPageNT:
+	xor	rax,	rax
+	mov	rcx,	64
+.next:
+	movnti	[rdi],		rax
+	movnti	[rdi+8],	rax
+	movnti	[rdi+16],	rax
+	movnti	[rdi+24],	rax
+	movnti	[rdi+32],	rax
+	movnti	[rdi+40],	rax
+	movnti	[rdi+48],	rax
+	movnti	[rdi+56],	rax
+	add	rdi,	64
+	dec	rcx
+	jnz	.next
+	sfence
 	ret
\ No newline at end of file
@@ -43,9 +43,10 @@ _syscall_entry:
 	mov rsp, [gs:0x10]
 
 	; save the return context on the stack (this will be needed if we need to
-	; dispatch signals)
+	; dispatch signals). the kernel does not touch the FPU while handling a syscall,
+	; so we only reserve space for the FPU state; it is saved lazily by `sysSaveFPU()`
+	; if needed (e.g. to dispatch a signal)
 	sub rsp, 512
-	fxsave [rsp]
 	push rcx					; userspace return RIP
 	push r11					; userspace return RFLAGS
 	push qword [gs:0x18]				; userspace stack pointer
@@ -55,7 +56,7 @@ _syscall_entry:
 	push r12					; nonvolatile reg
 	push rbp					; nonvolatile reg
 	push rbx					; nonvolatile reg
-	push rbx					; push again for alignment reasons
+	push qword 0					; FPU state not saved yet
 
 	; load kernel data segments
 	mov bx, 0x10
@@ -66,6 +67,21 @@ _syscall_entry:
 	mov rbx, [gs:0x08]				; get current thread from CPU struct
 	mov [rbx], rsp					; store in the `syscallContext` field of the thread
 
+	; charge the time since the last accounting point as user time (see
+	; `schedAccountUser()`); RCX and R11 are already saved so we can use them
+	; to preserve RAX and RDX
+	mov r11, rax
+	mov rcx, rdx
+	rdtsc
+	shl rdx, 32
+	or rax, rdx
+	mov rdx, rax
+	sub rdx, [rbx+0x08]				; Thread.acctStamp
+	add [rbx+0x10], rdx				; Thread.utime
+	mov [rbx+0x08], rax
+	mov rax, r11
+	mov rdx, rcx
+
 	; at this point it is safe to enable interrupts
 	sti
 
@@ -96,16 +112,34 @@ _syscall_entry:
 	; disable interrupts before returning
 	cli
 
+	; charge the time since the last accounting point as system time (see
+	; `schedAccountSystem()`), preserving the return value in RDI
+	mov rbx, [gs:0x08]
+	mov rdi, rax
+	rdtsc
+	shl rdx, 32
+	or rax, rdx
+	mov rdx, rax
+	sub rdx, [rbx+0x08]				; Thread.acctStamp
+	add [rbx+0x18], rdx				; Thread.stime
+	mov [rbx+0x08], rax
+	mov rax, rdi
+
 	; restore the context. note that we only clobbered RBX so the other
 	; registers can be popped without restroing
-	pop rbx
+	pop r10					; 'FPU state saved' flag
 	pop rbx
 	pop rbp
 	add rsp, 4*8
 	pop rdx					; userspace stack pointer -> RDX
 	pop r11					; userspace RFLAGS
 	pop rcx					; userspace RIP
+
+	; only restore the FPU state if someone saved it
+	test r10, r10
+	jz .noFPU
 	fxrstor [rsp]
+.noFPU:
 
 	; restore userspace data segments
 	mov r8, 0x23
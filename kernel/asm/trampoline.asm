@@ -39,9 +39,45 @@ _cpuTrampolineStart:
 	mov es, ax
 	mov ss, ax
 
-	; tell the BSP that we've started
-	mov ax, 1
-	mov [0xB000], ax			; flagAP2BSP
+	; get our initial APIC ID; if the BSP is in x2APIC mode, we must use the
+	; full x2APIC ID from leaf 0xB instead
+	mov eax, 1
+	cpuid
+	shr ebx, 24
+	cmp dword [0xB00C], 0			; useX2APICID
+	jz .findSlot
+	mov eax, 0xB
+	xor ecx, ecx
+	cpuid
+	mov ebx, edx
+
+	; find the slot with our APIC ID
+.findSlot:
+	mov si, 0xE000
+	mov cx, [0xB010]			; numSlots
+.nextSlot:
+	test cx, cx
+	jz .noSlot
+	cmp [si], ebx
+	je .foundSlot
+	add si, 32
+	dec cx
+	jmp .nextSlot
+
+	; we were not asked to start (e.g. we were woken up by a broadcast INIT-SIPI
+	; but are not listed as enabled in the MADT), so just halt forever
+.noSlot:
+	cli
+	hlt
+	jmp .noSlot
+
+.foundSlot:
+	movzx esi, si
+
+	; tell the BSP that we've started; numStarted must be incremented first, so
+	; that once the BSP sees our slot marked, the count already includes us
+	lock inc dword [0xB000]			; numStarted
+	mov dword [si+4], 1			; slot->started
 
 	; loop until the BSP enables its flag
 .waitForBSP:
@@ -88,12 +124,15 @@ trampoline64:
 	xor ax, ax
 	mov ss, ax
 
+	; the upper half of RSI is undefined after switching modes; RSI points to our slot
+	mov esi, esi
+
 	; load the real GDTPointer and set the GDT
-	mov rax, [0xB010]
+	mov rax, [rsi+0x10]			; slot->realGDTPtr
 	lgdt [rax]
 
 	; load the real PML4
-	mov rax, [0xB028]
+	mov rax, [rsi+0x08]			; slot->pml4Phys
 	mov cr3, rax
 
 	; can't remember why we apparently need this
@@ -101,11 +140,11 @@ trampoline64:
 	mov cr0, rax
 
 	; load the IDT
-	mov rax, [0xB030]
+	mov rax, [0xB028]
 	lidt [rax]
 
 	; load the requested stack pointer and align it properly
-	mov rax, [0xB038]
+	mov rax, [rsi+0x18]			; slot->initRSP
 	and rax, ~0xF
 	mov rsp, rax
 	
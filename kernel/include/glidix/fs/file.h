@@ -76,6 +76,11 @@ typedef struct File_
 	off_t offset;
 } File;
 
+/**
+ * Create the object cache for open file descriptions. This is called during kernel initialization.
+ */
+void vfsInitFileCache();
+
 /**
  * Create an open file description referring to an inode. Access rights are NOT checked.
  * Returns the file description on success, or NULL on error. If NULL is returned, and `err` is not
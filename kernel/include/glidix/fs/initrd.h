@@ -29,11 +29,19 @@
 #ifndef __glidix_fs_initrd_h
 #define	__glidix_fs_initrd_h
 
+#include <glidix/util/common.h>
+
 /**
  * Kernel init action for unpacking the initrd.
  */
 #define	KIA_INITRD					"initrd"
 
+/**
+ * The initrd image, as loaded by the bootloader. The kernel symbol table is also in here (see
+ * `KernelBootInfo`).
+ */
+extern uint8_t initrdImage[];
+
 /**
  * TAR header.
  */
@@ -37,7 +37,7 @@
 #define	RAMFS_ROOT_INO						2
 
 /**
- * Kernel init action for registering the ramfs.
+ * Kernel init action for registering the ramfs and tmpfs.
  */
 #define	KIA_RAMFS_REGISTER					"ramfsRegister"
 
@@ -65,7 +65,8 @@
 
 /**
  * Inode flag indicating the inode is only in RAM and thus cannot be cached when the
- * refcount is zero (this is only used by `ramfs`).
+ * refcount is zero (this is only used by `ramfs`). Its page cache is never evicted either,
+ * since it holds the only copy of the data.
  */
 #define	VFS_INODE_NOCACHE				(1 << 1)
 
@@ -54,6 +54,17 @@
  */
 #define	VFS_PAGECACHE_DIRTY				(1UL << 63)
 
+/**
+ * The accessed flag in page cache. This is set whenever a page is accessed, and cleared by the
+ * reclaim CLOCK hand; only pages which were not accessed since the last pass are evicted.
+ */
+#define	VFS_PAGECACHE_ACCESSED				(1UL << 62)
+
+/**
+ * Kernel init action for registering the VFS shrinkers.
+ */
+#define	KAI_VFS_SHRINKERS				"vfsInitShrinkers"
+
 /**
  * Maximum size of a file. File offsets can only be up to 48 bits long,
  * just like memory addresses.
@@ -103,6 +114,13 @@ struct FSDriver_
 	 */
 	int (*mount)(FileSystem *fs, const char *image, const char *options);
 
+	/**
+	 * Called to release whatever `mount()` set up (such as the `drvdata` of the `fs`), when the
+	 * filesystem is being unmounted, or could not be set up after a successful `mount()`. This may be
+	 * NULL if `mount()` allocates nothing.
+	 */
+	void (*unmount)(FileSystem *fs);
+
 	/**
 	 * Get the inode number for the root directory.
 	 */
@@ -123,6 +141,13 @@ struct FSDriver_
 	 */
 	int (*loadInode)(FileSystem *fs, Inode *inode, ino_t ino);
 
+	/**
+	 * Called when an unreferenced inode is dropped from the inode cache, before it is freed. The driver
+	 * must save whatever it needs to load the inode again later (the size, mode, etc may have changed
+	 * since `loadInode()`), and release anything `drvdata` refers to. This may be NULL.
+	 */
+	void (*releaseInode)(Inode *inode);
+
 	/**
 	 * Load a dentry when there was a dentry cache miss. If successful, this function sets `dent->target`
 	 * to the target inode number, and returns 0. Otherwise, it returns a negated error number.
@@ -145,9 +170,23 @@ struct FSDriver_
 	 * data. Returns 0 on success, or a negated error number on error.
 	 * 
 	 * If the offset does not currently exist, most filesystem will zero out `buffer`.
+	 * 
+	 * This may be NULL if the filesystem has no backing store; new pages are then zero-filled, using
+	 * pre-zeroed pages from the zero pool where possible.
 	 */
 	int (*loadPage)(Inode *inode, off_t offset, void *buffer);
 
+	/**
+	 * Write the dirty page `buffer` of `inode`, at the page-aligned `offset`, back to the backing store, so
+	 * that it can be evicted from the page cache and later loaded again with `loadPage()`. This is called
+	 * by the page cache shrinker with the page cache lock held, so it must not block on locks which may be
+	 * held by an allocating thread. Returns 0 on success, or a negated error number on error, in which case
+	 * the page stays in the page cache.
+	 * 
+	 * This may be NULL, in which case dirty pages are never evicted.
+	 */
+	int (*storePage)(Inode *inode, off_t offset, const void *buffer);
+
 	/**
 	 * Resize the specified file. Free on-disk blocks past the page boundary of the new size. The kernel
 	 * will automatically zero out up to the page boundary in the page cache, and drop following pages.
@@ -173,6 +212,11 @@ struct FileSystem_
 	 * The filesystem driver.
 	 */
 	FSDriver *driver;
+
+	/**
+	 * Cache of inodes (including their driver data) belonging to this filesystem.
+	 */
+	struct KmemCache_ *inodeCache;
 };
 
 /**
@@ -193,6 +237,12 @@ struct InodeOps_
 	 * negated error number on error.
 	 */
 	ssize_t (*pwrite)(Inode *inode, const void *buffer, size_t size, off_t pos);
+
+	/**
+	 * Inode flags (`VFS_INODE_*`) to set on device inodes created with these operations; for example
+	 * `VFS_INODE_SEEKABLE` if reads and writes should be given the file position.
+	 */
+	int inodeFlags;
 };
 
 /**
@@ -448,6 +498,20 @@ ssize_t vfsInodeWrite(Inode *inode, const void *buffer, size_t size, off_t pos);
  */
 void* vfsInodeGetPage(Inode *inode, off_t offset);
 
+/**
+ * Get (and upref) the pages of `inode` at the `count` consecutive page-aligned offsets starting at `offset`,
+ * but only those which are already in the page cache; nothing is loaded. `pages[i]` is set to the page, or
+ * to NULL if it is not cached. Returns the number of pages found.
+ */
+int vfsInodeGetCachedPages(Inode *inode, off_t offset, int count, void **pages);
+
+/**
+ * Migrate the page cache page `page` (marked `KOM_PAGE_CACHE`) into `newPage`. This is only possible if
+ * it is not mapped into any address space. On success, returns 0; the page cache now holds the reference
+ * to `newPage`, and `page` is released. Otherwise, returns `EAGAIN`, and the caller still owns `newPage`.
+ */
+errno_t vfsMigratePage(void *page, void *newPage);
+
 /**
  * Get the current inode state. This function never fails.
  */
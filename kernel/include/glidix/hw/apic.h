@@ -30,6 +30,7 @@
 #define	__glidix_hw_apic_h
 
 #include <glidix/util/common.h>
+#include <glidix/hw/msr.h>
 
 /**
  * Physical base address of the APIC register space.
@@ -51,6 +52,25 @@
  */
 #define	APIC_BASE_ENABLE		(1 << 11)
 
+/**
+ * Flag in the `MSR_APIC_BASE` to switch the local APIC into x2APIC mode.
+ */
+#define	APIC_BASE_X2APIC		(1 << 10)
+
+/**
+ * In x2APIC mode, the register at offset N in `APICRegisterSpace` is instead accessed
+ * through the MSR `MSR_X2APIC_BASE + N/16`. The ICR is a single 64-bit MSR, with the
+ * destination in the upper 32 bits.
+ */
+#define	MSR_X2APIC_BASE			0x800
+#define	MSR_X2APIC_ICR			0x830
+
+/**
+ * LVT timer modes.
+ */
+#define	APIC_LVT_TIMER_ONESHOT		(0 << 17)
+#define	APIC_LVT_TIMER_TSC_DEADLINE	(2 << 17)
+
 /**
  * APIC Interrupt Command Register (ICR) destination modes.
  */
@@ -67,6 +87,14 @@
 #define	APIC_ICR_INITDEAS_NO		(1 << 14)
 #define	APIC_ICR_INITDEAS_YES		(1 << 5)
 
+/**
+ * ICR destination shorthands.
+ */
+#define	APIC_ICR_DEST_NORMAL		(0 << 18)
+#define	APIC_ICR_DEST_SELF		(1 << 18)
+#define	APIC_ICR_DEST_ALL		(2 << 18)
+#define	APIC_ICR_DEST_ALL_BUT_SELF	(3 << 18)
+
 /**
  * Delivery status bit in the ICR.
  */
@@ -149,4 +177,115 @@ typedef struct
  */
 extern volatile APICRegisterSpace apic;
 
+/**
+ * Set to nonzero if the local APICs are in x2APIC mode. In this case, `apic` must not be
+ * accessed, and all registers must be accessed through the functions below.
+ */
+extern int apicX2Mode;
+
+/**
+ * Set to nonzero if the local APIC timer supports TSC-deadline mode.
+ */
+extern int apicHasTSCDeadline;
+
+/**
+ * Get the offset of the specified register in `APICRegisterSpace`.
+ */
+#define	APIC_REG(field)			offsetof(APICRegisterSpace, field)
+
+/**
+ * Enable the local APIC of the calling CPU, in x2APIC mode if supported, and set the spurious
+ * interrupt vector.
+ */
+void apicInitLocal();
+
+/**
+ * Read the APIC register at the specified offset (use `APIC_REG()`).
+ */
+static inline uint32_t apicRead(size_t offset)
+{
+	if (apicX2Mode)
+	{
+		return (uint32_t) rdmsr(MSR_X2APIC_BASE + (offset >> 4));
+	}
+	else
+	{
+		return *((volatile uint32_t*) ((volatile char*) &apic + offset));
+	};
+};
+
+/**
+ * Write to the APIC register at the specified offset (use `APIC_REG()`).
+ */
+static inline void apicWrite(size_t offset, uint32_t value)
+{
+	if (apicX2Mode)
+	{
+		wrmsr(MSR_X2APIC_BASE + (offset >> 4), value);
+	}
+	else
+	{
+		*((volatile uint32_t*) ((volatile char*) &apic + offset)) = value;
+		__sync_synchronize();
+	};
+};
+
+/**
+ * Get the APIC ID of the calling CPU.
+ */
+static inline uint32_t apicGetID()
+{
+	if (apicX2Mode)
+	{
+		return (uint32_t) rdmsr(MSR_X2APIC_BASE + (APIC_REG(id) >> 4));
+	}
+	else
+	{
+		return apic.id >> 24;
+	};
+};
+
+/**
+ * Signal the end of interrupt.
+ */
+static inline void apicEOI()
+{
+	apicWrite(APIC_REG(eoi), 0);
+};
+
+/**
+ * Send an inter-processor interrupt to the CPU with the specified APIC ID. `icr` is the value
+ * of the lower 32 bits of the ICR (vector, delivery mode, etc).
+ */
+static inline void apicSendIPI(uint32_t apicID, uint32_t icr)
+{
+	// make sure all our memory writes are visible before the target CPU gets the interrupt;
+	// in x2APIC mode, the WRMSR is not serializing
+	__sync_synchronize();
+
+	if (apicX2Mode)
+	{
+		wrmsr(MSR_X2APIC_ICR, ((uint64_t) apicID << 32) | icr);
+	}
+	else
+	{
+		apic.icrDestApicID = apicID << 24;
+		__sync_synchronize();
+		apic.icr = icr;
+		__sync_synchronize();
+	};
+};
+
+/**
+ * Wait until the last IPI sent by this CPU was accepted. In x2APIC mode, the ICR has no delivery
+ * status bit, so this does nothing.
+ */
+static inline void apicWaitIPI()
+{
+	if (!apicX2Mode)
+	{
+		while (apic.icr & APIC_ICR_PENDING) __sync_synchronize();
+	};
+};
+
 #endif
\ No newline at end of file
@@ -0,0 +1,115 @@
+/*
+	Glidix kernel
+
+	Copyright (c) 2021, Madd Games.
+	All rights reserved.
+	
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+	
+	* Redistributions of source code must retain the above copyright notice, this
+	  list of conditions and the following disclaimer.
+	
+	* Redistributions in binary form must reproduce the above copyright notice,
+	  this list of conditions and the following disclaimer in the documentation
+	  and/or other materials provided with the distribution.
+	
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+	DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+	FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+	DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+	SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+	CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+	OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+	OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#ifndef __glidix_hw_compact_h
+#define	__glidix_hw_compact_h
+
+#include <glidix/util/common.h>
+#include <glidix/util/errno.h>
+#include <glidix/hw/kom.h>
+
+/**
+ * Kernel init action which creates the compaction control file.
+ */
+#define	KIA_COMPACT_INIT				"compactInit"
+
+/**
+ * Path to the compaction control file. Reading it returns the statistics; writing anything to it
+ * compacts all of memory into blocks of `COMPACT_MAX_BUCKET`, and the result can then be read back
+ * as `LastManualFreed`.
+ */
+#define	COMPACT_PATH					"/proc/compact"
+
+/**
+ * Largest bucket which compaction tries to assemble; larger allocations are not worth it.
+ */
+#define	COMPACT_MAX_BUCKET				KOM_BUCKET_LARGE_PAGE
+
+/**
+ * Maximum number of candidate blocks examined by one direct compaction.
+ */
+#define	COMPACT_DIRECT_SCAN				256
+
+/**
+ * Compaction statistics.
+ */
+typedef struct
+{
+	/**
+	 * Number of direct compactions (on allocation failure), and of compactions of all memory
+	 * requested through `COMPACT_PATH`.
+	 */
+	uint64_t directRuns;
+	uint64_t manualRuns;
+
+	/**
+	 * Number of direct compactions which assembled a free block, and which did not.
+	 */
+	uint64_t success;
+	uint64_t failure;
+
+	/**
+	 * Number of blocks examined, and number of free blocks assembled (by any kind of compaction).
+	 */
+	uint64_t blocksScanned;
+	uint64_t blocksFreed;
+
+	/**
+	 * Number of pages migrated, and number of pages which could not be migrated.
+	 */
+	uint64_t pagesMigrated;
+	uint64_t migrateFailed;
+
+	/**
+	 * Number of free blocks assembled by the last compaction of all memory.
+	 */
+	uint64_t lastManualFreed;
+} CompactStats;
+
+/**
+ * Called by the allocator when an allocation from the specified bucket failed. Tries to assemble
+ * a free block of that bucket by migrating movable pages (see `KOM_PAGE_MOVABLE`), and returns
+ * nonzero if one was assembled (though another thread may take it before the caller retries).
+ * Returns 0 without doing anything if the bucket is too large or too small, if the calling thread
+ * may not sleep, or if it is already compacting or reclaiming.
+ */
+int compactDirect(int bucket);
+
+/**
+ * Compact all of memory into blocks of the specified bucket. Returns the number of free blocks
+ * assembled.
+ */
+size_t compactAll(int bucket);
+
+/**
+ * Get the compaction statistics.
+ */
+void compactGetStats(CompactStats *stats);
+
+#endif
\ No newline at end of file
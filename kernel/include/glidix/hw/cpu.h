@@ -32,6 +32,7 @@
 #include <glidix/util/common.h>
 #include <glidix/thread/sched.h>
 #include <glidix/hw/tss.h>
+#include <glidix/hw/kom.h>
 
 /**
  * Size of the lowmem mapping when setting up APs.
@@ -45,6 +46,13 @@
 #define	CPU_LOWMEM_TRAM_DATA				0xB000
 #define	CPU_LOWMEM_PML4					0xC000
 #define	CPU_LOWMEM_GDT					0xD000
+#define	CPU_LOWMEM_SLOTS				0xE000
+
+/**
+ * Set this to 0 to start the APs one at a time instead of broadcasting INIT-SIPI to all of
+ * them at once. APs which fail to start in parallel are always retried one at a time.
+ */
+#define	CPU_STARTUP_PARALLEL				1
 
 /**
  * Size of the idle stack.
@@ -61,6 +69,22 @@
  */
 #define	CPU_MAX						128
 
+/**
+ * Kernel init action which creates `CPU_IPI_LATENCY_PATH`.
+ */
+#define	KIA_IPI_LATENCY					"cpuInitIPILatency"
+
+/**
+ * Path to the IPI latency benchmark file. Writing anything to it times `CPU_IPI_LATENCY_ROUNDS`
+ * IPI round trips to every other CPU; reading it returns the results of the last run.
+ */
+#define	CPU_IPI_LATENCY_PATH				"/proc/ipilat"
+
+/**
+ * Number of round trips timed per CPU by a write to `CPU_IPI_LATENCY_PATH`.
+ */
+#define	CPU_IPI_LATENCY_ROUNDS				64
+
 /**
  * CPU message types.
  */
@@ -68,6 +92,15 @@
 #define	CPU_MSG_INVLPG_TABLE				2		/* invalidate the whole page table */
 #define	CPU_MSG_PROC_SIGNAL				3		/* process received signal */
 #define	CPU_MSG_THREAD_SIGNAL				4		/* thread received signal */
+#define	CPU_MSG_INVLPG_BATCH				5		/* invalidate the pages in a `TLBBatch` */
+#define	CPU_MSG_PING					6		/* do nothing (used to time IPIs) */
+
+/**
+ * Maximum number of separate address ranges in a `TLBBatch`, and the number of pages above which
+ * a CPU flushes its whole TLB rather than invalidating the pages one by one.
+ */
+#define	TLB_BATCH_RANGES				16
+#define	TLB_BATCH_FLUSH_ALL				64
 
 /**
  * Represents a message for the CPU.
@@ -107,6 +140,34 @@ struct CPUMessage_
 	Thread *waiter;
 };
 
+/**
+ * A batch of user pages in one address space whose TLB entries must be invalidated, after changing
+ * many page table entries at once. Adjacent pages are merged into ranges; a batch with too many
+ * pages, or too many ranges, is handled by flushing the whole TLB.
+ */
+typedef struct
+{
+	/**
+	 * The address space.
+	 */
+	uint64_t cr3;
+
+	/**
+	 * Number of pages added since the batch was last flushed.
+	 */
+	size_t numPages;
+
+	/**
+	 * The ranges to invalidate (`end` is exclusive), and how many there are.
+	 */
+	struct
+	{
+		uint64_t start;
+		uint64_t end;
+	} ranges[TLB_BATCH_RANGES];
+	int numRanges;
+} TLBBatch;
+
 /**
  * Represents a CPU. Some of the fields here must have specific offsets, as they are
  * accessed from assembly. These are marked with a comment specifying the offset.
@@ -162,7 +223,12 @@ struct CPU_
 	/**
 	 * This CPU's APIC ID.
 	 */
-	uint8_t apicID;
+	uint32_t apicID;
+
+	/**
+	 * Index of this CPU in the CPU array.
+	 */
+	int index;
 
 	/**
 	 * GDT pointer for APs.
@@ -200,6 +266,22 @@ struct CPU_
 	 * Pending message list.
 	 */
 	CPUMessage *msg;
+
+	/**
+	 * The NUMA node this CPU belongs to (see `komSetupNodes()`).
+	 */
+	int numaNode;
+
+	/**
+	 * This CPU's cache of free pages.
+	 */
+	KOM_PageCache komPageCache;
+
+	/**
+	 * This CPU's share of the memory usage counters (see `komCounterAdd()`). These may be negative,
+	 * since memory may be released on a different CPU than it was allocated on.
+	 */
+	int64_t komCounters[KOM_NUM_COUNTERS];
 };
 
 /**
@@ -208,27 +290,32 @@ struct CPU_
 typedef struct
 {
 	/**
-	 * Flags used by AP and BSP during startup. flagAP2BSP is set by the AP,
-	 * to communicate to the BSP it has booted. Then, to avoid the BSP rebooting
-	 * the AP due to a race condition, flagBSP2AP is then set by the BSP to tell
-	 * the AP that it can continue.
+	 * Number of APs which have entered the trampoline and found their slot. Then, to
+	 * avoid the BSP rebooting the APs due to a race condition, flagBSP2AP is set by the
+	 * BSP to tell the APs that they can continue.
 	 */
-	volatile int flagAP2BSP;		// 0x0000
+	volatile int numStarted;		// 0x0000
 	volatile int flagBSP2AP;		// 0x0004
 
 	/**
-	 * Flag set by the AP when it's done initializing the trampoline data can be
+	 * Number of APs which are done initializing, such that the trampoline data can be
 	 * released.
 	 */
-	volatile int flagAPDone;		// 0x0008
+	volatile int numDone;			// 0x0008
 
-	// 0x000C
-	// (padded to 0x0010)
-	
 	/**
-	 * Pointer to the 64-bit `GDTPointer`.
+	 * Set to nonzero if the APs should identify themselves using their 32-bit x2APIC ID
+	 * instead of the 8-bit initial APIC ID.
 	 */
-	void *realGDTPtr;			// 0x0010
+	uint32_t useX2APICID;			// 0x000C
+
+	/**
+	 * Number of valid entries in the slot array at `CPU_LOWMEM_SLOTS`.
+	 */
+	uint32_t numSlots;			// 0x0010
+
+	// 0x0014
+	// (padded to 0x0018)
 
 	/**
 	 * Temp GDT pointer.
@@ -239,23 +326,50 @@ typedef struct
 		uint64_t base;
 	} PACKED tempGDT;			// 0x0018
 
+	// 0x0022
+	// (padded to 0x0028)
+
+	/**
+	 * Pointer to the idtPtr.
+	 */
+	void *idtPtrPtr;			// 0x0028
+
+	// 0x0030
+} TrampolineData;
+
+/**
+ * Per-AP startup information. The trampoline finds the slot matching its APIC ID, so that
+ * many APs can go through the trampoline at the same time.
+ */
+typedef struct
+{
+	/**
+	 * APIC ID of the AP which should use this slot.
+	 */
+	uint32_t apicID;			// 0x0000
+
+	/**
+	 * Set to 1 by the AP once it found this slot.
+	 */
+	volatile uint32_t started;		// 0x0004
+
 	/**
 	 * Physical address of this AP's initial PML4.
 	 */
-	uint64_t pml4Phys;			// 0x0028
+	uint64_t pml4Phys;			// 0x0008
 
 	/**
-	 * Pointer to the idtPtr.
+	 * Pointer to the 64-bit `GDTPointer`.
 	 */
-	void *idtPtrPtr;			// 0x0030
+	void *realGDTPtr;			// 0x0010
 
 	/**
 	 * Initial stack pointer.
 	 */
-	uint64_t initRSP;			// 0x0038
+	uint64_t initRSP;			// 0x0018
 
-	// 0x0040
-} TrampolineData;
+	// 0x0020
+} TrampolineSlot;
 
 /**
  * Initialize the calling CPU's structures. The CPU has index `index` allocated
@@ -272,7 +386,7 @@ CPU* cpuGetCurrent();
  * Report that a CPU with the specified APIC ID was detected, and should be enabled
  * when `cpuStartAPs()` is called.
  */
-void cpuRegister(uint8_t apicID);
+void cpuRegister(uint32_t apicID);
 
 /**
  * Start up the application processors.
@@ -318,6 +432,34 @@ void cpuProcessMessages();
  */
 void cpuInvalidatePage(uint64_t cr3, void *ptr);
 
+/**
+ * Start a batch of invalidations for the address space using the specified CR3.
+ */
+void cpuBatchInit(TLBBatch *batch, uint64_t cr3);
+
+/**
+ * Add the page at `ptr` to a batch. Nothing is invalidated until `cpuBatchFlush()` is called, so
+ * the page must not be released before then. For a large page, adding its first address is enough.
+ */
+void cpuBatchAdd(TLBBatch *batch, void *ptr);
+
+/**
+ * Add the pages from `ptr` to `ptr+size` to a batch, like `cpuBatchAdd()`.
+ */
+void cpuBatchAddRange(TLBBatch *batch, void *ptr, size_t size);
+
+/**
+ * Invalidate the pages in a batch on the calling CPU, and on every other CPU currently using the
+ * address space, with one message per CPU. Returns once all of them are done; the batch is then empty.
+ */
+void cpuBatchFlush(TLBBatch *batch);
+
+/**
+ * Flush the whole TLB of every other running CPU. This is used after kernel mappings, which are shared
+ * by all address spaces, were removed.
+ */
+void cpuInvalidateKernel();
+
 /**
  * Tell other CPUs that the process using the specified CR3 received a signal, and so someone
  * should dispatch it.
@@ -0,0 +1,77 @@
+/*
+	Glidix kernel
+
+	Copyright (c) 2021, Madd Games.
+	All rights reserved.
+	
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+	
+	* Redistributions of source code must retain the above copyright notice, this
+	  list of conditions and the following disclaimer.
+	
+	* Redistributions in binary form must reproduce the above copyright notice,
+	  this list of conditions and the following disclaimer in the documentation
+	  and/or other materials provided with the distribution.
+	
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+	DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+	FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+	DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+	SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+	CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+	OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+	OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#ifndef __glidix_hw_cpuid_h
+#define	__glidix_hw_cpuid_h
+
+#include <glidix/util/common.h>
+
+/**
+ * CPUID leaves.
+ */
+#define	CPUID_LEAF_FEATURES			0x00000001
+#define	CPUID_LEAF_EXT_FEATURES			0x80000001
+
+/**
+ * Feature bits returned in ECX by `CPUID_LEAF_FEATURES`.
+ */
+#define	CPUID_1_ECX_X2APIC			(1 << 21)
+#define	CPUID_1_ECX_TSC_DEADLINE		(1 << 24)
+
+/**
+ * Feature bits returned in EDX by `CPUID_LEAF_EXT_FEATURES`.
+ */
+#define	CPUID_EXT_EDX_PAGE1GB			(1 << 26)
+
+/**
+ * Result of a CPUID instruction.
+ */
+typedef struct
+{
+	uint32_t				eax;
+	uint32_t				ebx;
+	uint32_t				ecx;
+	uint32_t				edx;
+} CPUIDResult;
+
+/**
+ * Execute the CPUID instruction with the specified leaf and subleaf, and return the result.
+ */
+static inline CPUIDResult cpuid(uint32_t leaf, uint32_t subleaf)
+{
+	CPUIDResult result;
+	ASM (
+		"cpuid"
+		: "=a"(result.eax), "=b"(result.ebx), "=c"(result.ecx), "=d"(result.edx)
+		: "a"(leaf), "c"(subleaf)
+	);
+	return result;
+};
+
+#endif
\ No newline at end of file
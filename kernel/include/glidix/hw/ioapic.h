@@ -42,6 +42,7 @@
 #define	MADT_RECORD_LAPIC			0
 #define	MADT_RECORD_IOAPIC			1
 #define	MADT_RECORD_INTOVR			2
+#define	MADT_RECORD_X2APIC			9
 
 /**
  * I/O APIC registers.
@@ -241,6 +242,14 @@ typedef struct
 	uint32_t				flags;
 } PACKED MADTRecord_LAPIC;
 
+typedef struct
+{
+	uint16_t				rsv;
+	uint32_t				id;
+	uint32_t				flags;
+	uint32_t				acpiID;
+} PACKED MADTRecord_X2APIC;
+
 /**
  * Initialize all the I/O APICs.
  */
@@ -62,6 +62,39 @@ typedef enum
  */
 #define	KOM_BUCKET_PAGE					6
 
+/**
+ * The bucket containing large-page-sized (2 MB) blocks, and the number of pages in one.
+ */
+#define	KOM_BUCKET_LARGE_PAGE				15
+#define	KOM_LARGE_PAGE_PAGES				512
+
+/**
+ * Page descriptor flags: `KOM_PAGE_RESERVED` marks pages not managed by the allocator, `KOM_PAGE_USER`
+ * marks refcounted user pages, and `KOM_PAGE_LARGE` marks the pages of a large user page.
+ * 
+ * `KOM_PAGE_ANON` and `KOM_PAGE_CACHE` mark movable user pages, whose owner is recorded in the
+ * reverse map (see `komSetPageOwner()`): anonymous memory of a process, and pages in the page cache
+ * of an inode, respectively.
+ */
+#define	KOM_PAGE_RESERVED				(1 << 0)
+#define	KOM_PAGE_USER					(1 << 1)
+#define	KOM_PAGE_LARGE					(1 << 2)
+#define	KOM_PAGE_ANON					(1 << 3)
+#define	KOM_PAGE_CACHE					(1 << 4)
+#define	KOM_PAGE_MOVABLE				(KOM_PAGE_ANON | KOM_PAGE_CACHE)
+
+/**
+ * Page descriptors are allocated for each section of physical memory (128 MB) containing usable
+ * memory, so that holes in the physical address space need no descriptors. The descriptors of one
+ * section take up a block of `KOM_SECTION_BUCKET`. The reverse map of a section (see `KOM_PageRmap`)
+ * takes up a block of `KOM_RMAP_BUCKET`, and is only allocated once a movable page in the section
+ * needs it.
+ */
+#define	KOM_SECTION_SHIFT				27
+#define	KOM_SECTION_PAGES				(1UL << (KOM_SECTION_SHIFT - 12))
+#define	KOM_SECTION_BUCKET				12
+#define	KOM_RMAP_BUCKET					13
+
 /**
  * Number of buckets in a pool.
  */
@@ -73,13 +106,52 @@ typedef enum
 #define	KOM_MAX_REGIONS					64
 
 /**
- * Kernel object header.
+ * Amount of kernel address space always left to the range allocator after the direct map. Physical
+ * memory which would push the direct map into this area is not used.
+ */
+#define	KOM_MIN_VM_SPACE				(64UL << 30)
+
+/**
+ * Maximum number of NUMA nodes. Each node has its own set of pools; memory is assigned to nodes in
+ * whole sections.
+ */
+#define	KOM_MAX_NODES					8
+
+/**
+ * Distance between a node and itself, and the default distance between two different nodes, on the
+ * scale used by the ACPI SLIT.
+ */
+#define	KOM_LOCAL_DISTANCE				10
+#define	KOM_REMOTE_DISTANCE				20
+
+/**
+ * Number of pages moved between a per-CPU page cache and the unused pool at once.
+ */
+#define	KOM_PCP_BATCH					32
+
+/**
+ * Once a per-CPU page cache holds more than this many pages, a batch of them is drained
+ * back into the unused pool.
+ */
+#define	KOM_PCP_HIGH					128
+
+/**
+ * Kernel object header. This is stored at the start of every free block.
  */
 typedef struct KOM_Header_ KOM_Header;
 struct KOM_Header_
 {
 	KOM_Header* prev;
 	KOM_Header* next;
+
+	/**
+	 * The bucket and pool which this block is free in; only valid if the block is marked
+	 * free in the free bitmap. The pool is identified by `node * KOM_NUM_POOLS + poolType`,
+	 * so that blocks in different nodes are never merged. The pool is also still valid in a
+	 * block just returned by the allocator, until its new owner writes to it.
+	 */
+	uint32_t bucket;
+	uint32_t pool;
 };
 
 /**
@@ -88,32 +160,168 @@ struct KOM_Header_
 typedef struct
 {
 	/**
-	 * The buckets. Each is a linked list of kernel objects, sorted by ascending
-	 * address.
+	 * The buckets. Each is a linked list of free blocks, in no particular order. A block
+	 * in bucket `i` is always aligned to `KOM_BUCKET_SIZE(i)` relative to the start of
+	 * the managed memory, so that its buddy can be found by address.
 	 */
 	KOM_Header* buckets[KOM_NUM_BUCKETS];
+
+	/**
+	 * Number of free blocks in each bucket.
+	 */
+	uint64_t numFree[KOM_NUM_BUCKETS];
 } KOM_Pool;
 
 /**
- * User page information.
+ * Per-CPU cache of free page-sized blocks (see `KOM_BUCKET_PAGE`) belonging to the unused pool
+ * of the CPU's own node; pages from other nodes are never cached. It is only ever accessed by its
+ * own CPU with interrupts disabled, so single-page allocations and releases do not need to take
+ * the global lock. Blocks are moved to and from the unused pool in batches of `KOM_PCP_BATCH`.
+ */
+typedef struct
+{
+	/**
+	 * The hot list: pages which were recently released on this CPU and are likely still in its
+	 * cache. New pages are added at the head, and drained from the tail.
+	 */
+	KOM_Header* hotHead;
+	KOM_Header* hotTail;
+	int numHot;
+
+	/**
+	 * The cold list: pages taken from the unused pool during a refill. These are only handed
+	 * out once the hot list is empty, and drained first.
+	 */
+	KOM_Header* cold;
+	int numCold;
+
+	/**
+	 * Statistics: allocations served from this cache, and number of refills and drains.
+	 */
+	uint64_t hits;
+	uint64_t refills;
+	uint64_t drains;
+
+	/**
+	 * Set by `komInitLocal()` once the cache is initialised; until then, the CPU allocates
+	 * directly from the pools.
+	 */
+	int ready;
+} KOM_PageCache;
+
+/**
+ * Allocator statistics, as returned by `komGetStats()`.
  */
 typedef struct
 {
 	/**
-	 * Reference count for this page.
+	 * Number of times the global allocator lock was taken, and how many of those times
+	 * it was already held by another CPU.
+	 */
+	uint64_t lockAcquires;
+	uint64_t lockContended;
+
+	/**
+	 * Totals of the per-CPU page cache statistics.
 	 */
-	uint64_t refcount;
+	uint64_t pcpHits;
+	uint64_t pcpRefills;
+	uint64_t pcpDrains;
 
 	/**
-	 * Spinlock protecting the blocker list.
+	 * Number of pages currently sitting in per-CPU page caches.
 	 */
-	Spinlock blockerLock;
+	uint64_t pcpPages;
 
 	/**
-	 * The blocker list.
+	 * Number of free blocks in each bucket of each pool.
 	 */
-	void *blockerList;
-} KOM_UserPageInfo;
+	uint64_t numFree[KOM_NUM_POOLS][KOM_NUM_BUCKETS];
+
+	/**
+	 * Number of 4 KB, 2 MB and 1 GB pages used for the direct map.
+	 */
+	uint64_t directPages[3];
+
+	/**
+	 * Number of NUMA nodes, and for each node: the number of pages it manages, how many of them are
+	 * free in the pools, and how many blocks were allocated from the pools on behalf of its CPUs from
+	 * the node itself and from other nodes.
+	 */
+	int numNodes;
+	uint64_t nodeTotalPages[KOM_MAX_NODES];
+	uint64_t nodeFreePages[KOM_MAX_NODES];
+	uint64_t nodeLocalAllocs[KOM_MAX_NODES];
+	uint64_t nodeRemoteAllocs[KOM_MAX_NODES];
+
+	/**
+	 * Distances between nodes (`KOM_LOCAL_DISTANCE` from a node to itself).
+	 */
+	uint8_t nodeDistance[KOM_MAX_NODES][KOM_MAX_NODES];
+} KOM_Stats;
+
+/**
+ * A range of physical memory belonging to a NUMA node, as passed to `komSetupNodes()`.
+ */
+typedef struct
+{
+	uint64_t base;
+	uint64_t size;
+	int node;
+} KOM_NodeRange;
+
+/**
+ * Memory usage counters. Each is a number of bytes, maintained per-CPU by whoever allocates and
+ * releases the memory (see `komCounterAdd()`).
+ */
+typedef enum
+{
+	KOM_COUNTER_PAGE_CACHE,				// pages in inode page caches
+	KOM_COUNTER_SLAB,				// slabs of object caches
+	KOM_COUNTER_PAGE_TABLES,			// page tables (user and kernel)
+	KOM_COUNTER_KERNEL_STACKS,			// kernel stacks of threads
+	KOM_COUNTER_VMALLOC,				// pages allocated by `vmalloc()`
+	KOM_COUNTER_ZRAM,				// the compressed swap pool
+
+	KOM_NUM_COUNTERS,				// number of counters
+} KOM_Counter;
+
+/**
+ * Page descriptor, one for every page of physical memory in a section containing usable memory;
+ * see `komGetPageDesc()`.
+ */
+typedef struct
+{
+	/**
+	 * Reference count, for user pages.
+	 */
+	uint32_t refcount;
+
+	/**
+	 * Flags (`KOM_PAGE_*`).
+	 */
+	uint16_t flags;
+
+	/**
+	 * For user pages, the order (log2 of the number of pages) of the block the page was allocated
+	 * as part of, and the pool it came from.
+	 */
+	uint8_t order;
+	uint8_t pool;
+} KOM_PageDesc;
+
+/**
+ * The reverse mapping of a movable page: for `KOM_PAGE_ANON`, the pid of the process and the
+ * virtual page number it is mapped at; for `KOM_PAGE_CACHE`, the inode and the page number
+ * within the file. This is only a hint, and must be verified against the owner's own structures
+ * (under its locks) before use. These are kept apart from the page descriptors, so that only
+ * sections holding movable pages pay for them.
+ */
+typedef struct
+{
+	uint64_t owner;
+	uint64_t index;
+} KOM_PageRmap;
 
 /**
  * Represents a region of memory.
@@ -134,11 +342,6 @@ typedef struct
 	 * Size of the region in bytes.
 	 */
 	uint64_t size;
-
-	/**
-	 * Auxiliary information about the pages.
-	 */
-	KOM_UserPageInfo *pageInfo;
 } KOM_Region;
 
 /**
@@ -146,6 +349,12 @@ typedef struct
  */
 void komInit();
 
+/**
+ * Enable the per-CPU page cache on the calling CPU. This is called by `cpuInitSelf()` once the
+ * GS base points to the CPU structure; an AP must not allocate memory before its GS base is set.
+ */
+void komInitLocal();
+
 /**
  * Allocate a block from the specified bucket, out of the allowed pools. The `allowedPools`
  * argument is a bitwise-OR of one or more of the `KOM_POOLBIT_*` macros, or `KOM_POOLBIT_ALL`
@@ -167,10 +376,68 @@ void* komAllocBlock(int bucket, int allowedPools);
 void komReleaseBlock(void *block, int bucket);
 
 /**
- * Allocate a page-aligned address, which will fit at least `size` bytes. This is used for
- * allocating virtual addresses statically; the returned address space can never be freed.
+ * Versions of `komAllocBlock()` and `komReleaseBlock()` which are not seen by the allocation profiler.
+ * These are used by allocators built on top of KOM, such as `kmalloc()`, which report their own
+ * allocations instead.
+ */
+void* komAllocBlockUntracked(int bucket, int allowedPools);
+void komReleaseBlockUntracked(void *block, int bucket);
+
+/**
+ * Give memory which was only used during boot to the allocator. `start` is where the bootloader
+ * mapped it in the kernel image, and both it and `size` must be page-aligned. The pages are unmapped
+ * from there (on all CPUs), added to the direct map, and released into the unused pool. Returns the
+ * number of bytes released.
+ */
+size_t komReleaseBootMemory(void *start, size_t size);
+
+/**
+ * Return all pages in the calling CPU's page cache to the unused pool, so that they may be merged
+ * into larger blocks.
+ */
+void komDrainLocalCache();
+
+/**
+ * Get allocator statistics.
+ */
+void komGetStats(KOM_Stats *stats);
+
+/**
+ * Split memory into `numNodes` NUMA nodes. Each section is assigned to the node of the range in
+ * `ranges` which covers its start (or node 0 if there is none), and the free blocks are moved into
+ * the pools of their nodes. From then on, blocks are allocated from the node of the calling CPU
+ * (see `CPU.numaNode`), falling back to other nodes in order of `distance`. This is called once,
+ * when the ACPI SRAT is parsed.
+ */
+void komSetupNodes(int numNodes, uint8_t distance[KOM_MAX_NODES][KOM_MAX_NODES], const KOM_NodeRange *ranges, int numRanges);
+
+/**
+ * Add `delta` (which may be negative) to the calling CPU's copy of a memory usage counter. This is
+ * cheap, as it does not touch any shared cache line.
  */
-void* komAllocVirtual(size_t size);
+void komCounterAdd(KOM_Counter counter, int64_t delta);
+
+/**
+ * Get the current value of a memory usage counter, summed over all CPUs.
+ */
+uint64_t komCounterRead(KOM_Counter counter);
+
+/**
+ * Get the number of free pages in the pools (pages sitting in per-CPU page caches are not counted).
+ */
+uint64_t komGetFreePages();
+
+/**
+ * Get the total number of pages managed by the allocator.
+ */
+uint64_t komGetTotalPages();
+
+/**
+ * Given a pointer into a block allocated from the specified bucket, return the start of the block.
+ * This works because blocks are always aligned to their size relative to the start of the
+ * managed memory.
+ */
+void* komGetBlockBase(void *ptr, int bucket);
 
 /**
  * Get the virtual address from a physical address previously returned by `komAllocBlock()`.
@@ -179,9 +446,35 @@ void* komAllocVirtual(size_t size);
 void* komPhysToVirt(uint64_t phaddr);
 
 /**
- * Get user page information for the specified pointer.
+ * Get the physical address of a pointer into the direct map. This is a subtraction, as the direct
+ * map is linear.
+ */
+uint64_t komVirtToPhys(const void *ptr);
+
+/**
+ * Get the descriptor of the page containing the specified physical address, or NULL if it is not in
+ * a section of usable memory.
+ */
+KOM_PageDesc* komGetPageDescByPhys(uint64_t phaddr);
+
+/**
+ * Get the descriptor of the page containing the specified pointer into the direct map, or NULL if
+ * it is not in the direct map.
+ */
+KOM_PageDesc* komGetPageDesc(const void *ptr);
+
+/**
+ * Get the pool type (`KOM_POOL_*`) which a block just returned by `komAllocBlock()` came from. This
+ * must be called before anything is written to the block.
  */
-KOM_UserPageInfo* komGetUserPageInfo(void *ptr);
+int komGetBlockPool(const void *block);
+
+/**
+ * Set up the descriptors of a newly-allocated user block of the specified order (log2 of the number
+ * of pages), which came from the specified pool (see `komGetBlockPool()`): each page gets a refcount
+ * of 1, and no owner.
+ */
+void komInitUserPages(void *block, int order, int pool);
 
 /**
  * Allocate a user page, initially with a refcount of 1. Returns NULL if we have run out of
@@ -194,9 +487,62 @@ void* komAllocUserPage();
  */
 void komUserPageUnref(void *page);
 
+/**
+ * Record the owner of a user page (see `KOM_PageRmap`); `kind` is `KOM_PAGE_ANON`, `KOM_PAGE_CACHE`,
+ * or 0 to mark the page as no longer movable. If the reverse map of the page's section cannot be
+ * allocated, the page is simply left unmovable.
+ */
+void komSetPageOwner(void *page, int kind, uint64_t owner, uint64_t index);
+
+/**
+ * Get the owner of a movable user page, as recorded by `komSetPageOwner()`. Only call this once the
+ * page's flags show that it is movable; if no owner was ever recorded, both are set to 0.
+ */
+void komGetPageOwner(const void *page, uint64_t *owner, uint64_t *index);
+
+/**
+ * Check whether the block at `block`, in the specified bucket, could be made free by migrating its
+ * pages elsewhere: every part of it must be either free in a pool, or a movable page with a refcount
+ * of 1. If so, the movable pages are stored into `pages` (which must have room for one entry per page
+ * in the block), and their number is returned; otherwise, -1 is returned.
+ */
+int komGetMovablePages(void *block, int bucket, void **pages);
+
+/**
+ * Return nonzero if the block at `block` is currently free, in the specified bucket or a larger one.
+ */
+int komIsBlockFree(void *block, int bucket);
+
+/**
+ * Get the block of the specified bucket at the specified index (counting from the start of managed
+ * memory), or NULL if it is beyond the end of memory.
+ */
+void* komGetBlockAt(int bucket, uint64_t index);
+
 /**
  * Increment the refcount on a user page, and return the page again.
  */
 void* komUserPageDup(void *page);
 
+/**
+ * Allocate a large (2 MB) user page, which is physically aligned to its size, and set the refcount
+ * of each of its 4 KB pages to 1. This never waits for reclaim: NULL is returned if no free large
+ * block is available, and the caller should then fall back to 4 KB pages.
+ * 
+ * Each 4 KB page keeps its own refcount, so that a large page can be split into 4 KB mappings
+ * without touching the refcounts, and the parts that are no longer mapped are released separately.
+ */
+void* komAllocUserLargePage();
+
+/**
+ * Decrement the refcount of every 4 KB page in a large user page, releasing those which become
+ * unused.
+ */
+void komUserLargePageUnref(void *page);
+
+/**
+ * Increment the refcount of every 4 KB page in a large user page, and return the page again.
+ */
+void* komUserLargePageDup(void *page);
+
 #endif
\ No newline at end of file
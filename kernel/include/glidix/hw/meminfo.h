@@ -0,0 +1,72 @@
+/*
+	Glidix kernel
+
+	Copyright (c) 2021, Madd Games.
+	All rights reserved.
+	
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+	
+	* Redistributions of source code must retain the above copyright notice, this
+	  list of conditions and the following disclaimer.
+	
+	* Redistributions in binary form must reproduce the above copyright notice,
+	  this list of conditions and the following disclaimer in the documentation
+	  and/or other materials provided with the distribution.
+	
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+	DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+	FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+	DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+	SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+	CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+	OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+	OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef __glidix_hw_meminfo_h
+#define	__glidix_hw_meminfo_h
+
+#include <glidix/util/common.h>
+
+/**
+ * Kernel init action which creates the memory statistics files.
+ */
+#define	KIA_MEMINFO					"memInfo"
+
+/**
+ * Directory in the kernel root which holds the statistics files:
+ * 
+ * `meminfo` - memory usage totals, one per line, in kilobytes.
+ * `buddyinfo` - for each pool, the number of free blocks of each order, starting with 4 KB blocks.
+ * `nodeinfo` - for each NUMA node, its memory, local and remote allocation counts, and distances.
+ * `rss` - the resident set size of each process, in kilobytes.
+ */
+#define	MEMINFO_DIR					"/proc"
+
+/**
+ * Text being generated for one of the statistics files. The whole file is generated on each read;
+ * everything it shows is already maintained as it changes, so this is cheap.
+ */
+typedef struct
+{
+	char *buf;
+	size_t len;
+	size_t cap;
+	int failed;
+} MemInfoText;
+
+/**
+ * Append formatted text. If memory runs out, `failed` is set and the rest of the text is dropped.
+ */
+void meminfoPrintf(MemInfoText *text, const char *fmt, ...) FORMAT(printf, 2, 3);
+
+/**
+ * Generate the text using `gen`, and copy the part at `pos` into `buffer`. This is meant to be called
+ * from the `pread` operation of a statistics file.
+ */
+ssize_t meminfoRead(void (*gen)(MemInfoText *text), void *buffer, size_t size, off_t pos);
+
+#endif
\ No newline at end of file
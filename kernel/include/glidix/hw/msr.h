@@ -42,6 +42,7 @@
 #define	MSR_KERNEL_GS_BASE		0xC0000102
 #define MSR_FS_BASE			0xC0000100
 #define MSR_GS_BASE			0xC0000101
+#define	MSR_TSC_DEADLINE		0x000006E0
 
 /**
  * EFER bits.
@@ -77,4 +78,14 @@ static inline uint64_t rdmsr(uint64_t msr)
 	return ((uint64_t)high << 32) | low;
 };
 
+/**
+ * Read the timestamp counter.
+ */
+static inline uint64_t rdtsc()
+{
+	uint32_t low, high;
+	ASM ("rdtsc" : "=a"(low), "=d"(high));
+	return ((uint64_t)high << 32) | low;
+};
+
 #endif
\ No newline at end of file
@@ -42,17 +42,36 @@
 #define	PT_WRITE			(1UL << 1)
 #define	PT_USER				(1UL << 2)
 #define	PT_NOCACHE			(1UL << 4)
+#define	PT_ACCESSED			(1UL << 5)
+#define	PT_HUGE				(1UL << 7)
+#define	PT_SWAP				(1UL << 9)
 #define	PT_PROT_READ			(1UL << 59)
 #define	PT_PROT_WRITE			(1UL << 60)
 #define	PT_PROT_EXEC			(1UL << 61)
 #define	PT_COW				(1UL << 62)
 #define	PT_NOEXEC			(1UL << 63)
 
+/**
+ * In a PDE which points to a page table rather than a large page, the `PT_COW` bit instead marks
+ * a table shared by several address spaces since a fork. Such a PDE is read-only, and the table must
+ * be unshared before any entry in it is changed. The number of address spaces using the table is
+ * the refcount in its page descriptor; a table which is not shared has a refcount of 0.
+ */
+#define	PT_SHARED			PT_COW
+
 /**
  * Page table physical address mask.
  */
 #define	PT_PHYS_MASK			0x0000FFFFFFFFF000UL
 
+/**
+ * A non-present entry with `PT_SWAP` set refers to a page swapped out to zram; the slot number is
+ * stored in the physical address bits, shifted by `PT_SWAP_SHIFT`. The protection comes from the
+ * memory area when the page is faulted back in.
+ */
+#define	PT_SWAP_SHIFT			12
+#define	PT_SWAP_SLOT(entry)		(((entry) & PT_PHYS_MASK) >> PT_SWAP_SHIFT)
+
 /**
  * Mask for the glidix permission bits.
  */
@@ -63,6 +82,12 @@
  */
 #define	PAGE_SIZE			0x1000
 
+/**
+ * Size of a large page (mapped by a PD entry) and a huge page (mapped by a PDPT entry).
+ */
+#define	LARGE_PAGE_SIZE			0x200000UL
+#define	HUGE_PAGE_SIZE			0x40000000UL
+
 /**
  * Page fault flags (as provided by the CPU in the `errCode`).
  */
@@ -114,7 +139,7 @@ void pagetabReload();
 
 /**
  * Get the physical address for the specified virtual address. This assumed that
- * the specified address is mapped!
+ * the specified address is mapped! Large and huge pages are handled.
  */
 uint64_t pagetabGetPhys(const void *ptr);
 
@@ -127,14 +152,15 @@ uint64_t pagetabGetPhys(const void *ptr);
  * 
  * `ENOMEM` is returned if page table allocations failed.
  * 
- * `EINVAL` is returend if either `ptr` or `physBase` is not page-aligned.
+ * `EINVAL` is returend if either `ptr` or `physBase` is not page-aligned, or if part of the
+ * range is covered by a large page (i.e. it is in the direct map).
  */
 errno_t pagetabMapKernel(void *ptr, uint64_t physBase, size_t size, uint64_t flags);
 
 /**
- * Map an arbitrary physical pointer into virtual memory. Note that it is impossible
- * to free the address space allocated by this function. Returns NULL if the allocation
- * was not possible (out of memory for page tables).
+ * Map an arbitrary physical pointer into virtual memory. Returns NULL if the allocation
+ * was not possible (out of address space, or out of memory for page tables). Unmap it
+ * using `pagetabUnmapPhys()` once it is no longer needed.
  * 
  * `flags` are the flags to be passed to `pagetabMapKernel()`.
  * 
@@ -142,6 +168,12 @@ errno_t pagetabMapKernel(void *ptr, uint64_t physBase, size_t size, uint64_t fla
  */
 void* pagetabMapPhys(uint64_t phaddr, size_t size, uint64_t flags);
 
+/**
+ * Unmap memory mapped by `pagetabMapPhys()`, and free its address space. `ptr` is the
+ * pointer returned by `pagetabMapPhys()`.
+ */
+void pagetabUnmapPhys(void *ptr);
+
 /**
  * Get the current physical address of the PML4.
  */
@@ -0,0 +1,177 @@
+/*
+	Glidix kernel
+
+	Copyright (c) 2021, Madd Games.
+	All rights reserved.
+	
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+	
+	* Redistributions of source code must retain the above copyright notice, this
+	  list of conditions and the following disclaimer.
+	
+	* Redistributions in binary form must reproduce the above copyright notice,
+	  this list of conditions and the following disclaimer in the documentation
+	  and/or other materials provided with the distribution.
+	
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+	DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+	FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+	DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+	SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+	CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+	OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+	OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#ifndef __glidix_hw_reclaim_h
+#define	__glidix_hw_reclaim_h
+
+#include <glidix/util/common.h>
+
+/**
+ * Kernel init action which starts the reclaim thread.
+ */
+#define	KIA_RECLAIM_INIT				"reclaimInit"
+
+/**
+ * The free memory watermarks, in pages, are this fraction of the total memory (with a minimum of
+ * `RECLAIM_WMARK_MIN_PAGES` for the low watermark). When the number of free pages drops below the low
+ * watermark, the reclaim thread is woken up, and it reclaims memory until the number of free pages
+ * reaches the high watermark.
+ */
+#define	RECLAIM_WMARK_LOW_DIV				64
+#define	RECLAIM_WMARK_HIGH_DIV				32
+#define	RECLAIM_WMARK_MIN_PAGES				256
+
+/**
+ * Number of pages direct reclaim tries to free when an allocation fails.
+ */
+#define	RECLAIM_DIRECT_BATCH				32
+
+/**
+ * Maximum number of passes over all shrinkers in a single reclaim run.
+ */
+#define	RECLAIM_MAX_PASSES				4
+
+/**
+ * Represents a shrinker: a subsystem holding memory which can be freed on demand.
+ */
+typedef struct Shrinker_ Shrinker;
+struct Shrinker_
+{
+	/**
+	 * Next shrinker in the list.
+	 */
+	Shrinker *next;
+
+	/**
+	 * Name of the shrinker.
+	 */
+	const char *name;
+
+	/**
+	 * Try to free about `numPages` pages, and return the number of pages actually freed. The
+	 * shrinker must not block on locks that may be held by the allocating thread, and should use
+	 * `mutexTryLock()` and the like instead.
+	 */
+	size_t (*shrink)(size_t numPages);
+
+	/**
+	 * If nonzero, this shrinker is costly (for example it compresses memory which is in use), and
+	 * is only called in a pass if the cheap shrinkers did not free enough memory.
+	 */
+	int expensive;
+};
+
+/**
+ * Reclaim statistics.
+ */
+typedef struct
+{
+	/**
+	 * Number of times the reclaim thread was woken up.
+	 */
+	uint64_t kswapdWakeups;
+
+	/**
+	 * Number of direct reclaim attempts (made by allocating threads themselves).
+	 */
+	uint64_t directReclaims;
+
+	/**
+	 * Total number of pages freed by reclaim.
+	 */
+	uint64_t pagesReclaimed;
+
+	/**
+	 * Page cache statistics: pages scanned by the CLOCK hand, pages evicted, and dirty pages
+	 * written back (with `storePage()`) so that they could be evicted.
+	 */
+	uint64_t pageCacheScanned;
+	uint64_t pageCacheEvicted;
+	uint64_t pageCacheWritten;
+
+	/**
+	 * Number of unreferenced inodes and dentries dropped.
+	 */
+	uint64_t inodesDropped;
+	uint64_t dentriesDropped;
+
+	/**
+	 * Number of empty slabs released.
+	 */
+	uint64_t slabsReleased;
+
+	/**
+	 * Number of anonymous pages scanned for swapping out, and swapped out.
+	 */
+	uint64_t anonScanned;
+	uint64_t anonSwapped;
+} ReclaimStats;
+
+/**
+ * The statistics; the counters are updated atomically by the shrinkers and the reclaim code, and
+ * should be read using `reclaimGetStats()`.
+ */
+extern ReclaimStats reclaimStats;
+
+/**
+ * The low watermark, in pages; the allocator wakes the reclaim thread when the number of free pages
+ * drops below this.
+ */
+extern uint64_t reclaimWmarkLow;
+
+/**
+ * Register a shrinker. The structure must remain valid forever.
+ */
+void reclaimRegisterShrinker(Shrinker *shrinker);
+
+/**
+ * Called by the allocator when the number of free pages drops below the low watermark. Wakes up
+ * the reclaim thread if it is not running already. This can be called with interrupts disabled.
+ */
+void reclaimWakeup();
+
+/**
+ * Returns nonzero if the calling thread may do direct reclaim or compaction: interrupts must be
+ * enabled (since we may sleep on locks), and the thread must not already be reclaiming.
+ */
+int reclaimCanRunDirect();
+
+/**
+ * Try to reclaim at least `numPages` pages in the context of the calling thread. Returns the number
+ * of pages freed. Returns 0 without doing anything if the calling thread is already performing
+ * reclaim.
+ */
+size_t reclaimDirect(size_t numPages);
+
+/**
+ * Get the reclaim statistics.
+ */
+void reclaimGetStats(ReclaimStats *stats);
+
+#endif
\ No newline at end of file
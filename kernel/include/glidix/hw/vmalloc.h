@@ -0,0 +1,148 @@
+/*
+	Glidix kernel
+
+	Copyright (c) 2021, Madd Games.
+	All rights reserved.
+	
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+	
+	* Redistributions of source code must retain the above copyright notice, this
+	  list of conditions and the following disclaimer.
+	
+	* Redistributions in binary form must reproduce the above copyright notice,
+	  this list of conditions and the following disclaimer in the documentation
+	  and/or other materials provided with the distribution.
+	
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+	DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+	FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+	DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+	SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+	CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+	OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+	OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef __glidix_hw_vmalloc_h
+#define	__glidix_hw_vmalloc_h
+
+#include <glidix/util/common.h>
+
+/**
+ * End of the kernel virtual address space handed out by the range allocator; the recursive page
+ * table mapping begins here.
+ */
+#define	VM_ARENA_END					0xFFFFFF8000000000UL
+
+/**
+ * Number of size classes of free ranges. A free range of N pages is in class `floor(log2(N))`.
+ */
+#define	VM_NUM_CLASSES					40
+
+/**
+ * Number of buckets in the table of allocated ranges (must be a power of 2).
+ */
+#define	VM_HASH_SIZE					256
+
+/**
+ * Freed ranges are not reused until the TLBs of all CPUs are flushed. This is done in one batch once
+ * this many pages are waiting.
+ */
+#define	VM_LAZY_MAX_PAGES				8192
+
+/**
+ * Range states.
+ */
+#define	VM_RANGE_FREE					0
+#define	VM_RANGE_USED					1
+#define	VM_RANGE_LAZY					2
+
+/**
+ * Describes a range of kernel virtual addresses.
+ */
+typedef struct VmRange_ VmRange;
+struct VmRange_
+{
+	/**
+	 * Neighbouring ranges, in address order. Every range is on this list, whatever its state.
+	 */
+	VmRange *prev;
+	VmRange *next;
+
+	/**
+	 * Links in the free list of the size class (if free), in the hash chain (if used), or in the
+	 * lazy list (if waiting for a TLB flush; only `nextLink` is used).
+	 */
+	VmRange *prevLink;
+	VmRange *nextLink;
+
+	/**
+	 * Base address and size in bytes (both page-aligned).
+	 */
+	char *base;
+	size_t size;
+
+	/**
+	 * State (`VM_RANGE_*`).
+	 */
+	int state;
+};
+
+/**
+ * Virtual memory allocator statistics.
+ */
+typedef struct
+{
+	/**
+	 * Bytes of address space allocated, free, and waiting for a TLB flush.
+	 */
+	uint64_t usedBytes;
+	uint64_t freeBytes;
+	uint64_t lazyBytes;
+
+	/**
+	 * Number of batched TLB flushes performed so far.
+	 */
+	uint64_t flushes;
+} VmStats;
+
+/**
+ * Set up the range allocator to manage addresses from `start` to `VM_ARENA_END`. This is called
+ * by `komInit()` once the direct map is set up.
+ */
+void vmInit(void *start);
+
+/**
+ * Allocate a page-aligned range of kernel virtual addresses, which will fit at least `size` bytes.
+ * Nothing is mapped there. Returns NULL if there is no space, or no memory for the range descriptor.
+ */
+void* vmAllocRange(size_t size);
+
+/**
+ * Unmap and free a range previously returned by `vmAllocRange()`. The physical pages it was mapped
+ * to are not released. The range is reused only after the TLBs of all CPUs were flushed, which is
+ * done lazily in batches, so this must not be called with interrupts disabled.
+ */
+void vmFreeRange(void *ptr);
+
+/**
+ * Allocate `size` bytes of kernel memory, which is virtually but not physically contiguous. Use this
+ * for large allocations which do not need to be physically contiguous, as it does not require a large
+ * free block in the buddy allocator. Returns NULL if out of memory. Free with `vfree()`.
+ */
+void* vmalloc(size_t size);
+
+/**
+ * Free memory allocated by `vmalloc()`.
+ */
+void vfree(void *ptr);
+
+/**
+ * Get the allocator statistics.
+ */
+void vmGetStats(VmStats *stats);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,90 @@
+/*
+	Glidix kernel
+
+	Copyright (c) 2021, Madd Games.
+	All rights reserved.
+	
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+	
+	* Redistributions of source code must retain the above copyright notice, this
+	  list of conditions and the following disclaimer.
+	
+	* Redistributions in binary form must reproduce the above copyright notice,
+	  this list of conditions and the following disclaimer in the documentation
+	  and/or other materials provided with the distribution.
+	
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+	DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+	FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+	DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+	SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+	CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+	OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+	OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef __glidix_hw_zeropool_h
+#define	__glidix_hw_zeropool_h
+
+#include <glidix/util/common.h>
+
+/**
+ * Kernel init action which starts the zeroing thread.
+ */
+#define	KIA_ZEROPOOL_INIT				"zpoolInit"
+
+/**
+ * The pool is refilled up to this fraction of the total memory, but no more than `ZEROPOOL_MAX_PAGES`
+ * pages. The zeroing thread is woken up when it drops below half of that.
+ */
+#define	ZEROPOOL_TARGET_DIV				256
+#define	ZEROPOOL_MAX_PAGES				4096
+
+/**
+ * Number of pages the zeroing thread zeroes before giving other threads a chance to run.
+ */
+#define	ZEROPOOL_BATCH					16
+
+/**
+ * Zero pool statistics.
+ */
+typedef struct
+{
+	/**
+	 * Number of zeroed pages taken from the pool, and number of requests which found the pool empty
+	 * and had to zero a page synchronously.
+	 */
+	uint64_t hits;
+	uint64_t misses;
+
+	/**
+	 * Number of pages zeroed by the zeroing thread.
+	 */
+	uint64_t pagesZeroed;
+
+	/**
+	 * Number of pages currently in the pool.
+	 */
+	uint64_t pages;
+} ZeroPoolStats;
+
+/**
+ * Allocate a zeroed page (a `KOM_BUCKET_PAGE` block), taking it from the pool of pre-zeroed pages if
+ * possible, and otherwise zeroing it now. Returns NULL if we are out of memory.
+ */
+void* zpoolAlloc();
+
+/**
+ * Like `zpoolAlloc()`, but returns a user page with a refcount of 1 (see `komAllocUserPage()`).
+ */
+void* zpoolAllocUserPage();
+
+/**
+ * Get the zero pool statistics.
+ */
+void zpoolGetStats(ZeroPoolStats *stats);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,144 @@
+/*
+	Glidix kernel
+
+	Copyright (c) 2021, Madd Games.
+	All rights reserved.
+	
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+	
+	* Redistributions of source code must retain the above copyright notice, this
+	  list of conditions and the following disclaimer.
+	
+	* Redistributions in binary form must reproduce the above copyright notice,
+	  this list of conditions and the following disclaimer in the documentation
+	  and/or other materials provided with the distribution.
+	
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+	DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+	FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+	DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+	SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+	CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+	OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+	OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#ifndef __glidix_hw_zram_h
+#define	__glidix_hw_zram_h
+
+#include <glidix/util/common.h>
+#include <glidix/util/errno.h>
+
+/**
+ * Kernel init action which sets up the compressed swap pool.
+ */
+#define	KIA_ZRAM_INIT					"zramInit"
+
+/**
+ * Path to the statistics file.
+ */
+#define	ZRAM_STATS_PATH					"/proc/zram"
+
+/**
+ * Compressed pages are stored as objects in size classes, `ZRAM_CLASS_SIZE` bytes apart. Pages which do
+ * not compress to `ZRAM_MAX_OBJECT` bytes or less are not worth storing, and stay in memory.
+ */
+#define	ZRAM_CLASS_SIZE					32
+#define	ZRAM_MAX_OBJECT					3072
+#define	ZRAM_NUM_CLASSES				(ZRAM_MAX_OBJECT / ZRAM_CLASS_SIZE)
+
+/**
+ * The objects of a class are packed into zspages: blocks of 1, 2 or 4 physically contiguous pages,
+ * whichever wastes the least space at the end. Objects may cross page boundaries within a zspage.
+ */
+#define	ZRAM_MAX_ZSPAGE_ORDER				2
+
+/**
+ * The compressed pool may use at most this fraction of the total memory.
+ */
+#define	ZRAM_POOL_DIV					4
+
+/**
+ * Maximum number of swapped out pages is the total number of pages multiplied by this. The slot table
+ * is allocated in chunks of `ZRAM_SLOTS_PER_CHUNK` slots as needed.
+ */
+#define	ZRAM_SLOTS_MUL					2
+#define	ZRAM_SLOTS_PER_CHUNK				256
+
+/**
+ * Maximum number of processes scanned in one call to the shrinker, and maximum number of pages
+ * scanned in one process before moving on to the next.
+ */
+#define	ZRAM_SCAN_PROCS					8
+#define	ZRAM_SCAN_PAGES					1024
+
+/**
+ * Compressed swap statistics.
+ */
+typedef struct
+{
+	/**
+	 * Number of slots in use, and how many of them are zero-filled pages (which take no space in
+	 * the pool).
+	 */
+	uint64_t storedPages;
+	uint64_t zeroPages;
+
+	/**
+	 * Total size of the compressed data, and the number of pages used by the pool to store it.
+	 */
+	uint64_t compressedBytes;
+	uint64_t poolPages;
+
+	/**
+	 * Maximum number of pages the pool may use.
+	 */
+	uint64_t maxPoolPages;
+
+	/**
+	 * Number of pages swapped out, and number of faults served by swapping a page back in.
+	 */
+	uint64_t pagesOut;
+	uint64_t faults;
+
+	/**
+	 * Number of pages which were not swapped out because they did not compress well enough, or
+	 * because the pool or slot table was full.
+	 */
+	uint64_t incompressible;
+	uint64_t rejected;
+} ZramStats;
+
+/**
+ * Compress the page at `page` and store it in a new slot, whose number is returned in `slotOut`,
+ * with a reference count of 1. Returns 0 on success, or an error number: `EINVAL` if the page does
+ * not compress well enough, `ENOSPC` if the pool is full, or `ENOMEM` if we are out of memory.
+ */
+errno_t zramStore(const void *page, uint64_t *slotOut);
+
+/**
+ * Decompress the contents of the specified slot into the page at `page`. This counts as a fault served.
+ * Returns 0 on success, or `EIO` if the compressed data is corrupt.
+ */
+errno_t zramLoad(uint64_t slot, void *page);
+
+/**
+ * Add a reference to the specified slot (when a page table entry referring to it is copied on fork).
+ */
+void zramDup(uint64_t slot);
+
+/**
+ * Drop a reference to the specified slot, freeing it if this was the last one.
+ */
+void zramFree(uint64_t slot);
+
+/**
+ * Get the statistics.
+ */
+void zramGetStats(ZramStats *stats);
+
+#endif
\ No newline at end of file
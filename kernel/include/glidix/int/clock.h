@@ -0,0 +1,111 @@
+/*
+	Glidix kernel
+
+	Copyright (c) 2021, Madd Games.
+	All rights reserved.
+	
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+	
+	* Redistributions of source code must retain the above copyright notice, this
+	  list of conditions and the following disclaimer.
+	
+	* Redistributions in binary form must reproduce the above copyright notice,
+	  this list of conditions and the following disclaimer in the documentation
+	  and/or other materials provided with the distribution.
+	
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+	DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+	FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+	DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+	SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+	CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+	OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+	OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#ifndef __glidix_int_clock_h
+#define	__glidix_int_clock_h
+
+#include <glidix/util/common.h>
+#include <glidix/thread/process.h>
+
+/**
+ * Clock IDs for `clock_gettime()`.
+ */
+#define	CLOCK_REALTIME							0
+#define	CLOCK_MONOTONIC							1
+#define	CLOCK_PROCESS_CPUTIME_ID					2
+#define	CLOCK_THREAD_CPUTIME_ID						3
+
+/**
+ * Units of the times reported by `times()`, per second; this must match `CLK_TCK` in the C library.
+ */
+#define	CLOCK_TICKS_PER_SEC						1000000
+
+/**
+ * Values of `who` for `getrusage()`.
+ */
+#define	RUSAGE_SELF							0
+#define	RUSAGE_CHILDREN							1
+
+/**
+ * Userspace `struct timespec`.
+ */
+typedef struct
+{
+	int64_t tv_sec;
+	int64_t tv_nsec;
+} ktimespec_t;
+
+/**
+ * Userspace `struct timeval`.
+ */
+typedef struct
+{
+	int64_t tv_sec;
+	int64_t tv_usec;
+} ktimeval_t;
+
+/**
+ * Userspace `struct rusage`.
+ */
+typedef struct
+{
+	ktimeval_t ru_utime;
+	ktimeval_t ru_stime;
+} krusage_t;
+
+/**
+ * Userspace `struct tms`. All times are in units of `CLOCK_TICKS_PER_SEC`.
+ */
+typedef struct
+{
+	int64_t tms_utime;
+	int64_t tms_stime;
+	int64_t tms_cutime;
+	int64_t tms_cstime;
+} ktms_t;
+
+/**
+ * Get resource usage of the calling process or its children. Returns 0 on success, or a
+ * negated error number on error.
+ */
+int sys_getrusage(int who, user_addr_t uusage);
+
+/**
+ * Get the CPU times of the calling process and its children (in units of `CLOCK_TICKS_PER_SEC`).
+ * Returns the system uptime in the same units, or a negated error number on error.
+ */
+int64_t sys_times(user_addr_t ubuf);
+
+/**
+ * Get the value of the specified clock. Returns 0 on success, or a negated error number on
+ * error.
+ */
+int sys_clock_gettime(int clockid, user_addr_t uts);
+
+#endif
\ No newline at end of file
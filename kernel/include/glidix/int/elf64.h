@@ -121,6 +121,12 @@ typedef	int64_t				Elf64_Sxword;
 #define ELF64_R_TYPE(i)			((i) & 0xffffffffL)
 #define ELF64_R_INFO(s, t)		(((s) << 32) + ((t) & 0xffffffffL))
 
+#define	ELF64_ST_TYPE(i)		((i) & 0xf)
+
+#define	STT_NOTYPE			0
+#define	STT_OBJECT			1
+#define	STT_FUNC			2
+
 #define	R_X86_64_NONE			0
 #define	R_X86_64_64			1
 #define	R_X86_64_GLOB_DAT		6
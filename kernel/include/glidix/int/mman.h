@@ -38,4 +38,9 @@
  */
 user_addr_t sys_mmap(user_addr_t addr, size_t length, int prot, int flags, int fd, off_t offset);
 
+/**
+ * Implement `sys_madvise()`. Returns 0 on success, or a negated error number on error.
+ */
+int sys_madvise(user_addr_t addr, size_t length, int advice);
+
 #endif
\ No newline at end of file
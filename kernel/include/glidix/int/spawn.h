@@ -0,0 +1,96 @@
+/*
+	Glidix kernel
+
+	Copyright (c) 2021, Madd Games.
+	All rights reserved.
+	
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+	
+	* Redistributions of source code must retain the above copyright notice, this
+	  list of conditions and the following disclaimer.
+	
+	* Redistributions in binary form must reproduce the above copyright notice,
+	  this list of conditions and the following disclaimer in the documentation
+	  and/or other materials provided with the distribution.
+	
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+	DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+	FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+	DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+	SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+	CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+	OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+	OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef __glidix_int_spawn_h
+#define	__glidix_int_spawn_h
+
+#include <glidix/int/syscall.h>
+#include <glidix/thread/process.h>
+
+/**
+ * File actions for `spawn()` (the `action` field of `kspawn_file_action_t`).
+ */
+#define	SPAWN_FA_CLOSE							0
+#define	SPAWN_FA_DUP2							1
+#define	SPAWN_FA_OPEN							2
+
+/**
+ * Spawn flags (the `flags` field of `kspawn_attr_t`). These have the same values as the `POSIX_SPAWN_*`
+ * flags in the C library.
+ */
+#define	SPAWN_SETPGROUP							(1 << 1)
+#define	SPAWN_SETSID							(1 << 7)
+#define	SPAWN_ALL							(SPAWN_SETPGROUP | SPAWN_SETSID)
+
+/**
+ * Maximum number of file actions passed to `spawn()`.
+ */
+#define	SPAWN_ACTIONS_MAX						64
+
+/**
+ * Maximum total size of the path, arguments, environment variables and file action paths passed to
+ * `spawn()`, including the terminators, and the maximum number of arguments plus environment variables.
+ */
+#define	SPAWN_ARGS_MAX							(64 * 1024)
+#define	SPAWN_STRINGS_MAX						1024
+
+/**
+ * Userspace `posix_spawn_file_actions_t` entry.
+ */
+typedef struct
+{
+	int action;
+	int fd;
+	int newfd;
+	int oflags;
+	mode_t mode;
+	user_addr_t path;
+} kspawn_file_action_t;
+
+/**
+ * Userspace `posix_spawnattr_t`.
+ */
+typedef struct
+{
+	int flags;
+	pid_t pgroup;
+} kspawn_attr_t;
+
+/**
+ * Create a child process running the program at `upath`, with the NULL-terminated argument and environment
+ * arrays `uargv` and `uenvp` (either may be NULL for an empty list). Unlike `fork()` followed by exec, the
+ * address space of the caller is not copied at all, so the cost does not depend on its size. In the child,
+ * the attributes at `uattr` (which may be NULL) are applied, and then the `numActions` file actions at
+ * `uactions` are performed in order (as in `posix_spawn()`), before the program is executed. Returns the PID of
+ * the child on success, or a negated error number on error. If a file action or the exec fails in the child,
+ * it exits with status 127.
+ */
+pid_t sys_spawn(user_addr_t upath, user_addr_t uargv, user_addr_t uenvp, user_addr_t uactions, int numActions,
+			user_addr_t uattr);
+
+#endif
\ No newline at end of file
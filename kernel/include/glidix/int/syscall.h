@@ -31,6 +31,7 @@
 
 #include <glidix/util/common.h>
 #include <glidix/int/signal.h>
+#include <glidix/hw/fpu.h>
 
 /**
  * Dispatch a signal from a system call. `si` is the signal to dispatch; `rax` is the
@@ -39,4 +40,13 @@
  */
 void sysDispatchSignal(ksiginfo_t *si, uint64_t rax);
 
+/**
+ * Save the userspace FPU state into the syscall context of the calling thread, if it was
+ * not saved yet, and return a pointer to it. System call entry does not save the FPU state,
+ * so this must be called by any system call handler which wishes to use vector registers,
+ * or which needs to inspect the userspace FPU state. The state is then restored when
+ * returning to userspace.
+ */
+FPURegs* sysSaveFPU();
+
 #endif
\ No newline at end of file
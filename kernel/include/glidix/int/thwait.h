@@ -40,7 +40,12 @@
 #define	THWAIT_NEQUALS							1
 
 /**
- * An entry in the blocker list of a page.
+ * Number of buckets in the wait table (must be a power of 2).
+ */
+#define	THWAIT_HASH_SIZE						256
+
+/**
+ * An entry in a wait table bucket.
  */
 typedef struct Blocker_ Blocker;
 struct Blocker_
@@ -56,12 +61,13 @@ struct Blocker_
 	Blocker *next;
 
 	/**
-	 * Offset into the page.
+	 * Physical address of the word being waited on; this identifies the word regardless of which
+	 * process, or which virtual address, it was waited on through.
 	 */
-	uint64_t offset;
+	uint64_t key;
 
 	/**
-	 * The thread waiting on this offset.
+	 * The thread waiting on this word.
 	 */
 	Thread *waiter;
 
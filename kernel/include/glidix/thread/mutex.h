@@ -94,6 +94,13 @@ void mutexLock(Mutex *mtx);
  */
 int mutexTryLock(Mutex *mtx);
 
+/**
+ * Try to lock a mutex from within a shrinker. Unlike `mutexTryLock()`, this fails if the calling
+ * thread already holds the mutex, because then the allocation which triggered reclaim may be in
+ * the middle of using the structure it protects.
+ */
+int mutexTryLockForReclaim(Mutex *mtx);
+
 /**
  * Unlock the mutex. Note that the calling thread may have locked this mutex multiple
  * times recursively; the mutex is only unlocked once the same number of calls was
@@ -35,12 +35,25 @@
 #include <glidix/fs/file.h>
 #include <glidix/int/signal.h>
 #include <glidix/thread/semaphore.h>
+#include <glidix/hw/cpu.h>
 
 /**
  * The kernel init action for initialising the process table and starting `init`.
  */
 #define	KIA_PROCESS_INIT					"procInit"
 
+/**
+ * The kernel init action which creates the fault-around control file.
+ */
+#define	KIA_FAULT_AROUND_INIT					"procFaultAroundInit"
+
+/**
+ * Path to the fault-around control file. Reading it returns the window size and the statistics; writing a
+ * number to it sets the window size (a power of 2 no larger than `PROC_FAULT_AROUND_MAX`; 0 or 1 turns
+ * fault-around off).
+ */
+#define	PROC_FAULT_AROUND_PATH					"/proc/faultaround"
+
 /**
  * Maximum number of processes allowed.
  */
@@ -50,11 +63,24 @@
  * Maximum address for userspace mappings.
  * 
  * This is set to be 44 bits long, so that upon discarding the bottom 12 bits, we get a
- * 32-bit 'page index', which we are using with a treemap. The implementation of the mapping
- * tree must change if we want to make this longer.
+ * 32-bit 'page index', which is what the swap cursor and the page owner records store. Those
+ * must change if we want to make this longer.
  */
 #define	PROC_USER_ADDR_MAX					(1UL << 44)
 
+/**
+ * Number of unmapped pages held back while waiting for their TLB entries to be invalidated; when
+ * more are unmapped at once, the TLB is flushed in between.
+ */
+#define	PROC_GATHER_PAGES					64
+
+/**
+ * Default and maximum number of pages in the fault-around window: on a read fault on a file mapping, the
+ * pages of the aligned window around the faulting page which are already in the page cache are mapped too.
+ */
+#define	PROC_FAULT_AROUND_DEFAULT				16
+#define	PROC_FAULT_AROUND_MAX					64
+
 /**
  * Maximum number of open file descriptors allowed in a process.
  */
@@ -91,6 +117,11 @@
 #define	PROC_WCONTINUED						(1 << 3)
 #define	PROC_WALL						((1 << 4)-1)
 
+/**
+ * Flags for `procCreate()`.
+ */
+#define	PROC_CREATE_EMPTY					(1 << 0)		/* don't copy the address space */
+
 /**
  * Protection settings.
  */
@@ -114,6 +145,15 @@
 #define	MAP_FAILED						((uint64_t)-1)
 #endif
 
+/**
+ * Memory advice (for `procAdvise()`).
+ */
+#ifndef MADV_NORMAL
+#define	MADV_NORMAL						0
+#define	MADV_HUGEPAGE						14
+#define	MADV_NOHUGEPAGE						15
+#endif
+
 /**
  * Type representing a userspace address. Never cast these to pointers, as userspace addresses
  * are NOT to be trusted!
@@ -172,43 +212,91 @@ typedef struct
 } ProcessStartupInfo;
 
 /**
- * Represents a process memory mapping. These objects are immutable, except for the `refcount`
- * field, and so can be reused when forking etc.
+ * Fault-around statistics.
  */
 typedef struct
 {
 	/**
-	 * The refcount. This basically indicates how many pages across any number of processes
-	 * are using this exact mapping.
+	 * Number of read faults on file mappings which looked for cached pages around them, and the number of
+	 * pages mapped that way; each of these pages saves a fault if it is accessed.
 	 */
-	int refcount;
+	uint64_t faults;
+	uint64_t pagesMapped;
+} FaultAroundStats;
+
+/**
+ * Flags for a `VMA` (the `flags` field).
+ */
+#define	VMA_NOHUGE						(1 << 0)		/* MADV_NOHUGEPAGE was given */
+
+/**
+ * Represents a virtual memory area: a contiguous range of the address space, mapped from the same
+ * source with the same protection. The areas of a process are kept in a `VMATree` (see `<glidix/thread/vma.h>`),
+ * which is protected by the `mapLock` of the process.
+ */
+typedef struct VMA_ VMA;
+struct VMA_
+{
+	/**
+	 * Children in the tree (areas at lower and higher addresses), and the height of the subtree
+	 * rooted at this area.
+	 */
+	VMA *left;
+	VMA *right;
+	int height;
 
 	/**
-	 * The file open flags (`O_*`, this is used to control when we can set prots etc).
+	 * The range of user addresses covered by this area (`end` is exclusive); both are page-aligned.
 	 */
-	int oflags;
+	user_addr_t start;
+	user_addr_t end;
 
 	/**
-	 * The inode. We are holding a reference to it, and this will be unreffed once this mapping
-	 * is unmapped from all pages. This is NULL in the special "anonymous mapping".
+	 * The lowest `start` and highest `end` in the subtree, and the size of the largest hole between
+	 * two consecutive areas in the subtree. These are maintained by the tree.
 	 */
-	Inode *inode;
+	user_addr_t subtreeStart;
+	user_addr_t subtreeEnd;
+	user_addr_t maxGap;
 
 	/**
-	 * The user base address where this mapping begins (i.e. corresponds to `offset`).
+	 * Protection (`PROT_*`).
 	 */
-	user_addr_t addr;
+	int prot;
 
 	/**
-	 * The offset within the inode (corresponding to `addr`).
+	 * Area flags (`VMA_*`).
 	 */
-	off_t offset;
+	int flags;
+
+	/**
+	 * The file open flags (`O_*`, this is used to control when we can set prots etc).
+	 */
+	int oflags;
 
 	/**
 	 * Mapping flags (`MAP_*`).
 	 */
 	int mflags;
-} ProcessMapping;
+
+	/**
+	 * The inode, which we hold a reference to. This is NULL for anonymous memory.
+	 */
+	Inode *inode;
+
+	/**
+	 * The offset within the inode corresponding to `start`.
+	 */
+	off_t offset;
+};
+
+/**
+ * A tree of virtual memory areas, ordered by address. All zeroes is an empty tree.
+ */
+typedef struct
+{
+	VMA *root;
+} VMATree;
 
 /**
  * Entry in the file table.
@@ -242,15 +330,26 @@ struct Process_
 	void *pagetabVirt;
 
 	/**
-	 * Tree map, mapping "page indices" to a `ProcessMapping*`.
+	 * The memory areas making up the address space.
 	 */
-	TreeMap *mappingTree;
+	VMATree vmas;
 
 	/**
 	 * Mutex protecting the address space.
 	 */
 	Mutex mapLock;
 
+	/**
+	 * Number of pages mapped into the address space (the resident set size); protected by
+	 * `mapLock`, but may be read without it.
+	 */
+	uint64_t rss;
+
+	/**
+	 * Index of the page at which the next swap-out scan of this process starts; protected by `mapLock`.
+	 */
+	uint32_t swapCursor;
+
 	/**
 	 * Parent process ID. Note that this may change to 1 once the parent terminates. The
 	 * change is protected by `procTableLock`.
@@ -359,8 +458,41 @@ struct Process_
 	 * Process group ID. Protected by the process table lock.
 	 */
 	pid_t pgid;
+
+	/**
+	 * CPU time (in TSC ticks) used in userspace and in the kernel by threads of this
+	 * process which have exited. Protected by the thread table lock.
+	 */
+	uint64_t utime;
+	uint64_t stime;
+
+	/**
+	 * CPU time (in TSC ticks) used in userspace and in the kernel by terminated children
+	 * which were waited for (including their own waited-for children). Protected by the
+	 * process table lock.
+	 */
+	uint64_t cutime;
+	uint64_t cstime;
 };
 
+/**
+ * CPU times of a process, in nanoseconds.
+ */
+typedef struct
+{
+	/**
+	 * Time used by the process itself in userspace and in the kernel.
+	 */
+	uint64_t utime;
+	uint64_t stime;
+
+	/**
+	 * Time used by terminated children which were waited for.
+	 */
+	uint64_t cutime;
+	uint64_t cstime;
+} ProcCPUTimes;
+
 /**
  * Context of child reaping.
  */
@@ -410,9 +542,14 @@ typedef struct
 	Process *parent;
 
 	/**
-	 * The mapping tree of the child.
+	 * The area currently being cloned.
 	 */
-	TreeMap *childTree;
+	VMA *vma;
+
+	/**
+	 * Pages of the parent which became copy-on-write, to be invalidated at the end.
+	 */
+	TLBBatch tlb;
 
 	/**
 	 * The child PML4.
@@ -423,8 +560,18 @@ typedef struct
 	 * Initially set to 0, set to an error number if one occurs.
 	 */
 	errno_t err;
+
+	/**
+	 * Number of pages mapped into the child so far.
+	 */
+	uint64_t rss;
 } PageCloneContext;
 
+/**
+ * Callback for `procWalk()`.
+ */
+typedef void (*ProcWalkCallback)(Process *proc, void *context);
+
 /**
  * Walk context for getting the session ID for a process group ID.
  */
@@ -475,9 +622,13 @@ typedef struct
  * a new thread, which will be part of a new process, and `func(param)` is called inside the new
  * thread.
  * 
+ * If `PROC_CREATE_EMPTY` is set in `flags`, the new process starts with no user mappings at all,
+ * and `func` must exec a program (this is how `spawn()` avoids the cost of copying an address
+ * space which would be thrown away); open files are still inherited.
+ * 
  * Returns the (positive) pid of the new process on success, or a negated error number on error.
  */
-pid_t procCreate(KernelThreadFunc func, void *param);
+pid_t procCreate(KernelThreadFunc func, void *param, int flags);
 
 /**
  * Decrement the refcount of a process object.
@@ -487,11 +638,12 @@ void procUnref(Process *proc);
 /**
  * Create a file mapping or an anonymous mapping in the address space of the calling process.
  * 
- * `addr` must be page-aligned, and `addr+length` must not exceed `PROC_USER_ADDR_MAX`. The mapping
- * will always be made at the requested address, with one exception depending on whether `MAP_FIXED`
- * is set in `flags`. If `MAP_FIXED` is set, `addr` will always be the address used, and you can even
- * map NULL. If `MAP_FIXED` is not set, then if `addr` is zero, the kernel will automatically allocate
- * enough address space to map `length` without overlapping existing segments.
+ * `addr` must be page-aligned, and `addr+length` must not exceed `PROC_USER_ADDR_MAX`; `length` is
+ * rounded up to a whole number of pages. The mapping will always be made at the requested address,
+ * with one exception depending on whether `MAP_FIXED` is set in `flags`. If `MAP_FIXED` is set,
+ * `addr` will always be the address used, and you can even map NULL. If `MAP_FIXED` is not set,
+ * then if `addr` is zero, the kernel will automatically allocate enough address space to map
+ * `length` without overlapping existing segments.
  * 
  * If `MAP_ANON` is set in `flags`, `fp` must be NULL and `offset` is ignored. In this case, an anonymous
  * mapping is created, and accessing the mapped memory range will initially read zeroes. If `MAP_ANON` is
@@ -503,7 +655,7 @@ void procUnref(Process *proc);
  * not committed to disk. On the other hand, with a `MAP_SHARED` mapping, changes will be visible to all
  * processes which map the same file as shared, and the changes will be committed to disk.
  * 
- * If the function fails and returns an error, some of the requested address space might be mapped.
+ * If the function fails and returns an error, the address space is left unchanged.
  * 
  * On success, this function will return the user address where the new mapping begins (which might be zero).
  * On error, `MAP_FAILED` is returned, and if `err` is not NULL, the error number is stored there.
@@ -511,7 +663,8 @@ void procUnref(Process *proc);
 user_addr_t procMap(user_addr_t addr, size_t length, int prot, int flags, File *fp, off_t offset, errno_t *err);
 
 /**
- * Unmap the specified address space. Returns 0 on success, or a negated error number on error.
+ * Unmap the specified address space; `addr` must be page-aligned. Areas partly in the range are split, so
+ * only the part outside it stays mapped. Returns 0 on success, or a negated error number on error.
  */
 int procUnmap(user_addr_t addr, size_t len);
 
@@ -520,6 +673,14 @@ int procUnmap(user_addr_t addr, size_t len);
  */
 int procProtect(user_addr_t addr, size_t len, int prot);
 
+/**
+ * Give advice about the use of a part of the address space. `MADV_HUGEPAGE` allows anonymous memory in the
+ * range to be faulted in as large (2 MB) pages, which is the default; `MADV_NOHUGEPAGE` prevents it, and
+ * splits any large pages already in the range. `MADV_NORMAL` does nothing. Returns 0 on success, or a
+ * negated error number on error (`ENOMEM` if part of the range is not mapped).
+ */
+int procAdvise(user_addr_t addr, size_t len, int advice);
+
 /**
  * Perform pre-exec cleanup.
  * 
@@ -560,6 +721,12 @@ int procToUserCopy(user_addr_t addr, const void *ptr, size_t size);
  */
 Process* procByPID(pid_t pid);
 
+/**
+ * Call `callback` for every process, in order of PID. The process table is locked during the walk,
+ * so the callback must not create or destroy processes.
+ */
+void procWalk(ProcWalkCallback callback, void *context);
+
 /**
  * Increment the reference count of the process, and return it again.
  */
@@ -616,6 +783,11 @@ pid_t procWait(pid_t pid, int *wstatus, int flags);
  */
 void procWakeThreads(Process *proc);
 
+/**
+ * Get the CPU times of the calling process.
+ */
+void procGetCPUTimes(ProcCPUTimes *times);
+
 /**
  * Create a new session by setting the SID and PGID of the calling process to its own PID. Returns 0 on success,
  * or a negated error number on error.
@@ -646,4 +818,19 @@ errno_t procDetachThread(thid_t thid);
  */
 void* procGetUserPage(user_addr_t addr, int faultFlags);
 
+/**
+ * Swap out up to `numPages` anonymous pages of processes which were not accessed recently, compressing
+ * them into zram (see `zramStore()`). Each call continues from where the previous one stopped, and scans
+ * a limited number of processes and pages. Returns the number of pages swapped out.
+ */
+size_t procSwapOut(size_t numPages);
+
+/**
+ * Migrate the anonymous page `page` (marked `KOM_PAGE_ANON`) into `newPage`, updating the page table entry
+ * of its owner. On success, returns 0; the owner now holds the reference to `newPage`, and `page` is released.
+ * Otherwise, returns an error number (`EAGAIN` if the page is busy or no longer mapped by its recorded
+ * owner, `ESRCH` if the owner no longer exists), and the caller still owns `newPage`.
+ */
+errno_t procMigratePage(void *page, void *newPage);
+
 #endif
\ No newline at end of file
@@ -44,6 +44,13 @@
  */
 #define	SCHED_NUM_QUEUES			16
 
+/**
+ * Thread priorities (runqueue indices; a lower index runs first). Threads at `SCHED_PRIO_IDLE`
+ * only run when a CPU would otherwise be idle.
+ */
+#define	SCHED_PRIO_NORMAL			0
+#define	SCHED_PRIO_IDLE				(SCHED_NUM_QUEUES-1)
+
 /**
  * Default kernel stack size.
  */
@@ -59,6 +66,11 @@ typedef void (*KernelThreadFunc)(void *param);
  */
 typedef uint64_t thretval_t;
 
+/**
+ * Bits of `Thread.workPending`.
+ */
+#define	THREAD_WORK_SIGNAL				(1 << 0)		/* signals may be ready */
+
 /**
  * Typedef all the structs here.
  */
@@ -68,11 +80,11 @@ typedef struct Runqueue_ Runqueue;
 
 /**
  * Syscall return context. This is the format of the stack frame pushed by `syscall.asm`
- * (see there).
+ * (see there). `fpuRegs` is only valid if `fpuSaved` is nonzero; see `sysSaveFPU()`.
  */
 typedef struct
 {
-	uint64_t ignore;
+	uint64_t fpuSaved;
 	uint64_t rbx;
 	uint64_t rbp;
 	uint64_t r12;
@@ -96,6 +108,19 @@ struct Thread_
 	 */
 	SyscallContext *syscallContext;						// 0x00
 
+	/**
+	 * TSC value at the last CPU time accounting point (a context switch, or a transition
+	 * between userspace and the kernel).
+	 */
+	uint64_t acctStamp;							// 0x08
+
+	/**
+	 * CPU time spent by this thread in userspace and in the kernel respectively, in TSC
+	 * ticks (see `schedTicksToNanos()`).
+	 */
+	uint64_t utime;								// 0x10
+	uint64_t stime;								// 0x18
+
 	/**
 	 * Next thread in the runqueue.
 	 */
@@ -172,6 +197,31 @@ struct Thread_
 	 * The thread return value. This is set before the thread fully terminates.
 	 */
 	thretval_t retval;
+
+	/**
+	 * Deferred work which must be done before returning to userspace (`THREAD_WORK_*`).
+	 * This is checked without a lock on every return to userspace; bits may be set
+	 * spuriously, but never missed. Bits are set with `schedPostWork()`, and cleared
+	 * only by the thread itself.
+	 */
+	volatile uint32_t workPending;
+
+	/**
+	 * Set while this thread is reclaiming memory, so that allocations made while reclaiming
+	 * do not recurse into reclaim.
+	 */
+	int inReclaim;
+
+	/**
+	 * Priority of this thread (`SCHED_PRIO_*`); this is the runqueue it is placed on.
+	 */
+	int priority;
+
+	/**
+	 * A heap block holding the arguments passed to an exec which does not return (as done by `spawn()`), or
+	 * `NULL`. It is freed once the new program has been set up, or when the thread is destroyed.
+	 */
+	void *execArgs;
 };
 
 /**
@@ -268,12 +318,49 @@ void schedInitTimer();
  */
 void schedPreempt();
 
+/**
+ * Called from the APIC timer IRQ handler. Returns nonzero if the current quantum has actually
+ * expired (as opposed to the interrupt arriving late, after the timer was reset).
+ */
+int schedTimerExpired();
+
 /**
  * Returns nonzero if there are signals ready to dispatch for the current thread/process
  * (i.e. pending and not blocked).
  */
 int schedHaveReadySigs();
 
+/**
+ * Called when the calling thread enters the kernel from userspace: the time since the last
+ * accounting point is charged as user time.
+ */
+void schedAccountUser();
+
+/**
+ * Called when the calling thread returns to userspace, and before reading its own CPU times:
+ * the time since the last accounting point is charged as system time.
+ */
+void schedAccountSystem();
+
+/**
+ * Convert a number of TSC ticks (as used in CPU time accounting) to nanoseconds.
+ */
+uint64_t schedTicksToNanos(uint64_t ticks);
+
+/**
+ * Mark the specified deferred work (`THREAD_WORK_*` bits) as pending for the specified thread.
+ * This must be done before informing the thread's CPU.
+ */
+void schedPostWork(Thread *thread, uint32_t bits);
+
+/**
+ * Returns nonzero if the calling thread has any deferred work pending (see `Thread.workPending`).
+ */
+static inline int schedHaveWork(Thread *me)
+{
+	return __atomic_load_n(&me->workPending, __ATOMIC_ACQUIRE) != 0;
+};
+
 /**
  * Get the effective user ID of the current process. Kernel is always root.
  */
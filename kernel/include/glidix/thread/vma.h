@@ -0,0 +1,114 @@
+/*
+	Glidix kernel
+
+	Copyright (c) 2021, Madd Games.
+	All rights reserved.
+	
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+	
+	* Redistributions of source code must retain the above copyright notice, this
+	  list of conditions and the following disclaimer.
+	
+	* Redistributions in binary form must reproduce the above copyright notice,
+	  this list of conditions and the following disclaimer in the documentation
+	  and/or other materials provided with the distribution.
+	
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+	DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+	FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+	DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+	SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+	CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+	OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+	OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef __glidix_thread_vma_h
+#define	__glidix_thread_vma_h
+
+#include <glidix/util/common.h>
+#include <glidix/util/errno.h>
+#include <glidix/thread/process.h>
+
+/**
+ * Kernel init action which creates the cache of memory areas.
+ */
+#define	KIA_VMA_INIT					"vmaInit"
+
+/**
+ * Returned by `vmaFindFree()` when there is no hole big enough.
+ */
+#define	VMA_NO_SPACE					((user_addr_t)-1)
+
+/**
+ * Create a new memory area covering the page-aligned range `start` to `end`, not yet in any tree.
+ * If `inode` is not NULL, a new reference to it is taken. Returns NULL if we ran out of memory.
+ */
+VMA* vmaNew(user_addr_t start, user_addr_t end, int prot, int mflags, int oflags, Inode *inode, off_t offset);
+
+/**
+ * Delete an area which is not in any tree, releasing its inode.
+ */
+void vmaDelete(VMA *vma);
+
+/**
+ * Return the area containing `addr`, or NULL if `addr` is not mapped.
+ */
+VMA* vmaFind(VMATree *tree, user_addr_t addr);
+
+/**
+ * Return the lowest area which ends above `addr` (that is, the area containing `addr` or else the first area
+ * after it), or NULL if there is none.
+ */
+VMA* vmaFindAfter(VMATree *tree, user_addr_t addr);
+
+/**
+ * Return the area following `vma` in address order, or NULL if it is the last one.
+ */
+VMA* vmaNext(VMATree *tree, VMA *vma);
+
+/**
+ * Add an area to the tree. It must not overlap any area already there.
+ */
+void vmaInsert(VMATree *tree, VMA *vma);
+
+/**
+ * Remove an area from the tree. This does not delete it.
+ */
+void vmaRemove(VMATree *tree, VMA *vma);
+
+/**
+ * Find the highest address at which `length` bytes could be mapped without overlapping any area, such that the
+ * whole range is within `low` to `high` and the address is aligned as specified by `alignMask`. Returns
+ * `VMA_NO_SPACE` if there is no such address. This takes logarithmic time, as whole subtrees without a big enough
+ * hole are skipped.
+ */
+user_addr_t vmaFindFree(VMATree *tree, size_t length, user_addr_t alignMask, user_addr_t low, user_addr_t high);
+
+/**
+ * Split `vma` at `addr`, which must be a page-aligned address inside it; `vma` keeps the part below `addr`, and a
+ * new area is inserted for the rest. Returns 0 on success, or ENOMEM.
+ */
+errno_t vmaSplit(VMATree *tree, VMA *vma, user_addr_t addr);
+
+/**
+ * Merge `vma` with the area directly before it, and with as many areas following it as possible, if they are mapped
+ * the same way and contiguous in the file. Returns the resulting area (which might not be `vma`, as that may have been deleted).
+ */
+VMA* vmaMerge(VMATree *tree, VMA *vma);
+
+/**
+ * Make `dest` (which must be empty) a copy of `src`. Returns 0 on success, or ENOMEM, in which case `dest` is
+ * left empty.
+ */
+errno_t vmaTreeClone(VMATree *dest, VMATree *src);
+
+/**
+ * Delete all areas in the tree, leaving it empty.
+ */
+void vmaTreeDestroy(VMATree *tree);
+
+#endif
\ No newline at end of file
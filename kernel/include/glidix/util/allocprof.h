@@ -0,0 +1,157 @@
+/*
+	Glidix kernel
+
+	Copyright (c) 2021, Madd Games.
+	All rights reserved.
+	
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+	
+	* Redistributions of source code must retain the above copyright notice, this
+	  list of conditions and the following disclaimer.
+	
+	* Redistributions in binary form must reproduce the above copyright notice,
+	  this list of conditions and the following disclaimer in the documentation
+	  and/or other materials provided with the distribution.
+	
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+	DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+	FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+	DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+	SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+	CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+	OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+	OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#ifndef __glidix_util_allocprof_h
+#define	__glidix_util_allocprof_h
+
+#include <glidix/util/common.h>
+
+/**
+ * Kernel init action which creates the allocation profiler file.
+ */
+#define	KIA_ALLOCPROF					"allocProf"
+
+/**
+ * Path to the allocation profiler file. Reading it returns the report; writing `on` starts profiling
+ * (clearing any previous data), `off` stops it, and `reset` clears the data without stopping.
+ */
+#define	ALLOCPROF_PATH					"/proc/allocprof"
+
+/**
+ * Number of return addresses recorded for each allocation. Only the immediate caller is recorded
+ * unless the kernel is built with frame pointers (`-fno-omit-frame-pointer -DCONFIG_FRAME_POINTER`).
+ */
+#define	ALLOCPROF_DEPTH					4
+
+/**
+ * Maximum number of distinct call sites, and of live allocations, which can be tracked at once.
+ * Allocations beyond that are counted as dropped.
+ */
+#define	ALLOCPROF_MAX_SITES				4096
+#define	ALLOCPROF_MAX_LIVE				65536
+
+/**
+ * Number of buckets in the live allocation hash table.
+ */
+#define	ALLOCPROF_HASH_SIZE				16384
+
+/**
+ * Number of sites listed in each section of the report.
+ */
+#define	ALLOCPROF_REPORT_TOP				64
+
+/**
+ * Kinds of allocations.
+ */
+enum
+{
+	ALLOCPROF_KMALLOC,
+	ALLOCPROF_KOM,
+	
+	ALLOCPROF_NUM_KINDS
+};
+
+/**
+ * Call site statistics.
+ */
+typedef struct
+{
+	/**
+	 * The call stack, starting with the immediate caller of the allocator; unused entries are zero.
+	 * A site with all zeroes is unused.
+	 */
+	uint64_t stack[ALLOCPROF_DEPTH];
+
+	/**
+	 * Kind of allocation (`ALLOCPROF_*`).
+	 */
+	int kind;
+
+	/**
+	 * Bytes and number of allocations currently live.
+	 */
+	uint64_t liveBytes;
+	uint64_t liveCount;
+
+	/**
+	 * Total number of allocations and bytes allocated, and number of frees, since profiling started.
+	 */
+	uint64_t allocs;
+	uint64_t allocBytes;
+	uint64_t frees;
+} AllocSite;
+
+/**
+ * A live allocation.
+ */
+typedef struct AllocLive_ AllocLive;
+struct AllocLive_
+{
+	/**
+	 * Next allocation in the same hash bucket, or in the free list.
+	 */
+	AllocLive *next;
+
+	/**
+	 * The allocated pointer and its size.
+	 */
+	const void *ptr;
+	size_t size;
+
+	/**
+	 * The call site which allocated it.
+	 */
+	AllocSite *site;
+};
+
+/**
+ * Nonzero while profiling is on. The hooks check this before calling into the profiler, so that it
+ * costs nothing when off.
+ */
+extern volatile int allocprofActive;
+
+/**
+ * Record an allocation made on behalf of `caller`. Use `ALLOCPROF_ALLOC()` instead of calling this
+ * directly.
+ */
+void allocprofAlloc(int kind, const void *ptr, size_t size, void *caller);
+
+/**
+ * Record that `ptr` was freed. Pointers which were allocated before profiling started are ignored.
+ */
+void allocprofFree(const void *ptr);
+
+/**
+ * Hooks for the allocators; these must be used directly in the public allocation functions, so that
+ * the return address is that of their caller.
+ */
+#define	ALLOCPROF_ALLOC(kind, ptr, size)	do {if (allocprofActive) allocprofAlloc((kind), (ptr), (size), __builtin_return_address(0));} while (0)
+#define	ALLOCPROF_FREE(ptr)			do {if (allocprofActive) allocprofFree(ptr);} while (0)
+
+#endif
\ No newline at end of file
@@ -46,6 +46,11 @@
 #define	FORMAT(a, b, c)				__attribute__ ((format(a, b, c)))
 #define	SECTION(name)				__attribute__ ((section(name)))
 #define	noreturn				_Noreturn
+
+// code and data only used during boot; it is freed once the kernel init actions have run, so
+// nothing marked with these may be called or accessed after that
+#define	__init					SECTION(".init.text")
+#define	__initdata				SECTION(".init.data")
 #define	ASSERT(x)				if (!(x)) panic("Assertion failed: %s", #x)
 
 #ifndef	__SYSTYPES_DEFINED
@@ -0,0 +1,238 @@
+/*
+	Glidix kernel
+
+	Copyright (c) 2021, Madd Games.
+	All rights reserved.
+	
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+	
+	* Redistributions of source code must retain the above copyright notice, this
+	  list of conditions and the following disclaimer.
+	
+	* Redistributions in binary form must reproduce the above copyright notice,
+	  this list of conditions and the following disclaimer in the documentation
+	  and/or other materials provided with the distribution.
+	
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+	DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+	FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+	DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+	SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+	CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+	OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+	OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#ifndef __glidix_util_kmem_h
+#define	__glidix_util_kmem_h
+
+#include <glidix/util/common.h>
+#include <glidix/thread/spinlock.h>
+#include <glidix/hw/kom.h>
+#include <glidix/hw/cpu.h>
+
+/**
+ * Kernel init action which registers the slab shrinker.
+ */
+#define	KIA_KMEM_SHRINKER				"kmemInitShrinker"
+
+/**
+ * Maximum length of a cache name, including the terminator.
+ */
+#define	KMEM_NAME_MAX					32
+
+/**
+ * Number of objects a per-CPU magazine can hold. When a magazine runs empty or fills up,
+ * half of this is moved from or to the slabs at once.
+ */
+#define	KMEM_MAG_SIZE					16
+
+/**
+ * Minimum number of objects we try to fit in a slab; the slab size is doubled (up to
+ * `KMEM_SLAB_MAX_BUCKET`) until this many objects fit.
+ */
+#define	KMEM_MIN_OBJS_PER_SLAB				8
+
+/**
+ * Largest KOM bucket used for a slab.
+ */
+#define	KMEM_SLAB_MAX_BUCKET				(KOM_BUCKET_PAGE+3)
+
+/**
+ * Cache line size, used for object alignment and slab colouring.
+ */
+#define	KMEM_CACHE_LINE					64
+
+/**
+ * Constructor for objects in a cache. It is called once for each object when a new slab is
+ * created, and objects are expected to be returned to the cache in their constructed state.
+ */
+typedef void (*KmemConstructor)(void *obj);
+
+/**
+ * Per-CPU magazine: a small stack of free objects which the CPU can allocate from and free into
+ * without taking the cache lock. Only accessed by its own CPU with interrupts disabled.
+ */
+typedef struct
+{
+	int count;
+	void* objs[KMEM_MAG_SIZE];
+} KmemMagazine;
+
+/**
+ * Header at the start of each slab. It is followed by the free index stack (`objsPerSlab`
+ * 16-bit object indices, of which the first `numFree` are free), then the colour padding,
+ * then the objects themselves.
+ */
+typedef struct KmemSlab_ KmemSlab;
+struct KmemSlab_
+{
+	/**
+	 * Links in the cache's slab list (empty, partial or full).
+	 */
+	KmemSlab *prev;
+	KmemSlab *next;
+
+	/**
+	 * Address of the first object.
+	 */
+	char *objs;
+
+	/**
+	 * Number of free objects.
+	 */
+	int numFree;
+
+	/**
+	 * Free object index stack.
+	 */
+	uint16_t freeStack[];
+};
+
+/**
+ * An object cache.
+ */
+typedef struct KmemCache_ KmemCache;
+struct KmemCache_
+{
+	/**
+	 * Links in the global cache list.
+	 */
+	KmemCache *prev;
+	KmemCache *next;
+
+	/**
+	 * Name of the cache, for reporting.
+	 */
+	char name[KMEM_NAME_MAX];
+
+	/**
+	 * Size of each object as requested, and the actual stride between objects.
+	 */
+	size_t objSize;
+	size_t stride;
+
+	/**
+	 * The constructor, or NULL.
+	 */
+	KmemConstructor ctor;
+
+	/**
+	 * KOM bucket from which slabs are allocated, and the number of objects in each slab.
+	 */
+	int slabBucket;
+	int objsPerSlab;
+
+	/**
+	 * Offset from the start of the slab to the first object, not including the colour.
+	 */
+	size_t headerSize;
+
+	/**
+	 * Number of bytes left over in each slab, and the colour of the next slab (the offset
+	 * of its objects, which cycles through multiples of the alignment up to `colourMax`).
+	 */
+	size_t colourMax;
+	size_t nextColour;
+
+	/**
+	 * Lock protecting the slab lists and statistics.
+	 */
+	Spinlock lock;
+
+	/**
+	 * Slabs with all objects free, with some objects free, and with no objects free.
+	 */
+	KmemSlab *empty;
+	KmemSlab *partial;
+	KmemSlab *full;
+
+	/**
+	 * Statistics: number of slabs, and number of objects currently taken out of the slabs
+	 * (in use, or sitting in a magazine).
+	 */
+	uint64_t numSlabs;
+	uint64_t numActive;
+
+	/**
+	 * Per-CPU magazines, indexed by CPU index. Each is allocated the first time its CPU uses the
+	 * cache, so that a cache only costs memory on CPUs which actually use it.
+	 */
+	KmemMagazine* mags[CPU_MAX];
+};
+
+/**
+ * Usage information about a cache, as returned by `kmemCacheGetInfo()`.
+ */
+typedef struct
+{
+	const char *name;
+	size_t objSize;
+	size_t slabSize;
+	uint64_t numSlabs;
+	uint64_t numActive;
+	uint64_t numTotal;
+} KmemCacheInfo;
+
+/**
+ * Callback for `kmemWalkCaches()`.
+ */
+typedef void (*KmemCacheWalkCallback)(KmemCacheInfo *info, void *context);
+
+/**
+ * Enable the per-CPU magazines on the calling CPU. This is called by `cpuInitSelf()`; before
+ * that, all allocations go directly to the slab lists.
+ */
+void kmemInitLocal();
+
+/**
+ * Create an object cache called `name`, for objects of `objSize` bytes. The `ctor` may be NULL.
+ * Returns NULL if memory could not be allocated.
+ */
+KmemCache* kmemCacheCreate(const char *name, size_t objSize, KmemConstructor ctor);
+
+/**
+ * Destroy an object cache. All objects must have been returned to it.
+ */
+void kmemCacheDestroy(KmemCache *cache);
+
+/**
+ * Allocate an object from the cache. Returns NULL if memory could not be allocated.
+ */
+void* kmemCacheAlloc(KmemCache *cache);
+
+/**
+ * Return an object to the cache it was allocated from.
+ */
+void kmemCacheFree(KmemCache *cache, void *obj);
+
+/**
+ * Call `callback` with usage information about every cache.
+ */
+void kmemWalkCaches(KmemCacheWalkCallback callback, void *context);
+
+#endif
\ No newline at end of file
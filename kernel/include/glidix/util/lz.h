@@ -0,0 +1,71 @@
+/*
+	Glidix kernel
+
+	Copyright (c) 2021, Madd Games.
+	All rights reserved.
+	
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+	
+	* Redistributions of source code must retain the above copyright notice, this
+	  list of conditions and the following disclaimer.
+	
+	* Redistributions in binary form must reproduce the above copyright notice,
+	  this list of conditions and the following disclaimer in the documentation
+	  and/or other materials provided with the distribution.
+	
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+	DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+	FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+	DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+	SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+	CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+	OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+	OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#ifndef __glidix_util_lz_h
+#define	__glidix_util_lz_h
+
+#include <glidix/util/common.h>
+
+/**
+ * A fast LZ77 codec in the style of LZ4, used to compress pages in memory. The compressed data is a
+ * sequence of blocks, each consisting of a token byte (the high nibble is the number of literals, the
+ * low nibble the match length minus `LZ_MIN_MATCH`; 15 means more length bytes follow, each added to
+ * it, until one is less than 255), the literals, and a 2-byte little-endian offset back into the
+ * output. The last block has no offset and no match.
+ */
+
+/**
+ * Minimum length of a match.
+ */
+#define	LZ_MIN_MATCH					4
+
+/**
+ * Number of bits in the hash used to find matches; the compressor keeps a table of `1 << LZ_HASH_BITS`
+ * 16-bit positions on the stack.
+ */
+#define	LZ_HASH_BITS					12
+
+/**
+ * Maximum size of the input to `lzCompress()`, so that positions fit in the hash table.
+ */
+#define	LZ_MAX_INPUT					0x10000
+
+/**
+ * Compress `size` bytes (at most `LZ_MAX_INPUT`) from `src` into `dst`, which has space for `dstSize`
+ * bytes. Returns the size of the compressed data, or 0 if it would not fit in `dstSize` bytes.
+ */
+size_t lzCompress(const void *src, size_t size, void *dst, size_t dstSize);
+
+/**
+ * Decompress `size` bytes from `src` into `dst`, which has space for `dstSize` bytes. Returns the size
+ * of the decompressed data, or -1 if the compressed data is corrupt or does not fit.
+ */
+ssize_t lzDecompress(const void *src, size_t size, void *dst, size_t dstSize);
+
+#endif
\ No newline at end of file
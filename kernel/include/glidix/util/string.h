@@ -65,4 +65,10 @@ char *strstr(const char *in, const char *str);
  */
 void memZeroPage(void *page);
 
+/**
+ * Zero out a page using non-temporal stores, which bypass the cache. Use this for pages which
+ * will not be accessed soon.
+ */
+void memZeroPageNT(void *page);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,58 @@
+/*
+	Glidix kernel
+
+	Copyright (c) 2021, Madd Games.
+	All rights reserved.
+	
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+	
+	* Redistributions of source code must retain the above copyright notice, this
+	  list of conditions and the following disclaimer.
+	
+	* Redistributions in binary form must reproduce the above copyright notice,
+	  this list of conditions and the following disclaimer in the documentation
+	  and/or other materials provided with the distribution.
+	
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+	DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+	FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+	DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+	SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+	CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+	OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+	OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#ifndef __glidix_util_symtab_h
+#define	__glidix_util_symtab_h
+
+#include <glidix/util/common.h>
+
+/**
+ * Kernel init action which copies the kernel symbol table out of the initrd image, so that it remains
+ * available after the image is freed.
+ */
+#define	KIA_SYMTAB					"symtab"
+
+/**
+ * A kernel function, in the table sorted by address.
+ */
+typedef struct
+{
+	uint64_t addr;
+	uint64_t size;
+	const char *name;
+} KernelSymbol;
+
+/**
+ * Find the kernel function containing the address `addr`. Returns the name of the function, and
+ * stores the offset of `addr` into it in `offsetOut`; or returns NULL if the address is not inside
+ * any known function, or the symbol table has not been loaded yet.
+ */
+const char* symLookup(uint64_t addr, uint64_t *offsetOut);
+
+#endif
\ No newline at end of file
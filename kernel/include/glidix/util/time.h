@@ -37,6 +37,32 @@
  */
 #define	NANOS_PER_SEC				1000000000UL
 
+/**
+ * Kernel init action which reads the wall-clock time from the CMOS real-time clock.
+ */
+#define	KIA_TIME_RTC				"timeInitRTC"
+
+/**
+ * CMOS ports and real-time clock registers.
+ */
+#define	CMOS_PORT_INDEX				0x70
+#define	CMOS_PORT_DATA				0x71
+#define	CMOS_RTC_SECONDS			0x00
+#define	CMOS_RTC_MINUTES			0x02
+#define	CMOS_RTC_HOURS				0x04
+#define	CMOS_RTC_DAY				0x07
+#define	CMOS_RTC_MONTH				0x08
+#define	CMOS_RTC_YEAR				0x09
+#define	CMOS_RTC_STATUS_A			0x0A
+#define	CMOS_RTC_STATUS_B			0x0B
+
+/**
+ * Bits in the RTC status registers.
+ */
+#define	CMOS_RTC_UPDATING			(1 << 7)	/* status A */
+#define	CMOS_RTC_24HOUR				(1 << 1)	/* status B */
+#define	CMOS_RTC_BINARY				(1 << 2)	/* status B */
+
 /**
  * Make a `nanoseconds_t` given a number of seconds.
  */
@@ -100,6 +126,13 @@ struct TimedEvent_
  */
 nanoseconds_t timeGetUptime();
 
+/**
+ * Get the wall-clock time, in nanoseconds since the UNIX epoch. This is the time read from the
+ * real-time clock at boot, advanced by the uptime since then; it is 0-based (i.e. the same as the
+ * uptime) if the clock has not been read yet.
+ */
+nanoseconds_t timeGetRealtime();
+
 /**
  * Increase the uptime by the specified number of nanoseconds. This is usually called
  * from a timer interrupt handler, and is async-interrupt-safe.
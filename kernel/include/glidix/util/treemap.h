@@ -72,6 +72,12 @@ typedef struct
  */
 typedef void (*TreeMapWalkCallback)(TreeMap *treemap, uint32_t index, void *value, void *context);
 
+/**
+ * Create the object cache for treemap nodes. This is called during kernel initialization,
+ * before any treemap is created.
+ */
+void treemapInit();
+
 /**
  * Create a new treemap. Make sure to destroy it later using `treemapDestroy()`.
  * 
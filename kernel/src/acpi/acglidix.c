@@ -482,7 +482,7 @@ void *AcpiOsMapMemory(ACPI_PHYSICAL_ADDRESS phaddr, ACPI_SIZE len)
 void AcpiOsUnmapMemory(void *laddr, ACPI_SIZE len)
 {
 	TRACE();
-	// TODO
+	pagetabUnmapPhys(laddr);
 };
 
 ACPI_STATUS AcpiOsCreateMutex(ACPI_MUTEX *out)
@@ -34,6 +34,7 @@
 #include <glidix/hw/kom.h>
 #include <glidix/util/memory.h>
 #include <glidix/hw/pagetab.h>
+#include <glidix/hw/vmalloc.h>
 #include <glidix/util/panic.h>
 
 /**
@@ -212,8 +213,8 @@ void conRemapFramebuffers()
 	size_t fbSize = conScanlineSize * conPixelHeight;
 	size_t fbSizePages = (fbSize + 0xFFF) & ~0xFFFUL;
 
-	uint8_t *newFrontBuffer = (uint8_t*) komAllocVirtual(fbSizePages);
-	if (pagetabMapKernel(newFrontBuffer, pagetabGetPhys(conFrontBuffer), fbSizePages, PT_WRITE | PT_NOEXEC | PT_NOCACHE) != 0)
+	uint8_t *newFrontBuffer = (uint8_t*) vmAllocRange(fbSizePages);
+	if (newFrontBuffer == NULL || pagetabMapKernel(newFrontBuffer, pagetabGetPhys(conFrontBuffer), fbSizePages, PT_WRITE | PT_NOEXEC | PT_NOCACHE) != 0)
 	{
 		spinlockRelease(&conLock, irqState);
 		panic("Failed to re-map the framebuffer!\n");
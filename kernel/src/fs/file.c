@@ -29,10 +29,26 @@
 #include <glidix/fs/file.h>
 #include <glidix/util/memory.h>
 #include <glidix/util/string.h>
+#include <glidix/util/kmem.h>
+#include <glidix/util/panic.h>
+
+/**
+ * The cache of open file descriptions.
+ */
+static KmemCache *vfsFileCache;
+
+void vfsInitFileCache()
+{
+	vfsFileCache = kmemCacheCreate("file", sizeof(File), NULL);
+	if (vfsFileCache == NULL)
+	{
+		panic("Failed to create the file cache!");
+	};
+};
 
 File* vfsOpenInode(PathWalker *walker, int oflags, errno_t *err)
 {
-	File *fp = (File*) kmalloc(sizeof(File));
+	File *fp = (File*) kmemCacheAlloc(vfsFileCache);
 	if (fp == NULL)
 	{
 		if (err != NULL) *err = ENOMEM;
@@ -57,7 +73,7 @@ File* vfsDup(File *fp)
 
 File* vfsFork(File *fp)
 {
-	File *newFP = (File*) kmalloc(sizeof(File));
+	File *newFP = (File*) kmemCacheAlloc(vfsFileCache);
 	if (newFP == NULL) return NULL;
 
 	newFP->oflags = fp->oflags;
@@ -74,7 +90,7 @@ void vfsClose(File *fp)
 	if (__sync_add_and_fetch(&fp->refcount, -1) == 0)
 	{
 		vfsPathWalkerDestroy(&fp->walker);
-		kfree(fp);
+		kmemCacheFree(vfsFileCache, fp);
 	};
 };
 
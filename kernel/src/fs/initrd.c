@@ -52,7 +52,7 @@ static InodeOps initrdConsoleOps = {
 	.pwrite = initrdConsolePWrite,
 };
 
-static uint64_t parseOct(const char *data)
+static uint64_t __init parseOct(const char *data)
 {
 	uint64_t out = 0;
 	while (*data != 0)
@@ -62,7 +62,7 @@ static uint64_t parseOct(const char *data)
 	return out;
 };
 
-static void initrdInit(KernelBootInfo *info)
+static void __init initrdInit(KernelBootInfo *info)
 {
 	kprintf("initrd: Creating the /initrd-console file...\n");
 	if (vfsCreateCharDev(NULL, "/initrd-console", 0644, &initrdConsoleOps) != 0)
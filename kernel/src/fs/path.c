@@ -45,10 +45,10 @@ static void vfsInitKernelRoot()
 	kprintf("Creating the kernel root directory...\n");
 
 	errno_t err;
-	FileSystem *rootfs = vfsCreateFileSystem("ramfs", "", NULL, &err);
+	FileSystem *rootfs = vfsCreateFileSystem("tmpfs", "", NULL, &err);
 	if (rootfs == NULL)
 	{
-		panic("Failed to create the ramfs for kernel root: errno %d", err);
+		panic("Failed to create the tmpfs for kernel root: errno %d", err);
 	};
 
 	vfsKernelRootWalker.current = vfsGetFileSystemRoot(rootfs, &err);
@@ -32,7 +32,54 @@
 #include <glidix/util/log.h>
 #include <glidix/util/panic.h>
 #include <glidix/hw/pagetab.h>
+#include <glidix/hw/zram.h>
 #include <glidix/util/string.h>
+#include <glidix/util/memory.h>
+#include <glidix/util/treemap.h>
+#include <glidix/thread/spinlock.h>
+
+/**
+ * The state of a tmpfs inode, which outlives the VFS inode (which may be dropped from the inode
+ * cache once it is unreferenced). The VFS inode is authoritative while it exists, and is saved
+ * back here when it is dropped.
+ */
+typedef struct
+{
+	mode_t mode;
+	int flags;
+	InodeOps *ops;
+	uid_t uid;
+	gid_t gid;
+	nlink_t numLinks;
+	size_t size;
+	time_t mtime;
+	time_t atime;
+	time_t ctime;
+	time_t btime;
+	ino_t parentIno;
+
+	/**
+	 * Maps page indices to the compressed swap slots (plus 1) holding the pages which were written
+	 * back; NULL until the first page is. Protected by the page cache lock of the VFS inode.
+	 */
+	TreeMap *pages;
+} TmpfsNode;
+
+/**
+ * The `drvdata` of a mounted tmpfs.
+ */
+typedef struct
+{
+	/**
+	 * Lock protecting the node table.
+	 */
+	Spinlock lock;
+
+	/**
+	 * Maps inode numbers to `TmpfsNode` structures.
+	 */
+	TreeMap *nodes;
+} Tmpfs;
 
 static ino_t ramfsNextIno = 8;
 
@@ -61,11 +108,140 @@ static ino_t ramfsGetRootIno(FileSystem *fs)
 
 static size_t ramfsGetInodeDriverDataSize(FileSystem *fs)
 {
+	// on tmpfs, the driver data points to the TmpfsNode
+	return fs->drvdata == NULL ? 0 : sizeof(TmpfsNode*);
+};
+
+/**
+ * Get the `TmpfsNode` of a tmpfs inode.
+ */
+static TmpfsNode* tmpfsGetNode(Inode *inode)
+{
+	return *((TmpfsNode**) inode->drvdata);
+};
+
+/**
+ * Allocate a `TmpfsNode` and add it to the node table under the specified inode number. Returns
+ * NULL if we ran out of memory.
+ */
+static TmpfsNode* tmpfsNewNode(Tmpfs *tmpfs, ino_t ino)
+{
+	TmpfsNode *node = (TmpfsNode*) kmalloc(sizeof(TmpfsNode));
+	if (node == NULL)
+	{
+		return NULL;
+	};
+
+	memset(node, 0, sizeof(TmpfsNode));
+
+	IrqState irqState = spinlockAcquire(&tmpfs->lock);
+	errno_t err = treemapSet(tmpfs->nodes, ino, node);
+	spinlockRelease(&tmpfs->lock, irqState);
+
+	if (err != 0)
+	{
+		kfree(node);
+		return NULL;
+	};
+
+	return node;
+};
+
+static void tmpfsFreeSlot(TreeMap *pages, uint32_t index, void *value, void *context)
+{
+	zramFree((uint64_t) value - 1);
+};
+
+static void tmpfsFreeNode(TreeMap *nodes, uint32_t index, void *value, void *context)
+{
+	TmpfsNode *node = (TmpfsNode*) value;
+	if (node->pages != NULL)
+	{
+		treemapWalk(node->pages, tmpfsFreeSlot, NULL);
+		treemapDestroy(node->pages);
+	};
+
+	kfree(node);
+};
+
+static int tmpfsMount(FileSystem *fs, const char *image, const char *options)
+{
+	int status = ramfsMount(fs, image, options);
+	if (status != 0)
+	{
+		return status;
+	};
+
+	Tmpfs *tmpfs = (Tmpfs*) kmalloc(sizeof(Tmpfs));
+	if (tmpfs == NULL)
+	{
+		return -ENOMEM;
+	};
+
+	memset(tmpfs, 0, sizeof(Tmpfs));
+	tmpfs->nodes = treemapNew();
+	if (tmpfs->nodes == NULL)
+	{
+		kfree(tmpfs);
+		return -ENOMEM;
+	};
+
+	// the root directory has the same attributes as on ramfs
+	TmpfsNode *root = tmpfsNewNode(tmpfs, RAMFS_ROOT_INO);
+	if (root == NULL)
+	{
+		treemapDestroy(tmpfs->nodes);
+		kfree(tmpfs);
+		return -ENOMEM;
+	};
+
+	root->mode = VFS_MODE_DIRECTORY | VFS_MODE_STICKY | 0755;
+	root->parentIno = RAMFS_ROOT_INO;
+	root->numLinks = 1;
+
+	fs->drvdata = tmpfs;
 	return 0;
 };
 
+static void tmpfsUnmount(FileSystem *fs)
+{
+	Tmpfs *tmpfs = (Tmpfs*) fs->drvdata;
+	treemapWalk(tmpfs->nodes, tmpfsFreeNode, NULL);
+	treemapDestroy(tmpfs->nodes);
+	kfree(tmpfs);
+};
+
 static int ramfsLoadInode(FileSystem *fs, Inode *inode, ino_t ino)
 {
+	Tmpfs *tmpfs = (Tmpfs*) fs->drvdata;
+	if (tmpfs != NULL)
+	{
+		IrqState irqState = spinlockAcquire(&tmpfs->lock);
+		TmpfsNode *node = (TmpfsNode*) treemapGet(tmpfs->nodes, ino);
+		spinlockRelease(&tmpfs->lock, irqState);
+
+		if (node == NULL)
+		{
+			// we should only be called with inode numbers we handed out
+			panic("tmpfsLoadInode called with unknown inode number %lu!", ino);
+		};
+
+		*((TmpfsNode**) inode->drvdata) = node;
+		inode->mode = node->mode;
+		inode->flags = node->flags;
+		inode->ops = node->ops;
+		inode->uid = node->uid;
+		inode->gid = node->gid;
+		inode->numLinks = node->numLinks;
+		inode->size = node->size;
+		inode->mtime = node->mtime;
+		inode->atime = node->atime;
+		inode->ctime = node->ctime;
+		inode->btime = node->btime;
+		inode->parentIno = node->parentIno;
+		return 0;
+	};
+
 	if (ino != RAMFS_ROOT_INO)
 	{
 		// we should never be called with any other inode number
@@ -113,6 +289,25 @@ static int ramfsMakeNode(Inode *parent, Dentry *dent, Inode *child)
 
 	child->ino = __sync_fetch_and_add(&ramfsNextIno, 1);
 
+	Tmpfs *tmpfs = (Tmpfs*) parent->fs->drvdata;
+	if (tmpfs != NULL)
+	{
+		// on tmpfs, the inode and its pages can be evicted, as we keep a copy of the inode, and
+		// write pages back to the compressed swap
+		TmpfsNode *node = tmpfsNewNode(tmpfs, child->ino);
+		if (node == NULL)
+		{
+			return -ENOMEM;
+		};
+
+		*((TmpfsNode**) child->drvdata) = node;
+	}
+	else
+	{
+		// the inode and its page cache exist only in RAM, so must never be evicted
+		child->flags |= VFS_INODE_NOCACHE;
+	};
+
 	if ((child->mode & VFS_MODE_TYPEMASK) == VFS_MODE_REGULAR)
 	{
 		// regular file is seekable
@@ -127,15 +322,100 @@ static int ramfsMakeNode(Inode *parent, Dentry *dent, Inode *child)
 	return 0;
 };
 
-static int ramfsLoadPage(Inode *inode, off_t pos, void *buffer)
+static int ramfsTruncate(Inode *inode, size_t newSize)
 {
-	// there's no data "already on disk" ever, so we just zero out
-	memZeroPage(buffer);
+	if (inode->fs->drvdata != NULL)
+	{
+		// drop the written back pages past the new end
+		TmpfsNode *node = tmpfsGetNode(inode);
+		if (node->pages != NULL)
+		{
+			uint32_t index;
+			uint32_t end = (inode->size + PAGE_SIZE - 1) >> 12;
+			for (index=(newSize + PAGE_SIZE - 1) >> 12; index<end; index++)
+			{
+				void *value = treemapGet(node->pages, index);
+				if (value != NULL)
+				{
+					zramFree((uint64_t) value - 1);
+					treemapSet(node->pages, index, NULL);
+				};
+			};
+		};
+	};
+
 	return 0;
 };
 
-static int ramfsTruncate(Inode *inode, size_t newSize)
+static void tmpfsReleaseInode(Inode *inode)
 {
+	TmpfsNode *node = tmpfsGetNode(inode);
+	node->mode = inode->mode;
+	node->flags = inode->flags;
+	node->ops = inode->ops;
+	node->uid = inode->uid;
+	node->gid = inode->gid;
+	node->numLinks = inode->numLinks;
+	node->size = inode->size;
+	node->mtime = inode->mtime;
+	node->atime = inode->atime;
+	node->ctime = inode->ctime;
+	node->btime = inode->btime;
+	node->parentIno = inode->parentIno;
+};
+
+static int tmpfsLoadPage(Inode *inode, off_t offset, void *buffer)
+{
+	TmpfsNode *node = tmpfsGetNode(inode);
+	void *value = node->pages == NULL ? NULL : treemapGet(node->pages, offset >> 12);
+	if (value == NULL)
+	{
+		// never written back
+		memset(buffer, 0, PAGE_SIZE);
+		return 0;
+	};
+
+	// keep the slot, so that the page can be evicted again without compressing it, as long as it
+	// is not written to
+	if (zramLoad((uint64_t) value - 1, buffer) != 0)
+	{
+		return -EIO;
+	};
+
+	return 0;
+};
+
+static int tmpfsStorePage(Inode *inode, off_t offset, const void *buffer)
+{
+	TmpfsNode *node = tmpfsGetNode(inode);
+	if (node->pages == NULL)
+	{
+		node->pages = treemapNew();
+		if (node->pages == NULL)
+		{
+			return -ENOMEM;
+		};
+	};
+
+	uint64_t slot;
+	errno_t err = zramStore(buffer, &slot);
+	if (err != 0)
+	{
+		return -err;
+	};
+
+	void *old = treemapGet(node->pages, offset >> 12);
+	if (treemapSet(node->pages, offset >> 12, (void*) (slot + 1)) != 0)
+	{
+		zramFree(slot);
+		return -ENOMEM;
+	};
+
+	if (old != NULL)
+	{
+		zramFree((uint64_t) old - 1);
+	};
+
 	return 0;
 };
 
@@ -150,14 +430,33 @@ static FSDriver ramfsDriver = {
 	.loadInode = ramfsLoadInode,
 	.loadDentry = ramfsLoadDentry,
 	.makeNode = ramfsMakeNode,
-	.loadPage = ramfsLoadPage,
+	.truncate = ramfsTruncate,
+};
+
+/**
+ * The tmpfs FSDriver object. This is ramfs, except that unreferenced inodes and file pages can be
+ * evicted: pages are written back to the compressed swap (see `zram.h`).
+ */
+static FSDriver tmpfsDriver = {
+	.fsname = "tmpfs",
+	.mount = tmpfsMount,
+	.unmount = tmpfsUnmount,
+	.getRootIno = ramfsGetRootIno,
+	.getInodeDriverDataSize = ramfsGetInodeDriverDataSize,
+	.loadInode = ramfsLoadInode,
+	.releaseInode = tmpfsReleaseInode,
+	.loadDentry = ramfsLoadDentry,
+	.makeNode = ramfsMakeNode,
+	.loadPage = tmpfsLoadPage,
+	.storePage = tmpfsStorePage,
 	.truncate = ramfsTruncate,
 };
 
 static void ramfsInit()
 {
-	kprintf("Registering the ramfs...\n");
+	kprintf("Registering the ramfs and tmpfs...\n");
 	vfsRegisterFileSystemDriver(&ramfsDriver);
+	vfsRegisterFileSystemDriver(&tmpfsDriver);
 };
 
 KERNEL_INIT_ACTION(ramfsInit, KIA_RAMFS_REGISTER, KAI_VFS_DRIVER_MAP);
\ No newline at end of file
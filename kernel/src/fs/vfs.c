@@ -38,6 +38,9 @@
 #include <glidix/fs/path.h>
 #include <glidix/hw/kom.h>
 #include <glidix/hw/pagetab.h>
+#include <glidix/util/kmem.h>
+#include <glidix/hw/reclaim.h>
+#include <glidix/hw/zeropool.h>
 
 /**
  * The mutex protecting the inode hashtable.
@@ -69,6 +72,12 @@ static Mutex vfsDentryTableLock;
  */
 static Dentry* vfsDentryTable[VFS_DENTRYTAB_NUM_BUCKETS];
 
+/**
+ * The CLOCK hand for page cache reclaim: the next inode hashtable bucket to scan (protected by
+ * the inode table lock).
+ */
+static int vfsClockHand;
+
 static void vfsInitDriverMap()
 {
 	kprintf("Creating the filesystem driver map...\n");
@@ -132,6 +141,20 @@ FileSystem* vfsCreateFileSystem(const char *fsname, const char *image, const cha
 		return NULL;
 	};
 
+	// the driver data size may depend on the mounted filesystem, so create the inode cache now
+	char cacheName[KMEM_NAME_MAX];
+	strcpy(cacheName, "inode_");
+	strncat(cacheName, fsname, KMEM_NAME_MAX-7);
+	
+	fs->inodeCache = kmemCacheCreate(cacheName, sizeof(Inode) + driver->getInodeDriverDataSize(fs), NULL);
+	if (fs->inodeCache == NULL)
+	{
+		if (driver->unmount != NULL) driver->unmount(fs);
+		kfree(fs);
+		if (err != NULL) *err = ENOMEM;
+		return NULL;
+	};
+
 	return fs;
 };
 
@@ -145,7 +168,7 @@ static unsigned int vfsInodeHash(FileSystem *fs, ino_t ino)
 
 static Inode* vfsAllocInode(FileSystem *fs)
 {
-	Inode *inode = (Inode*) kmalloc(sizeof(Inode) + fs->driver->getInodeDriverDataSize(fs));
+	Inode *inode = (Inode*) kmemCacheAlloc(fs->inodeCache);
 	if (inode == NULL)
 	{
 		return NULL;
@@ -190,7 +213,7 @@ Inode* vfsInodeGet(FileSystem *fs, ino_t ino, errno_t *err)
 			if (status != 0)
 			{
 				// TODO: release inode correctly
-				kfree(inode);
+				kmemCacheFree(fs->inodeCache, inode);
 				if (err != NULL) *err = -status;
 				inode = NULL;
 			}
@@ -350,7 +373,7 @@ static Inode* vfsCreateChildNode(Inode *parent, const char *basename, mode_t mod
 	if (dent == NULL)
 	{
 		// TODO: proper uncaching etc of child
-		kfree(child);
+		kmemCacheFree(parent->fs->inodeCache, child);
 		if (err != NULL) *err = ENOMEM;
 		return NULL;
 	};
@@ -380,7 +403,7 @@ static Inode* vfsCreateChildNode(Inode *parent, const char *basename, mode_t mod
 	if (status != 0)
 	{
 		// TODO: proper uncaching etc
-		kfree(child);
+		kmemCacheFree(parent->fs->inodeCache, child);
 		kfree(dent);
 		if (err != NULL) *err = -status;
 		return NULL;
@@ -508,6 +531,7 @@ int vfsCreateCharDev(File *start, const char *path, mode_t mode, InodeOps *ops)
 	else
 	{
 		child->ops = ops;
+		child->flags |= ops->inodeFlags;
 		vfsInodeUnref(child);
 		return 0;
 	};
@@ -720,9 +744,11 @@ static void* _vfsGetCachePage(Inode *inode, off_t offset, int markDirty, errno_t
 	int finalIndex = indexes[3];
 	if (node->ents[finalIndex] == 0)
 	{
-		// cache miss, try to load it
+		// cache miss, try to load it; if the filesystem has no backing store, the page starts
+		// out zeroed, so take a pre-zeroed one
 		off_t alignedOffset = offset & ~0xFFF;
-		void *page = komAllocUserPage();
+		FSDriver *driver = inode->fs->driver;
+		void *page = driver->loadPage == NULL ? zpoolAllocUserPage() : komAllocUserPage();
 		
 		if (page == NULL)
 		{
@@ -730,7 +756,7 @@ static void* _vfsGetCachePage(Inode *inode, off_t offset, int markDirty, errno_t
 			return NULL;
 		};
 
-		int status = inode->fs->driver->loadPage(inode, alignedOffset, page);
+		int status = driver->loadPage == NULL ? 0 : driver->loadPage(inode, alignedOffset, page);
 		if (status != 0)
 		{
 			komUserPageUnref(page);
@@ -739,6 +765,8 @@ static void* _vfsGetCachePage(Inode *inode, off_t offset, int markDirty, errno_t
 		};
 
 		node->ents[finalIndex] = (uint64_t) page & VFS_PAGECACHE_ADDR_MASK;
+		komCounterAdd(KOM_COUNTER_PAGE_CACHE, PAGE_SIZE);
+		komSetPageOwner(page, KOM_PAGE_CACHE, (uint64_t) inode, offset >> 12);
 	};
 
 	if (markDirty)
@@ -746,6 +774,7 @@ static void* _vfsGetCachePage(Inode *inode, off_t offset, int markDirty, errno_t
 		node->ents[finalIndex] |= VFS_PAGECACHE_DIRTY;
 	};
 
+	node->ents[finalIndex] |= VFS_PAGECACHE_ACCESSED;
 	return (void*) ((node->ents[finalIndex] | (~VFS_PAGECACHE_ADDR_MASK)) + (offset & 0xFFF));
 };
 
@@ -832,7 +861,7 @@ ssize_t vfsInodeWrite(Inode *inode, const void *buffer, size_t size, off_t pos)
 
 		while (size > 0)
 		{
-			void *data = _vfsGetCachePage(inode, pos, 0, &err);
+			void *data = _vfsGetCachePage(inode, pos, 1, &err);
 			if (data == NULL)
 			{
 				break;
@@ -871,11 +900,7 @@ void* vfsInodeGetPage(Inode *inode, off_t offset)
 {
 	if (inode == NULL)
 	{
-		void *result = komAllocUserPage();
-		if (result == NULL) return NULL;
-		
-		memZeroPage(result);
-		return result;
+		return zpoolAllocUserPage();
 	};
 
 	mutexLock(&inode->pageCacheLock);
@@ -886,6 +911,111 @@ void* vfsInodeGetPage(Inode *inode, off_t offset)
 	return page;
 };
 
+/**
+ * Find the page cache entry for the specified offset, without allocating anything. Returns NULL if
+ * there is no entry. The page cache lock must be held.
+ */
+static uint64_t* _vfsLookupCacheEntry(Inode *inode, off_t offset)
+{
+	if (offset < 0 || offset >= VFS_MAX_SIZE || inode->pageCacheMaster == NULL)
+	{
+		return NULL;
+	};
+
+	PageCacheNode *node = inode->pageCacheMaster;
+
+	int i;
+	for (i=0; i<3; i++)
+	{
+		uint64_t ent = node->ents[(offset >> (12 + 9 * (3 - i))) & 0x1FF];
+		if (ent == 0)
+		{
+			return NULL;
+		};
+
+		node = (PageCacheNode*) (ent | (~VFS_PAGECACHE_ADDR_MASK));
+	};
+
+	uint64_t *ent = &node->ents[(offset >> 12) & 0x1FF];
+	if (*ent == 0)
+	{
+		return NULL;
+	};
+
+	return ent;
+};
+
+int vfsInodeGetCachedPages(Inode *inode, off_t offset, int count, void **pages)
+{
+	int found = 0;
+
+	mutexLock(&inode->pageCacheLock);
+
+	int i;
+	for (i=0; i<count; i++)
+	{
+		uint64_t *ent = _vfsLookupCacheEntry(inode, offset + ((off_t) i << 12));
+		if (ent == NULL)
+		{
+			pages[i] = NULL;
+			continue;
+		};
+
+		*ent |= VFS_PAGECACHE_ACCESSED;
+		pages[i] = (void*) (*ent | (~VFS_PAGECACHE_ADDR_MASK));
+		komUserPageDup(pages[i]);
+		found++;
+	};
+
+	mutexUnlock(&inode->pageCacheLock);
+	return found;
+};
+
+errno_t vfsMigratePage(void *page, void *newPage)
+{
+	// inodes are only freed with the inode table lock held, once their page cache is empty; so as
+	// long as the page is marked as being in a page cache, its inode is still alive
+	if (mutexTryLockForReclaim(&vfsInodeTableLock) != 0)
+	{
+		return EAGAIN;
+	};
+
+	KOM_PageDesc *desc = komGetPageDesc(page);
+	if ((desc->flags & KOM_PAGE_CACHE) == 0)
+	{
+		mutexUnlock(&vfsInodeTableLock);
+		return EAGAIN;
+	};
+
+	__sync_synchronize();
+	uint64_t owner, index;
+	komGetPageOwner(page, &owner, &index);
+	Inode *inode = (Inode*) owner;
+	off_t offset = index << 12;
+
+	errno_t status = EAGAIN;
+	if (inode != NULL && mutexTryLockForReclaim(&inode->pageCacheLock) == 0)
+	{
+		// pages which are mapped into some address space stay
+		uint64_t *ent = _vfsLookupCacheEntry(inode, offset);
+		if (ent != NULL && (*ent | (~VFS_PAGECACHE_ADDR_MASK)) == (uint64_t) page && desc->refcount == 1)
+		{
+			memcpy(newPage, page, PAGE_SIZE);
+			komSetPageOwner(newPage, KOM_PAGE_CACHE, (uint64_t) inode, offset >> 12);
+
+			*ent = (*ent & ~VFS_PAGECACHE_ADDR_MASK) | ((uint64_t) newPage & VFS_PAGECACHE_ADDR_MASK);
+			komSetPageOwner(page, 0, 0, 0);
+			komUserPageUnref(page);
+			status = 0;
+		};
+
+		mutexUnlock(&inode->pageCacheLock);
+	};
+
+	mutexUnlock(&vfsInodeTableLock);
+	return status;
+};
+
 void vfsInodeStat(Inode *inode, struct kstat *st)
 {
 	memset(st, 0, sizeof(struct kstat));
@@ -908,7 +1038,10 @@ static PageCacheNode* _vfsPageCachePurgeRecur(int depth, PageCacheNode *node, si
 		size_t totalOffset = suboffset << 12;
 		if (totalOffset >= endPos)
 		{
+			// the page may live on in an address space, but it's no longer ours
+			komSetPageOwner(node, 0, 0, 0);
 			komUserPageUnref(node);
+			komCounterAdd(KOM_COUNTER_PAGE_CACHE, -PAGE_SIZE);
 			return NULL;
 		};
 	}
@@ -938,8 +1071,9 @@ int vfsInodeTruncate(Inode *inode, size_t newSize)
 	{
 		if (newSize & 0xFFF)
 		{
-			// get the final page and zero out the end
-			char *page = (char*) _vfsGetCachePage(inode, newSize, 0, NULL);
+			// get the final page and zero out the end; it is then dirty, as the copy in the backing
+			// store (if any) still has the old data
+			char *page = (char*) _vfsGetCachePage(inode, newSize, 1, NULL);
 			if (page != NULL)
 			{
 				memset(page + (newSize & 0xFFF), 0, PAGE_SIZE - (newSize & 0xFFF));
@@ -957,4 +1091,285 @@ int vfsInodeTruncate(Inode *inode, size_t newSize)
 	mutexUnlock(&inode->pageCacheLock);
 	
 	return status;
-};
\ No newline at end of file
+};
+
+/**
+ * Context for `_vfsPageCacheEvictRecur()`.
+ */
+typedef struct
+{
+	/**
+	 * The inode whose page cache is being evicted.
+	 */
+	Inode *inode;
+
+	/**
+	 * If zero, pages which were accessed since the last pass are given a second chance; otherwise,
+	 * all unmapped pages which are clean (or can be written back) are evicted.
+	 */
+	int force;
+
+	/**
+	 * Stop evicting once this many pages were freed.
+	 */
+	size_t limit;
+
+	/**
+	 * Statistics: pages freed (including page cache nodes), pages scanned, pages evicted, and dirty
+	 * pages written back.
+	 */
+	size_t freed;
+	size_t scanned;
+	size_t evicted;
+	size_t written;
+} VfsEvictContext;
+
+/**
+ * Evict pages from a page cache subtree. `depth` is the level of `node` (0 is the master node,
+ * and nodes at level 3 point to the pages themselves), and `base` is the index of `node` within
+ * its level, from which the page offsets are calculated. Nodes which become empty are released.
+ * Returns nonzero if `node` itself is now empty. The page cache lock must be held.
+ */
+static int _vfsPageCacheEvictRecur(PageCacheNode *node, int depth, uint64_t base, VfsEvictContext *ctx)
+{
+	int empty = 1;
+
+	int i;
+	for (i=0; i<512; i++)
+	{
+		uint64_t ent = node->ents[i];
+		if (ent == 0) continue;
+
+		void *ptr = (void*) (ent | (~VFS_PAGECACHE_ADDR_MASK));
+		if (ctx->freed >= ctx->limit)
+		{
+			empty = 0;
+		}
+		else if (depth == 3)
+		{
+			ctx->scanned++;
+			if (!ctx->force && (ent & VFS_PAGECACHE_ACCESSED))
+			{
+				// second chance
+				node->ents[i] = ent & ~VFS_PAGECACHE_ACCESSED;
+				empty = 0;
+				continue;
+			};
+
+			// pages mapped into some address space must stay
+			KOM_PageDesc *desc = komGetPageDesc(ptr);
+			if (desc->refcount != 1)
+			{
+				empty = 0;
+				continue;
+			};
+
+			// dirty pages must stay too, unless the filesystem can write them back
+			if (ent & VFS_PAGECACHE_DIRTY)
+			{
+				FSDriver *driver = ctx->inode->fs->driver;
+				off_t offset = (off_t) ((base << 9) | i) << 12;
+				if (driver->storePage == NULL || driver->storePage(ctx->inode, offset, ptr) != 0)
+				{
+					empty = 0;
+					continue;
+				};
+
+				ctx->written++;
+			};
+
+			node->ents[i] = 0;
+			komSetPageOwner(ptr, 0, 0, 0);
+			komUserPageUnref(ptr);
+			komCounterAdd(KOM_COUNTER_PAGE_CACHE, -PAGE_SIZE);
+			ctx->freed++;
+			ctx->evicted++;
+		}
+		else
+		{
+			if (_vfsPageCacheEvictRecur((PageCacheNode*) ptr, depth+1, (base << 9) | i, ctx))
+			{
+				node->ents[i] = 0;
+				komReleaseBlock(ptr, KOM_BUCKET_PAGE);
+				ctx->freed++;
+			}
+			else
+			{
+				empty = 0;
+			};
+		};
+	};
+
+	return empty;
+};
+
+/**
+ * Evict pages from the page cache of an inode. The page cache lock must be held.
+ */
+static void _vfsInodeEvict(Inode *inode, VfsEvictContext *ctx)
+{
+	ctx->inode = inode;
+	if (inode->pageCacheMaster != NULL && _vfsPageCacheEvictRecur(inode->pageCacheMaster, 0, 0, ctx))
+	{
+		komReleaseBlock(inode->pageCacheMaster, KOM_BUCKET_PAGE);
+		inode->pageCacheMaster = NULL;
+		ctx->freed++;
+	};
+};
+
+/**
+ * The page cache shrinker. The CLOCK hand moves through the inode table, clearing the accessed
+ * flags of pages, and evicting unmapped pages whose flag was already clear; dirty pages are
+ * written back first, if the filesystem supports it.
+ */
+static size_t vfsShrinkPageCache(size_t numPages)
+{
+	if (mutexTryLockForReclaim(&vfsInodeTableLock) != 0)
+	{
+		return 0;
+	};
+
+	VfsEvictContext ctx;
+	memset(&ctx, 0, sizeof(VfsEvictContext));
+	ctx.limit = numPages;
+
+	int i;
+	for (i=0; i<VFS_INODETAB_NUM_BUCKETS && ctx.freed<ctx.limit; i++)
+	{
+		Inode *inode;
+		for (inode=vfsInodeTable[vfsClockHand]; inode!=NULL; inode=inode->next)
+		{
+			if ((inode->flags & VFS_INODE_NOCACHE) || inode->pageCacheMaster == NULL)
+			{
+				continue;
+			};
+
+			if (mutexTryLockForReclaim(&inode->pageCacheLock) != 0)
+			{
+				continue;
+			};
+
+			_vfsInodeEvict(inode, &ctx);
+			mutexUnlock(&inode->pageCacheLock);
+		};
+
+		vfsClockHand = (vfsClockHand + 1) % VFS_INODETAB_NUM_BUCKETS;
+	};
+
+	mutexUnlock(&vfsInodeTableLock);
+
+	__sync_fetch_and_add(&reclaimStats.pageCacheScanned, ctx.scanned);
+	__sync_fetch_and_add(&reclaimStats.pageCacheEvicted, ctx.evicted);
+	__sync_fetch_and_add(&reclaimStats.pageCacheWritten, ctx.written);
+	return ctx.freed;
+};
+
+/**
+ * The inode and dentry shrinker. Drops unreferenced dentries, and unreferenced inodes whose page
+ * cache can be evicted completely.
+ */
+static size_t vfsShrinkInodes(size_t numPages)
+{
+	size_t freed = 0;
+
+	if (mutexTryLockForReclaim(&vfsDentryTableLock) == 0)
+	{
+		uint64_t dropped = 0;
+
+		int i;
+		for (i=0; i<VFS_DENTRYTAB_NUM_BUCKETS; i++)
+		{
+			Dentry *dent = vfsDentryTable[i];
+			while (dent != NULL)
+			{
+				Dentry *next = dent->next;
+				if (dent->refcount == 0 && (dent->flags & VFS_DENTRY_NOCACHE) == 0)
+				{
+					if (dent->prev == NULL) vfsDentryTable[i] = next;
+					else dent->prev->next = next;
+					if (next != NULL) next->prev = dent->prev;
+
+					kfree(dent);
+					dropped++;
+				};
+
+				dent = next;
+			};
+		};
+
+		mutexUnlock(&vfsDentryTableLock);
+		__sync_fetch_and_add(&reclaimStats.dentriesDropped, dropped);
+	};
+
+	if (mutexTryLockForReclaim(&vfsInodeTableLock) == 0)
+	{
+		VfsEvictContext ctx;
+		memset(&ctx, 0, sizeof(VfsEvictContext));
+		ctx.force = 1;
+		ctx.limit = (size_t) -1;
+
+		uint64_t dropped = 0;
+
+		int i;
+		for (i=0; i<VFS_INODETAB_NUM_BUCKETS; i++)
+		{
+			Inode *inode = vfsInodeTable[i];
+			while (inode != NULL)
+			{
+				Inode *next = inode->next;
+				if (inode->refcount == 0 && (inode->flags & VFS_INODE_NOCACHE) == 0
+					&& mutexTryLockForReclaim(&inode->pageCacheLock) == 0)
+				{
+					_vfsInodeEvict(inode, &ctx);
+					mutexUnlock(&inode->pageCacheLock);
+
+					// if any pages remain (dirty or mapped), keep the inode
+					if (inode->pageCacheMaster == NULL)
+					{
+						if (inode->prev == NULL) vfsInodeTable[i] = next;
+						else inode->prev->next = next;
+						if (next != NULL) next->prev = inode->prev;
+
+						FSDriver *driver = inode->fs->driver;
+						if (driver->releaseInode != NULL) driver->releaseInode(inode);
+						kmemCacheFree(inode->fs->inodeCache, inode);
+						dropped++;
+					};
+				};
+
+				inode = next;
+			};
+		};
+
+		mutexUnlock(&vfsInodeTableLock);
+
+		__sync_fetch_and_add(&reclaimStats.pageCacheScanned, ctx.scanned);
+		__sync_fetch_and_add(&reclaimStats.pageCacheEvicted, ctx.evicted);
+		__sync_fetch_and_add(&reclaimStats.pageCacheWritten, ctx.written);
+		__sync_fetch_and_add(&reclaimStats.inodesDropped, dropped);
+		freed += ctx.freed;
+	};
+
+	return freed;
+};
+
+/**
+ * The VFS shrinkers.
+ */
+static Shrinker vfsPageCacheShrinker = {
+	.name = "pagecache",
+	.shrink = vfsShrinkPageCache,
+};
+
+static Shrinker vfsInodeShrinker = {
+	.name = "inodes",
+	.shrink = vfsShrinkInodes,
+};
+
+static void vfsInitShrinkers()
+{
+	reclaimRegisterShrinker(&vfsInodeShrinker);
+	reclaimRegisterShrinker(&vfsPageCacheShrinker);
+};
+
+KERNEL_INIT_ACTION(vfsInitShrinkers, KAI_VFS_SHRINKERS);
\ No newline at end of file
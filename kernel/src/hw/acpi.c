@@ -45,7 +45,7 @@ static const UINT8 uuidOffset[16] =
     6,4,2,0,11,9,16,14,19,21,24,26,28,30,32,34
 };
 
-static UINT8 hex2num(char hex)
+static UINT8 __init hex2num(char hex)
 {
 	if ((hex >= 'A') && (hex <= 'F'))
 	{
@@ -57,7 +57,7 @@ static UINT8 hex2num(char hex)
 	};
 };
 
-static void str2uuid(char *InString, UINT8 *UuidBuffer)
+static void __init str2uuid(char *InString, UINT8 *UuidBuffer)
 {
 	UINT32                  i;
 
@@ -71,7 +71,7 @@ static void str2uuid(char *InString, UINT8 *UuidBuffer)
 	};
 };
 
-static void _acpiInit()
+static void __init _acpiInit()
 {
 	ACPI_STATUS status = AcpiInitializeSubsystem();
 	if (ACPI_FAILURE(status))
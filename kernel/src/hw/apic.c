@@ -0,0 +1,63 @@
+/*
+	Glidix kernel
+
+	Copyright (c) 2021, Madd Games.
+	All rights reserved.
+	
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+	
+	* Redistributions of source code must retain the above copyright notice, this
+	  list of conditions and the following disclaimer.
+	
+	* Redistributions in binary form must reproduce the above copyright notice,
+	  this list of conditions and the following disclaimer in the documentation
+	  and/or other materials provided with the distribution.
+	
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+	DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+	FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+	DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+	SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+	CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+	OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+	OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include <glidix/hw/apic.h>
+#include <glidix/hw/cpuid.h>
+#include <glidix/hw/msr.h>
+
+int apicX2Mode;
+int apicHasTSCDeadline;
+
+void apicInitLocal()
+{
+	CPUIDResult features = cpuid(CPUID_LEAF_FEATURES, 0);
+	uint64_t base = rdmsr(MSR_APIC_BASE);
+
+	// enable the local APIC at the default base address; if the firmware already put it in
+	// x2APIC mode then we must leave it there, as going back to xAPIC mode directly is illegal
+	if ((base & APIC_BASE_X2APIC) == 0)
+	{
+		wrmsr(MSR_APIC_BASE, APIC_PHYS_BASE | APIC_BASE_ENABLE);
+	};
+
+	// switch to x2APIC mode if supported (this must be done from xAPIC mode)
+	if (features.ecx & CPUID_1_ECX_X2APIC)
+	{
+		wrmsr(MSR_APIC_BASE, APIC_PHYS_BASE | APIC_BASE_ENABLE | APIC_BASE_X2APIC);
+		apicX2Mode = 1;
+	};
+
+	if (features.ecx & CPUID_1_ECX_TSC_DEADLINE)
+	{
+		apicHasTSCDeadline = 1;
+	};
+
+	// set the spurious interrupt vector
+	apicWrite(APIC_REG(sivr), 0x1FF);
+};
\ No newline at end of file
@@ -0,0 +1,278 @@
+/*
+	Glidix kernel
+
+	Copyright (c) 2021, Madd Games.
+	All rights reserved.
+	
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+	
+	* Redistributions of source code must retain the above copyright notice, this
+	  list of conditions and the following disclaimer.
+	
+	* Redistributions in binary form must reproduce the above copyright notice,
+	  this list of conditions and the following disclaimer in the documentation
+	  and/or other materials provided with the distribution.
+	
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+	DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+	FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+	DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+	SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+	CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+	OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+	OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include <glidix/hw/compact.h>
+#include <glidix/hw/kom.h>
+#include <glidix/hw/meminfo.h>
+#include <glidix/hw/pagetab.h>
+#include <glidix/hw/reclaim.h>
+#include <glidix/fs/vfs.h>
+#include <glidix/thread/mutex.h>
+#include <glidix/thread/process.h>
+#include <glidix/thread/sched.h>
+#include <glidix/util/init.h>
+#include <glidix/util/panic.h>
+#include <glidix/util/string.h>
+
+/**
+ * The lock serialising compactions, so that they don't undo each other's work. It also protects
+ * the cursors below.
+ */
+static Mutex compactLock;
+
+/**
+ * For each bucket, the index of the block at which the next direct compaction starts looking.
+ */
+static uint64_t compactCursor[KOM_NUM_BUCKETS];
+
+/**
+ * The statistics; the counters are updated atomically.
+ */
+static CompactStats compactStats;
+
+/**
+ * Set once compaction is ready to use.
+ */
+static int compactReady;
+
+/**
+ * Allocate a page to migrate into, which must not be part of the block being compacted. Pages from
+ * within the block are chained onto `*rejected`, to be released once the block has been emptied.
+ */
+static void* compactAllocDest(void *block, int bucket, void **rejected)
+{
+	char *start = (char*) block;
+	char *end = start + KOM_BUCKET_SIZE(bucket);
+
+	while (1)
+	{
+		char *page = (char*) komAllocUserPage();
+		if (page == NULL || page < start || page >= end)
+		{
+			return page;
+		};
+
+		*((void**) page) = *rejected;
+		*rejected = page;
+	};
+};
+
+/**
+ * Migrate a movable page into `newPage`, asking its owner to update its references. On success, the
+ * owner takes over `newPage`, and the old page is released.
+ */
+static errno_t compactMigratePage(void *page, void *newPage)
+{
+	KOM_PageDesc *desc = komGetPageDesc(page);
+	uint16_t flags = desc->flags;
+
+	if (flags & KOM_PAGE_ANON) return procMigratePage(page, newPage);
+	if (flags & KOM_PAGE_CACHE) return vfsMigratePage(page, newPage);
+	return EAGAIN;
+};
+
+/**
+ * Try to empty the specified block by migrating its pages elsewhere. `pages` is scratch space for the
+ * list of movable pages. Returns nonzero if the block is now free. Call this with the compaction lock held.
+ */
+static int compactBlock(void *block, int bucket, void **pages)
+{
+	__sync_fetch_and_add(&compactStats.blocksScanned, 1);
+
+	int numPages = komGetMovablePages(block, bucket, pages);
+	if (numPages <= 0)
+	{
+		// either it can't be emptied, or it is already free
+		return 0;
+	};
+
+	void *rejected = NULL;
+	int migrated = 0;
+
+	int i;
+	for (i=0; i<numPages; i++)
+	{
+		void *newPage = compactAllocDest(block, bucket, &rejected);
+		if (newPage == NULL)
+		{
+			break;
+		};
+
+		if (compactMigratePage(pages[i], newPage) != 0)
+		{
+			komUserPageUnref(newPage);
+			__sync_fetch_and_add(&compactStats.migrateFailed, 1);
+			break;
+		};
+
+		migrated++;
+	};
+
+	while (rejected != NULL)
+	{
+		void *page = rejected;
+		rejected = *((void**) page);
+		komUserPageUnref(page);
+	};
+
+	__sync_fetch_and_add(&compactStats.pagesMigrated, migrated);
+
+	// the old pages were released into our page cache; put them back so they can merge
+	komDrainLocalCache();
+
+	if (migrated == numPages && komIsBlockFree(block, bucket))
+	{
+		__sync_fetch_and_add(&compactStats.blocksFreed, 1);
+		return 1;
+	};
+
+	return 0;
+};
+
+int compactDirect(int bucket)
+{
+	if (!compactReady || bucket <= KOM_BUCKET_PAGE || bucket > COMPACT_MAX_BUCKET)
+	{
+		return 0;
+	};
+
+	// the shrinkers must not end up waiting for migrations
+	if (!reclaimCanRunDirect())
+	{
+		return 0;
+	};
+
+	// this also fails if we are already compacting, and are now allocating pages to migrate into
+	if (mutexTryLockForReclaim(&compactLock) != 0)
+	{
+		return 0;
+	};
+
+	__sync_fetch_and_add(&compactStats.directRuns, 1);
+
+	void *pages[KOM_BUCKET_SIZE(COMPACT_MAX_BUCKET) / PAGE_SIZE];
+	int result = 0;
+
+	int i;
+	for (i=0; i<COMPACT_DIRECT_SCAN && !result; i++)
+	{
+		void *block = komGetBlockAt(bucket, compactCursor[bucket]++);
+		if (block == NULL)
+		{
+			compactCursor[bucket] = 0;
+			continue;
+		};
+
+		result = compactBlock(block, bucket, pages);
+	};
+
+	mutexUnlock(&compactLock);
+
+	if (result) __sync_fetch_and_add(&compactStats.success, 1);
+	else __sync_fetch_and_add(&compactStats.failure, 1);
+
+	return result;
+};
+
+size_t compactAll(int bucket)
+{
+	if (!compactReady || bucket <= KOM_BUCKET_PAGE || bucket > COMPACT_MAX_BUCKET)
+	{
+		return 0;
+	};
+
+	mutexLock(&compactLock);
+	__sync_fetch_and_add(&compactStats.manualRuns, 1);
+
+	void *pages[KOM_BUCKET_SIZE(COMPACT_MAX_BUCKET) / PAGE_SIZE];
+	size_t freed = 0;
+
+	uint64_t index;
+	void *block;
+	for (index=0; (block=komGetBlockAt(bucket, index))!=NULL; index++)
+	{
+		freed += compactBlock(block, bucket, pages);
+	};
+
+	compactStats.lastManualFreed = freed;
+	mutexUnlock(&compactLock);
+	return freed;
+};
+
+void compactGetStats(CompactStats *stats)
+{
+	// the counters are independent, so a plain copy is fine
+	memcpy(stats, &compactStats, sizeof(CompactStats));
+};
+
+static void compactGenStats(MemInfoText *text)
+{
+	CompactStats stats;
+	compactGetStats(&stats);
+
+	meminfoPrintf(text, "DirectRuns:     %10lu\n", stats.directRuns);
+	meminfoPrintf(text, "ManualRuns:     %10lu\n", stats.manualRuns);
+	meminfoPrintf(text, "Success:        %10lu\n", stats.success);
+	meminfoPrintf(text, "Failure:        %10lu\n", stats.failure);
+	meminfoPrintf(text, "BlocksScanned:  %10lu\n", stats.blocksScanned);
+	meminfoPrintf(text, "BlocksFreed:    %10lu\n", stats.blocksFreed);
+	meminfoPrintf(text, "PagesMigrated:  %10lu\n", stats.pagesMigrated);
+	meminfoPrintf(text, "MigrateFailed:  %10lu\n", stats.migrateFailed);
+	meminfoPrintf(text, "LastManualFreed:%10lu\n", stats.lastManualFreed);
+};
+
+static ssize_t compactRead(Inode *inode, void *buffer, size_t size, off_t pos)
+{
+	return meminfoRead(compactGenStats, buffer, size, pos);
+};
+
+static ssize_t compactWrite(Inode *inode, const void *buffer, size_t size, off_t pos)
+{
+	compactAll(COMPACT_MAX_BUCKET);
+	return size;
+};
+
+static InodeOps compactOps = {
+	.pread = compactRead,
+	.pwrite = compactWrite,
+	.inodeFlags = VFS_INODE_SEEKABLE,
+};
+
+static void __init compactInit()
+{
+	mutexInit(&compactLock);
+	if (vfsCreateCharDev(NULL, COMPACT_PATH, 0644, &compactOps) != 0)
+	{
+		panic("Failed to create %s!", COMPACT_PATH);
+	};
+
+	compactReady = 1;
+};
+
+KERNEL_INIT_ACTION(compactInit, KIA_COMPACT_INIT, KIA_MEMINFO);
\ No newline at end of file
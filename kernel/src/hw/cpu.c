@@ -30,11 +30,16 @@
 #include <glidix/hw/msr.h>
 #include <glidix/hw/apic.h>
 #include <glidix/hw/kom.h>
+#include <glidix/util/kmem.h>
 #include <glidix/hw/pagetab.h>
+#include <glidix/hw/vmalloc.h>
 #include <glidix/util/panic.h>
 #include <glidix/util/string.h>
 #include <glidix/util/time.h>
 #include <glidix/util/log.h>
+#include <glidix/util/init.h>
+#include <glidix/hw/meminfo.h>
+#include <glidix/fs/vfs.h>
 #include <glidix/hw/idt.h>
 #include <glidix/hw/fpu.h>
 #include <glidix/thread/process.h>
@@ -93,7 +98,16 @@ void cpuInitSelf(int index)
 {
 	CPU *me = &cpuList[index];
 	me->self = me;
-	me->apicID = apic.id >> 24;		// we need this for the initial CPU
+	me->index = index;
+
+	// set the GS segment to point to the CPU struct as expected, before anything which might
+	// allocate memory; our page cache is not used until komInitLocal() below marks it ready
+	wrmsr(MSR_GS_BASE, (uint64_t) me);
+
+	// enable the local APIC (possibly switching to x2APIC mode), before we read our
+	// APIC ID, which we need for the initial CPU
+	apicInitLocal();
+	me->apicID = apicGetID();
 	me->kernelCR3 = pagetabGetCR3();
 
 	// set up the TSS
@@ -120,15 +134,10 @@ void cpuInitSelf(int index)
 	// reload GDT
 	ASM ("lgdt (%%rax)" : : "a" (&me->gdtPtr));
 
-	// set the GS segment to point to the CPU struct as expected
-	wrmsr(MSR_GS_BASE, (uint64_t) me);
+	// we can now use the per-CPU page cache and object magazines
+	komInitLocal();
+	kmemInitLocal();
 
-	// enable the local APIC at the default base address
-	wrmsr(MSR_APIC_BASE, APIC_PHYS_BASE | APIC_BASE_ENABLE);
-
-	// set the spurious interrupt vector
-	apic.sivr = 0x1FF;
-	
 	// set up syscalls
 	wrmsr(MSR_STAR, ((uint64_t)8 << 32) | ((uint64_t)0x1b << 48));
 	wrmsr(MSR_LSTAR, (uint64_t)(_syscall_entry));
@@ -140,25 +149,163 @@ void cpuInitSelf(int index)
 	schedInitLocal();
 };
 
-void cpuRegister(uint8_t apicID)
+void cpuRegister(uint32_t apicID)
 {
+	// the MADT may list a CPU both as a LAPIC and as an x2APIC
+	int i;
+	for (i=1; i<nextCPUIndex; i++)
+	{
+		if (cpuList[i].apicID == apicID)
+		{
+			return;
+		};
+	};
+
+	if (nextCPUIndex == CPU_MAX)
+	{
+		kprintf("Too many CPUs, ignoring the one with APIC ID %u\n", apicID);
+		return;
+	};
+
 	CPU *cpu = &cpuList[nextCPUIndex++];
 	cpu->apicID = apicID;
 };
 
-static void cpuSendInterrupt(uint8_t apicID, uint32_t icr)
+/**
+ * Wait until the counter reaches the specified value, or until the timeout (in nanoseconds)
+ * passes. Returns nonzero if the value was reached.
+ */
+static int cpuWaitCounter(volatile int *counter, int value, nanoseconds_t timeout)
 {
-	apic.icrDestApicID = (uint32_t) apicID << 24;
-	__sync_synchronize();
-	apic.icr = icr;
+	nanoseconds_t startTime = timeGetUptime();
+	while (timeGetUptime() < startTime+timeout && *counter != value) __sync_synchronize();
+	return *counter == value;
+};
+
+/**
+ * Set up a trampoline slot for starting the specified AP.
+ */
+static void cpuInitSlot(TrampolineSlot *slot, CPU *cpu, char *lowmem, uint64_t pml4EntZero)
+{
+	uint64_t *pml4BSP = (uint64_t*) 0xFFFFFFFFFFFFF000;
+
+	// allocate a new PML4 for this CPU:
+	// (1) PML4[0] is set to the PML4e we got earlier, to identity-map lowmem
+	// (2) PML4[509] is mapped to our own PML4[509], as this is the userspace auxiliary area
+	// (3) PML4[510] is mapped to our own PML4[510], as this is where the kernel resides
+	// (4) PML4[511] is mapped to itself (to its real version), for recursive mapping
+	uint64_t *pml4 = (uint64_t*) komAllocBlock(KOM_BUCKET_PAGE, KOM_POOLBIT_ALL);
+	if (pml4 == NULL)
+	{
+		panic("failed to allocate a PML4 for the AP!");
+	};
+
+	memset(pml4, 0, PAGE_SIZE);
+	pml4[0] = pml4EntZero;
+	pml4[509] = pml4BSP[509];
+	pml4[510] = pml4BSP[510];
+	pml4[511] = pagetabGetPhys(pml4) | PT_WRITE | PT_PRESENT | PT_NOEXEC;
+
+	// load a copy of the PML4 into the page table area (so that the trampoline
+	// can use it before it can address 64-bit memory).
+	// we don't care about recursive mappinig working on this copy, so we don't
+	// need to fix up pml4[511]; and since all the other entries are the same for
+	// all APs, they can all share this copy
+	memcpy(lowmem + CPU_LOWMEM_PML4, pml4, PAGE_SIZE);
+
+	// copy the GDT to the AP area
+	memcpy(cpu->gdt, &GDT64, 64);
+	cpu->gdtPtr.limit = 63;
+	cpu->gdtPtr.base = cpu->gdt;
+
+	// fill in the slot
+	slot->apicID = cpu->apicID;
+	slot->started = 0;
+	slot->pml4Phys = pagetabGetPhys(pml4);
+	slot->realGDTPtr = &cpu->gdtPtr;
+	slot->initRSP = (uint64_t) cpu->startupStack + CPU_STARTUP_STACK_SIZE;
+};
+
+/**
+ * Start all APs at once by broadcasting INIT-SIPI-SIPI. All the slots must be set up already.
+ * APs which did not respond in time still have `started` set to 0 in their slot.
+ */
+static void cpuStartParallel(TrampolineData *tramData, int numAPs)
+{
+	// initialize all the CPUs and wait 10ms
+	apicSendIPI(0, APIC_ICR_DESTMODE_INIT | APIC_ICR_INITDEAS_NO | APIC_ICR_DEST_ALL_BUT_SELF);
+	nanoseconds_t startTime = timeGetUptime();
+	while (timeGetUptime() < startTime+10*NANOS_PER_SEC/1000);
+
+	// try to launch the trampoline by sending SIPI, and send it again if not
+	// all CPUs responded
+	apicSendIPI(0, (CPU_LOWMEM_TRAM_CODE >> 12) | APIC_ICR_DESTMODE_SIPI | APIC_ICR_INITDEAS_NO | APIC_ICR_DEST_ALL_BUT_SELF);
+	if (!cpuWaitCounter(&tramData->numStarted, numAPs, 5*NANOS_PER_SEC/1000))
+	{
+		apicSendIPI(0, (CPU_LOWMEM_TRAM_CODE >> 12) | APIC_ICR_DESTMODE_SIPI | APIC_ICR_INITDEAS_NO | APIC_ICR_DEST_ALL_BUT_SELF);
+		cpuWaitCounter(&tramData->numStarted, numAPs, 5*NANOS_PER_SEC/1000);
+	};
+
+	// tell the APs which started that they can continue, and wait for them to
+	// stop using the trampoline data. An AP which received a SIPI but has not
+	// started by now may still show up later, while we start the rest one at a time
+	tramData->flagBSP2AP = 1;
+	while (tramData->numDone < tramData->numStarted) __sync_synchronize();
+
+	kprintf("BSP: %d out of %d APs started in parallel.\n", tramData->numStarted, numAPs);
+};
+
+/**
+ * Start a single AP, whose slot is already set up, by sending it INIT-SIPI-SIPI.
+ */
+static void cpuStartSerial(TrampolineData *tramData, TrampolineSlot *slot, int numAPs)
+{
+	uint32_t apicID = slot->apicID;
+
+	// late APs from the parallel start-up will wait for the flag again, which is harmless
+	tramData->flagBSP2AP = 0;
 	__sync_synchronize();
+
+	// initialize the CPU and to wait 10ms
+	apicSendIPI(apicID, APIC_ICR_DESTMODE_INIT | APIC_ICR_INITDEAS_NO);
+	nanoseconds_t startTime = timeGetUptime();
+	while (timeGetUptime() < startTime+10*NANOS_PER_SEC/1000);
+
+	// try to launch the trampoline by sending SIPI
+	apicSendIPI(apicID, (CPU_LOWMEM_TRAM_CODE >> 12) | APIC_ICR_DESTMODE_SIPI | APIC_ICR_INITDEAS_NO);
+
+	// wait for the core to respond, and try sending the SIPI again if the CPU
+	// didn't start
+	if (!cpuWaitCounter((volatile int*) &slot->started, 1, 5*NANOS_PER_SEC/1000))
+	{
+		apicSendIPI(apicID, (CPU_LOWMEM_TRAM_CODE >> 12) | APIC_ICR_DESTMODE_SIPI | APIC_ICR_INITDEAS_NO);
+		cpuWaitCounter((volatile int*) &slot->started, 1, 5*NANOS_PER_SEC/1000);
+	};
+
+	// if it still didn't work, we have an issue
+	if (!slot->started)
+	{
+		panic("AP failed to start!");
+	};
+
+	// tell the AP that it can continue
+	tramData->flagBSP2AP = 1;
+
+	// wait for the AP (and any late ones) to complete initializing; it was counted in
+	// numStarted before it marked its slot
+	while (tramData->numDone < tramData->numStarted) __sync_synchronize();
+
+	// report success
+	kprintf("BSP: AP init done.\n");
 };
 
 void cpuStartAPs()
 {
+	nanoseconds_t bootStart = timeGetUptime();
+
 	// create a pointer to low memory
-	char *lowmem = (char*) komAllocVirtual(CPU_LOWMEM_SIZE);
-	if (pagetabMapKernel(lowmem, 0, CPU_LOWMEM_SIZE, PT_WRITE | PT_NOEXEC) != 0)
+	char *lowmem = (char*) vmAllocRange(CPU_LOWMEM_SIZE);
+	if (lowmem == NULL || pagetabMapKernel(lowmem, 0, CPU_LOWMEM_SIZE, PT_WRITE | PT_NOEXEC) != 0)
 	{
 		panic("Failed to map lowmem!\n");
 	};
@@ -166,8 +313,9 @@ void cpuStartAPs()
 	// load the trampoline code
 	memcpy(lowmem + CPU_LOWMEM_TRAM_CODE, _cpuTrampolineStart, _cpuTrampolineEnd-_cpuTrampolineStart);
 
-	// get a pointer to the data
+	// get a pointer to the data and the slots
 	TrampolineData *tramData = (TrampolineData*) (lowmem + CPU_LOWMEM_TRAM_DATA);
+	TrampolineSlot *slots = (TrampolineSlot*) (lowmem + CPU_LOWMEM_SLOTS);
 
 	// get our PML4
 	uint64_t *pml4BSP = (uint64_t*) 0xFFFFFFFFFFFFF000;
@@ -191,104 +339,55 @@ void cpuStartAPs()
 	pml4BSP[0] = 0;
 	pagetabReload();
 
-	// start each CPU
-	int i;
-	for (i=1; i<nextCPUIndex; i++)
-	{
-		CPU *cpu = &cpuList[i];
-		kprintf("Starting CPU with APIC ID %hhu...\n", cpu->apicID);
-
-		// allocate a new PML4 for this CPU:
-		// (1) PML4[0] is set to the PML4e we got earlier, to identity-map lowmem
-		// (2) PML4[509] is mapped to our own PML4[509], as this is the userspace auxiliary area
-		// (3) PML4[510] is mapped to our own PML4[510], as this is where the kernel resides
-		// (4) PML4[511] is mapped to itself (to its real version), for recursive mapping
-		uint64_t *pml4 = (uint64_t*) komAllocBlock(KOM_BUCKET_PAGE, KOM_POOLBIT_ALL);
-		if (pml4 == NULL)
-		{
-			panic("failed to allocate a PML4 for the AP!");
-		};
-
-		memset(pml4, 0, PAGE_SIZE);
-		pml4[0] = pml4EntZero;
-		pml4[509] = pml4BSP[509];
-		pml4[510] = pml4BSP[510];
-		pml4[511] = pagetabGetPhys(pml4) | PT_WRITE | PT_PRESENT | PT_NOEXEC;
-
-		// load a copy of the PML4 into the page table area (so that the trampoline
-		// can use it before it can address 64-bit memory).
-		// we don't care about recursive mappinig working on this copy, so we don't
-		// need to fix up pml4[511]
-		memcpy(lowmem + CPU_LOWMEM_PML4, pml4, PAGE_SIZE);
-
-		// copy the GDT to the temp location (GDT goes from `GDT64` to `GDTPointer`,
-		// see bootstrap.asm).
-		memcpy(lowmem + CPU_LOWMEM_GDT, &GDT64, (uint64_t) &GDTPointer - (uint64_t) &GDT64);
-
-		// copy the GDT to the AP area
-		memcpy(cpu->gdt, &GDT64, 64);
-		cpu->gdtPtr.limit = 63;
-		cpu->gdtPtr.base = cpu->gdt;
-
-		// clear the 'continue flags' in the trampoline area
-		tramData->flagAP2BSP = 0;
-		tramData->flagBSP2AP = 0;
-		tramData->flagAPDone = 0;
-
-		// pass the true GDT pointer
-		tramData->realGDTPtr = &cpu->gdtPtr;
-
-		// set up the temp GDT pointer
-		tramData->tempGDT.limit = GDTPointer.limit;
-		tramData->tempGDT.base = CPU_LOWMEM_GDT;
+	// copy the GDT to the temp location (GDT goes from `GDT64` to `GDTPointer`,
+	// see bootstrap.asm).
+	memcpy(lowmem + CPU_LOWMEM_GDT, &GDT64, (uint64_t) &GDTPointer - (uint64_t) &GDT64);
 
-		// pass the PML4
-		tramData->pml4Phys = pagetabGetPhys(pml4);
+	// set up the temp GDT pointer
+	tramData->tempGDT.limit = GDTPointer.limit;
+	tramData->tempGDT.base = CPU_LOWMEM_GDT;
 
-		// pass the IDT
-		tramData->idtPtrPtr = &idtPtr;
+	// pass the IDT
+	tramData->idtPtrPtr = &idtPtr;
 
-		// pass the stack
-		tramData->initRSP = (uint64_t) cpu->startupStack + CPU_STARTUP_STACK_SIZE;
+	// the APs must identify themselves by their x2APIC ID if we are using those
+	tramData->useX2APICID = apicX2Mode;
 
-		// memory fence before we try to start the CPU
-		__sync_synchronize();
-
-		// initialize the CPU and to wait 10ms
-		cpuSendInterrupt(cpu->apicID, APIC_ICR_DESTMODE_INIT | APIC_ICR_INITDEAS_NO);
-		nanoseconds_t startTime = timeGetUptime();
-		while (timeGetUptime() < startTime+10*NANOS_PER_SEC/1000);
+	// set up the slots for every AP
+	int numAPs = nextCPUIndex - 1;
+	int i;
+	for (i=0; i<numAPs; i++)
+	{
+		cpuInitSlot(&slots[i], &cpuList[i+1], lowmem, pml4EntZero);
+	};
 
-		// try to launch the trampoline by sending SIPI
-		cpuSendInterrupt(cpu->apicID, (CPU_LOWMEM_TRAM_CODE >> 12) | APIC_ICR_DESTMODE_SIPI | APIC_ICR_INITDEAS_NO);
+	// no AP is running yet, so the counters can be reset safely; they are never reset again,
+	// as APs which miss the parallel start-up may still increment them later
+	tramData->numStarted = 0;
+	tramData->flagBSP2AP = 0;
+	tramData->numDone = 0;
+	tramData->numSlots = numAPs;
 
-		// wait for the core to respond
-		startTime = timeGetUptime();
-		while (timeGetUptime() < startTime+5*NANOS_PER_SEC/1000 && !tramData->flagAP2BSP);
+	// memory fence before we try to start the CPUs
+	__sync_synchronize();
 
-		// try sending the SIPI again if the CPU didn't start
-		if (!tramData->flagAP2BSP)
-		{
-			cpuSendInterrupt(cpu->apicID, (CPU_LOWMEM_TRAM_CODE >> 12) | APIC_ICR_DESTMODE_SIPI | APIC_ICR_INITDEAS_NO);
-			startTime = timeGetUptime();
-			while (timeGetUptime() < startTime+5*NANOS_PER_SEC/1000 && !tramData->flagAP2BSP);
-		};
+	// start them all at once if we can
+	if (CPU_STARTUP_PARALLEL && numAPs != 0)
+	{
+		cpuStartParallel(tramData, numAPs);
+	};
 
-		// if it still didn't work, we have an issue
-		if (!tramData->flagAP2BSP)
+	// start the remaining ones one at a time
+	for (i=0; i<numAPs; i++)
+	{
+		if (!slots[i].started)
 		{
-			panic("AP failed to start!");
+			kprintf("Starting CPU with APIC ID %u...\n", slots[i].apicID);
+			cpuStartSerial(tramData, &slots[i], numAPs);
 		};
-
-		// tell the AP that it can continue
-		tramData->flagBSP2AP = 1;
-
-		// wait for the AP to complete initializing
-		while (!tramData->flagAPDone);
-
-		// report success
-		kprintf("BSP: AP init done.\n");
 	};
+
+	kprintf("BSP: Started %d APs in %lu us.\n", numAPs, (timeGetUptime() - bootStart) / 1000);
 };
 
 int cpuGetCount()
@@ -304,7 +403,7 @@ noreturn void _cpuApEntry()
 {
 	// tell the BSP that we are done with the trampoline data
 	TrampolineData *tramData = (TrampolineData*) CPU_LOWMEM_TRAM_DATA;
-	tramData->flagAPDone = 1;
+	__sync_fetch_and_add(&tramData->numDone, 1);
 
 	// Make sure to unmap PML4[0] where we've temporarily identity-mapped lowmem
 	uint64_t *pml4 = (uint64_t*) 0xFFFFFFFFFFFFF000;
@@ -314,17 +413,21 @@ noreturn void _cpuApEntry()
 	// init the FPU
 	fpuInit();
 
+	// enable the local APIC so that we can find our own APIC ID
+	apicInitLocal();
+	uint32_t apicID = apicGetID();
+
 	// perform per-CPU initialization
 	int index;
 	for (index=0; index<CPU_MAX; index++)
 	{
-		if (cpuList[index].apicID == apic.id >> 24)
+		if (cpuList[index].apicID == apicID)
 		{
 			break;
 		};
 	};
 
-	kprintf("Performing per-CPU init on CPU %d (APIC ID %d)...\n", index, (int) (apic.id >> 24));
+	kprintf("Performing per-CPU init on CPU %d (APIC ID %u)...\n", index, apicID);
 	cpuInitSelf(index);
 
 	// now yield control to other threads
@@ -337,16 +440,18 @@ noreturn void _cpuApEntry()
 
 void cpuWake(int index)
 {
-	cpuSendInterrupt(cpuList[index].apicID, I_IPI_WAKE | APIC_ICR_INITDEAS_NO);
-	while (apic.icr & APIC_ICR_PENDING) __sync_synchronize();
+	apicSendIPI(cpuList[index].apicID, I_IPI_WAKE | APIC_ICR_INITDEAS_NO);
+	apicWaitIPI();
 };
 
 int cpuGetMyIndex()
 {
+	uint32_t apicID = apicGetID();
+
 	int i;
 	for (i=0; i<CPU_MAX; i++)
 	{
-		if (cpuList[i].apicID == apic.id >> 24)
+		if (cpuList[i].apicID == apicID)
 		{
 			break;
 		};
@@ -375,6 +480,112 @@ void cpuInvalidatePage(uint64_t cr3, void *ptr)
 	};
 };
 
+void cpuInvalidateKernel()
+{
+	CPU *me = cpuGetCurrent();
+
+	int i;
+	for (i=0; i<nextCPUIndex; i++)
+	{
+		CPU *cpu = &cpuList[i];
+		if (cpu->currentCR3 != 0 && cpu != me)
+		{
+			cpuSendMessage(i, CPU_MSG_INVLPG_TABLE, NULL);
+		};
+	};
+};
+
+void cpuBatchInit(TLBBatch *batch, uint64_t cr3)
+{
+	batch->cr3 = cr3;
+	batch->numPages = 0;
+	batch->numRanges = 0;
+};
+
+void cpuBatchAdd(TLBBatch *batch, void *ptr)
+{
+	cpuBatchAddRange(batch, ptr, PAGE_SIZE);
+};
+
+void cpuBatchAddRange(TLBBatch *batch, void *ptr, size_t size)
+{
+	uint64_t start = (uint64_t) ptr & ~0xFFFUL;
+	uint64_t end = ((uint64_t) ptr + size + 0xFFF) & ~0xFFFUL;
+
+	// once we know the whole TLB is to be flushed, the ranges don't matter
+	batch->numPages += (end - start) / PAGE_SIZE;
+	if (batch->numPages > TLB_BATCH_FLUSH_ALL)
+	{
+		return;
+	};
+
+	if (batch->numRanges != 0 && batch->ranges[batch->numRanges-1].end == start)
+	{
+		batch->ranges[batch->numRanges-1].end = end;
+	}
+	else if (batch->numRanges == TLB_BATCH_RANGES)
+	{
+		batch->numPages = TLB_BATCH_FLUSH_ALL + 1;
+	}
+	else
+	{
+		batch->ranges[batch->numRanges].start = start;
+		batch->ranges[batch->numRanges].end = end;
+		batch->numRanges++;
+	};
+};
+
+/**
+ * Perform the invalidations in a batch on the calling CPU.
+ */
+static void _cpuInvalidateBatch(TLBBatch *batch)
+{
+	if (batch->numPages > TLB_BATCH_FLUSH_ALL)
+	{
+		ASM ("mov %%cr3, %%rax ; mov %%rax, %%cr3" : : : "%rax");
+		return;
+	};
+
+	int i;
+	for (i=0; i<batch->numRanges; i++)
+	{
+		uint64_t addr;
+		for (addr=batch->ranges[i].start; addr<batch->ranges[i].end; addr+=PAGE_SIZE)
+		{
+			invlpg((void*) addr);
+		};
+	};
+};
+
+void cpuBatchFlush(TLBBatch *batch)
+{
+	if (batch->numPages == 0)
+	{
+		return;
+	};
+
+	CPU *me = cpuGetCurrent();
+	if (me->currentCR3 == batch->cr3)
+	{
+		_cpuInvalidateBatch(batch);
+	};
+
+	// a CPU which switched away from the address space has reloaded CR3 since, so only the ones
+	// using it right now can have stale entries
+	int i;
+	for (i=0; i<nextCPUIndex; i++)
+	{
+		CPU *cpu = &cpuList[i];
+		if (cpu->currentCR3 == batch->cr3 && cpu != me)
+		{
+			cpuSendMessage(i, CPU_MSG_INVLPG_BATCH, batch);
+		};
+	};
+
+	batch->numPages = 0;
+	batch->numRanges = 0;
+};
+
 int cpuSendMessage(int index, int msgType, void *param)
 {
 	CPU *cpu = &cpuList[index];
@@ -392,7 +603,7 @@ int cpuSendMessage(int index, int msgType, void *param)
 	cpu->msg = &msg;
 	spinlockRelease(&cpu->msgLock, irqState);
 
-	cpuSendInterrupt(cpu->apicID, I_IPI_MESSAGE | APIC_ICR_INITDEAS_NO);
+	apicSendIPI(cpu->apicID, I_IPI_MESSAGE | APIC_ICR_INITDEAS_NO);
 	while (!msg.ack)
 	{
 		schedSuspend();
@@ -420,13 +631,21 @@ void cpuProcessMessages()
 		{
 			ASM ("mov %%cr3, %%rax ; mov %%rax, %%cr3" : : : "%rax");
 		}
+		else if (msg->msgType == CPU_MSG_INVLPG_BATCH)
+		{
+			_cpuInvalidateBatch((TLBBatch*) msg->param);
+		}
 		else if (msg->msgType == CPU_MSG_PROC_SIGNAL || msg->msgType == CPU_MSG_THREAD_SIGNAL)
 		{
 			// NOP; the signal will be handled upon entry to userspace
 		}
+		else if (msg->msgType == CPU_MSG_PING)
+		{
+			// NOP
+		}
 		else
 		{
-			panic("CPU with APIC ID %hhu received invalid message type (%d)", cpu->apicID, msg->msgType);
+			panic("CPU with APIC ID %u received invalid message type (%d)", cpu->apicID, msg->msgType);
 		};
 
 		msg->ack = 1;
@@ -441,6 +660,9 @@ void cpuInformProcSignalled(Process *proc)
 {
 	CPU *me = cpuGetCurrent();
 
+	// the threads must know they have a signal to check before we interrupt them
+	procWakeThreads(proc);
+
 	int i;
 	for (i=0; i<nextCPUIndex; i++)
 	{
@@ -450,8 +672,6 @@ void cpuInformProcSignalled(Process *proc)
 			cpuSendMessage(i, CPU_MSG_PROC_SIGNAL, NULL);
 		};
 	};
-
-	procWakeThreads(proc);
 };
 
 void cpuInformThreadSignalled(Thread *thread)
@@ -468,4 +688,116 @@ void cpuInformThreadSignalled(Thread *thread)
 			cpuSendMessage(i, CPU_MSG_THREAD_SIGNAL, NULL);
 		};
 	};
-};
\ No newline at end of file
+};
+
+/**
+ * Time a single IPI round trip to the specified CPU: post a `CPU_MSG_PING` and spin until it is
+ * acknowledged, rather than sleeping as `cpuSendMessage()` does, so that the scheduler is not
+ * part of the measurement. Returns the number of TSC ticks it took.
+ */
+static uint64_t cpuPing(int index)
+{
+	CPU *cpu = &cpuList[index];
+
+	CPUMessage msg;
+	msg.msgType = CPU_MSG_PING;
+	msg.param = NULL;
+	msg.ack = 0;
+	msg.waiter = schedGetCurrentThread();
+	__sync_synchronize();
+
+	uint64_t start = rdtsc();
+
+	IrqState irqState = spinlockAcquire(&cpu->msgLock);
+	msg.next = cpu->msg;
+	cpu->msg = &msg;
+	spinlockRelease(&cpu->msgLock, irqState);
+
+	apicSendIPI(cpu->apicID, I_IPI_MESSAGE | APIC_ICR_INITDEAS_NO);
+	while (!msg.ack)
+	{
+		__sync_synchronize();
+	};
+
+	return rdtsc() - start;
+};
+
+/**
+ * Results of the last IPI latency measurement, in nanoseconds, per CPU index (0 for the CPU which
+ * ran it, or if it has not been run yet); protected by `cpuIPILatencyLock`.
+ */
+static Mutex cpuIPILatencyLock;
+static uint64_t cpuIPILatencyMin[CPU_MAX];
+static uint64_t cpuIPILatencyAvg[CPU_MAX];
+
+static ssize_t cpuIPILatencyWrite(Inode *inode, const void *buffer, size_t size, off_t pos)
+{
+	mutexLock(&cpuIPILatencyLock);
+
+	int me = cpuGetMyIndex();
+
+	int i;
+	for (i=0; i<nextCPUIndex; i++)
+	{
+		cpuIPILatencyMin[i] = cpuIPILatencyAvg[i] = 0;
+		if (i == me)
+		{
+			continue;
+		};
+
+		uint64_t min = ~0UL;
+		uint64_t total = 0;
+
+		int round;
+		for (round=0; round<CPU_IPI_LATENCY_ROUNDS; round++)
+		{
+			uint64_t ticks = cpuPing(i);
+			if (ticks < min) min = ticks;
+			total += ticks;
+		};
+
+		cpuIPILatencyMin[i] = schedTicksToNanos(min);
+		cpuIPILatencyAvg[i] = schedTicksToNanos(total / CPU_IPI_LATENCY_ROUNDS);
+	};
+
+	mutexUnlock(&cpuIPILatencyLock);
+	return size;
+};
+
+static void cpuGenIPILatency(MemInfoText *text)
+{
+	mutexLock(&cpuIPILatencyLock);
+
+	meminfoPrintf(text, "%-5s%-10s%12s%12s\n", "CPU", "APIC ID", "Min (ns)", "Avg (ns)");
+
+	int i;
+	for (i=0; i<nextCPUIndex; i++)
+	{
+		meminfoPrintf(text, "%-5d%-10u%12lu%12lu\n", i, cpuList[i].apicID,
+			cpuIPILatencyMin[i], cpuIPILatencyAvg[i]);
+	};
+
+	mutexUnlock(&cpuIPILatencyLock);
+};
+
+static ssize_t cpuIPILatencyRead(Inode *inode, void *buffer, size_t size, off_t pos)
+{
+	return meminfoRead(cpuGenIPILatency, buffer, size, pos);
+};
+
+static InodeOps cpuIPILatencyOps = {
+	.pread = cpuIPILatencyRead,
+	.pwrite = cpuIPILatencyWrite,
+	.inodeFlags = VFS_INODE_SEEKABLE,
+};
+
+static void cpuInitIPILatency()
+{
+	mutexInit(&cpuIPILatencyLock);
+	if (vfsCreateCharDev(NULL, CPU_IPI_LATENCY_PATH, 0644, &cpuIPILatencyOps) != 0)
+	{
+		panic("Failed to create %s!", CPU_IPI_LATENCY_PATH);
+	};
+};
+
+KERNEL_INIT_ACTION(cpuInitIPILatency, KIA_IPI_LATENCY, KIA_MEMINFO);
\ No newline at end of file
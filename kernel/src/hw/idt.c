@@ -280,6 +280,11 @@ static void isrDispatchSignal(Regs *regs, FPURegs *fpuRegs, ksiginfo_t *siginfo)
 
 void isrHandler(Regs *regs, FPURegs *fpuregs)
 {
+	if ((regs->cs & 3) == 3)
+	{
+		schedAccountUser();
+	};
+
 	if (regs->intNo == I_PAGE_FAULT)
 	{
 		uint64_t faultAddr;
@@ -319,17 +324,17 @@ void isrHandler(Regs *regs, FPURegs *fpuregs)
 	}
 	else if (regs->intNo == I_APIC_TIMER)
 	{
-		apic.eoi = 0;
+		apicEOI();
 		__sync_synchronize();
 
-		if (apic.timerCurrentCount == 0)
+		if (schedTimerExpired())
 		{
 			schedPreempt();
 		};
 	}
 	else if (regs->intNo == I_IPI_WAKE)
 	{
-		apic.eoi = 0;
+		apicEOI();
 		__sync_synchronize();
 
 		// if we are currently in the idle thread, we must switch task
@@ -341,7 +346,7 @@ void isrHandler(Regs *regs, FPURegs *fpuregs)
 	}
 	else if (regs->intNo == I_IPI_MESSAGE)
 	{
-		apic.eoi = 0;
+		apicEOI();
 		__sync_synchronize();
 		cpuProcessMessages();
 	}
@@ -349,13 +354,13 @@ void isrHandler(Regs *regs, FPURegs *fpuregs)
 	{
 		// the PIT is running at 1000 Hz
 		timeIncrease(NANOS_PER_SEC/1000);
-		apic.eoi = 0;
+		apicEOI();
 		__sync_synchronize();
 	}
 	else if (regs->intNo >= IRQ0 && regs->intNo <= IRQ15)
 	{
 		// miscellanous unhandled IRQs
-		apic.eoi = 0;
+		apicEOI();
 		if (intHandlers[regs->intNo] != NULL)
 		{
 			intHandlers[regs->intNo](intHandlerCtx[regs->intNo]);
@@ -368,8 +373,13 @@ void isrHandler(Regs *regs, FPURegs *fpuregs)
 		panic("Received unexpected interrupt: %lu", regs->intNo);
 	};
 
-	// check for signals
 	if ((regs->cs & 3) == 3)
+	{
+		schedAccountSystem();
+	};
+
+	// check for signals
+	if ((regs->cs & 3) == 3 && schedHaveWork(schedGetCurrentThread()))
 	{
 		ksiginfo_t si;
 		if (schedCheckSignals(&si) == 0)
@@ -128,7 +128,25 @@ static void ioapicProcessIntOvr(MADTRecord_IntOvr *record)
 static void ioapicProcessLAPICRecord(MADTRecord_LAPIC *record)
 {
 	kprintf("    Found CPU with ID %hhu (%s)\n", record->id, record->flags & IOAPIC_LAPIC_ENABLED ? "enabled" : "disabled");
-	if (record->flags & IOAPIC_LAPIC_ENABLED && record->id != (apic.id >> 24))
+	if (record->flags & IOAPIC_LAPIC_ENABLED && record->id != apicGetID())
+	{
+		cpuRegister(record->id);
+	};
+};
+
+/**
+ * Process a MADT x2APIC record. These are used for CPUs whose APIC IDs do not fit in 8 bits.
+ */
+static void ioapicProcessX2APICRecord(MADTRecord_X2APIC *record)
+{
+	kprintf("    Found CPU with x2APIC ID %u (%s)\n", record->id, record->flags & IOAPIC_LAPIC_ENABLED ? "enabled" : "disabled");
+	if (!apicX2Mode)
+	{
+		kprintf("    Ignoring this CPU, as we are not in x2APIC mode\n");
+		return;
+	};
+
+	if (record->flags & IOAPIC_LAPIC_ENABLED && record->id != apicGetID())
 	{
 		cpuRegister(record->id);
 	};
@@ -151,6 +169,10 @@ static void ioapicProcessMADTRecord(MADTRecord *record)
 	else if (record->type == MADT_RECORD_LAPIC)
 	{
 		ioapicProcessLAPICRecord((MADTRecord_LAPIC*) record->data);
+	}
+	else if (record->type == MADT_RECORD_X2APIC)
+	{
+		ioapicProcessX2APICRecord((MADTRecord_X2APIC*) record->data);
 	};
 };
 
@@ -203,6 +225,26 @@ static IOAPIC *ioapicGetForInt(uint32_t sysint)
 	return ioapic;
 };
 
+/**
+ * Get the APIC ID of the CPU which receives all I/O APIC interrupts. Without interrupt remapping,
+ * a redirection entry can only name APIC IDs up to 255, so if the BSP's ID is larger, use the
+ * first CPU which fits.
+ */
+static uint8_t ioapicGetDestination()
+{
+	int i;
+	for (i=0; i<cpuGetCount(); i++)
+	{
+		uint32_t apicID = cpuGetIndex(i)->apicID;
+		if (apicID <= 0xFF)
+		{
+			return (uint8_t) apicID;
+		};
+	};
+
+	panic("No CPU has an APIC ID which the I/O APIC can address!");
+};
+
 void ioapicMap(int sysint, uint8_t vector, int polarity, int triggerMode)
 {
 	IrqState irqState = spinlockAcquire(&ioapicLock);
@@ -222,7 +264,7 @@ void ioapicMap(int sysint, uint8_t vector, int polarity, int triggerMode)
 	redir.destMode = IOAPIC_DEST_MODE_PHYSICAL;
 	redir.pinPolarity = polarity;
 	redir.triggerMode = triggerMode;
-	redir.destination = cpuGetIndex(0)->apicID;
+	redir.destination = ioapicGetDestination();
 
 	ioapicWrite(ioapic, IOAPICREDTBL(intOffset), redir.lowerDword);
 	ioapicWrite(ioapic, IOAPICREDTBL(intOffset)+1, redir.upperDword);
@@ -283,8 +325,12 @@ void ioapicInit()
 		};
 
 		ioapicProcessTable(table);
+		pagetabUnmapPhys(table);
 	};
 
+	pagetabUnmapPhys(rsdt);
+	pagetabUnmapPhys(rsdp);
+
 	// map the interrupts
 	for (i=0; i<16; i++)
 	{
@@ -328,7 +374,7 @@ void ioapicInit()
 		redir.destMode = IOAPIC_DEST_MODE_PHYSICAL;
 		if (ovr->flags & IOAPIC_INTFLAGS_LOW) redir.pinPolarity = IOAPIC_POLARITY_ACTIVE_LOW;
 		if (ovr->flags & IOAPIC_INTFLAGS_LEVEL) redir.triggerMode = IOAPIC_TRIGGER_MODE_LEVEL;
-		redir.destination = apic.id >> 24;
+		redir.destination = ioapicGetDestination();
 
 		ioapicWrite(ioapic, IOAPICREDTBL(intOffset), redir.lowerDword);
 		ioapicWrite(ioapic, IOAPICREDTBL(intOffset)+1, redir.upperDword);
@@ -34,6 +34,12 @@
 #include <glidix/thread/spinlock.h>
 #include <glidix/util/panic.h>
 #include <glidix/util/memory.h>
+#include <glidix/hw/cpu.h>
+#include <glidix/hw/cpuid.h>
+#include <glidix/hw/reclaim.h>
+#include <glidix/hw/compact.h>
+#include <glidix/hw/vmalloc.h>
+#include <glidix/util/allocprof.h>
 
 /**
  * The allocator lock.
@@ -41,9 +47,37 @@
 static Spinlock komLock;
 
 /**
- * The array of pools.
+ * The pools of each node.
  */
-static KOM_Pool komPools[KOM_NUM_POOLS];
+static KOM_Pool komPools[KOM_MAX_NODES][KOM_NUM_POOLS];
+
+/**
+ * Number of NUMA nodes; this stays 1 unless `komSetupNodes()` is called.
+ */
+static int komNumNodes = 1;
+
+/**
+ * For each node, all nodes in the order in which they should be tried when allocating on behalf of
+ * that node: the node itself first, then the others by increasing distance.
+ */
+static int komNodeOrder[KOM_MAX_NODES][KOM_MAX_NODES];
+
+/**
+ * Distances between nodes.
+ */
+static uint8_t komNodeDistance[KOM_MAX_NODES][KOM_MAX_NODES] = {{KOM_LOCAL_DISTANCE}};
+
+/**
+ * The node of each section, or NULL while there is only one node.
+ */
+static uint8_t *komSectionNodes;
+
+/**
+ * Per-node statistics (protected by the allocator lock).
+ */
+static uint64_t komNodeTotalBytes[KOM_MAX_NODES];
+static uint64_t komNodeLocalAllocs[KOM_MAX_NODES];
+static uint64_t komNodeRemoteAllocs[KOM_MAX_NODES];
 
 /**
  * This is defined in the linker script, `kernel.ld`, to be a page-aligned address
@@ -53,9 +87,25 @@ static KOM_Pool komPools[KOM_NUM_POOLS];
 extern char __virtMapArea[];
 
 /**
- * The next virtual address to return for virtual allocations.
+ * Start of the direct map, and of the address range managed by the buddy allocator: `__virtMapArea`
+ * rounded up to a huge page. Physical address X is mapped at `komMapBase + X`, so blocks are aligned
+ * to their size both virtually and physically.
+ */
+static char *komMapBase;
+
+/**
+ * The page descriptor sections, indexed by physical address divided by the section size; a NULL
+ * entry means the section contains no usable memory.
+ */
+static KOM_PageDesc **komSections;
+
+/**
+ * The reverse maps of the sections, indexed like `komSections`; a NULL entry means no movable
+ * page was recorded in the section yet.
  */
-static char* nextVirtualAddr;
+static KOM_PageRmap **komSectionRmaps;
+static uint64_t komNumSections;
+
 
 /**
  * The list of regions.
@@ -68,107 +118,214 @@ static KOM_Region regions[KOM_MAX_REGIONS];
 static int numRegions;
 
 /**
- * Index of the current physical memory region to allocate from.
+ * Set if the CPU supports 1 GB pages, which are then used in the direct map where possible.
+ */
+static int komHugePages;
+
+/**
+ * Number of 4 KB, 2 MB and 1 GB pages used to build the direct map.
+ */
+static uint64_t komDirectPages[3];
+
+/**
+ * Set to 1 once the bootstrap CPU has a valid GS base, so that `cpuGetCurrent()` can be used.
+ * Whether a CPU's own page cache can be used is tracked separately, in `KOM_PageCache.ready`.
+ */
+static int komPageCachesReady;
+
+/**
+ * Memory usage counter changes made before the per-CPU counters could be used.
+ */
+static int64_t komBootCounters[KOM_NUM_COUNTERS];
+
+/**
+ * Lock statistics (protected by the lock itself).
+ */
+static uint64_t komLockAcquires;
+static uint64_t komLockContended;
+
+/**
+ * Size of the address range managed by the buddy allocator, starting at `komMapBase`. This
+ * includes the holes between regions.
+ */
+static uint64_t komMemSize;
+
+/**
+ * Number of bytes actually released into the pools at startup.
  */
-static int allocMmapIndex;
+static uint64_t komTotalBytes;
+
+/**
+ * The free bitmap. It has one bit for every `KOM_BUCKET_SIZE(0)` bytes of managed memory, and
+ * the bit is set if a free block (in any pool) starts at that address. The bucket and pool of
+ * the free block are then stored in its header. This lets us find out whether a buddy is free
+ * without searching the free lists.
+ */
+static uint64_t *komFreeBitmap;
+
+/**
+ * Number of free bytes in all pools, not including the per-CPU page caches (protected by the
+ * allocator lock).
+ */
+static uint64_t komFreeBytes;
 
 static void _komReleaseIntoPool(KOM_Pool *pool, KOM_Header *obj, int bucketIndex);
 
-static uint64_t placementAlloc(uint64_t *placeptr)
+/**
+ * Acquire the allocator lock, counting contention.
+ */
+static IrqState komLockAcquire()
+{
+	int contended = *((volatile int*) &komLock._) != 0;
+	IrqState irqState = spinlockAcquire(&komLock);
+
+	komLockAcquires++;
+	if (contended) komLockContended++;
+
+	return irqState;
+};
+
+/**
+ * Make sure that the page table node `node` points to a table, taking the table from the
+ * reservation at `*tablePlace` (ending at `tableEnd`) if necessary. `next` is any entry in the
+ * next level (as returned by `pagetabGetNodes()`).
+ */
+static void __init komMapTable(PageNodeEntry *node, PageNodeEntry *next, uint64_t *tablePlace, uint64_t tableEnd)
 {
-	uint64_t end = bootInfo->mmap[allocMmapIndex].baseAddr + bootInfo->mmap[allocMmapIndex].len;
-	end &= ~0xFFF;
-	if (*placeptr == end)
+	if ((node->value & PT_PRESENT) == 0)
 	{
-		int mmapIndex;
-		for (mmapIndex=0; mmapIndex<bootInfo->mmapCount; mmapIndex++)
+		if (*tablePlace == tableEnd)
 		{
-			MemoryMapEntry *ent = &bootInfo->mmap[mmapIndex];
-			if (ent->baseAddr > *placeptr && ent->type == 1 && (ent->baseAddr & 0xFFF) == 0 && ent->len >= PAGE_SIZE)
-			{
-				allocMmapIndex = mmapIndex;
-				*placeptr = ent->baseAddr;
-			};
+			panic("Ran out of reserved page tables while mapping physical memory");
 		};
+
+		node->value = *tablePlace | PT_PRESENT | PT_WRITE | PT_NOEXEC;
+		*tablePlace += PAGE_SIZE;
+		invlpg(next);
+		memset(pagetabGetPageStart(next), 0, PAGE_SIZE);
 	};
 
-	uint64_t result = *placeptr;
-	(*placeptr) += PAGE_SIZE;
-	return result;
+	__sync_synchronize();
 };
 
-void komInit()
+/**
+ * Map `size` bytes of physical memory at `phaddr` into the direct map at `vaddr`, using the
+ * largest pages allowed by the alignment. Page tables are taken from the reservation at
+ * `*tablePlace`.
+ */
+static void __init komMapDirect(char *vaddr, uint64_t phaddr, uint64_t size, uint64_t *tablePlace, uint64_t tableEnd)
 {
-	kprintf("Virtual mapping area begins at: 0x%p\n", __virtMapArea);
+	uint64_t end = phaddr + size;
+	while (phaddr < end)
+	{
+		uint64_t left = end - phaddr;
+		uint64_t align = (uint64_t) vaddr | phaddr;
 
-	uint64_t place = bootInfo->end;
-	place = (place + 0xFFF) & ~0xFFF;
-	kprintf("Physical placement of page tables will begin at: 0x%lx\n", place);
+		PageNodeEntry *nodes[4];
+		pagetabGetNodes(vaddr, nodes);
 
-	for (allocMmapIndex=0; allocMmapIndex<bootInfo->mmapCount; allocMmapIndex++)
-	{
-		MemoryMapEntry *ent = &bootInfo->mmap[allocMmapIndex];		
-		if (ent->baseAddr <= place && ent->baseAddr+ent->len > place && ent->type == 1)
+		komMapTable(nodes[0], nodes[1], tablePlace, tableEnd);
+		if (komHugePages && (align & (HUGE_PAGE_SIZE-1)) == 0 && left >= HUGE_PAGE_SIZE
+			&& (nodes[1]->value & PT_PRESENT) == 0)
 		{
-			break;
+			nodes[1]->value = phaddr | PT_PRESENT | PT_WRITE | PT_NOEXEC | PT_HUGE;
+			komDirectPages[2]++;
+			vaddr += HUGE_PAGE_SIZE;
+			phaddr += HUGE_PAGE_SIZE;
+			continue;
+		};
+
+		komMapTable(nodes[1], nodes[2], tablePlace, tableEnd);
+		if ((align & (LARGE_PAGE_SIZE-1)) == 0 && left >= LARGE_PAGE_SIZE && (nodes[2]->value & PT_PRESENT) == 0)
+		{
+			nodes[2]->value = phaddr | PT_PRESENT | PT_WRITE | PT_NOEXEC | PT_HUGE;
+			komDirectPages[1]++;
+			vaddr += LARGE_PAGE_SIZE;
+			phaddr += LARGE_PAGE_SIZE;
+			continue;
 		};
+
+		komMapTable(nodes[2], nodes[3], tablePlace, tableEnd);
+		nodes[3]->value = phaddr | PT_PRESENT | PT_WRITE | PT_NOEXEC;
+		komDirectPages[0]++;
+		vaddr += PAGE_SIZE;
+		phaddr += PAGE_SIZE;
 	};
+};
 
-	if (allocMmapIndex == bootInfo->mmapCount)
+/**
+ * Release the managed memory between the offsets `start` and `end` (relative to `komMapBase`)
+ * into the unused pool, as the largest naturally-aligned blocks that fit.
+ */
+static void __init komSeedRange(uint64_t start, uint64_t end)
+{
+	while (start < end)
 	{
-		panic("Failed to find the physical memory region containing the current placement address");
-	};
+		int bucket = KOM_NUM_BUCKETS-1;
+		while ((start & (KOM_BUCKET_SIZE(bucket)-1)) != 0 || start + KOM_BUCKET_SIZE(bucket) > end)
+		{
+			bucket--;
+		};
 
-	kprintf("Creating page tables for useable memory...\n");
-	kprintf("%-21s%s\n", "Phys. addr", "Size (bytes)");
+		_komReleaseIntoPool(&komPools[0][KOM_POOL_UNUSED], (KOM_Header*) (komMapBase + start), bucket);
+		start += KOM_BUCKET_SIZE(bucket);
+	};
+};
 
-	char *vaddr = __virtMapArea;
-	int mmapIndex;
-	for (mmapIndex=0; mmapIndex<bootInfo->mmapCount; mmapIndex++)
+/**
+ * Get the page descriptors of a section, allocating them (with all pages reserved) if they do not
+ * exist yet. Returns NULL if they could not be allocated.
+ */
+static KOM_PageDesc* komGetSection(uint64_t section)
+{
+	if (komSections[section] == NULL)
 	{
-		MemoryMapEntry *ent = &bootInfo->mmap[mmapIndex];
-
-		if (ent->type == 1 && (ent->baseAddr & 0xFFF) == 0)
+		KOM_PageDesc *descs = (KOM_PageDesc*) komAllocBlock(KOM_SECTION_BUCKET, KOM_POOLBIT_ALL);
+		if (descs == NULL)
 		{
-			kprintf("0x%016lx   0x%lx\n", ent->baseAddr, ent->len);
+			return NULL;
+		};
 
-			uint64_t phaddr;
-			for (phaddr=ent->baseAddr; phaddr<ent->baseAddr+ent->len; phaddr+=512*PAGE_SIZE)
-			{
-				if (phaddr >= place)
-				{
-					PageNodeEntry *nodes[4];
-					pagetabGetNodes(vaddr, nodes);
-
-					// map the first 3 levels of the page table
-					int i;
-					for (i=0; i<3; i++)
-					{
-						if ((nodes[i]->value & PT_PRESENT) == 0)
-						{
-							nodes[i]->value = placementAlloc(&place) | PT_PRESENT | PT_WRITE | PT_NOEXEC;
-							invlpg(nodes[i+1]);
-							memset(pagetabGetPageStart(nodes[i+1]), 0, PAGE_SIZE);
-						};
-
-						__sync_synchronize();
-					};
-
-					vaddr += 512*PAGE_SIZE;
-				};
-			};
+		uint64_t j;
+		for (j=0; j<KOM_SECTION_PAGES; j++)
+		{
+			descs[j].refcount = 0;
+			descs[j].flags = KOM_PAGE_RESERVED;
+			descs[j].order = 0;
+			descs[j].pool = 0;
 		};
+
+		komSections[section] = descs;
 	};
 
-	kprintf("\nFinal start of useable physical memory: 0x%lx\n", place);
+	return komSections[section];
+};
+
+void __init komInit()
+{
+	komMapBase = (char*) (((uint64_t) __virtMapArea + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1));
+	kprintf("Virtual mapping area begins at: 0x%p\n", komMapBase);
+
+	uint64_t place = bootInfo->end;
+	place = (place + 0xFFF) & ~0xFFF;
+	kprintf("Useable physical memory begins at: 0x%lx\n", place);
+
+	komHugePages = !!(cpuid(CPUID_LEAF_EXT_FEATURES, 0).edx & CPUID_EXT_EDX_PAGE1GB);
+	kprintf("1 GB pages are %s\n", komHugePages ? "supported" : "not supported");
+
 	kprintf("Mapping physical memory:\n");
 	kprintf("%-21s%-21s%s\n", "Virt. addr", "Phys. addr", "Size (bytes)");
 
-	// the virtual addresses of the PTEs are consecutive, so we can use an iterator
-	// to map the pages
-	vaddr = __virtMapArea;
-	uint64_t *pte = ((uint64_t*)(((((uint64_t)vaddr) >> 9) & (~(0x7UL | 0xFFFF000000000000UL))) | 0xFFFFFF8000000000));
+	// the direct map is linear: physical address X is mapped at `komMapBase + X`, so translating
+	// either way is a single addition, and the largest pages can always be used; the holes between
+	// regions are never released into the pools, and a region that starts exactly where another
+	// one ends gives up its first page as a guard (see below), so the buddy allocator never merges
+	// across a region boundary
+	char *mapEnd = komMapBase;
+	uint64_t physLimit = VM_ARENA_END - KOM_MIN_VM_SPACE - (uint64_t) komMapBase;
+	kprintf("Direct map can hold physical addresses up to: 0x%lx\n", physLimit);
 
+	int mmapIndex;
 	for (mmapIndex=0; mmapIndex<bootInfo->mmapCount; mmapIndex++)
 	{
 		MemoryMapEntry *ent = &bootInfo->mmap[mmapIndex];
@@ -176,20 +333,47 @@ void komInit()
 		if (ent->type == 1 && (ent->baseAddr & 0xFFF) == 0)
 		{
 			uint64_t baseAddr = ent->baseAddr;
-			uint64_t len = ent->len;
+			uint64_t len = ent->len & ~0xFFFUL;
 
 			if (place > baseAddr)
 			{
 				uint64_t delta = place-baseAddr;
 				if (len < delta)
 				{
-					goto badSection;
+					continue;
 				};
 
 				baseAddr += delta;
 				len -= delta;
 			};
 
+			// anything beyond the end of the direct map window cannot be used
+			if (baseAddr >= physLimit)
+			{
+				kprintf("Ignoring memory at 0x%lx (0x%lx bytes): outside the direct map\n", baseAddr, len);
+				continue;
+			};
+
+			if (baseAddr + len > physLimit)
+			{
+				kprintf("Ignoring memory at 0x%lx (0x%lx bytes): outside the direct map\n",
+					physLimit, baseAddr + len - physLimit);
+				len = physLimit - baseAddr;
+			};
+
+			// reserve page tables at the end of the region: at most one PT at each end, one PD
+			// per GB plus one at each end, and likewise for PDPTs
+			uint64_t numTables = 2 + ((len >> 30) + 2) + ((len >> 39) + 2);
+			if (len <= numTables * PAGE_SIZE)
+			{
+				continue;
+			};
+
+			len -= numTables * PAGE_SIZE;
+			uint64_t tablePlace = baseAddr + len;
+			uint64_t tableEnd = tablePlace + numTables * PAGE_SIZE;
+
+			char *vaddr = komMapBase + baseAddr;
 			kprintf("0x%016lx   0x%016lx   0x%lx\n", (uint64_t) vaddr, baseAddr, len);
 
 			int regionIndex = numRegions++;
@@ -203,163 +387,185 @@ void komInit()
 			region->physBase = baseAddr;
 			region->size = len;
 
-			uint64_t phaddr;
-			for (phaddr=baseAddr; phaddr<baseAddr+len; phaddr+=PAGE_SIZE)
-			{
-				*pte++ = phaddr | PT_PRESENT | PT_WRITE | PT_NOEXEC;
-				vaddr += PAGE_SIZE;
-			};
-
-			badSection:;
+			komMapDirect(vaddr, baseAddr, len, &tablePlace, tableEnd);
+			if (vaddr + len > mapEnd) mapEnd = vaddr + len;
 		};
 	};
 
 	// now set up the heap
 	pagetabReload();
-	uint64_t memSize = vaddr - __virtMapArea;
-	kprintf("\nSuccessfully mapped %lu bytes (%lu MB) of available memory, setting up the allocator...\n",
-		memSize, memSize/1024/1024);
-	vaddr = __virtMapArea;
+	uint64_t memSize = mapEnd - komMapBase;
+	kprintf("\nDirect map uses %lu 1 GB pages, %lu 2 MB pages and %lu 4 KB pages\n",
+		komDirectPages[2], komDirectPages[1], komDirectPages[0]);
 
-	KOM_Pool *unusedPool = &komPools[KOM_POOL_UNUSED];
+	// take the free bitmap from the end of the largest region
+	uint64_t bitmapSize = ((memSize >> 6) / 8 + 0xFFF) & ~0xFFFUL;
+	KOM_Region *bitmapRegion = &regions[0];
 	int i;
-	for (i=KOM_NUM_BUCKETS-1; i>=0; i--)
+	for (i=1; i<numRegions; i++)
 	{
-		uint64_t bucketSize = KOM_BUCKET_SIZE(i);
-		if (memSize & bucketSize)
-		{
-			kprintf("Bucket %2d: %p\n", i, vaddr);
+		if (regions[i].size > bitmapRegion->size) bitmapRegion = &regions[i];
+	};
 
-			KOM_Header *header = (KOM_Header*) vaddr;
-			memset(header, 0, sizeof(KOM_Header));
+	if (numRegions == 0 || bitmapRegion->size <= bitmapSize)
+	{
+		panic("Not enough memory for the free bitmap");
+	};
 
-			unusedPool->buckets[i] = header;
-			vaddr += bucketSize;
+	komFreeBitmap = (uint64_t*) (bitmapRegion->virtualBase + bitmapRegion->size - bitmapSize);
+	memset(komFreeBitmap, 0, bitmapSize);
+	komMemSize = memSize;
+	kprintf("Free bitmap at %p (%lu bytes)\n", komFreeBitmap, bitmapSize);
+
+	for (i=0; i<numRegions; i++)
+	{
+		KOM_Region *region = &regions[i];
+		uint64_t start = region->virtualBase - (uint64_t) komMapBase;
+		uint64_t end = start + region->size;
+		if (region == bitmapRegion) end -= bitmapSize;
+
+		// if another region ends exactly where this one begins, keep the first page out of the
+		// pools, so that no free block can ever span both regions
+		int j;
+		for (j=0; j<numRegions; j++)
+		{
+			if (regions[j].physBase + regions[j].size == region->physBase)
+			{
+				start += PAGE_SIZE;
+				break;
+			};
 		};
+
+		if (start >= end) continue;
+		komSeedRange(start, end);
+		komTotalBytes += end - start;
+	};
+
+	kprintf("Successfully mapped %lu bytes (%lu MB) of available memory\n",
+		komTotalBytes, komTotalBytes/1024/1024);
+	komNodeTotalBytes[0] = komTotalBytes;
+
+	kprintf("\nAllocating page descriptors...\n");
+	komNumSections = (memSize + (1UL << KOM_SECTION_SHIFT) - 1) >> KOM_SECTION_SHIFT;
+	komSections = (KOM_PageDesc**) kmalloc(sizeof(KOM_PageDesc*) * komNumSections);
+	if (komSections == NULL)
+	{
+		panic("Failed to allocate the section table!");
+	};
+
+	memset(komSections, 0, sizeof(KOM_PageDesc*) * komNumSections);
+
+	komSectionRmaps = (KOM_PageRmap**) kmalloc(sizeof(KOM_PageRmap*) * komNumSections);
+	if (komSectionRmaps == NULL)
+	{
+		panic("Failed to allocate the reverse map table!");
 	};
 
-	kprintf("\nAllocating page information...\n");
+	memset(komSectionRmaps, 0, sizeof(KOM_PageRmap*) * komNumSections);
+
+	// everything starts out reserved, then the pages we released into the pools are marked
+	// as managed
 	for (i=0; i<numRegions; i++)
 	{
 		KOM_Region *region = &regions[i];
-		uint64_t numPages = (region->size + 0xFFF) >> 12;
+		uint64_t firstPFN = region->physBase >> 12;
+		uint64_t endPFN = (region->physBase + region->size) >> 12;
+		if (region == bitmapRegion) endPFN -= bitmapSize >> 12;
 
-		region->pageInfo = (KOM_UserPageInfo*) kmalloc(sizeof(KOM_UserPageInfo) * numPages);
-		if (region->pageInfo == NULL)
+		uint64_t pfn;
+		for (pfn=firstPFN; pfn<endPFN; pfn++)
 		{
-			panic("Failed to allocate page info for a region!");
-		};
+			KOM_PageDesc *descs = komGetSection(pfn / KOM_SECTION_PAGES);
+			if (descs == NULL)
+			{
+				panic("Failed to allocate page descriptors!");
+			};
 
-		memset(region->pageInfo, 0, sizeof(KOM_UserPageInfo) * numPages);
+			descs[pfn % KOM_SECTION_PAGES].flags = 0;
+		};
 	};
 
-	nextVirtualAddr = (char*) (((uint64_t) vaddr + 0xFFF) & ~0xFFFUL);
-	kprintf("Starting address for virtual allocations: 0x%p\n", nextVirtualAddr);
+	vmInit(mapEnd);
 };
 
 /**
- * Get the alignment requirement for blocks in the specified bucket.
+ * Get the index of the bit in the free bitmap corresponding to the specified block.
  */
-static uint64_t komGetAlignmentForBucket(int bucketIndex)
+static uint64_t komGetFreeBit(KOM_Header *obj)
 {
-	uint64_t size = KOM_BUCKET_SIZE(bucketIndex);
-	if (size >= PAGE_SIZE) return PAGE_SIZE;
-	else return size;
+	return ((uint64_t) obj - (uint64_t) komMapBase) >> 6;
 };
 
 /**
- * Check if the specified bucket in the pool contains any blocks which can be merged
- * and moved to the next bucket.
+ * Add a block to the free list of a bucket, and mark it free.
  */
-static void _komMergeBlocks(KOM_Pool *pool, int bucketIndex)
+static void _komListAdd(KOM_Pool *pool, KOM_Header *obj, int bucketIndex)
 {
-	if (bucketIndex == KOM_NUM_BUCKETS-1)
-	{
-		return;
-	};
-
-	uint64_t alignmentForNextBucket = komGetAlignmentForBucket(bucketIndex+1);
-	uint64_t sizeForThisBucket = KOM_BUCKET_SIZE(bucketIndex);
+	obj->prev = NULL;
+	obj->next = pool->buckets[bucketIndex];
+	if (obj->next != NULL) obj->next->prev = obj;
+	pool->buckets[bucketIndex] = obj;
+	pool->numFree[bucketIndex]++;
+	komFreeBytes += KOM_BUCKET_SIZE(bucketIndex);
+
+	obj->bucket = bucketIndex;
+	obj->pool = pool - &komPools[0][0];
+
+	uint64_t bit = komGetFreeBit(obj);
+	komFreeBitmap[bit >> 6] |= (1UL << (bit & 63));
+};
 
-	KOM_Header *obj;
-	for (obj=pool->buckets[bucketIndex]; (obj!=NULL&&obj->next!=NULL); obj=obj->next)
-	{
-		uint64_t objAddr = (uint64_t) obj;
-		if ((objAddr & (alignmentForNextBucket-1)) == 0)
-		{
-			// correctly aligned for next bucket, see if consecutive with next block
-			KOM_Header *expectedNext = (KOM_Header*) (objAddr + sizeForThisBucket);
-			if (obj->next == expectedNext)
-			{
-				// unlink this double-object from this bucket and push to next one up
-				if (obj->prev == NULL)
-				{
-					pool->buckets[bucketIndex] = expectedNext->next;
-				}
-				else
-				{
-					obj->prev->next = expectedNext->next;
-				};
+/**
+ * Remove a block from the free list of a bucket, and mark it as no longer free.
+ */
+static void _komListRemove(KOM_Pool *pool, KOM_Header *obj, int bucketIndex)
+{
+	if (obj->prev == NULL) pool->buckets[bucketIndex] = obj->next;
+	else obj->prev->next = obj->next;
 
-				if (expectedNext->next != NULL)
-				{
-					expectedNext->next->prev = obj->prev;
-				};
+	if (obj->next != NULL) obj->next->prev = obj->prev;
+	pool->numFree[bucketIndex]--;
+	komFreeBytes -= KOM_BUCKET_SIZE(bucketIndex);
 
-				_komReleaseIntoPool(pool, obj, bucketIndex+1);
-				return;
-			};
-		};
-	};
+	uint64_t bit = komGetFreeBit(obj);
+	komFreeBitmap[bit >> 6] &= ~(1UL << (bit & 63));
 };
 
+/**
+ * Release a block into a pool, merging it with its buddy for as long as the buddy is free and
+ * in the same bucket of the same pool.
+ */
 static void _komReleaseIntoPool(KOM_Pool *pool, KOM_Header *obj, int bucketIndex)
 {
-	if (pool->buckets[bucketIndex] == NULL)
-	{
-		// list of blocks, trivial
-		obj->prev = obj->next = NULL;
-		pool->buckets[bucketIndex] = obj;
-	}
-	else
+	uint64_t poolIndex = pool - &komPools[0][0];
+	
+	while (bucketIndex < KOM_NUM_BUCKETS-1)
 	{
-		// find the object which is 'directly after' this one
-		KOM_Header *justAfter;
-		for (justAfter=pool->buckets[bucketIndex]; (justAfter!=NULL&&justAfter<obj); justAfter=justAfter->next);
-
-		if (justAfter == NULL)
+		uint64_t size = KOM_BUCKET_SIZE(bucketIndex);
+		uint64_t buddyOffset = ((uint64_t) obj - (uint64_t) komMapBase) ^ size;
+		if (buddyOffset + size > komMemSize)
 		{
-			// there is no block after us, so we are the last
-			KOM_Header *lastObj;
-			for (lastObj=pool->buckets[bucketIndex]; lastObj->next!=NULL; lastObj=lastObj->next);
-
-			obj->prev = lastObj;
-			obj->next = NULL;
+			break;
+		};
 
-			lastObj->next = obj;
-		}
-		else
+		KOM_Header *buddy = (KOM_Header*) (komMapBase + buddyOffset);
+		uint64_t bit = komGetFreeBit(buddy);
+		if ((komFreeBitmap[bit >> 6] & (1UL << (bit & 63))) == 0)
 		{
-			// attach us before
-			if (justAfter->prev == NULL)
-			{
-				obj->prev = NULL;
-				obj->next = justAfter;
-				justAfter->prev = obj;
-				pool->buckets[bucketIndex] = obj;
-			}
-			else
-			{
-				obj->prev = justAfter->prev;
-				obj->next = justAfter;
+			break;
+		};
 
-				justAfter->prev->next = obj;
-				justAfter->prev = obj;
-			};
+		if (buddy->bucket != bucketIndex || buddy->pool != poolIndex)
+		{
+			break;
 		};
 
-		_komMergeBlocks(pool, bucketIndex);
+		_komListRemove(pool, buddy, bucketIndex);
+		if (buddy < obj) obj = buddy;
+		bucketIndex++;
 	};
+
+	_komListAdd(pool, obj, bucketIndex);
 };
 
 static void* _komAllocBlockFromPool(KOM_Pool *pool, int bucketIndex)
@@ -371,14 +577,8 @@ static void* _komAllocBlockFromPool(KOM_Pool *pool, int bucketIndex)
 
 	if (pool->buckets[bucketIndex] != NULL)
 	{
-		// TODO: scan the blocks to choose which one is "preferable"
-		KOM_Header *header = (KOM_Header*) pool->buckets[bucketIndex];
-		if (header->next != NULL)
-		{
-			header->next->prev = header->prev;
-		};
-
-		pool->buckets[bucketIndex] = header->next;
+		KOM_Header *header = pool->buckets[bucketIndex];
+		_komListRemove(pool, header, bucketIndex);
 		return header;
 	}
 	else
@@ -390,113 +590,926 @@ static void* _komAllocBlockFromPool(KOM_Pool *pool, int bucketIndex)
 		};
 
 		char *otherHalf = result + KOM_BUCKET_SIZE(bucketIndex);
-		_komReleaseIntoPool(pool, (KOM_Header*) otherHalf, bucketIndex);
+		_komListAdd(pool, (KOM_Header*) otherHalf, bucketIndex);
 
 		return result;
 	};
 };
 
-void* komAllocBlock(int bucket, int allowedPools)
+/**
+ * Get the node which the memory at `ptr` belongs to.
+ */
+static int komGetNodeOf(const void *ptr)
 {
-	IrqState irqState = spinlockAcquire(&komLock);
-	
-	int poolIndex;
-	for (poolIndex=0; poolIndex<KOM_NUM_POOLS; poolIndex++)
-	{
-		if (allowedPools & (1 << poolIndex))
-		{
-			void *candidate = _komAllocBlockFromPool(&komPools[poolIndex], bucket);
-			if (candidate != NULL)
-			{
-				spinlockRelease(&komLock, irqState);
-				return candidate;
-			};
-		};
-	};
-
-	spinlockRelease(&komLock, irqState);
-	return NULL;
+	if (komSectionNodes == NULL) return 0;
+	return komSectionNodes[((uint64_t) ptr - (uint64_t) komMapBase) >> KOM_SECTION_SHIFT];
 };
 
-void komReleaseBlock(void *block, int bucket)
+/**
+ * Get the unused pool of the node which `block` belongs to; freed blocks always go back to their
+ * own node.
+ */
+static KOM_Pool* komGetHomePool(const void *block)
 {
-	IrqState irqState = spinlockAcquire(&komLock);
-	_komReleaseIntoPool(&komPools[KOM_POOL_UNUSED], (KOM_Header*) block, bucket);
-	spinlockRelease(&komLock, irqState);
+	return &komPools[komGetNodeOf(block)][KOM_POOL_UNUSED];
 };
 
-void* komAllocVirtual(size_t size)
+/**
+ * Get the node of the calling CPU. Interrupts must be disabled.
+ */
+static int komGetLocalNode()
 {
-	size = (size + 0xFFF) & ~0xFFFUL;
-	
-	IrqState irqState = spinlockAcquire(&komLock);
-	char *result = nextVirtualAddr;
-	nextVirtualAddr += size;
-	spinlockRelease(&komLock, irqState);
-
-	return result;
+	if (!komPageCachesReady) return 0;
+	return cpuGetCurrent()->numaNode;
 };
 
-void* komPhysToVirt(uint64_t phaddr)
+/**
+ * Allocate a block on behalf of the calling CPU, from its own node if possible, and otherwise from the
+ * nearest node that has one. Call this with the allocator lock held.
+ */
+static void* _komAllocNear(int bucket, int allowedPools)
 {
+	int local = komGetLocalNode();
+
 	int i;
-	for (i=0; i<numRegions; i++)
+	for (i=0; i<komNumNodes; i++)
 	{
-		KOM_Region *region = &regions[i];
-		if (region->physBase+region->size >= phaddr && region->physBase < phaddr)
+		int node = komNodeOrder[local][i];
+
+		int poolIndex;
+		for (poolIndex=0; poolIndex<KOM_NUM_POOLS; poolIndex++)
 		{
-			return (void*) (phaddr - region->physBase + region->virtualBase);
+			if (allowedPools & (1 << poolIndex))
+			{
+				void *result = _komAllocBlockFromPool(&komPools[node][poolIndex], bucket);
+				if (result != NULL)
+				{
+					if (node == local) komNodeLocalAllocs[local]++;
+					else komNodeRemoteAllocs[local]++;
+					return result;
+				};
+			};
 		};
 	};
 
 	return NULL;
 };
 
-KOM_UserPageInfo* komGetUserPageInfo(void *ptr)
+void komInitLocal()
 {
-	uint64_t addr = (uint64_t) ptr;
+	IrqState irqState = irqDisable();
 
-	int i;
-	for (i=0; i<numRegions; i++)
-	{
-		KOM_Region *region = &regions[i];
-		if (region->virtualBase+region->size >= addr && region->virtualBase < addr)
-		{
-			return &region->pageInfo[(addr - region->virtualBase) >> 12];
-		};
-	};
+	KOM_PageCache *pcp = &cpuGetCurrent()->komPageCache;
+	pcp->hotHead = pcp->hotTail = NULL;
+	pcp->cold = NULL;
+	pcp->numHot = pcp->numCold = 0;
+	pcp->ready = 1;
 
-	return NULL;
+	komPageCachesReady = 1;
+	irqRestore(irqState);
 };
 
-void* komAllocUserPage()
+/**
+ * Get the page cache of the calling CPU, or NULL if it is not initialised yet. Interrupts must
+ * be disabled.
+ */
+static KOM_PageCache* komGetLocalPageCache()
 {
-	void *result = komAllocBlock(KOM_BUCKET_PAGE, KOM_POOLBIT_ALL);
-	if (result == NULL) return NULL;
+	if (!komPageCachesReady)
+	{
+		return NULL;
+	};
 
-	KOM_UserPageInfo *info = komGetUserPageInfo(result);
-	ASSERT(info != NULL);
+	KOM_PageCache *pcp = &cpuGetCurrent()->komPageCache;
+	if (!pcp->ready)
+	{
+		return NULL;
+	};
 
-	info->refcount = 1;
-	return result;
+	return pcp;
 };
 
-void komUserPageUnref(void *page)
+/**
+ * Move up to `count` pages from the page cache back into the unused pool. Cold pages are
+ * drained first, then hot pages from the tail of the hot list. Interrupts must be disabled.
+ */
+static void komPageCacheDrain(KOM_PageCache *pcp, int count)
 {
-	KOM_UserPageInfo *info = komGetUserPageInfo(page);
-	ASSERT(info != NULL);
+	IrqState irqState = komLockAcquire();
 
-	if (__sync_add_and_fetch(&info->refcount, -1) == 0)
+	while (count != 0 && pcp->cold != NULL)
 	{
-		komReleaseBlock(page, KOM_BUCKET_PAGE);
+		KOM_Header *page = pcp->cold;
+		pcp->cold = page->next;
+		pcp->numCold--;
+		
+		_komReleaseIntoPool(komGetHomePool(page), page, KOM_BUCKET_PAGE);
+		count--;
 	};
+
+	while (count != 0 && pcp->hotTail != NULL)
+	{
+		KOM_Header *page = pcp->hotTail;
+		pcp->hotTail = page->prev;
+		if (pcp->hotTail == NULL) pcp->hotHead = NULL;
+		else pcp->hotTail->next = NULL;
+		pcp->numHot--;
+
+		_komReleaseIntoPool(komGetHomePool(page), page, KOM_BUCKET_PAGE);
+		count--;
+	};
+
+	pcp->drains++;
+	spinlockRelease(&komLock, irqState);
 };
 
-void* komUserPageDup(void *page)
+/**
+ * Take a page from the page cache, refilling it from the unused pool if it is empty. Returns
+ * NULL if the unused pool is empty too. Interrupts must be disabled.
+ */
+static void* komPageCacheAlloc(KOM_PageCache *pcp)
 {
-	KOM_UserPageInfo *info = komGetUserPageInfo(page);
-	ASSERT(info != NULL);
-	__sync_add_and_fetch(&info->refcount, 1);
+	if (pcp->hotHead == NULL && pcp->cold == NULL)
+	{
+		IrqState irqState = komLockAcquire();
+
+		// only refill from our own node; if it has run out, the caller falls back to
+		// `_komAllocNear()`, and the remote page never enters the cache
+		int local = komGetLocalNode();
+		int i;
+		for (i=0; i<KOM_PCP_BATCH; i++)
+		{
+			KOM_Header *page = (KOM_Header*) _komAllocBlockFromPool(&komPools[local][KOM_POOL_UNUSED], KOM_BUCKET_PAGE);
+			if (page == NULL) break;
+
+			komNodeLocalAllocs[local]++;
+
+			page->next = pcp->cold;
+			pcp->cold = page;
+			pcp->numCold++;
+		};
+
+		pcp->refills++;
+		int belowLow = (komFreeBytes >> 12) < reclaimWmarkLow;
+		spinlockRelease(&komLock, irqState);
+
+		if (belowLow) reclaimWakeup();
+	};
+
+	KOM_Header *page = pcp->hotHead;
+	if (page != NULL)
+	{
+		pcp->hotHead = page->next;
+		if (pcp->hotHead == NULL) pcp->hotTail = NULL;
+		else pcp->hotHead->prev = NULL;
+		pcp->numHot--;
+	}
+	else
+	{
+		page = pcp->cold;
+		if (page == NULL) return NULL;
+
+		pcp->cold = page->next;
+		pcp->numCold--;
+	};
+
+	// the header was overwritten while the page was in use; it came from the unused pool
+	page->pool = komGetHomePool(page) - &komPools[0][0];
+	pcp->hits++;
+	return page;
+};
+
+/**
+ * Put a page into the page cache, draining a batch if it has grown too large. Interrupts must
+ * be disabled.
+ */
+static void komPageCacheRelease(KOM_PageCache *pcp, KOM_Header *page)
+{
+	page->prev = NULL;
+	page->next = pcp->hotHead;
+	if (pcp->hotHead == NULL) pcp->hotTail = page;
+	else pcp->hotHead->prev = page;
+	pcp->hotHead = page;
+	pcp->numHot++;
+
+	if (pcp->numHot + pcp->numCold > KOM_PCP_HIGH)
+	{
+		komPageCacheDrain(pcp, KOM_PCP_BATCH);
+	};
+};
+
+void komDrainLocalCache()
+{
+	IrqState irqState = irqDisable();
+	KOM_PageCache *pcp = komGetLocalPageCache();
+	if (pcp != NULL && (pcp->numHot + pcp->numCold) != 0)
+	{
+		komPageCacheDrain(pcp, -1);
+	};
+	irqRestore(irqState);
+};
+
+static void* _komAllocBlockFromPools(int bucket, int allowedPools)
+{
+	IrqState irqState = komLockAcquire();
+	void *result = _komAllocNear(bucket, allowedPools);
+	int belowLow = (komFreeBytes >> 12) < reclaimWmarkLow;
+	spinlockRelease(&komLock, irqState);
+
+	if (belowLow) reclaimWakeup();
+	return result;
+};
+
+/**
+ * Try to allocate a block, first from the local page cache if applicable, then from the pools.
+ */
+static void* _komTryAllocBlock(int bucket, int allowedPools)
+{
+	if (bucket == KOM_BUCKET_PAGE && (allowedPools & KOM_POOLBIT_UNUSED))
+	{
+		// fast path: take a page from our own cache without touching the lock
+		IrqState irqState = irqDisable();
+		KOM_PageCache *pcp = komGetLocalPageCache();
+		if (pcp != NULL)
+		{
+			void *page = komPageCacheAlloc(pcp);
+			if (page != NULL)
+			{
+				irqRestore(irqState);
+				return page;
+			};
+		};
+		irqRestore(irqState);
+	};
+
+	void *result = _komAllocBlockFromPools(bucket, allowedPools);
+	if (result == NULL && bucket > KOM_BUCKET_PAGE)
+	{
+		// our cached pages may be what stops a larger block from forming
+		komDrainLocalCache();
+		result = _komAllocBlockFromPools(bucket, allowedPools);
+	};
+
+	return result;
+};
+
+void* komAllocBlockUntracked(int bucket, int allowedPools)
+{
+	void *result = _komTryAllocBlock(bucket, allowedPools);
+	if (result == NULL)
+	{
+		// out of memory; try to reclaim some ourselves, and retry
+		size_t numPages = KOM_BUCKET_SIZE(bucket) >> 12;
+		if (numPages < RECLAIM_DIRECT_BATCH) numPages = RECLAIM_DIRECT_BATCH;
+
+		if (reclaimDirect(numPages) != 0)
+		{
+			result = _komTryAllocBlock(bucket, allowedPools);
+		};
+	};
+
+	if (result == NULL && bucket > KOM_BUCKET_PAGE)
+	{
+		// there may be enough free memory, just not in one piece
+		if (compactDirect(bucket))
+		{
+			result = _komTryAllocBlock(bucket, allowedPools);
+		};
+	};
+
+	return result;
+};
+
+void* komAllocBlock(int bucket, int allowedPools)
+{
+	void *result = komAllocBlockUntracked(bucket, allowedPools);
+	if (result != NULL) ALLOCPROF_ALLOC(ALLOCPROF_KOM, result, KOM_BUCKET_SIZE(bucket));
+	return result;
+};
+
+void komReleaseBlockUntracked(void *block, int bucket)
+{
+	if (bucket == KOM_BUCKET_PAGE)
+	{
+		// pages from other nodes go straight back home, so that the cache only ever hands out
+		// local memory
+		IrqState irqState = irqDisable();
+		KOM_PageCache *pcp = komGetLocalPageCache();
+		if (pcp != NULL && komGetNodeOf(block) == komGetLocalNode())
+		{
+			komPageCacheRelease(pcp, (KOM_Header*) block);
+			irqRestore(irqState);
+			return;
+		};
+		irqRestore(irqState);
+	};
+
+	IrqState irqState = komLockAcquire();
+	_komReleaseIntoPool(komGetHomePool(block), (KOM_Header*) block, bucket);
+	spinlockRelease(&komLock, irqState);
+};
+
+void komReleaseBlock(void *block, int bucket)
+{
+	ALLOCPROF_FREE(block);
+	komReleaseBlockUntracked(block, bucket);
+};
+
+size_t komReleaseBootMemory(void *start, size_t size)
+{
+	// first move each page from the image mapping into the direct map, chaining the pages
+	// together through the direct map; they can only be released once no CPU can still
+	// reach them through a stale TLB entry
+	KOM_Header *chain = NULL;
+	size_t released = 0;
+
+	char *scan;
+	for (scan=(char*)start; scan<(char*)start+size; scan+=PAGE_SIZE)
+	{
+		PageNodeEntry *nodes[4];
+		pagetabGetNodes(scan, nodes);
+
+		int i;
+		for (i=0; i<3; i++)
+		{
+			if ((nodes[i]->value & PT_PRESENT) == 0 || (nodes[i]->value & PT_HUGE))
+			{
+				break;
+			};
+		};
+
+		if (i != 3 || (nodes[3]->value & PT_PRESENT) == 0)
+		{
+			continue;
+		};
+
+		uint64_t phaddr = nodes[3]->value & PT_PHYS_MASK;
+		if (phaddr + PAGE_SIZE > komMemSize)
+		{
+			continue;
+		};
+
+		KOM_PageDesc *descs = komGetSection(phaddr >> KOM_SECTION_SHIFT);
+		if (descs == NULL)
+		{
+			continue;
+		};
+
+		char *direct = komMapBase + phaddr;
+		if (pagetabMapKernel(direct, phaddr, PAGE_SIZE, PT_WRITE | PT_NOEXEC) != 0)
+		{
+			continue;
+		};
+
+		nodes[3]->value = 0;
+		invlpg(scan);
+
+		descs[(phaddr >> 12) % KOM_SECTION_PAGES].flags = 0;
+
+		KOM_Header *page = (KOM_Header*) direct;
+		page->next = chain;
+		chain = page;
+		released += PAGE_SIZE;
+	};
+
+	cpuInvalidateKernel();
+
+	IrqState irqState = komLockAcquire();
+	while (chain != NULL)
+	{
+		KOM_Header *page = chain;
+		chain = page->next;
+
+		_komReleaseIntoPool(komGetHomePool(page), page, KOM_BUCKET_PAGE);
+		komNodeTotalBytes[komGetNodeOf(page)] += PAGE_SIZE;
+	};
+
+	komTotalBytes += released;
+	spinlockRelease(&komLock, irqState);
+
+	return released;
+};
+
+void komGetStats(KOM_Stats *stats)
+{
+	memset(stats, 0, sizeof(KOM_Stats));
+
+	IrqState irqState = spinlockAcquire(&komLock);
+	stats->lockAcquires = komLockAcquires;
+	stats->lockContended = komLockContended;
+
+	stats->numNodes = komNumNodes;
+	int node, pool, bucket;
+	for (node=0; node<komNumNodes; node++)
+	{
+		for (pool=0; pool<KOM_NUM_POOLS; pool++)
+		{
+			for (bucket=0; bucket<KOM_NUM_BUCKETS; bucket++)
+			{
+				uint64_t numFree = komPools[node][pool].numFree[bucket];
+				stats->numFree[pool][bucket] += numFree;
+				stats->nodeFreePages[node] += (numFree * KOM_BUCKET_SIZE(bucket)) >> 12;
+			};
+		};
+
+		stats->nodeTotalPages[node] = komNodeTotalBytes[node] >> 12;
+		stats->nodeLocalAllocs[node] = komNodeLocalAllocs[node];
+		stats->nodeRemoteAllocs[node] = komNodeRemoteAllocs[node];
+	};
+
+	memcpy(stats->nodeDistance, komNodeDistance, sizeof(komNodeDistance));
+	spinlockRelease(&komLock, irqState);
+
+	memcpy(stats->directPages, komDirectPages, sizeof(komDirectPages));
+
+	// the per-CPU counters are read without synchronisation, so they may be slightly stale
+	int i;
+	for (i=0; i<cpuGetCount(); i++)
+	{
+		KOM_PageCache *pcp = &cpuGetIndex(i)->komPageCache;
+		stats->pcpHits += pcp->hits;
+		stats->pcpRefills += pcp->refills;
+		stats->pcpDrains += pcp->drains;
+		stats->pcpPages += pcp->numHot + pcp->numCold;
+	};
+};
+
+/**
+ * Release a free block of the specified pool type into the pool of the node it belongs to. If it
+ * spans sections of different nodes, it is split in half until each piece lies within one node.
+ * Call this with the allocator lock held.
+ */
+static void __init _komRehomeBlock(int poolType, KOM_Header *block, int bucket)
+{
+	uint64_t size = KOM_BUCKET_SIZE(bucket);
+	int node = komGetNodeOf(block);
+
+	uint64_t offset;
+	for (offset=(1UL << KOM_SECTION_SHIFT); offset<size; offset+=(1UL << KOM_SECTION_SHIFT))
+	{
+		if (komGetNodeOf((char*) block + offset) != node)
+		{
+			_komRehomeBlock(poolType, block, bucket-1);
+			_komRehomeBlock(poolType, (KOM_Header*) ((char*) block + size/2), bucket-1);
+			return;
+		};
+	};
+
+	_komReleaseIntoPool(&komPools[node][poolType], block, bucket);
+};
+
+void __init komSetupNodes(int numNodes, uint8_t distance[KOM_MAX_NODES][KOM_MAX_NODES], const KOM_NodeRange *ranges, int numRanges)
+{
+	if (numNodes < 2 || numNodes > KOM_MAX_NODES || komSectionNodes != NULL)
+	{
+		return;
+	};
+
+	uint8_t *sectionNodes = (uint8_t*) kmalloc(komNumSections);
+	if (sectionNodes == NULL)
+	{
+		kprintf("kom: cannot allocate the section node map; NUMA disabled\n");
+		return;
+	};
+
+	uint64_t nodeTotalBytes[KOM_MAX_NODES];
+	memset(nodeTotalBytes, 0, sizeof(nodeTotalBytes));
+
+	uint64_t section;
+	for (section=0; section<komNumSections; section++)
+	{
+		uint64_t phaddr = section << KOM_SECTION_SHIFT;
+		sectionNodes[section] = 0;
+
+		int i;
+		for (i=0; i<numRanges; i++)
+		{
+			if (phaddr >= ranges[i].base && phaddr - ranges[i].base < ranges[i].size)
+			{
+				sectionNodes[section] = ranges[i].node;
+				break;
+			};
+		};
+
+		if (komSections[section] != NULL)
+		{
+			uint64_t j;
+			for (j=0; j<KOM_SECTION_PAGES; j++)
+			{
+				if ((komSections[section][j].flags & KOM_PAGE_RESERVED) == 0)
+				{
+					nodeTotalBytes[sectionNodes[section]] += 0x1000;
+				};
+			};
+		};
+	};
+
+	IrqState irqState = komLockAcquire();
+
+	// take all free blocks out of node 0, which currently holds everything
+	KOM_Header *chains[KOM_NUM_POOLS];
+	int poolType, bucket;
+	for (poolType=0; poolType<KOM_NUM_POOLS; poolType++)
+	{
+		chains[poolType] = NULL;
+		for (bucket=0; bucket<KOM_NUM_BUCKETS; bucket++)
+		{
+			KOM_Pool *pool = &komPools[0][poolType];
+			while (pool->buckets[bucket] != NULL)
+			{
+				KOM_Header *block = pool->buckets[bucket];
+				_komListRemove(pool, block, bucket);
+				block->bucket = bucket;
+				block->next = chains[poolType];
+				chains[poolType] = block;
+			};
+		};
+	};
+
+	komSectionNodes = sectionNodes;
+	komNumNodes = numNodes;
+
+	int node;
+	for (node=0; node<numNodes; node++)
+	{
+		komNodeTotalBytes[node] = nodeTotalBytes[node];
+
+		int other;
+		for (other=0; other<numNodes; other++)
+		{
+			komNodeDistance[node][other] = distance[node][other];
+			komNodeOrder[node][other] = other;
+		};
+
+		// sort the fallback order by distance; the node itself is always first
+		int i, j;
+		for (i=1; i<numNodes; i++)
+		{
+			for (j=i; j>0; j--)
+			{
+				int a = komNodeOrder[node][j-1];
+				int b = komNodeOrder[node][j];
+				int keyA = (a == node) ? -1 : distance[node][a];
+				int keyB = (b == node) ? -1 : distance[node][b];
+				if (keyA <= keyB) break;
+
+				komNodeOrder[node][j-1] = b;
+				komNodeOrder[node][j] = a;
+			};
+		};
+	};
+
+	for (poolType=0; poolType<KOM_NUM_POOLS; poolType++)
+	{
+		while (chains[poolType] != NULL)
+		{
+			KOM_Header *block = chains[poolType];
+			chains[poolType] = block->next;
+			_komRehomeBlock(poolType, block, block->bucket);
+		};
+	};
+
+	spinlockRelease(&komLock, irqState);
+};
+
+void komCounterAdd(KOM_Counter counter, int64_t delta)
+{
+	IrqState irqState = irqDisable();
+	if (komPageCachesReady)
+	{
+		cpuGetCurrent()->komCounters[counter] += delta;
+	}
+	else
+	{
+		komBootCounters[counter] += delta;
+	};
+	irqRestore(irqState);
+};
+
+uint64_t komCounterRead(KOM_Counter counter)
+{
+	// like the page cache statistics, this is read without synchronisation
+	int64_t total = komBootCounters[counter];
+
+	int i;
+	for (i=0; i<cpuGetCount(); i++)
+	{
+		total += cpuGetIndex(i)->komCounters[counter];
+	};
+
+	if (total < 0) return 0;
+	return total;
+};
+
+uint64_t komGetFreePages()
+{
+	return komFreeBytes >> 12;
+};
+
+uint64_t komGetTotalPages()
+{
+	return komTotalBytes >> 12;
+};
+
+void* komGetBlockBase(void *ptr, int bucket)
+{
+	uint64_t offset = (uint64_t) ptr - (uint64_t) komMapBase;
+	return komMapBase + (offset & ~(KOM_BUCKET_SIZE(bucket) - 1));
+};
+
+uint64_t komVirtToPhys(const void *ptr)
+{
+	return (uint64_t) ptr - (uint64_t) komMapBase;
+};
+
+KOM_PageDesc* komGetPageDescByPhys(uint64_t phaddr)
+{
+	uint64_t pfn = phaddr >> 12;
+	uint64_t section = pfn / KOM_SECTION_PAGES;
+	if (section >= komNumSections || komSections[section] == NULL)
+	{
+		return NULL;
+	};
+
+	return &komSections[section][pfn % KOM_SECTION_PAGES];
+};
+
+KOM_PageDesc* komGetPageDesc(const void *ptr)
+{
+	if ((const char*) ptr < komMapBase || (const char*) ptr >= komMapBase + komMemSize)
+	{
+		return NULL;
+	};
+
+	return komGetPageDescByPhys(komVirtToPhys(ptr));
+};
+
+void* komPhysToVirt(uint64_t phaddr)
+{
+	KOM_PageDesc *desc = komGetPageDescByPhys(phaddr);
+	if (desc == NULL || (desc->flags & KOM_PAGE_RESERVED))
+	{
+		return NULL;
+	};
+
+	return komMapBase + phaddr;
+};
+
+/**
+ * Get the reverse map entry of a page, allocating the reverse map of its section if `alloc` is
+ * nonzero. Returns NULL if there is no reverse map for the section, or it could not be allocated.
+ */
+static KOM_PageRmap* komGetRmap(const void *page, int alloc)
+{
+	uint64_t pfn = komVirtToPhys(page) >> 12;
+	uint64_t section = pfn / KOM_SECTION_PAGES;
+
+	KOM_PageRmap *rmaps = komSectionRmaps[section];
+	if (rmaps == NULL && alloc)
+	{
+		// this may be called during compaction, so don't try to reclaim or compact; if we are
+		// that short on memory, the page just won't be movable
+		rmaps = (KOM_PageRmap*) _komTryAllocBlock(KOM_RMAP_BUCKET, KOM_POOLBIT_ALL);
+		if (rmaps == NULL)
+		{
+			return NULL;
+		};
+
+		memset(rmaps, 0, KOM_BUCKET_SIZE(KOM_RMAP_BUCKET));
+		__sync_synchronize();
+
+		if (!__sync_bool_compare_and_swap(&komSectionRmaps[section], NULL, rmaps))
+		{
+			// someone else allocated it first
+			komReleaseBlockUntracked(rmaps, KOM_RMAP_BUCKET);
+			rmaps = komSectionRmaps[section];
+		};
+	};
+
+	if (rmaps == NULL)
+	{
+		return NULL;
+	};
+
+	return &rmaps[pfn % KOM_SECTION_PAGES];
+};
+
+int komGetBlockPool(const void *block)
+{
+	// the allocator leaves the header alone, so it still says which pool the block came from
+	return ((const KOM_Header*) block)->pool % KOM_NUM_POOLS;
+};
+
+void komInitUserPages(void *block, int order, int pool)
+{
+	KOM_PageDesc *desc = komGetPageDesc(block);
+	ASSERT(desc != NULL);
+
+	uint16_t flags = KOM_PAGE_USER;
+	if (order != 0) flags |= KOM_PAGE_LARGE;
+
+	uint64_t i;
+	for (i=0; i<(1UL << order); i++)
+	{
+		desc[i].refcount = 1;
+		desc[i].flags = flags;
+		desc[i].order = order;
+		desc[i].pool = pool;
+
+		KOM_PageRmap *rmap = komGetRmap((char*) block + (i << 12), 0);
+		if (rmap != NULL)
+		{
+			rmap->owner = 0;
+			rmap->index = 0;
+		};
+	};
+};
+
+void* komAllocUserPage()
+{
+	void *result = komAllocBlock(KOM_BUCKET_PAGE, KOM_POOLBIT_ALL);
+	if (result == NULL) return NULL;
+
+	komInitUserPages(result, 0, komGetBlockPool(result));
+	return result;
+};
+
+void komUserPageUnref(void *page)
+{
+	KOM_PageDesc *desc = komGetPageDesc(page);
+	ASSERT(desc != NULL);
+
+	if (__sync_add_and_fetch(&desc->refcount, -1) == 0)
+	{
+		desc->flags = 0;
+		komReleaseBlock(page, KOM_BUCKET_PAGE);
+	};
+};
+
+void komSetPageOwner(void *page, int kind, uint64_t owner, uint64_t index)
+{
+	KOM_PageDesc *desc = komGetPageDesc(page);
+	ASSERT(desc != NULL);
+
+	KOM_PageRmap *rmap = komGetRmap(page, kind != 0);
+	if (rmap != NULL)
+	{
+		rmap->owner = owner;
+		rmap->index = index;
+	}
+	else
+	{
+		kind = 0;
+	};
+
+	// the compactor reads the flags first, so make sure it sees the new owner along with them
+	__sync_synchronize();
+	desc->flags = (desc->flags & ~KOM_PAGE_MOVABLE) | kind;
+};
+
+void komGetPageOwner(const void *page, uint64_t *owner, uint64_t *index)
+{
+	KOM_PageRmap *rmap = komGetRmap(page, 0);
+	if (rmap == NULL)
+	{
+		*owner = *index = 0;
+	}
+	else
+	{
+		*owner = rmap->owner;
+		*index = rmap->index;
+	};
+};
+
+int komGetMovablePages(void *block, int bucket, void **pages)
+{
+	uint64_t start = (uint64_t) block - (uint64_t) komMapBase;
+	uint64_t end = start + KOM_BUCKET_SIZE(bucket);
+	int numPages = 0;
+
+	if (end > komMemSize)
+	{
+		return -1;
+	};
+
+	IrqState irqState = komLockAcquire();
+
+	uint64_t pos = start;
+	while (pos < end)
+	{
+		KOM_Header *header = (KOM_Header*) (komMapBase + pos);
+		uint64_t bit = komGetFreeBit(header);
+		if (komFreeBitmap[bit >> 6] & (1UL << (bit & 63)))
+		{
+			// by alignment, a free block starting inside the candidate lies entirely within it,
+			// unless it starts at the beginning and contains the whole candidate
+			pos += KOM_BUCKET_SIZE(header->bucket);
+			continue;
+		};
+
+		KOM_PageDesc *desc = komGetPageDescByPhys(pos);
+		if ((pos & 0xFFF) != 0 || desc == NULL || (desc->flags & KOM_PAGE_MOVABLE) == 0
+			|| (desc->flags & KOM_PAGE_LARGE) || desc->refcount != 1)
+		{
+			numPages = -1;
+			break;
+		};
+
+		pages[numPages++] = header;
+		pos += PAGE_SIZE;
+	};
+
+	spinlockRelease(&komLock, irqState);
+	return numPages;
+};
+
+int komIsBlockFree(void *block, int bucket)
+{
+	KOM_Header *header = (KOM_Header*) block;
+
+	IrqState irqState = komLockAcquire();
+	uint64_t bit = komGetFreeBit(header);
+	int result = (komFreeBitmap[bit >> 6] & (1UL << (bit & 63))) && header->bucket >= (uint32_t) bucket;
+	spinlockRelease(&komLock, irqState);
+
+	return result;
+};
+
+void* komGetBlockAt(int bucket, uint64_t index)
+{
+	uint64_t offset = index * KOM_BUCKET_SIZE(bucket);
+	if (offset + KOM_BUCKET_SIZE(bucket) > komMemSize)
+	{
+		return NULL;
+	};
+
+	return komMapBase + offset;
+};
+
+void* komUserPageDup(void *page)
+{
+	KOM_PageDesc *desc = komGetPageDesc(page);
+	ASSERT(desc != NULL);
+	__sync_add_and_fetch(&desc->refcount, 1);
+
+	return page;
+};
+
+void* komAllocUserLargePage()
+{
+	void *result = _komTryAllocBlock(KOM_BUCKET_LARGE_PAGE, KOM_POOLBIT_ALL);
+	if (result == NULL) return NULL;
+
+	komInitUserPages(result, KOM_BUCKET_LARGE_PAGE - KOM_BUCKET_PAGE, komGetBlockPool(result));
+	return result;
+};
+
+void komUserLargePageUnref(void *page)
+{
+	KOM_PageDesc *desc = komGetPageDesc(page);
+	ASSERT(desc != NULL);
+
+	uint64_t freedMask[KOM_LARGE_PAGE_PAGES/64];
+	memset(freedMask, 0, sizeof(freedMask));
+	int numFreed = 0;
+
+	int i;
+	for (i=0; i<KOM_LARGE_PAGE_PAGES; i++)
+	{
+		if (__sync_add_and_fetch(&desc[i].refcount, -1) == 0)
+		{
+			desc[i].flags = 0;
+			freedMask[i >> 6] |= (1UL << (i & 63));
+			numFreed++;
+		};
+	};
+
+	if (numFreed == KOM_LARGE_PAGE_PAGES)
+	{
+		// the usual case: the whole block goes back at once
+		komReleaseBlock(page, KOM_BUCKET_LARGE_PAGE);
+		return;
+	};
+
+	for (i=0; i<KOM_LARGE_PAGE_PAGES; i++)
+	{
+		if (freedMask[i >> 6] & (1UL << (i & 63)))
+		{
+			komReleaseBlock((char*) page + PAGE_SIZE * i, KOM_BUCKET_PAGE);
+		};
+	};
+};
+
+void* komUserLargePageDup(void *page)
+{
+	KOM_PageDesc *desc = komGetPageDesc(page);
+	ASSERT(desc != NULL);
+
+	int i;
+	for (i=0; i<KOM_LARGE_PAGE_PAGES; i++)
+	{
+		__sync_add_and_fetch(&desc[i].refcount, 1);
+	};
 
 	return page;
 };
\ No newline at end of file
@@ -0,0 +1,266 @@
+/*
+	Glidix kernel
+
+	Copyright (c) 2021, Madd Games.
+	All rights reserved.
+	
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+	
+	* Redistributions of source code must retain the above copyright notice, this
+	  list of conditions and the following disclaimer.
+	
+	* Redistributions in binary form must reproduce the above copyright notice,
+	  this list of conditions and the following disclaimer in the documentation
+	  and/or other materials provided with the distribution.
+	
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+	DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+	FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+	DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+	SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+	CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+	OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+	OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <glidix/hw/meminfo.h>
+#include <glidix/hw/kom.h>
+#include <glidix/hw/vmalloc.h>
+#include <glidix/hw/zeropool.h>
+#include <glidix/fs/vfs.h>
+#include <glidix/fs/path.h>
+#include <glidix/thread/process.h>
+#include <glidix/util/init.h>
+#include <glidix/util/format.h>
+#include <glidix/util/memory.h>
+#include <glidix/util/string.h>
+#include <glidix/util/panic.h>
+#include <glidix/util/log.h>
+
+/**
+ * Names of the pools, as shown in `buddyinfo`.
+ */
+static const char *meminfoPoolNames[KOM_NUM_POOLS] = {
+	"unused",
+	"pagecache",
+	"inodes",
+};
+
+void meminfoPrintf(MemInfoText *text, const char *fmt, ...)
+{
+	while (!text->failed)
+	{
+		va_list ap;
+		va_start(ap, fmt);
+		size_t len = kvsnprintf(text->buf + text->len, text->cap - text->len, fmt, ap);
+		va_end(ap);
+
+		if (text->len + len < text->cap)
+		{
+			text->len += len;
+			return;
+		};
+
+		size_t newCap = text->cap * 2;
+		while (newCap <= text->len + len) newCap *= 2;
+
+		char *newBuf = (char*) krealloc(text->buf, newCap);
+		if (newBuf == NULL)
+		{
+			text->failed = 1;
+			return;
+		};
+
+		text->buf = newBuf;
+		text->cap = newCap;
+	};
+};
+
+ssize_t meminfoRead(void (*gen)(MemInfoText *text), void *buffer, size_t size, off_t pos)
+{
+	MemInfoText text;
+	text.len = 0;
+	text.cap = 1024;
+	text.failed = 0;
+	text.buf = (char*) kmalloc(text.cap);
+	if (text.buf == NULL)
+	{
+		return -ENOMEM;
+	};
+
+	gen(&text);
+	if (text.failed)
+	{
+		kfree(text.buf);
+		return -ENOMEM;
+	};
+
+	if ((size_t) pos >= text.len)
+	{
+		kfree(text.buf);
+		return 0;
+	};
+
+	if (size > text.len - pos) size = text.len - pos;
+	memcpy(buffer, text.buf + pos, size);
+	kfree(text.buf);
+
+	return size;
+};
+
+static ssize_t meminfoWrite(Inode *inode, const void *buffer, size_t size, off_t pos)
+{
+	return -EINVAL;
+};
+
+static void meminfoGenMeminfo(MemInfoText *text)
+{
+	KOM_Stats komStats;
+	komGetStats(&komStats);
+
+	VmStats vmStats;
+	vmGetStats(&vmStats);
+
+	ZeroPoolStats zpoolStats;
+	zpoolGetStats(&zpoolStats);
+
+	meminfoPrintf(text, "MemTotal:       %10lu kB\n", komGetTotalPages() * 4);
+	meminfoPrintf(text, "MemFree:        %10lu kB\n", (komGetFreePages() + komStats.pcpPages) * 4);
+	meminfoPrintf(text, "PerCPUFree:     %10lu kB\n", komStats.pcpPages * 4);
+	meminfoPrintf(text, "ZeroPool:       %10lu kB\n", zpoolStats.pages * 4);
+	meminfoPrintf(text, "PageCache:      %10lu kB\n", komCounterRead(KOM_COUNTER_PAGE_CACHE) >> 10);
+	meminfoPrintf(text, "Slab:           %10lu kB\n", komCounterRead(KOM_COUNTER_SLAB) >> 10);
+	meminfoPrintf(text, "PageTables:     %10lu kB\n", komCounterRead(KOM_COUNTER_PAGE_TABLES) >> 10);
+	meminfoPrintf(text, "KernelStack:    %10lu kB\n", komCounterRead(KOM_COUNTER_KERNEL_STACKS) >> 10);
+	meminfoPrintf(text, "VmallocUsed:    %10lu kB\n", komCounterRead(KOM_COUNTER_VMALLOC) >> 10);
+	meminfoPrintf(text, "VmallocMapped:  %10lu kB\n", vmStats.usedBytes >> 10);
+	meminfoPrintf(text, "VmallocLazy:    %10lu kB\n", vmStats.lazyBytes >> 10);
+	meminfoPrintf(text, "Zram:           %10lu kB\n", komCounterRead(KOM_COUNTER_ZRAM) >> 10);
+	meminfoPrintf(text, "DirectMap4k:    %10lu kB\n", komStats.directPages[0] * 4);
+	meminfoPrintf(text, "DirectMap2M:    %10lu kB\n", komStats.directPages[1] * 2048);
+	meminfoPrintf(text, "DirectMap1G:    %10lu kB\n", komStats.directPages[2] * 1024 * 1024);
+	meminfoPrintf(text, "LockAcquires:   %10lu\n", komStats.lockAcquires);
+	meminfoPrintf(text, "LockContended:  %10lu\n", komStats.lockContended);
+};
+
+static void meminfoGenBuddyinfo(MemInfoText *text)
+{
+	KOM_Stats komStats;
+	komGetStats(&komStats);
+
+	int pool;
+	for (pool=0; pool<KOM_NUM_POOLS; pool++)
+	{
+		meminfoPrintf(text, "Pool %-10s", meminfoPoolNames[pool]);
+
+		int bucket;
+		for (bucket=KOM_BUCKET_PAGE; bucket<KOM_NUM_BUCKETS; bucket++)
+		{
+			meminfoPrintf(text, " %6lu", komStats.numFree[pool][bucket]);
+		};
+
+		meminfoPrintf(text, "\n");
+	};
+};
+
+static void meminfoGenNodeinfo(MemInfoText *text)
+{
+	KOM_Stats komStats;
+	komGetStats(&komStats);
+
+	meminfoPrintf(text, "Node       Total        Free       Local      Remote   Distances\n");
+
+	int node;
+	for (node=0; node<komStats.numNodes; node++)
+	{
+		meminfoPrintf(text, "%-4d%9lu kB%9lu kB%12lu%12lu  ", node,
+			komStats.nodeTotalPages[node] * 4, komStats.nodeFreePages[node] * 4,
+			komStats.nodeLocalAllocs[node], komStats.nodeRemoteAllocs[node]);
+
+		int other;
+		for (other=0; other<komStats.numNodes; other++)
+		{
+			meminfoPrintf(text, " %3d", (int) komStats.nodeDistance[node][other]);
+		};
+
+		meminfoPrintf(text, "\n");
+	};
+};
+
+static void meminfoRSSCallback(Process *proc, void *context)
+{
+	MemInfoText *text = (MemInfoText*) context;
+	meminfoPrintf(text, "%-8d%10lu kB\n", proc->pid, proc->rss * 4);
+};
+
+static void meminfoGenRSS(MemInfoText *text)
+{
+	meminfoPrintf(text, "PID            RSS\n");
+	procWalk(meminfoRSSCallback, text);
+};
+
+static ssize_t meminfoMeminfoRead(Inode *inode, void *buffer, size_t size, off_t pos)
+{
+	return meminfoRead(meminfoGenMeminfo, buffer, size, pos);
+};
+
+static ssize_t meminfoBuddyinfoRead(Inode *inode, void *buffer, size_t size, off_t pos)
+{
+	return meminfoRead(meminfoGenBuddyinfo, buffer, size, pos);
+};
+
+static ssize_t meminfoNodeinfoRead(Inode *inode, void *buffer, size_t size, off_t pos)
+{
+	return meminfoRead(meminfoGenNodeinfo, buffer, size, pos);
+};
+
+static ssize_t meminfoRSSRead(Inode *inode, void *buffer, size_t size, off_t pos)
+{
+	return meminfoRead(meminfoGenRSS, buffer, size, pos);
+};
+
+static InodeOps meminfoMeminfoOps = {
+	.pread = meminfoMeminfoRead,
+	.pwrite = meminfoWrite,
+	.inodeFlags = VFS_INODE_SEEKABLE,
+};
+
+static InodeOps meminfoBuddyinfoOps = {
+	.pread = meminfoBuddyinfoRead,
+	.pwrite = meminfoWrite,
+	.inodeFlags = VFS_INODE_SEEKABLE,
+};
+
+static InodeOps meminfoNodeinfoOps = {
+	.pread = meminfoNodeinfoRead,
+	.pwrite = meminfoWrite,
+	.inodeFlags = VFS_INODE_SEEKABLE,
+};
+
+static InodeOps meminfoRSSOps = {
+	.pread = meminfoRSSRead,
+	.pwrite = meminfoWrite,
+	.inodeFlags = VFS_INODE_SEEKABLE,
+};
+
+static void __init meminfoInit()
+{
+	kprintf("Creating the memory statistics files in %s...\n", MEMINFO_DIR);
+	if (vfsCreateDirectory(NULL, MEMINFO_DIR, 0755) != 0)
+	{
+		panic("Failed to create %s!", MEMINFO_DIR);
+	};
+
+	if (vfsCreateCharDev(NULL, MEMINFO_DIR "/meminfo", 0444, &meminfoMeminfoOps) != 0
+		|| vfsCreateCharDev(NULL, MEMINFO_DIR "/buddyinfo", 0444, &meminfoBuddyinfoOps) != 0
+		|| vfsCreateCharDev(NULL, MEMINFO_DIR "/nodeinfo", 0444, &meminfoNodeinfoOps) != 0
+		|| vfsCreateCharDev(NULL, MEMINFO_DIR "/rss", 0444, &meminfoRSSOps) != 0)
+	{
+		panic("Failed to create the memory statistics files!");
+	};
+};
+
+KERNEL_INIT_ACTION(meminfoInit, KIA_MEMINFO, KAI_VFS_KERNEL_ROOT);
\ No newline at end of file
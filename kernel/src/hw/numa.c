@@ -0,0 +1,199 @@
+/*
+	Glidix kernel
+
+	Copyright (c) 2021, Madd Games.
+	All rights reserved.
+	
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+	
+	* Redistributions of source code must retain the above copyright notice, this
+	  list of conditions and the following disclaimer.
+	
+	* Redistributions in binary form must reproduce the above copyright notice,
+	  this list of conditions and the following disclaimer in the documentation
+	  and/or other materials provided with the distribution.
+	
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+	DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+	FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+	DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+	SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+	CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+	OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+	OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include <glidix/hw/numa.h>
+#include <glidix/hw/acpi.h>
+#include <glidix/hw/kom.h>
+#include <glidix/hw/cpu.h>
+#include <glidix/util/init.h>
+#include <glidix/util/log.h>
+
+/**
+ * Proximity domain of each node; node IDs are assigned densely in the order in which domains
+ * appear in the SRAT.
+ */
+static uint32_t numaDomains[KOM_MAX_NODES] __initdata;
+static int numaNumNodes __initdata;
+
+/**
+ * Get the node ID of a proximity domain, assigning a new one if this is the first time it is seen.
+ * Returns -1 if there are too many nodes.
+ */
+static int __init numaGetNode(uint32_t domain)
+{
+	int i;
+	for (i=0; i<numaNumNodes; i++)
+	{
+		if (numaDomains[i] == domain)
+		{
+			return i;
+		};
+	};
+
+	if (numaNumNodes == KOM_MAX_NODES)
+	{
+		kprintf("numa: too many proximity domains, treating domain %u as node 0\n", domain);
+		return -1;
+	};
+
+	numaDomains[numaNumNodes] = domain;
+	return numaNumNodes++;
+};
+
+/**
+ * Assign the CPU with the specified APIC ID to a node.
+ */
+static void __init numaSetCPUNode(uint32_t apicID, int node)
+{
+	int i;
+	for (i=0; i<cpuGetCount(); i++)
+	{
+		CPU *cpu = cpuGetIndex(i);
+		if (cpu->apicID == apicID)
+		{
+			cpu->numaNode = node;
+			return;
+		};
+	};
+};
+
+static void __init numaInit()
+{
+	ACPI_TABLE_SRAT *srat;
+	if (ACPI_FAILURE(AcpiGetTable(ACPI_SIG_SRAT, 1, (ACPI_TABLE_HEADER**) &srat)))
+	{
+		// no SRAT; everything stays on node 0
+		return;
+	};
+
+	static KOM_NodeRange ranges[NUMA_MAX_RANGES] __initdata;
+	int numRanges = 0;
+
+	char *scan = (char*) &srat[1];
+	char *end = (char*) srat + srat->Header.Length;
+	while (scan + sizeof(ACPI_SUBTABLE_HEADER) <= end)
+	{
+		ACPI_SUBTABLE_HEADER *sub = (ACPI_SUBTABLE_HEADER*) scan;
+		if (sub->Length < sizeof(ACPI_SUBTABLE_HEADER) || scan + sub->Length > end)
+		{
+			break;
+		};
+
+		if (sub->Type == ACPI_SRAT_TYPE_CPU_AFFINITY)
+		{
+			ACPI_SRAT_CPU_AFFINITY *aff = (ACPI_SRAT_CPU_AFFINITY*) sub;
+			if (aff->Flags & ACPI_SRAT_CPU_USE_AFFINITY)
+			{
+				uint32_t domain = aff->ProximityDomainLo
+					| ((uint32_t) aff->ProximityDomainHi[0] << 8)
+					| ((uint32_t) aff->ProximityDomainHi[1] << 16)
+					| ((uint32_t) aff->ProximityDomainHi[2] << 24);
+				int node = numaGetNode(domain);
+				if (node != -1) numaSetCPUNode(aff->ApicId, node);
+			};
+		}
+		else if (sub->Type == ACPI_SRAT_TYPE_X2APIC_CPU_AFFINITY)
+		{
+			ACPI_SRAT_X2APIC_CPU_AFFINITY *aff = (ACPI_SRAT_X2APIC_CPU_AFFINITY*) sub;
+			if (aff->Flags & ACPI_SRAT_CPU_ENABLED)
+			{
+				int node = numaGetNode(aff->ProximityDomain);
+				if (node != -1) numaSetCPUNode(aff->ApicId, node);
+			};
+		}
+		else if (sub->Type == ACPI_SRAT_TYPE_MEMORY_AFFINITY)
+		{
+			ACPI_SRAT_MEM_AFFINITY *aff = (ACPI_SRAT_MEM_AFFINITY*) sub;
+			if ((aff->Flags & ACPI_SRAT_MEM_ENABLED) && aff->Length != 0)
+			{
+				int node = numaGetNode(aff->ProximityDomain);
+				if (node != -1 && numRanges != NUMA_MAX_RANGES)
+				{
+					ranges[numRanges].base = aff->BaseAddress;
+					ranges[numRanges].size = aff->Length;
+					ranges[numRanges].node = node;
+					numRanges++;
+				};
+			};
+		};
+
+		scan += sub->Length;
+	};
+
+	if (numaNumNodes < 2)
+	{
+		return;
+	};
+
+	// distances default to local/remote unless the SLIT says otherwise
+	static uint8_t distance[KOM_MAX_NODES][KOM_MAX_NODES] __initdata;
+	int i, j;
+	for (i=0; i<numaNumNodes; i++)
+	{
+		for (j=0; j<numaNumNodes; j++)
+		{
+			distance[i][j] = (i == j) ? KOM_LOCAL_DISTANCE : KOM_REMOTE_DISTANCE;
+		};
+	};
+
+	ACPI_TABLE_SLIT *slit;
+	if (ACPI_SUCCESS(AcpiGetTable(ACPI_SIG_SLIT, 1, (ACPI_TABLE_HEADER**) &slit)))
+	{
+		uint64_t count = slit->LocalityCount;
+		if (sizeof(ACPI_TABLE_SLIT) - 1 + count * count <= slit->Header.Length)
+		{
+			for (i=0; i<numaNumNodes; i++)
+			{
+				for (j=0; j<numaNumNodes; j++)
+				{
+					if (numaDomains[i] < count && numaDomains[j] < count)
+					{
+						distance[i][j] = slit->Entry[numaDomains[i] * count + numaDomains[j]];
+					};
+				};
+			};
+		};
+	};
+
+	komSetupNodes(numaNumNodes, distance, ranges, numRanges);
+
+	kprintf("NUMA: %d nodes, %d memory ranges\n", numaNumNodes, numRanges);
+	for (i=0; i<numaNumNodes; i++)
+	{
+		int numCPUs = 0;
+		for (j=0; j<cpuGetCount(); j++)
+		{
+			if (cpuGetIndex(j)->numaNode == i) numCPUs++;
+		};
+
+		kprintf("  Node %d: proximity domain %u, %d CPUs\n", i, numaDomains[i], numCPUs);
+	};
+};
+
+KERNEL_INIT_ACTION(numaInit, KIA_NUMA_INIT, KIA_ACPI_INIT);
\ No newline at end of file
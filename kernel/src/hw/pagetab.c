@@ -28,6 +28,7 @@
 
 #include <glidix/hw/pagetab.h>
 #include <glidix/hw/kom.h>
+#include <glidix/hw/vmalloc.h>
 #include <glidix/util/string.h>
 
 extern char __userAuxBegin[];
@@ -50,8 +51,21 @@ void* pagetabGetPageStart(void *ptr)
 
 uint64_t pagetabGetPhys(const void *ptr)
 {
-	uint64_t pte = *((uint64_t*)(((((uint64_t)ptr) >> 9) & (~(0x7UL | 0xFFFF000000000000UL))) | 0xFFFFFF8000000000));
-	return (pte & PT_PHYS_MASK) | ((uint64_t) ptr & (PAGE_SIZE-1));
+	PageNodeEntry *nodes[4];
+	pagetabGetNodes(ptr, nodes);
+
+	uint64_t addr = (uint64_t) ptr;
+	if (nodes[1]->value & PT_HUGE)
+	{
+		return (nodes[1]->value & PT_PHYS_MASK & ~(HUGE_PAGE_SIZE-1)) | (addr & (HUGE_PAGE_SIZE-1));
+	};
+
+	if (nodes[2]->value & PT_HUGE)
+	{
+		return (nodes[2]->value & PT_PHYS_MASK & ~(LARGE_PAGE_SIZE-1)) | (addr & (LARGE_PAGE_SIZE-1));
+	};
+
+	return (nodes[3]->value & PT_PHYS_MASK) | (addr & (PAGE_SIZE-1));
 };
 
 errno_t pagetabMapKernel(void *ptr, uint64_t phaddr, size_t size, uint64_t flags)
@@ -79,8 +93,15 @@ errno_t pagetabMapKernel(void *ptr, uint64_t phaddr, size_t size, uint64_t flags
 				};
 
 				memset(newLayer, 0, PAGE_SIZE);
+				komCounterAdd(KOM_COUNTER_PAGE_TABLES, PAGE_SIZE);
 				nodes[i]->value = pagetabGetPhys(newLayer) | PT_PRESENT | PT_WRITE;
 				invlpg(nodes[i+1]);
+			}
+			else if (nodes[i]->value & PT_HUGE)
+			{
+				// only the direct map uses large pages, and it only covers usable memory, which
+				// is never remapped
+				return EINVAL;
 			};
 
 			__sync_synchronize();
@@ -103,15 +124,26 @@ void* pagetabMapPhys(uint64_t phaddr, size_t size, uint64_t flags)
 	phaddr &= ~0xFFFUL;
 	size = mapEnd - phaddr;
 
-	char *result = (char*) komAllocVirtual(size);
+	char *result = (char*) vmAllocRange(size);
+	if (result == NULL)
+	{
+		return NULL;
+	};
+
 	if (pagetabMapKernel(result, phaddr, size, flags) != 0)
 	{
+		vmFreeRange(result);
 		return NULL;
 	};
 
 	return result + offset;
 };
 
+void pagetabUnmapPhys(void *ptr)
+{
+	vmFreeRange(pagetabGetPageStart(ptr));
+};
+
 void pagetabSetupUserAux()
 {
 	char *scan;
@@ -0,0 +1,223 @@
+/*
+	Glidix kernel
+
+	Copyright (c) 2021, Madd Games.
+	All rights reserved.
+	
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+	
+	* Redistributions of source code must retain the above copyright notice, this
+	  list of conditions and the following disclaimer.
+	
+	* Redistributions in binary form must reproduce the above copyright notice,
+	  this list of conditions and the following disclaimer in the documentation
+	  and/or other materials provided with the distribution.
+	
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+	DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+	FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+	DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+	SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+	CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+	OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+	OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include <glidix/hw/reclaim.h>
+#include <glidix/hw/kom.h>
+#include <glidix/hw/irq.h>
+#include <glidix/thread/sched.h>
+#include <glidix/thread/spinlock.h>
+#include <glidix/util/init.h>
+#include <glidix/util/log.h>
+#include <glidix/util/panic.h>
+
+ReclaimStats reclaimStats;
+
+/**
+ * The watermarks (in pages); see `RECLAIM_WMARK_*`. The low watermark is zero until the reclaim
+ * thread is started, so the allocator does not try to wake it up before then.
+ */
+uint64_t reclaimWmarkLow;
+static uint64_t reclaimWmarkHigh;
+
+/**
+ * Lock protecting the shrinker list against concurrent registrations. Shrinkers are only ever
+ * added at the head, so the list can be walked without the lock.
+ */
+static Spinlock reclaimShrinkerLock;
+static Shrinker* volatile reclaimShrinkers;
+
+/**
+ * The reclaim thread, and whether it is currently awake.
+ */
+static Thread* reclaimThread;
+static volatile int reclaimThreadActive;
+
+void reclaimRegisterShrinker(Shrinker *shrinker)
+{
+	IrqState irqState = spinlockAcquire(&reclaimShrinkerLock);
+	shrinker->next = reclaimShrinkers;
+	__sync_synchronize();
+	reclaimShrinkers = shrinker;
+	spinlockRelease(&reclaimShrinkerLock, irqState);
+};
+
+/**
+ * Call the shrinkers until at least `target` pages were freed, or they stop making progress.
+ * Returns the number of pages freed.
+ */
+static size_t reclaimRun(size_t target)
+{
+	size_t freed = 0;
+
+	int pass;
+	for (pass=0; pass<RECLAIM_MAX_PASSES && freed<target; pass++)
+	{
+		size_t freedThisPass = 0;
+
+		// cheap shrinkers first, and only then the expensive ones if we still need more
+		int expensive;
+		for (expensive=0; expensive<2 && freed<target; expensive++)
+		{
+			Shrinker *shrinker;
+			for (shrinker=reclaimShrinkers; shrinker!=NULL && freed<target; shrinker=shrinker->next)
+			{
+				if (shrinker->expensive != expensive) continue;
+
+				size_t count = shrinker->shrink(target - freed);
+				freed += count;
+				freedThisPass += count;
+			};
+		};
+
+		if (freedThisPass == 0) break;
+	};
+
+	__sync_fetch_and_add(&reclaimStats.pagesReclaimed, freed);
+	return freed;
+};
+
+void reclaimWakeup()
+{
+	if (reclaimThread == NULL)
+	{
+		return;
+	};
+
+	if (__sync_lock_test_and_set(&reclaimThreadActive, 1) == 0)
+	{
+		__sync_fetch_and_add(&reclaimStats.kswapdWakeups, 1);
+		schedWake(reclaimThread);
+	};
+};
+
+int reclaimCanRunDirect()
+{
+	// we may only sleep on locks if interrupts are enabled
+	IrqState irqState = irqDisable();
+	irqRestore(irqState);
+	if (irqState == IRQ_STATE_DISABLED)
+	{
+		return 0;
+	};
+
+	return !schedGetCurrentThread()->inReclaim;
+};
+
+size_t reclaimDirect(size_t numPages)
+{
+	if (reclaimThread == NULL)
+	{
+		// too early
+		return 0;
+	};
+
+	if (!reclaimCanRunDirect())
+	{
+		return 0;
+	};
+
+	Thread *me = schedGetCurrentThread();
+
+	__sync_fetch_and_add(&reclaimStats.directReclaims, 1);
+
+	me->inReclaim = 1;
+	size_t freed = reclaimRun(numPages);
+	komDrainLocalCache();
+	me->inReclaim = 0;
+
+	return freed;
+};
+
+void reclaimGetStats(ReclaimStats *stats)
+{
+	// the counters are independent, so it's fine to copy them one by one
+	stats->kswapdWakeups = reclaimStats.kswapdWakeups;
+	stats->directReclaims = reclaimStats.directReclaims;
+	stats->pagesReclaimed = reclaimStats.pagesReclaimed;
+	stats->pageCacheScanned = reclaimStats.pageCacheScanned;
+	stats->pageCacheEvicted = reclaimStats.pageCacheEvicted;
+	stats->pageCacheWritten = reclaimStats.pageCacheWritten;
+	stats->inodesDropped = reclaimStats.inodesDropped;
+	stats->dentriesDropped = reclaimStats.dentriesDropped;
+	stats->slabsReleased = reclaimStats.slabsReleased;
+	stats->anonScanned = reclaimStats.anonScanned;
+	stats->anonSwapped = reclaimStats.anonSwapped;
+};
+
+/**
+ * The reclaim thread. It sleeps until the number of free pages drops below the low watermark,
+ * and then reclaims until it reaches the high watermark (or there is nothing left to reclaim).
+ */
+static void reclaimThreadFunc(void *ignore)
+{
+	schedGetCurrentThread()->inReclaim = 1;
+
+	while (1)
+	{
+		while (komGetFreePages() < reclaimWmarkHigh)
+		{
+			size_t freed = reclaimRun(reclaimWmarkHigh - komGetFreePages());
+
+			// put the freed pages back into the pools, so that they count as free
+			komDrainLocalCache();
+
+			if (freed == 0) break;
+		};
+
+		reclaimThreadActive = 0;
+		schedSuspend();
+	};
+};
+
+static void reclaimInit()
+{
+	uint64_t totalPages = komGetTotalPages();
+	uint64_t low = totalPages / RECLAIM_WMARK_LOW_DIV;
+	uint64_t high = totalPages / RECLAIM_WMARK_HIGH_DIV;
+
+	if (low < RECLAIM_WMARK_MIN_PAGES) low = RECLAIM_WMARK_MIN_PAGES;
+	if (high < 2*low) high = 2*low;
+
+	kprintf("Starting the reclaim thread (low watermark %lu pages, high watermark %lu pages)...\n", low, high);
+
+	reclaimWmarkHigh = high;
+	reclaimThreadActive = 1;
+	reclaimThread = schedCreateKernelThread(reclaimThreadFunc, NULL, NULL);
+	if (reclaimThread == NULL)
+	{
+		panic("Failed to create the reclaim thread!");
+	};
+
+	schedDetachKernelThread(reclaimThread);
+
+	__sync_synchronize();
+	reclaimWmarkLow = low;
+};
+
+KERNEL_INIT_ACTION(reclaimInit, KIA_RECLAIM_INIT);
\ No newline at end of file
@@ -0,0 +1,413 @@
+/*
+	Glidix kernel
+
+	Copyright (c) 2021, Madd Games.
+	All rights reserved.
+	
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+	
+	* Redistributions of source code must retain the above copyright notice, this
+	  list of conditions and the following disclaimer.
+	
+	* Redistributions in binary form must reproduce the above copyright notice,
+	  this list of conditions and the following disclaimer in the documentation
+	  and/or other materials provided with the distribution.
+	
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+	DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+	FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+	DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+	SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+	CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+	OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+	OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <glidix/hw/vmalloc.h>
+#include <glidix/hw/kom.h>
+#include <glidix/hw/pagetab.h>
+#include <glidix/hw/cpu.h>
+#include <glidix/thread/spinlock.h>
+#include <glidix/util/memory.h>
+#include <glidix/util/log.h>
+#include <glidix/util/panic.h>
+
+/**
+ * The lock protecting all the lists below.
+ */
+static Spinlock vmLock;
+
+/**
+ * Free lists, one per size class.
+ */
+static VmRange *vmFreeLists[VM_NUM_CLASSES];
+
+/**
+ * Allocated ranges, hashed on the base address.
+ */
+static VmRange *vmUsed[VM_HASH_SIZE];
+
+/**
+ * Ranges freed since the last TLB flush.
+ */
+static VmRange *vmLazyList;
+
+/**
+ * Statistics.
+ */
+static VmStats vmStats;
+
+static int vmGetClass(size_t size)
+{
+	int class = 63 - __builtin_clzl(size >> 12);
+	if (class >= VM_NUM_CLASSES) class = VM_NUM_CLASSES-1;
+	return class;
+};
+
+static VmRange** vmGetBucket(const void *base)
+{
+	return &vmUsed[((uint64_t) base >> 12) & (VM_HASH_SIZE-1)];
+};
+
+static void vmLink(VmRange **head, VmRange *range)
+{
+	range->prevLink = NULL;
+	range->nextLink = *head;
+	if (range->nextLink != NULL) range->nextLink->prevLink = range;
+	*head = range;
+};
+
+static void vmUnlink(VmRange **head, VmRange *range)
+{
+	if (range->prevLink != NULL) range->prevLink->nextLink = range->nextLink;
+	if (range->nextLink != NULL) range->nextLink->prevLink = range->prevLink;
+	if (*head == range) *head = range->nextLink;
+};
+
+/**
+ * Find a free range of at least `size` bytes and remove it from its free list. Every range in a class
+ * above that of `size` is large enough, so only the first class needs to be searched. Call this with
+ * the lock held.
+ */
+static VmRange* vmFindFree(size_t size)
+{
+	int class = vmGetClass(size);
+
+	VmRange *range;
+	for (range=vmFreeLists[class]; range!=NULL; range=range->nextLink)
+	{
+		if (range->size >= size)
+		{
+			vmUnlink(&vmFreeLists[class], range);
+			return range;
+		};
+	};
+
+	for (class++; class<VM_NUM_CLASSES; class++)
+	{
+		range = vmFreeLists[class];
+		if (range != NULL)
+		{
+			vmUnlink(&vmFreeLists[class], range);
+			return range;
+		};
+	};
+
+	return NULL;
+};
+
+/**
+ * Return a range to the free lists, merging it with its free neighbours. The descriptors of merged
+ * neighbours are added to `dead`, to be freed once the lock is released. Call this with the lock held.
+ */
+static void vmMakeFree(VmRange *range, VmRange **dead)
+{
+	range->state = VM_RANGE_FREE;
+	vmStats.freeBytes += range->size;
+
+	VmRange *prev = range->prev;
+	if (prev != NULL && prev->state == VM_RANGE_FREE)
+	{
+		vmUnlink(&vmFreeLists[vmGetClass(prev->size)], prev);
+		prev->size += range->size;
+		prev->next = range->next;
+		if (prev->next != NULL) prev->next->prev = prev;
+
+		range->nextLink = *dead;
+		*dead = range;
+		range = prev;
+	};
+
+	VmRange *next = range->next;
+	if (next != NULL && next->state == VM_RANGE_FREE)
+	{
+		vmUnlink(&vmFreeLists[vmGetClass(next->size)], next);
+		range->size += next->size;
+		range->next = next->next;
+		if (range->next != NULL) range->next->prev = range;
+
+		next->nextLink = *dead;
+		*dead = next;
+	};
+
+	vmLink(&vmFreeLists[vmGetClass(range->size)], range);
+};
+
+static void vmFreeDead(VmRange *dead)
+{
+	while (dead != NULL)
+	{
+		VmRange *next = dead->nextLink;
+		kfree(dead);
+		dead = next;
+	};
+};
+
+/**
+ * Flush the TLBs of all CPUs, and make the ranges freed before the flush available again.
+ */
+static void vmPurge()
+{
+	IrqState irqState = spinlockAcquire(&vmLock);
+	VmRange *lazy = vmLazyList;
+	vmLazyList = NULL;
+	spinlockRelease(&vmLock, irqState);
+
+	if (lazy == NULL) return;
+
+	pagetabReload();
+	cpuInvalidateKernel();
+
+	VmRange *dead = NULL;
+	irqState = spinlockAcquire(&vmLock);
+	vmStats.flushes++;
+	while (lazy != NULL)
+	{
+		VmRange *range = lazy;
+		lazy = range->nextLink;
+
+		vmStats.lazyBytes -= range->size;
+		vmMakeFree(range, &dead);
+	};
+	spinlockRelease(&vmLock, irqState);
+
+	vmFreeDead(dead);
+};
+
+void vmInit(void *start)
+{
+	char *base = (char*) (((uint64_t) start + 0xFFF) & ~0xFFFUL);
+	if ((uint64_t) base >= VM_ARENA_END)
+	{
+		panic("No kernel address space left for the range allocator!");
+	};
+
+	VmRange *range = (VmRange*) kmalloc(sizeof(VmRange));
+	if (range == NULL)
+	{
+		panic("Failed to allocate the initial virtual range!");
+	};
+
+	range->prev = range->next = NULL;
+	range->base = base;
+	range->size = VM_ARENA_END - (uint64_t) base;
+	range->state = VM_RANGE_FREE;
+	vmLink(&vmFreeLists[vmGetClass(range->size)], range);
+
+	vmStats.freeBytes = range->size;
+
+	kprintf("Kernel virtual address space: 0x%p-0x%lx\n", base, VM_ARENA_END);
+};
+
+void* vmAllocRange(size_t size)
+{
+	size = (size + 0xFFF) & ~0xFFFUL;
+	if (size == 0) size = PAGE_SIZE;
+
+	// we may need a descriptor for the tail of the range we split
+	VmRange *spare = (VmRange*) kmalloc(sizeof(VmRange));
+	if (spare == NULL)
+	{
+		return NULL;
+	};
+
+	int purged = 0;
+	while (1)
+	{
+		IrqState irqState = spinlockAcquire(&vmLock);
+		VmRange *range = vmFindFree(size);
+		if (range != NULL)
+		{
+			vmStats.freeBytes -= range->size;
+			if (range->size > size)
+			{
+				spare->base = range->base + size;
+				spare->size = range->size - size;
+				spare->state = VM_RANGE_FREE;
+				spare->prev = range;
+				spare->next = range->next;
+				if (spare->next != NULL) spare->next->prev = spare;
+				range->next = spare;
+				range->size = size;
+
+				vmLink(&vmFreeLists[vmGetClass(spare->size)], spare);
+				vmStats.freeBytes += spare->size;
+				spare = NULL;
+			};
+
+			range->state = VM_RANGE_USED;
+			vmLink(vmGetBucket(range->base), range);
+			vmStats.usedBytes += range->size;
+			spinlockRelease(&vmLock, irqState);
+
+			if (spare != NULL) kfree(spare);
+			return range->base;
+		};
+
+		int haveLazy = vmLazyList != NULL;
+		spinlockRelease(&vmLock, irqState);
+
+		if (purged || !haveLazy)
+		{
+			kfree(spare);
+			return NULL;
+		};
+
+		// the ranges waiting for a flush might be enough
+		vmPurge();
+		purged = 1;
+	};
+};
+
+/**
+ * Return the PTE mapping `ptr`, or NULL if no page table covers it.
+ */
+static PageNodeEntry* vmGetPTE(const void *ptr)
+{
+	PageNodeEntry *nodes[4];
+	pagetabGetNodes(ptr, nodes);
+
+	int i;
+	for (i=0; i<3; i++)
+	{
+		if ((nodes[i]->value & PT_PRESENT) == 0)
+		{
+			return NULL;
+		};
+	};
+
+	return nodes[3];
+};
+
+/**
+ * Unmap and free an allocated range, optionally releasing the pages it was mapped to.
+ */
+static void vmRelease(void *ptr, int freePages)
+{
+	IrqState irqState = spinlockAcquire(&vmLock);
+	VmRange **bucket = vmGetBucket(ptr);
+	VmRange *range;
+	for (range=*bucket; range!=NULL; range=range->nextLink)
+	{
+		if (range->base == (char*) ptr)
+		{
+			break;
+		};
+	};
+
+	if (range == NULL)
+	{
+		spinlockRelease(&vmLock, irqState);
+		panic("Attempting to free an unallocated virtual range (0x%p)", ptr);
+	};
+
+	// the range stays in the 'used' state, off every list, until it is unmapped, so that it is
+	// neither freed twice nor flushed before its PTEs are cleared
+	vmUnlink(bucket, range);
+	spinlockRelease(&vmLock, irqState);
+
+	char *scan;
+	for (scan=range->base; scan<range->base+range->size; scan+=PAGE_SIZE)
+	{
+		PageNodeEntry *pte = vmGetPTE(scan);
+		if (pte == NULL || (pte->value & PT_PRESENT) == 0)
+		{
+			continue;
+		};
+
+		uint64_t phaddr = pte->value & PT_PHYS_MASK;
+		pte->value = 0;
+
+		// stale TLB entries may survive until the next flush, but nothing may legally use
+		// the range anymore, so the page can be reused right away
+		if (freePages)
+		{
+			komReleaseBlock(komPhysToVirt(phaddr), KOM_BUCKET_PAGE);
+			komCounterAdd(KOM_COUNTER_VMALLOC, -PAGE_SIZE);
+		};
+	};
+
+	irqState = spinlockAcquire(&vmLock);
+	range->state = VM_RANGE_LAZY;
+	range->nextLink = vmLazyList;
+	vmLazyList = range;
+	vmStats.usedBytes -= range->size;
+	vmStats.lazyBytes += range->size;
+	int needFlush = vmStats.lazyBytes >= VM_LAZY_MAX_PAGES * PAGE_SIZE;
+	spinlockRelease(&vmLock, irqState);
+
+	if (needFlush) vmPurge();
+};
+
+void vmFreeRange(void *ptr)
+{
+	vmRelease(ptr, 0);
+};
+
+void* vmalloc(size_t size)
+{
+	char *result = (char*) vmAllocRange(size);
+	if (result == NULL)
+	{
+		return NULL;
+	};
+
+	size = (size + 0xFFF) & ~0xFFFUL;
+
+	char *scan;
+	for (scan=result; scan<result+size; scan+=PAGE_SIZE)
+	{
+		void *page = komAllocBlock(KOM_BUCKET_PAGE, KOM_POOLBIT_ALL);
+		if (page == NULL)
+		{
+			vfree(result);
+			return NULL;
+		};
+
+		if (pagetabMapKernel(scan, komVirtToPhys(page), PAGE_SIZE, PT_WRITE | PT_NOEXEC) != 0)
+		{
+			komReleaseBlock(page, KOM_BUCKET_PAGE);
+			vfree(result);
+			return NULL;
+		};
+
+		komCounterAdd(KOM_COUNTER_VMALLOC, PAGE_SIZE);
+	};
+
+	return result;
+};
+
+void vfree(void *ptr)
+{
+	vmRelease(ptr, 1);
+};
+
+void vmGetStats(VmStats *stats)
+{
+	IrqState irqState = spinlockAcquire(&vmLock);
+	*stats = vmStats;
+	spinlockRelease(&vmLock, irqState);
+};
\ No newline at end of file
@@ -0,0 +1,244 @@
+/*
+	Glidix kernel
+
+	Copyright (c) 2021, Madd Games.
+	All rights reserved.
+	
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+	
+	* Redistributions of source code must retain the above copyright notice, this
+	  list of conditions and the following disclaimer.
+	
+	* Redistributions in binary form must reproduce the above copyright notice,
+	  this list of conditions and the following disclaimer in the documentation
+	  and/or other materials provided with the distribution.
+	
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+	DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+	FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+	DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+	SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+	CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+	OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+	OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <glidix/hw/zeropool.h>
+#include <glidix/hw/kom.h>
+#include <glidix/hw/reclaim.h>
+#include <glidix/hw/pagetab.h>
+#include <glidix/thread/sched.h>
+#include <glidix/thread/spinlock.h>
+#include <glidix/util/init.h>
+#include <glidix/util/log.h>
+#include <glidix/util/panic.h>
+#include <glidix/util/string.h>
+
+/**
+ * A page in the pool. The link is the only non-zero word in the page, and is cleared when the page
+ * is taken.
+ */
+typedef struct ZeroPage_ ZeroPage;
+struct ZeroPage_
+{
+	ZeroPage *next;
+};
+
+/**
+ * The lock, and the pool itself (a stack of zeroed pages).
+ */
+static Spinlock zpoolLock;
+static ZeroPage *zpoolHead;
+static volatile uint64_t zpoolCount;
+
+/**
+ * The number of pages the zeroing thread tries to keep in the pool; zero until the thread is started.
+ */
+static uint64_t zpoolTarget;
+
+/**
+ * The zeroing thread, and whether it is currently awake.
+ */
+static Thread* zpoolThread;
+static volatile int zpoolThreadActive;
+
+/**
+ * The statistics (updated atomically).
+ */
+static ZeroPoolStats zpoolStats;
+
+/**
+ * Wake up the zeroing thread if it is not running already.
+ */
+static void zpoolWakeup()
+{
+	if (zpoolThread == NULL)
+	{
+		return;
+	};
+
+	if (__sync_lock_test_and_set(&zpoolThreadActive, 1) == 0)
+	{
+		schedWake(zpoolThread);
+	};
+};
+
+/**
+ * Take a page from the pool, or return NULL if it is empty.
+ */
+static void* zpoolTake()
+{
+	IrqState irqState = spinlockAcquire(&zpoolLock);
+	ZeroPage *page = zpoolHead;
+	if (page != NULL)
+	{
+		zpoolHead = page->next;
+		zpoolCount--;
+	};
+	spinlockRelease(&zpoolLock, irqState);
+
+	if (page != NULL) page->next = NULL;
+	return page;
+};
+
+/**
+ * Add a zeroed page to the pool.
+ */
+static void zpoolPut(void *page)
+{
+	ZeroPage *zpage = (ZeroPage*) page;
+
+	IrqState irqState = spinlockAcquire(&zpoolLock);
+	zpage->next = zpoolHead;
+	zpoolHead = zpage;
+	zpoolCount++;
+	spinlockRelease(&zpoolLock, irqState);
+};
+
+void* zpoolAlloc()
+{
+	void *page = zpoolTake();
+	if (page != NULL)
+	{
+		__sync_fetch_and_add(&zpoolStats.hits, 1);
+		if (zpoolCount < zpoolTarget/2) zpoolWakeup();
+		return page;
+	};
+
+	__sync_fetch_and_add(&zpoolStats.misses, 1);
+	zpoolWakeup();
+
+	page = komAllocBlock(KOM_BUCKET_PAGE, KOM_POOLBIT_ALL);
+	if (page != NULL)
+	{
+		komGetPageDesc(page)->pool = komGetBlockPool(page);
+		memZeroPage(page);
+	};
+
+	return page;
+};
+
+void* zpoolAllocUserPage()
+{
+	void *page = zpoolAlloc();
+	if (page == NULL) return NULL;
+
+	KOM_PageDesc *desc = komGetPageDesc(page);
+	ASSERT(desc != NULL);
+
+	komInitUserPages(page, 0, desc->pool);
+	return page;
+};
+
+void zpoolGetStats(ZeroPoolStats *stats)
+{
+	stats->hits = zpoolStats.hits;
+	stats->misses = zpoolStats.misses;
+	stats->pagesZeroed = zpoolStats.pagesZeroed;
+	stats->pages = zpoolCount;
+};
+
+/**
+ * Shrinker: give pre-zeroed pages back to the allocator.
+ */
+static size_t zpoolShrink(size_t numPages)
+{
+	size_t freed = 0;
+	while (freed < numPages)
+	{
+		void *page = zpoolTake();
+		if (page == NULL) break;
+
+		komReleaseBlock(page, KOM_BUCKET_PAGE);
+		freed++;
+	};
+
+	return freed;
+};
+
+static Shrinker zpoolShrinker = {
+	.name = "zeropool",
+	.shrink = zpoolShrink,
+};
+
+static void zpoolThreadFunc(void *ignore)
+{
+	Thread *me = schedGetCurrentThread();
+
+	// only run when there is nothing else to do, and never enter direct reclaim for the sake of
+	// pages nobody asked for yet
+	me->priority = SCHED_PRIO_IDLE;
+	me->inReclaim = 1;
+
+	while (1)
+	{
+		int batch = 0;
+
+		// leave memory which is getting scarce to real allocations
+		while (zpoolCount < zpoolTarget && komGetFreePages() > 2 * reclaimWmarkLow)
+		{
+			void *page = komAllocBlock(KOM_BUCKET_PAGE, KOM_POOLBIT_ALL);
+			if (page == NULL) break;
+
+			// zeroing destroys the header, so remember the pool until the page is handed out
+			komGetPageDesc(page)->pool = komGetBlockPool(page);
+			memZeroPageNT(page);
+			zpoolPut(page);
+			__sync_fetch_and_add(&zpoolStats.pagesZeroed, 1);
+
+			if (++batch == ZEROPOOL_BATCH)
+			{
+				batch = 0;
+				schedPreempt();
+			};
+		};
+
+		zpoolThreadActive = 0;
+		schedSuspend();
+	};
+};
+
+static void zpoolInit()
+{
+	uint64_t target = komGetTotalPages() / ZEROPOOL_TARGET_DIV;
+	if (target > ZEROPOOL_MAX_PAGES) target = ZEROPOOL_MAX_PAGES;
+
+	kprintf("Starting the page zeroing thread (pool of %lu pages)...\n", target);
+
+	reclaimRegisterShrinker(&zpoolShrinker);
+
+	zpoolTarget = target;
+	zpoolThreadActive = 1;
+	zpoolThread = schedCreateKernelThread(zpoolThreadFunc, NULL, NULL);
+	if (zpoolThread == NULL)
+	{
+		panic("Failed to create the page zeroing thread!");
+	};
+
+	schedDetachKernelThread(zpoolThread);
+};
+
+KERNEL_INIT_ACTION(zpoolInit, KIA_ZEROPOOL_INIT, KIA_RECLAIM_INIT);
\ No newline at end of file
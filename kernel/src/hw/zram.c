@@ -0,0 +1,552 @@
+/*
+	Glidix kernel
+
+	Copyright (c) 2021, Madd Games.
+	All rights reserved.
+	
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+	
+	* Redistributions of source code must retain the above copyright notice, this
+	  list of conditions and the following disclaimer.
+	
+	* Redistributions in binary form must reproduce the above copyright notice,
+	  this list of conditions and the following disclaimer in the documentation
+	  and/or other materials provided with the distribution.
+	
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+	DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+	FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+	DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+	SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+	CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+	OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+	OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include <glidix/hw/zram.h>
+#include <glidix/hw/kom.h>
+#include <glidix/hw/reclaim.h>
+#include <glidix/hw/pagetab.h>
+#include <glidix/hw/vmalloc.h>
+#include <glidix/hw/meminfo.h>
+#include <glidix/fs/vfs.h>
+#include <glidix/thread/mutex.h>
+#include <glidix/thread/process.h>
+#include <glidix/util/lz.h>
+#include <glidix/util/kmem.h>
+#include <glidix/util/memory.h>
+#include <glidix/util/init.h>
+#include <glidix/util/log.h>
+#include <glidix/util/panic.h>
+#include <glidix/util/string.h>
+
+/**
+ * Marks the end of a free list (of objects within a zspage, or of slots).
+ */
+#define	ZRAM_NO_OBJECT					0xFFFF
+#define	ZRAM_NO_SLOT					(~0UL)
+
+/**
+ * A zspage: a block of pages holding the objects of a single class. Free objects are linked through
+ * their first 2 bytes, which hold the index of the next free object.
+ */
+typedef struct ZramZspage_ ZramZspage;
+struct ZramZspage_
+{
+	/**
+	 * Links in the partial list of the class; a zspage is on it if it has free objects.
+	 */
+	ZramZspage *prev;
+	ZramZspage *next;
+
+	/**
+	 * The pages.
+	 */
+	uint8_t *base;
+
+	/**
+	 * Number of objects in use, and the index of the first free object.
+	 */
+	uint16_t inuse;
+	uint16_t freeHead;
+};
+
+/**
+ * A size class.
+ */
+typedef struct
+{
+	/**
+	 * Size of each object, and the order (log2 of the number of pages) of the zspages.
+	 */
+	uint16_t size;
+	uint16_t order;
+
+	/**
+	 * Number of objects in each zspage.
+	 */
+	uint16_t objsPerZspage;
+
+	/**
+	 * List of zspages with free objects.
+	 */
+	ZramZspage *partial;
+} ZramClass;
+
+/**
+ * A slot, holding a swapped out page. A slot with a zero reference count is free, and `nextFree`
+ * links it into the free list.
+ */
+typedef struct
+{
+	union
+	{
+		ZramZspage *zspage;			// NULL for a zero-filled page
+		uint64_t nextFree;
+	};
+
+	uint16_t index;					// object index in the zspage
+	uint16_t size;					// compressed size
+	uint32_t refcount;
+} ZramSlot;
+
+/**
+ * The lock protecting everything below. Lock order: a process `mapLock` first, then this.
+ */
+static Mutex zramLock;
+
+/**
+ * The size classes, and the cache for zspage descriptors.
+ */
+static ZramClass zramClasses[ZRAM_NUM_CLASSES];
+static KmemCache *zramZspageCache;
+
+/**
+ * The slot table: a directory of chunks, allocated as needed, and the free list.
+ */
+static ZramSlot** zramSlotDir;
+static uint64_t zramMaxChunks;
+static uint64_t zramNumChunks;
+static uint64_t zramFreeSlot = ZRAM_NO_SLOT;
+
+/**
+ * The statistics.
+ */
+static ZramStats zramStats;
+
+static ZramSlot* zramGetSlot(uint64_t slot)
+{
+	ASSERT(slot / ZRAM_SLOTS_PER_CHUNK < zramNumChunks);
+	return &zramSlotDir[slot / ZRAM_SLOTS_PER_CHUNK][slot % ZRAM_SLOTS_PER_CHUNK];
+};
+
+/**
+ * Allocate a slot (with the lock held). Returns `ZRAM_NO_SLOT` if the table is full or we are out of memory.
+ */
+static uint64_t zramAllocSlot()
+{
+	if (zramFreeSlot == ZRAM_NO_SLOT)
+	{
+		if (zramNumChunks == zramMaxChunks)
+		{
+			return ZRAM_NO_SLOT;
+		};
+
+		ZramSlot *chunk = (ZramSlot*) kmalloc(sizeof(ZramSlot) * ZRAM_SLOTS_PER_CHUNK);
+		if (chunk == NULL)
+		{
+			return ZRAM_NO_SLOT;
+		};
+
+		uint64_t first = zramNumChunks * ZRAM_SLOTS_PER_CHUNK;
+		zramSlotDir[zramNumChunks++] = chunk;
+
+		int i;
+		for (i=ZRAM_SLOTS_PER_CHUNK-1; i>=0; i--)
+		{
+			chunk[i].nextFree = zramFreeSlot;
+			chunk[i].refcount = 0;
+			zramFreeSlot = first + i;
+		};
+	};
+
+	uint64_t slot = zramFreeSlot;
+	zramFreeSlot = zramGetSlot(slot)->nextFree;
+	return slot;
+};
+
+static uint16_t* zramObjectLink(ZramClass *cls, ZramZspage *zspage, uint16_t index)
+{
+	return (uint16_t*) (zspage->base + (size_t) index * cls->size);
+};
+
+static void zramUnlinkPartial(ZramClass *cls, ZramZspage *zspage)
+{
+	if (zspage->prev != NULL) zspage->prev->next = zspage->next;
+	else cls->partial = zspage->next;
+	if (zspage->next != NULL) zspage->next->prev = zspage->prev;
+	zspage->prev = zspage->next = NULL;
+};
+
+static void zramLinkPartial(ZramClass *cls, ZramZspage *zspage)
+{
+	zspage->prev = NULL;
+	zspage->next = cls->partial;
+	if (cls->partial != NULL) cls->partial->prev = zspage;
+	cls->partial = zspage;
+};
+
+/**
+ * Allocate an object from the specified class (with the lock held). Returns the zspage, and the object
+ * index in `indexOut`, or NULL if the pool is full or we are out of memory.
+ */
+static ZramZspage* zramAllocObject(ZramClass *cls, uint16_t *indexOut)
+{
+	ZramZspage *zspage = cls->partial;
+	if (zspage == NULL)
+	{
+		if (zramStats.poolPages + (1UL << cls->order) > zramStats.maxPoolPages)
+		{
+			return NULL;
+		};
+
+		zspage = (ZramZspage*) kmemCacheAlloc(zramZspageCache);
+		if (zspage == NULL)
+		{
+			return NULL;
+		};
+
+		zspage->base = (uint8_t*) komAllocBlock(KOM_BUCKET_PAGE + cls->order, KOM_POOLBIT_ALL);
+		if (zspage->base == NULL)
+		{
+			kmemCacheFree(zramZspageCache, zspage);
+			return NULL;
+		};
+
+		uint16_t i;
+		for (i=0; i<cls->objsPerZspage; i++)
+		{
+			*zramObjectLink(cls, zspage, i) = (i == cls->objsPerZspage-1) ? ZRAM_NO_OBJECT : i+1;
+		};
+
+		zspage->inuse = 0;
+		zspage->freeHead = 0;
+		zramLinkPartial(cls, zspage);
+
+		zramStats.poolPages += 1UL << cls->order;
+		komCounterAdd(KOM_COUNTER_ZRAM, PAGE_SIZE << cls->order);
+	};
+
+	uint16_t index = zspage->freeHead;
+	zspage->freeHead = *zramObjectLink(cls, zspage, index);
+	if (++zspage->inuse == cls->objsPerZspage)
+	{
+		zramUnlinkPartial(cls, zspage);
+	};
+
+	*indexOut = index;
+	return zspage;
+};
+
+/**
+ * Free an object (with the lock held), releasing its zspage if it becomes empty.
+ */
+static void zramFreeObject(ZramClass *cls, ZramZspage *zspage, uint16_t index)
+{
+	if (zspage->inuse-- == cls->objsPerZspage)
+	{
+		zramLinkPartial(cls, zspage);
+	};
+
+	if (zspage->inuse == 0)
+	{
+		zramUnlinkPartial(cls, zspage);
+		komReleaseBlock(zspage->base, KOM_BUCKET_PAGE + cls->order);
+		kmemCacheFree(zramZspageCache, zspage);
+
+		zramStats.poolPages -= 1UL << cls->order;
+		komCounterAdd(KOM_COUNTER_ZRAM, -(int64_t) (PAGE_SIZE << cls->order));
+		return;
+	};
+
+	*zramObjectLink(cls, zspage, index) = zspage->freeHead;
+	zspage->freeHead = index;
+};
+
+static int zramIsZeroPage(const void *page)
+{
+	const uint64_t *scan = (const uint64_t*) page;
+	size_t i;
+	for (i=0; i<PAGE_SIZE/8; i++)
+	{
+		if (scan[i] != 0) return 0;
+	};
+
+	return 1;
+};
+
+errno_t zramStore(const void *page, uint64_t *slotOut)
+{
+	// compress outside of the lock
+	uint8_t buffer[ZRAM_MAX_OBJECT];
+	size_t size = 0;
+	int isZero = zramIsZeroPage(page);
+
+	if (!isZero)
+	{
+		size = lzCompress(page, PAGE_SIZE, buffer, ZRAM_MAX_OBJECT);
+		if (size == 0)
+		{
+			__sync_fetch_and_add(&zramStats.incompressible, 1);
+			return EINVAL;
+		};
+	};
+
+	mutexLock(&zramLock);
+
+	uint64_t slot = zramAllocSlot();
+	if (slot == ZRAM_NO_SLOT)
+	{
+		zramStats.rejected++;
+		mutexUnlock(&zramLock);
+		return ENOSPC;
+	};
+
+	ZramSlot *desc = zramGetSlot(slot);
+	desc->zspage = NULL;
+	desc->index = 0;
+	desc->size = size;
+	desc->refcount = 1;
+
+	if (isZero)
+	{
+		zramStats.zeroPages++;
+	}
+	else
+	{
+		ZramClass *cls = &zramClasses[(size - 1) / ZRAM_CLASS_SIZE];
+		desc->zspage = zramAllocObject(cls, &desc->index);
+		if (desc->zspage == NULL)
+		{
+			desc->refcount = 0;
+			desc->nextFree = zramFreeSlot;
+			zramFreeSlot = slot;
+
+			zramStats.rejected++;
+			mutexUnlock(&zramLock);
+			return ENOSPC;
+		};
+
+		memcpy(desc->zspage->base + (size_t) desc->index * cls->size, buffer, size);
+		zramStats.compressedBytes += size;
+	};
+
+	zramStats.storedPages++;
+	zramStats.pagesOut++;
+	mutexUnlock(&zramLock);
+
+	*slotOut = slot;
+	return 0;
+};
+
+errno_t zramLoad(uint64_t slot, void *page)
+{
+	errno_t status = 0;
+
+	mutexLock(&zramLock);
+	ZramSlot *desc = zramGetSlot(slot);
+	ASSERT(desc->refcount != 0);
+
+	if (desc->zspage == NULL)
+	{
+		memset(page, 0, PAGE_SIZE);
+	}
+	else
+	{
+		ZramClass *cls = &zramClasses[(desc->size - 1) / ZRAM_CLASS_SIZE];
+		const void *data = desc->zspage->base + (size_t) desc->index * cls->size;
+		if (lzDecompress(data, desc->size, page, PAGE_SIZE) != PAGE_SIZE)
+		{
+			status = EIO;
+		};
+	};
+
+	zramStats.faults++;
+	mutexUnlock(&zramLock);
+
+	return status;
+};
+
+void zramDup(uint64_t slot)
+{
+	mutexLock(&zramLock);
+	ZramSlot *desc = zramGetSlot(slot);
+	ASSERT(desc->refcount != 0);
+	desc->refcount++;
+	mutexUnlock(&zramLock);
+};
+
+void zramFree(uint64_t slot)
+{
+	mutexLock(&zramLock);
+	ZramSlot *desc = zramGetSlot(slot);
+	ASSERT(desc->refcount != 0);
+
+	if (--desc->refcount == 0)
+	{
+		if (desc->zspage == NULL)
+		{
+			zramStats.zeroPages--;
+		}
+		else
+		{
+			ZramClass *cls = &zramClasses[(desc->size - 1) / ZRAM_CLASS_SIZE];
+			zramFreeObject(cls, desc->zspage, desc->index);
+			zramStats.compressedBytes -= desc->size;
+		};
+
+		zramStats.storedPages--;
+		desc->nextFree = zramFreeSlot;
+		zramFreeSlot = slot;
+	};
+
+	mutexUnlock(&zramLock);
+};
+
+void zramGetStats(ZramStats *stats)
+{
+	mutexLock(&zramLock);
+	memcpy(stats, &zramStats, sizeof(ZramStats));
+	mutexUnlock(&zramLock);
+};
+
+/**
+ * The shrinker: swap out anonymous pages of processes. The pool may grow while storing them, so the
+ * number of pages freed is what is left after that.
+ */
+static size_t zramShrink(size_t numPages)
+{
+	uint64_t poolBefore = zramStats.poolPages;
+	size_t swapped = procSwapOut(numPages);
+	uint64_t poolAfter = zramStats.poolPages;
+
+	if (poolAfter > poolBefore)
+	{
+		uint64_t grown = poolAfter - poolBefore;
+		return swapped > grown ? swapped - grown : 0;
+	};
+
+	return swapped;
+};
+
+static Shrinker zramShrinker = {
+	.name = "zram",
+	.shrink = zramShrink,
+	.expensive = 1,
+};
+
+static void zramGenStats(MemInfoText *text)
+{
+	ZramStats stats;
+	zramGetStats(&stats);
+
+	uint64_t origBytes = (stats.storedPages - stats.zeroPages) * PAGE_SIZE;
+	uint64_t ratio = stats.compressedBytes == 0 ? 0 : origBytes * 100 / stats.compressedBytes;
+
+	meminfoPrintf(text, "StoredPages:    %10lu\n", stats.storedPages);
+	meminfoPrintf(text, "ZeroPages:      %10lu\n", stats.zeroPages);
+	meminfoPrintf(text, "OrigData:       %10lu kB\n", origBytes >> 10);
+	meminfoPrintf(text, "ComprData:      %10lu kB\n", stats.compressedBytes >> 10);
+	meminfoPrintf(text, "PoolUsed:       %10lu kB\n", stats.poolPages * 4);
+	meminfoPrintf(text, "PoolLimit:      %10lu kB\n", stats.maxPoolPages * 4);
+	meminfoPrintf(text, "Ratio:          %7lu.%02lu\n", ratio / 100, ratio % 100);
+	meminfoPrintf(text, "PagesOut:       %10lu\n", stats.pagesOut);
+	meminfoPrintf(text, "Faults:         %10lu\n", stats.faults);
+	meminfoPrintf(text, "Incompressible: %10lu\n", stats.incompressible);
+	meminfoPrintf(text, "Rejected:       %10lu\n", stats.rejected);
+};
+
+static ssize_t zramStatsRead(Inode *inode, void *buffer, size_t size, off_t pos)
+{
+	return meminfoRead(zramGenStats, buffer, size, pos);
+};
+
+static ssize_t zramStatsWrite(Inode *inode, const void *buffer, size_t size, off_t pos)
+{
+	return -EINVAL;
+};
+
+static InodeOps zramStatsOps = {
+	.pread = zramStatsRead,
+	.pwrite = zramStatsWrite,
+	.inodeFlags = VFS_INODE_SEEKABLE,
+};
+
+/**
+ * Choose the zspage order for objects of the specified size, which wastes the least space.
+ */
+static uint16_t __init zramChooseOrder(size_t size)
+{
+	uint16_t best = 0;
+	size_t bestWaste = PAGE_SIZE;
+
+	uint16_t order;
+	for (order=0; order<=ZRAM_MAX_ZSPAGE_ORDER; order++)
+	{
+		size_t zspageSize = PAGE_SIZE << order;
+		size_t waste = (zspageSize % size) >> order;
+		if (waste < bestWaste)
+		{
+			best = order;
+			bestWaste = waste;
+		};
+	};
+
+	return best;
+};
+
+static void __init zramInit()
+{
+	mutexInit(&zramLock);
+
+	int i;
+	for (i=0; i<ZRAM_NUM_CLASSES; i++)
+	{
+		ZramClass *cls = &zramClasses[i];
+		cls->size = (i + 1) * ZRAM_CLASS_SIZE;
+		cls->order = zramChooseOrder(cls->size);
+		cls->objsPerZspage = (PAGE_SIZE << cls->order) / cls->size;
+		cls->partial = NULL;
+	};
+
+	zramZspageCache = kmemCacheCreate("zspage", sizeof(ZramZspage), NULL);
+	if (zramZspageCache == NULL)
+	{
+		panic("Failed to create the zspage cache!");
+	};
+
+	uint64_t totalPages = komGetTotalPages();
+	zramMaxChunks = (totalPages * ZRAM_SLOTS_MUL + ZRAM_SLOTS_PER_CHUNK - 1) / ZRAM_SLOTS_PER_CHUNK;
+	zramSlotDir = (ZramSlot**) vmalloc(sizeof(ZramSlot*) * zramMaxChunks);
+	if (zramSlotDir == NULL)
+	{
+		panic("Failed to allocate the zram slot directory!");
+	};
+
+	zramStats.maxPoolPages = totalPages / ZRAM_POOL_DIV;
+	kprintf("Compressed swap: pool limit %lu kB, up to %lu slots\n",
+		zramStats.maxPoolPages * 4, zramMaxChunks * ZRAM_SLOTS_PER_CHUNK);
+
+	if (vfsCreateCharDev(NULL, ZRAM_STATS_PATH, 0444, &zramStatsOps) != 0)
+	{
+		panic("Failed to create %s!", ZRAM_STATS_PATH);
+	};
+
+	reclaimRegisterShrinker(&zramShrinker);
+};
+
+KERNEL_INIT_ACTION(zramInit, KIA_ZRAM_INIT, KIA_MEMINFO, KIA_RECLAIM_INIT);
\ No newline at end of file
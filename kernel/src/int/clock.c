@@ -0,0 +1,123 @@
+/*
+	Glidix kernel
+
+	Copyright (c) 2021, Madd Games.
+	All rights reserved.
+	
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+	
+	* Redistributions of source code must retain the above copyright notice, this
+	  list of conditions and the following disclaimer.
+	
+	* Redistributions in binary form must reproduce the above copyright notice,
+	  this list of conditions and the following disclaimer in the documentation
+	  and/or other materials provided with the distribution.
+	
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+	DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+	FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+	DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+	SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+	CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+	OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+	OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include <glidix/int/clock.h>
+#include <glidix/thread/sched.h>
+#include <glidix/util/time.h>
+#include <glidix/util/string.h>
+#include <glidix/util/errno.h>
+
+/**
+ * Convert nanoseconds to a `ktimeval_t`.
+ */
+static void clockToTimeval(ktimeval_t *tv, uint64_t nanos)
+{
+	tv->tv_sec = nanos / NANOS_PER_SEC;
+	tv->tv_usec = (nanos % NANOS_PER_SEC) / 1000;
+};
+
+int sys_getrusage(int who, user_addr_t uusage)
+{
+	if (who != RUSAGE_SELF && who != RUSAGE_CHILDREN)
+	{
+		return -EINVAL;
+	};
+
+	ProcCPUTimes times;
+	procGetCPUTimes(&times);
+
+	krusage_t usage;
+	memset(&usage, 0, sizeof(krusage_t));
+
+	if (who == RUSAGE_SELF)
+	{
+		clockToTimeval(&usage.ru_utime, times.utime);
+		clockToTimeval(&usage.ru_stime, times.stime);
+	}
+	else
+	{
+		clockToTimeval(&usage.ru_utime, times.cutime);
+		clockToTimeval(&usage.ru_stime, times.cstime);
+	};
+
+	return procToUserCopy(uusage, &usage, sizeof(krusage_t));
+};
+
+int64_t sys_times(user_addr_t ubuf)
+{
+	ProcCPUTimes times;
+	procGetCPUTimes(&times);
+
+	ktms_t tms;
+	tms.tms_utime = times.utime / (NANOS_PER_SEC / CLOCK_TICKS_PER_SEC);
+	tms.tms_stime = times.stime / (NANOS_PER_SEC / CLOCK_TICKS_PER_SEC);
+	tms.tms_cutime = times.cutime / (NANOS_PER_SEC / CLOCK_TICKS_PER_SEC);
+	tms.tms_cstime = times.cstime / (NANOS_PER_SEC / CLOCK_TICKS_PER_SEC);
+
+	int status = procToUserCopy(ubuf, &tms, sizeof(ktms_t));
+	if (status != 0)
+	{
+		return status;
+	};
+
+	return timeGetUptime() / (NANOS_PER_SEC / CLOCK_TICKS_PER_SEC);
+};
+
+int sys_clock_gettime(int clockid, user_addr_t uts)
+{
+	uint64_t nanos;
+	ProcCPUTimes times;
+	Thread *me = schedGetCurrentThread();
+
+	switch (clockid)
+	{
+	case CLOCK_REALTIME:
+		nanos = timeGetRealtime();
+		break;
+	case CLOCK_MONOTONIC:
+		nanos = timeGetUptime();
+		break;
+	case CLOCK_PROCESS_CPUTIME_ID:
+		procGetCPUTimes(&times);
+		nanos = times.utime + times.stime;
+		break;
+	case CLOCK_THREAD_CPUTIME_ID:
+		schedAccountSystem();
+		nanos = schedTicksToNanos(me->utime + me->stime);
+		break;
+	default:
+		return -EINVAL;
+	};
+
+	ktimespec_t ts;
+	ts.tv_sec = nanos / NANOS_PER_SEC;
+	ts.tv_nsec = nanos % NANOS_PER_SEC;
+
+	return procToUserCopy(uts, &ts, sizeof(ktimespec_t));
+};
\ No newline at end of file
@@ -28,6 +28,7 @@
 
 #include <glidix/int/elf64.h>
 #include <glidix/util/string.h>
+#include <glidix/util/memory.h>
 #include <glidix/util/log.h>
 #include <glidix/util/panic.h>
 #include <glidix/hw/fpu.h>
@@ -255,6 +256,11 @@ static int elfExecStatic(File *fp, ElfInfo *info, const char **argv, const char
 
 	// TODO: push all the args and stuff
 
+	// the caller's copy of the arguments is no longer needed
+	Thread *me = schedGetCurrentThread();
+	kfree(me->execArgs);
+	me->execArgs = NULL;
+
 	// set up FPU regs
 	FPURegs fpuRegs;
 	memset(&fpuRegs, 0, sizeof(FPURegs));
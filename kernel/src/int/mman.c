@@ -54,4 +54,9 @@ user_addr_t sys_mmap(user_addr_t addr, size_t length, int prot, int flags, int f
 	};
 
 	return result;
+};
+
+int sys_madvise(user_addr_t addr, size_t length, int advice)
+{
+	return procAdvise(addr, length, advice);
 };
\ No newline at end of file
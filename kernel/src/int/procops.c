@@ -58,10 +58,12 @@ pid_t sys_fork()
 		return -ENOMEM;
 	};
 
+	// the child starts with our FPU state
+	sysSaveFPU();
 	memcpy(context, schedGetCurrentThread()->syscallContext, sizeof(SyscallContext));
 
 	// try to create the process, only release context if that doesn't work
-	pid_t pid = procCreate(forkEntry, context);
+	pid_t pid = procCreate(forkEntry, context, 0);
 	if (pid < 0)
 	{
 		kfree(context);
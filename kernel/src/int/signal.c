@@ -80,5 +80,9 @@ ksigset_t sys_sigmask(int how, ksigset_t mask)
 		break;
 	};
 
+	// some pending signals may have been unblocked; they are dispatched when
+	// we return
+	schedPostWork(me, THREAD_WORK_SIGNAL);
+
 	return oldMask;
 };
\ No newline at end of file
@@ -0,0 +1,411 @@
+/*
+	Glidix kernel
+
+	Copyright (c) 2021, Madd Games.
+	All rights reserved.
+	
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+	
+	* Redistributions of source code must retain the above copyright notice, this
+	  list of conditions and the following disclaimer.
+	
+	* Redistributions in binary form must reproduce the above copyright notice,
+	  this list of conditions and the following disclaimer in the documentation
+	  and/or other materials provided with the distribution.
+	
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+	DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+	FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+	DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+	SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+	CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+	OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+	OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <glidix/int/spawn.h>
+#include <glidix/int/exec.h>
+#include <glidix/fs/vfs.h>
+#include <glidix/util/memory.h>
+#include <glidix/util/string.h>
+
+/**
+ * A file action, as passed to the child.
+ */
+typedef struct
+{
+	int action;
+	int fd;
+	int newfd;
+	int oflags;
+	mode_t mode;
+
+	/**
+	 * Offset of the path (for `SPAWN_FA_OPEN`) into the strings of the `SpawnInfo`.
+	 */
+	size_t pathOffset;
+} SpawnAction;
+
+/**
+ * Everything the child needs, copied from the caller's memory before the child is created. This is a single
+ * heap block, sized to what the caller actually passed: the header is followed by `numActions` actions, and
+ * then by the strings (see `spawnArgs()`).
+ */
+typedef struct
+{
+	/**
+	 * The attributes.
+	 */
+	kspawn_attr_t attr;
+
+	/**
+	 * Number of file actions, arguments and environment variables.
+	 */
+	int numActions;
+	int argc;
+	int envc;
+
+	/**
+	 * Number of bytes of strings used and allocated respectively.
+	 */
+	size_t argsSize;
+	size_t argsCap;
+
+	/**
+	 * The file actions.
+	 */
+	SpawnAction actions[];
+} SpawnInfo;
+
+/**
+ * Initial number of bytes allocated for the strings; this is doubled as needed, up to `SPAWN_ARGS_MAX`.
+ */
+#define	SPAWN_ARGS_INITIAL						512
+
+/**
+ * Get the strings of `info`, each NUL-terminated: first the path, then the arguments, then the environment
+ * variables, then the file action paths.
+ */
+static char* spawnArgs(SpawnInfo *info)
+{
+	return (char*) &info->actions[info->numActions];
+};
+
+/**
+ * Add a string to the end of the strings of `*infoptr`, growing the block if necessary. Returns its offset on
+ * success, or a negated error number on error.
+ */
+static ssize_t spawnPack(SpawnInfo **infoptr, const char *str)
+{
+	SpawnInfo *info = *infoptr;
+	size_t size = strlen(str) + 1;
+	if (size > SPAWN_ARGS_MAX - info->argsSize)
+	{
+		return -E2BIG;
+	};
+
+	if (info->argsSize + size > info->argsCap)
+	{
+		size_t newCap = info->argsCap * 2;
+		if (newCap < info->argsSize + size) newCap = info->argsSize + size;
+		if (newCap > SPAWN_ARGS_MAX) newCap = SPAWN_ARGS_MAX;
+
+		info = (SpawnInfo*) krealloc(info, sizeof(SpawnInfo) + info->numActions * sizeof(SpawnAction) + newCap);
+		if (info == NULL)
+		{
+			return -ENOMEM;
+		};
+
+		info->argsCap = newCap;
+		*infoptr = info;
+	};
+
+	size_t offset = info->argsSize;
+	memcpy(spawnArgs(info) + offset, str, size);
+	info->argsSize += size;
+	return offset;
+};
+
+/**
+ * Copy the strings of the NULL-terminated user array `uarray` into the strings of `*infoptr`. Returns the number
+ * of strings on success, or a negated error number on error.
+ */
+static int spawnPackArray(SpawnInfo **infoptr, user_addr_t uarray, char *buffer, int maxStrings)
+{
+	int count = 0;
+	if (uarray == 0)
+	{
+		return 0;
+	};
+
+	while (1)
+	{
+		user_addr_t ustr;
+		int status = procToKernelCopy(&ustr, uarray + count * sizeof(user_addr_t), sizeof(user_addr_t));
+		if (status != 0)
+		{
+			return status;
+		};
+
+		if (ustr == 0)
+		{
+			return count;
+		};
+
+		if (count == maxStrings)
+		{
+			return -E2BIG;
+		};
+
+		status = procReadUserString(buffer, ustr);
+		if (status != 0)
+		{
+			return status;
+		};
+
+		ssize_t offset = spawnPack(infoptr, buffer);
+		if (offset < 0)
+		{
+			return offset;
+		};
+
+		count++;
+	};
+};
+
+/**
+ * Apply the attributes and perform the file actions in the child. Returns 0 on success, or -1 on error.
+ */
+static int spawnSetup(SpawnInfo *info)
+{
+	if ((info->attr.flags & SPAWN_SETSID) && procSetSessionID() != 0)
+	{
+		return -1;
+	};
+
+	if ((info->attr.flags & SPAWN_SETPGROUP) && procSetProcessGroup(0, info->attr.pgroup) != 0)
+	{
+		return -1;
+	};
+
+	int i;
+	for (i=0; i<info->numActions; i++)
+	{
+		SpawnAction *act = &info->actions[i];
+
+		if (act->action == SPAWN_FA_CLOSE)
+		{
+			// closing a descriptor which is not open is not an error
+			procFileClose(act->fd);
+		}
+		else if (act->action == SPAWN_FA_DUP2)
+		{
+			File *fp = procFileGet(act->fd);
+			if (fp == NULL)
+			{
+				return -1;
+			};
+
+			// also clears close-on-exec if both descriptors are the same
+			int status = procFileDupInto(act->newfd, fp, 0);
+			vfsClose(fp);
+
+			if (status < 0)
+			{
+				return -1;
+			};
+		}
+		else
+		{
+			File *fp = vfsOpen(NULL, spawnArgs(info) + act->pathOffset, act->oflags, act->mode, NULL);
+			if (fp == NULL)
+			{
+				return -1;
+			};
+
+			int status = procFileDupInto(act->fd, fp, !!(act->oflags & O_CLOEXEC));
+			vfsClose(fp);
+
+			if (status < 0)
+			{
+				return -1;
+			};
+		};
+	};
+
+	return 0;
+};
+
+static void spawnEntry(void *context_)
+{
+	SpawnInfo *info = (SpawnInfo*) context_;
+
+	if (spawnSetup(info) != 0)
+	{
+		kfree(info);
+		procExit(PROC_WS_EXIT(127));
+	};
+
+	// the argument and environment arrays go at the end of the same block (aligned)
+	int argc = info->argc;
+	int envc = info->envc;
+	size_t stringsOffset = (sizeof(SpawnInfo) + info->numActions * sizeof(SpawnAction) + info->argsSize + 7) & ~7UL;
+
+	SpawnInfo *grown = (SpawnInfo*) krealloc(info, stringsOffset + (argc + envc + 2) * sizeof(const char*));
+	if (grown == NULL)
+	{
+		kfree(info);
+		procExit(PROC_WS_EXIT(127));
+	};
+
+	info = grown;
+	const char **strings = (const char**) ((char*) info + stringsOffset);
+	const char *path = spawnArgs(info);
+
+	const char *scan = path + strlen(path) + 1;
+	int i;
+	for (i=0; i<argc+envc; i++)
+	{
+		// the arguments are followed by a NULL, and so are the environment variables
+		strings[i < argc ? i : i+1] = scan;
+		scan += strlen(scan) + 1;
+	};
+
+	strings[argc] = NULL;
+	strings[argc+envc+1] = NULL;
+
+	// exec does not return on success, so the thread owns the block until the new program no longer
+	// needs the arguments
+	Thread *me = schedGetCurrentThread();
+	me->execArgs = info;
+	kexec(path, strings, &strings[argc+1]);
+
+	me->execArgs = NULL;
+	kfree(info);
+	procExit(PROC_WS_EXIT(127));
+};
+
+pid_t sys_spawn(user_addr_t upath, user_addr_t uargv, user_addr_t uenvp, user_addr_t uactions, int numActions,
+			user_addr_t uattr)
+{
+	if (numActions < 0 || numActions > SPAWN_ACTIONS_MAX)
+	{
+		return -EINVAL;
+	};
+
+	SpawnInfo *info = (SpawnInfo*) kmalloc(sizeof(SpawnInfo) + numActions * sizeof(SpawnAction)
+		+ SPAWN_ARGS_INITIAL);
+	if (info == NULL)
+	{
+		return -ENOMEM;
+	};
+
+	memset(&info->attr, 0, sizeof(kspawn_attr_t));
+	info->numActions = numActions;
+	info->argsSize = 0;
+	info->argsCap = SPAWN_ARGS_INITIAL;
+
+	char *buffer = (char*) kmalloc(PROC_USER_STRING_SIZE);
+	if (buffer == NULL)
+	{
+		kfree(info);
+		return -ENOMEM;
+	};
+
+	int status = procReadUserString(buffer, upath);
+	if (status == 0)
+	{
+		ssize_t offset = spawnPack(&info, buffer);
+		if (offset < 0) status = offset;
+	};
+
+	if (status == 0)
+	{
+		status = spawnPackArray(&info, uargv, buffer, SPAWN_STRINGS_MAX);
+		info->argc = status;
+	};
+
+	if (status >= 0)
+	{
+		status = spawnPackArray(&info, uenvp, buffer, SPAWN_STRINGS_MAX - info->argc);
+		info->envc = status;
+	};
+
+	if (status >= 0 && uattr != 0)
+	{
+		status = procToKernelCopy(&info->attr, uattr, sizeof(kspawn_attr_t));
+		if (status == 0 && (info->attr.flags & ~SPAWN_ALL) != 0)
+		{
+			status = -EINVAL;
+		};
+	};
+
+	int i;
+	for (i=0; i<numActions && status >= 0; i++)
+	{
+		kspawn_file_action_t fa;
+		status = procToKernelCopy(&fa, uactions + i * sizeof(kspawn_file_action_t), sizeof(kspawn_file_action_t));
+		if (status != 0)
+		{
+			break;
+		};
+
+		if (fa.fd < 0 || fa.fd >= PROC_MAX_OPEN_FILES
+			|| (fa.action == SPAWN_FA_DUP2 && (fa.newfd < 0 || fa.newfd >= PROC_MAX_OPEN_FILES)))
+		{
+			status = -EBADF;
+			break;
+		};
+
+		SpawnAction *act = &info->actions[i];
+		act->action = fa.action;
+		act->fd = fa.fd;
+		act->newfd = fa.newfd;
+		act->oflags = fa.oflags;
+		act->mode = fa.mode;
+		act->pathOffset = 0;
+
+		if (fa.action == SPAWN_FA_OPEN)
+		{
+			status = procReadUserString(buffer, fa.path);
+			if (status != 0)
+			{
+				break;
+			};
+
+			ssize_t offset = spawnPack(&info, buffer);
+			if (offset < 0)
+			{
+				status = offset;
+				break;
+			};
+
+			// packing may have moved the block
+			info->actions[i].pathOffset = offset;
+		}
+		else if (fa.action != SPAWN_FA_CLOSE && fa.action != SPAWN_FA_DUP2)
+		{
+			status = -EINVAL;
+		};
+	};
+
+	kfree(buffer);
+
+	if (status < 0)
+	{
+		kfree(info);
+		return status;
+	};
+
+	// the child takes ownership of `info` if it is created
+	pid_t pid = procCreate(spawnEntry, info, PROC_CREATE_EMPTY);
+	if (pid < 0)
+	{
+		kfree(info);
+	};
+
+	return pid;
+};
\ No newline at end of file
@@ -35,6 +35,8 @@
 #include <glidix/int/fileops.h>
 #include <glidix/int/mman.h>
 #include <glidix/int/thwait.h>
+#include <glidix/int/clock.h>
+#include <glidix/int/spawn.h>
 
 /**
  * The system call table. This must not be static, as it must be accessed by `syscall.asm`!
@@ -70,6 +72,11 @@ void* _sysCallTable[] = {
 	sys_pthread_detach,						// 25
 	sys_thwait,							// 26
 	sys_thsignal,							// 27
+	sys_getrusage,							// 28
+	sys_times,							// 29
+	sys_clock_gettime,						// 30
+	sys_madvise,							// 31
+	sys_spawn,							// 32
 };
 
 /**
@@ -92,6 +99,7 @@ void _sysCallInvalid()
 void sysDispatchSignal(ksiginfo_t *si, uint64_t rax)
 {
 	SyscallContext *ctx = schedGetCurrentThread()->syscallContext;
+	FPURegs *fpuRegs = sysSaveFPU();
 
 	kmcontext_gpr_t gprs;
 	memset(&gprs, 0, sizeof(gprs));
@@ -107,7 +115,19 @@ void sysDispatchSignal(ksiginfo_t *si, uint64_t rax)
 	gprs.r15 = ctx->r15;
 	gprs.rip = ctx->rip;
 
-	schedDispatchSignal(&gprs, &ctx->fpuRegs, si);
+	schedDispatchSignal(&gprs, fpuRegs, si);
+};
+
+FPURegs* sysSaveFPU()
+{
+	SyscallContext *ctx = schedGetCurrentThread()->syscallContext;
+	if (!ctx->fpuSaved)
+	{
+		fpuSave(&ctx->fpuRegs);
+		ctx->fpuSaved = 1;
+	};
+
+	return &ctx->fpuRegs;
 };
 
 /**
@@ -116,6 +136,12 @@ void sysDispatchSignal(ksiginfo_t *si, uint64_t rax)
  */
 uint64_t _sysCheckSignals(uint64_t rax)
 {
+	// fast path: nothing to do (this avoids taking the schedLock on every syscall)
+	if (!schedHaveWork(schedGetCurrentThread()))
+	{
+		return rax;
+	};
+
 	ksiginfo_t si;
 	if (schedCheckSignals(&si) == 0)
 	{
@@ -31,6 +31,27 @@
 #include <glidix/thread/process.h>
 #include <glidix/hw/pagetab.h>
 #include <glidix/util/panic.h>
+#include <glidix/thread/spinlock.h>
+
+/**
+ * A bucket in the wait table.
+ */
+typedef struct
+{
+	Spinlock lock;
+	Blocker *list;
+} ThwaitBucket;
+
+/**
+ * The wait table. Blockers are hashed on the physical address of the word they wait on, so that
+ * no per-page state is needed.
+ */
+static ThwaitBucket thwaitTable[THWAIT_HASH_SIZE];
+
+static ThwaitBucket* thwaitGetBucket(uint64_t key)
+{
+	return &thwaitTable[((key >> 3) ^ (key >> 12)) & (THWAIT_HASH_SIZE-1)];
+};
 
 static int isConditionMet(uint64_t a, uint64_t b, int op)
 {
@@ -62,37 +83,38 @@ errno_t sys_thwait(user_addr_t uptr, int op, uint64_t compare)
 
 	volatile uint64_t *valptr = (volatile uint64_t*) (page + (uptr & 0xFFF));
 
-	KOM_UserPageInfo *info = komGetUserPageInfo(page);
-	ASSERT(info != NULL);
+	uint64_t key = komVirtToPhys(page) + (uptr & 0xFFF);
+	ThwaitBucket *bucket = thwaitGetBucket(key);
 
-	IrqState irqState = spinlockAcquire(&info->blockerLock);
+	IrqState irqState = spinlockAcquire(&bucket->lock);
 	if (isConditionMet(*valptr, compare, op))
 	{
-		spinlockRelease(&info->blockerLock, irqState);
+		spinlockRelease(&bucket->lock, irqState);
+		komUserPageUnref(page);
 		return 0;
 	};
 	
 	Blocker blocker;
 	blocker.prev = NULL;
-	blocker.next = (Blocker*) info->blockerList;
+	blocker.next = bucket->list;
 	if (blocker.next != NULL) blocker.next->prev = &blocker;
-	blocker.offset = uptr & 0xFFF;
+	blocker.key = key;
 	blocker.waiter = schedGetCurrentThread();
 	blocker.compareValue = compare;
-	info->blockerList = &blocker;
+	bucket->list = &blocker;
 
 	while (!isConditionMet(*valptr, compare, op) && !schedHaveReadySigs())
 	{
-		spinlockRelease(&info->blockerLock, irqState);
+		spinlockRelease(&bucket->lock, irqState);
 		schedSuspend();
-		spinlockAcquire(&info->blockerLock);
+		spinlockAcquire(&bucket->lock);
 	};
 
 	if (blocker.prev != NULL) blocker.prev->next = blocker.next;
 	if (blocker.next != NULL) blocker.next->prev = blocker.prev;
-	if (info->blockerList == &blocker) info->blockerList = blocker.next;
+	if (bucket->list == &blocker) bucket->list = blocker.next;
 
-	spinlockRelease(&info->blockerLock, irqState);
+	spinlockRelease(&bucket->lock, irqState);
 
 	komUserPageUnref(page);
 	return 0;
@@ -111,22 +133,21 @@ errno_t sys_thsignal(user_addr_t uptr, uint64_t newValue)
 		return EFAULT;
 	};
 
-	KOM_UserPageInfo *info = komGetUserPageInfo(page);
-	ASSERT(info != NULL);
+	uint64_t key = komVirtToPhys(page) + (uptr & 0xFFF);
+	ThwaitBucket *bucket = thwaitGetBucket(key);
 
-	uint64_t offset = uptr & 0xFFF;
-	IrqState irqState = spinlockAcquire(&info->blockerLock);
+	IrqState irqState = spinlockAcquire(&bucket->lock);
 
 	Blocker *blocker;
-	for (blocker=(Blocker*) info->blockerList; blocker!=NULL; blocker=blocker->next)
+	for (blocker=bucket->list; blocker!=NULL; blocker=blocker->next)
 	{
-		if (blocker->offset == offset && blocker->compareValue == newValue)
+		if (blocker->key == key && blocker->compareValue == newValue)
 		{
 			schedWake(blocker->waiter);
 		};
 	};
 
-	spinlockRelease(&info->blockerLock, irqState);
+	spinlockRelease(&bucket->lock, irqState);
 	komUserPageUnref(page);
 	return 0;
 };
\ No newline at end of file
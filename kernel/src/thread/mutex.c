@@ -118,6 +118,16 @@ int mutexTryLock(Mutex *mtx)
 	return status;
 };
 
+int mutexTryLockForReclaim(Mutex *mtx)
+{
+	if (mtx->owner == schedGetCurrentThread())
+	{
+		return -1;
+	};
+
+	return mutexTryLock(mtx);
+};
+
 void mutexUnlock(Mutex *mtx)
 {
 	Thread *me = schedGetCurrentThread();
@@ -27,6 +27,7 @@
 */
 
 #include <glidix/thread/process.h>
+#include <glidix/thread/vma.h>
 #include <glidix/util/treemap.h>
 #include <glidix/util/init.h>
 #include <glidix/util/log.h>
@@ -34,6 +35,11 @@
 #include <glidix/util/memory.h>
 #include <glidix/hw/pagetab.h>
 #include <glidix/util/string.h>
+#include <glidix/util/kmem.h>
+#include <glidix/hw/zeropool.h>
+#include <glidix/hw/zram.h>
+#include <glidix/hw/reclaim.h>
+#include <glidix/hw/meminfo.h>
 
 /**
  * The lock protecting the process table.
@@ -45,6 +51,11 @@ static Mutex procTableLock;
  */
 static TreeMap* procTable;
 
+/**
+ * The cache of process descriptions.
+ */
+static KmemCache* procCache;
+
 /**
  * The next available PID.
  * 
@@ -54,23 +65,26 @@ static TreeMap* procTable;
 static pid_t procNextPID = 1;
 
 /**
- * The anonymous mapping. This is a special mapping description, with the refcount being initialized
- * to one and hence never released. This single object can be reused for ALL anonymous mappings,
- * as there is no associated file and when we fault we just read out all-zeroes.
+ * The PID after which `procSwapOut()` continues scanning; protected by `procTableLock`.
  */
-static ProcessMapping procAnonMapping = {
-	.refcount = 1,
-	.inode = NULL,
-	.addr = 0,
-	.offset = 0,
-	.oflags = O_RDWR,
-	.mflags = MAP_PRIVATE | MAP_ANON,
-};
+static pid_t procSwapCursor;
+
+/**
+ * Number of pages in the fault-around window (see `PROC_FAULT_AROUND_PATH`), and the statistics.
+ */
+static int procFaultAroundPages = PROC_FAULT_AROUND_DEFAULT;
+static FaultAroundStats procFaultAroundStats;
 
 static void procInit()
 {
 	kprintf("Initializing the process table...\n");
 
+	procCache = kmemCacheCreate("process", sizeof(Process), NULL);
+	if (procCache == NULL)
+	{
+		panic("Failed to create the process cache!");
+	};
+
 	procTable = treemapNew();
 	if (procTable == NULL)
 	{
@@ -80,27 +94,56 @@ static void procInit()
 
 KERNEL_INIT_ACTION(procInit, KIA_PROCESS_INIT);
 
-static ProcessMapping* procMappingDup(ProcessMapping *mapping)
+static void procGenFaultAroundStats(MemInfoText *text)
 {
-	__sync_add_and_fetch(&mapping->refcount, 1);
-	return mapping;
+	meminfoPrintf(text, "Window:         %10d\n", procFaultAroundPages);
+	meminfoPrintf(text, "Faults:         %10lu\n", procFaultAroundStats.faults);
+	meminfoPrintf(text, "PagesMapped:    %10lu\n", procFaultAroundStats.pagesMapped);
 };
 
-static void procMappingUnref(ProcessMapping *mapping)
+static ssize_t procFaultAroundRead(Inode *inode, void *buffer, size_t size, off_t pos)
 {
-	if (__sync_add_and_fetch(&mapping->refcount, -1) == 0)
+	return meminfoRead(procGenFaultAroundStats, buffer, size, pos);
+};
+
+static ssize_t procFaultAroundWrite(Inode *inode, const void *buffer, size_t size, off_t pos)
+{
+	char value[16];
+	if (size >= sizeof(value))
+	{
+		return -EINVAL;
+	};
+
+	memcpy(value, buffer, size);
+	value[size] = 0;
+
+	char *end;
+	unsigned long pages = strtoul(value, &end, 10);
+	if (end == value || (*end != 0 && *end != '\n') || pages > PROC_FAULT_AROUND_MAX || (pages & (pages-1)) != 0)
 	{
-		vfsInodeUnref(mapping->inode);
-		kfree(mapping);
+		return -EINVAL;
 	};
+
+	procFaultAroundPages = (int) pages;
+	return size;
+};
+
+static InodeOps procFaultAroundOps = {
+	.pread = procFaultAroundRead,
+	.pwrite = procFaultAroundWrite,
+	.inodeFlags = VFS_INODE_SEEKABLE,
 };
 
-static void _procUnrefMappingWalk(TreeMap *treemap, uint32_t index, void *value_, void *context_)
+static void __init procFaultAroundInit()
 {
-	ProcessMapping *mapping = (ProcessMapping*) value_;
-	procMappingUnref(mapping);
+	if (vfsCreateCharDev(NULL, PROC_FAULT_AROUND_PATH, 0644, &procFaultAroundOps) != 0)
+	{
+		panic("Failed to create %s!", PROC_FAULT_AROUND_PATH);
+	};
 };
 
+KERNEL_INIT_ACTION(procFaultAroundInit, KIA_FAULT_AROUND_INIT, KIA_MEMINFO);
+
 static void procDeletePageTableRecur(void *ptr, int depth)
 {
 	if (depth == 4)
@@ -116,16 +159,66 @@ static void procDeletePageTableRecur(void *ptr, int depth)
 		for (i=0; i<limit; i++)
 		{
 			uint64_t ent = table[i];
-			if (ent & PT_PRESENT)
+			if (depth == 3 && (ent & (PT_PRESENT | PT_SWAP)) == PT_SWAP)
+			{
+				zramFree(PT_SWAP_SLOT(ent));
+			}
+			else if (ent & PT_PRESENT)
 			{
 				void *sub = komPhysToVirt(ent & PT_PHYS_MASK);
 				ASSERT(sub != NULL);
-				procDeletePageTableRecur(sub, depth+1);
+
+				if (depth == 2 && (ent & PT_HUGE))
+				{
+					// a large page rather than a page table
+					komUserLargePageUnref(sub);
+				}
+				else if (depth == 2 && (ent & PT_SHARED))
+				{
+					// a page table shared with other processes; the last one releases it
+					if (__sync_add_and_fetch(&komGetPageDesc(sub)->refcount, -1) == 0)
+					{
+						procDeletePageTableRecur(sub, 3);
+					};
+				}
+				else
+				{
+					procDeletePageTableRecur(sub, depth+1);
+				};
 			};
 		};
 
 		komReleaseBlock(ptr, KOM_BUCKET_PAGE);
+		komCounterAdd(KOM_COUNTER_PAGE_TABLES, -PAGE_SIZE);
+	};
+};
+
+/**
+ * Drop a reference to a shared page table, releasing it (and the pages it maps) if this was the last
+ * one. No CPU may be using the table anymore.
+ */
+static void _procTableUnref(void *table)
+{
+	if (__sync_add_and_fetch(&komGetPageDesc(table)->refcount, -1) == 0)
+	{
+		procDeletePageTableRecur(table, 3);
+	};
+};
+
+/**
+ * Return the number of pages mapped by the page table `table`.
+ */
+static uint64_t _procCountTablePages(uint64_t *table)
+{
+	uint64_t count = 0;
+
+	int i;
+	for (i=0; i<512; i++)
+	{
+		if (table[i] & PT_PRESENT) count++;
 	};
+
+	return count;
 };
 
 static void procDeletePageTable(void *pml4)
@@ -143,10 +236,9 @@ void procUnref(Process *proc)
 {
 	if (__sync_add_and_fetch(&proc->refcount, -1) == 0)
 	{
-		treemapWalk(proc->mappingTree, _procUnrefMappingWalk, NULL);
+		vmaTreeDestroy(&proc->vmas);
 		procDeletePageTable(proc->pagetabVirt);
 		treemapDestroy(proc->threads);
-		treemapDestroy(proc->mappingTree);
 		vfsPathWalkerDestroy(&proc->rootDir);
 		vfsPathWalkerDestroy(&proc->currentDir);
 
@@ -157,7 +249,7 @@ void procUnref(Process *proc)
 			if (fp != NULL) vfsClose(fp);
 		};
 
-		kfree(proc);
+		kmemCacheFree(procCache, proc);
 	};
 };
 
@@ -187,28 +279,148 @@ static void procStartup(void *context_)
 };
 
 /**
- * Get the page table entry for memory address `addr`. Call this only when the pagemap lock is acquired.
- * If the PTE does not yet exist, it will be as unmapped. NULL is returned if the PTE does not exist and
- * we have furthermore ran out of memory.
+ * Split the large page mapped by the page directory entry `pde` into 4 KB pages with the same attributes.
+ * `pt` is any entry in the new page table (as returned by `pagetabGetNodes()`). The 4 KB pages already
+ * have their own refcounts, so nothing else needs to change. Returns 0 on success, or ENOMEM.
  */
-static PageNodeEntry* _procGetPageTableEntry(user_addr_t addr)
+static errno_t _procSplitLargePage(PageNodeEntry *pde, PageNodeEntry *pt)
+{
+	Process *proc = schedGetCurrentThread()->proc;
+
+	uint64_t *table = (uint64_t*) komAllocBlock(KOM_BUCKET_PAGE, KOM_POOLBIT_ALL);
+	if (table == NULL)
+	{
+		return ENOMEM;
+	};
+
+	komCounterAdd(KOM_COUNTER_PAGE_TABLES, PAGE_SIZE);
+
+	// bit 7 is the PAT bit in a PTE, so drop the page size bit
+	uint64_t ent = pde->value;
+	uint64_t phaddr = ent & PT_PHYS_MASK & ~(LARGE_PAGE_SIZE-1);
+	uint64_t flags = ent & ~(PT_PHYS_MASK | PT_HUGE);
+
+	int i;
+	for (i=0; i<512; i++)
+	{
+		table[i] = (phaddr + PAGE_SIZE * i) | flags;
+	};
+
+	pde->value = pagetabGetPhys(table) | PT_WRITE | PT_USER | PT_PRESENT;
+
+	// the translations stay the same, but no CPU may keep using a stale recursive mapping of the
+	// page table which used to be here
+	invlpg(pt);
+	cpuInvalidatePage(proc->cr3, pt);
+	return 0;
+};
+
+/**
+ * Give the calling process its own copy of the shared page table pointed to by `pde`, which maps the 2 MB
+ * starting at `base`; or, if no other process uses the table anymore, just take it over. Call this with the
+ * `mapLock` held. Returns 0 on success, or ENOMEM.
+ */
+static errno_t _procUnshareTable(Process *proc, user_addr_t base, PageNodeEntry *pde)
+{
+	uint64_t *table = (uint64_t*) komPhysToVirt(pde->value & PT_PHYS_MASK);
+	ASSERT(table != NULL);
+
+	KOM_PageDesc *desc = komGetPageDesc(table);
+	uint64_t *newTable = table;
+
+	if (desc->refcount == 1)
+	{
+		// we are the only user left; nobody else can take a new reference, as that would require
+		// forking us
+		desc->refcount = 0;
+	}
+	else
+	{
+		newTable = (uint64_t*) zpoolAlloc();
+		if (newTable == NULL)
+		{
+			return ENOMEM;
+		};
+
+		komCounterAdd(KOM_COUNTER_PAGE_TABLES, PAGE_SIZE);
+
+		// both tables now refer to every page; writeable pages of private mappings become copy-on-write
+		// in both, before our reference to the old one is dropped (the other users might be unsharing
+		// it at the same time, and make the same change)
+		VMA *vma;
+		for (vma=vmaFindAfter(&proc->vmas, base); vma != NULL && vma->start < base + LARGE_PAGE_SIZE;
+			vma=vmaNext(&proc->vmas, vma))
+		{
+			int first = vma->start > base ? (int) ((vma->start - base) >> 12) : 0;
+			int last = vma->end < base + LARGE_PAGE_SIZE ? (int) ((vma->end - base) >> 12) : 512;
+
+			int i;
+			for (i=first; i<last; i++)
+			{
+				uint64_t ent = table[i];
+				if (ent & PT_PRESENT)
+				{
+					if ((vma->mflags & MAP_PRIVATE) && (ent & PT_WRITE))
+					{
+						ent = (ent & ~PT_WRITE) | PT_COW;
+						table[i] = ent;
+					};
+
+					void *page = komPhysToVirt(ent & PT_PHYS_MASK);
+					ASSERT(page != NULL);
+					komUserPageDup(page);
+				}
+				else if (ent & PT_SWAP)
+				{
+					zramDup(PT_SWAP_SLOT(ent));
+				};
+
+				newTable[i] = ent;
+			};
+		};
+	};
+
+	// the PDE was read-only, so no CPU can have a writeable TLB entry for a page which just became
+	// copy-on-write; only the recursive mapping of the table must go
+	PageNodeEntry *nodes[4];
+	pagetabGetNodes((void*) base, nodes);
+
+	pde->value = pagetabGetPhys(newTable) | PT_WRITE | PT_USER | PT_PRESENT;
+	invlpg(nodes[3]);
+	cpuInvalidatePage(proc->cr3, nodes[3]);
+
+	if (newTable != table)
+	{
+		_procTableUnref(table);
+	};
+
+	return 0;
+};
+
+/**
+ * Get the page table node at the specified level (0 is the PML4 entry, 3 is the PTE) for memory address
+ * `addr`. Call this only when the pagemap lock is acquired. Missing tables are created, a large page
+ * found above `level` is split, and a shared page table is unshared. NULL is returned if we ran out of
+ * memory.
+ */
+static PageNodeEntry* _procGetPageNode(user_addr_t addr, int level)
 {
 	PageNodeEntry *nodes[4];
 	pagetabGetNodes((void*)addr, nodes);
 
 	int i;
-	for (i=0; i<3; i++)
+	for (i=0; i<level; i++)
 	{
 		PageNodeEntry *node = nodes[i];
 		if (node->value == 0)
 		{
-			void *nextLevel = komAllocBlock(KOM_BUCKET_PAGE, KOM_POOLBIT_ALL);
+			void *nextLevel = zpoolAlloc();
 			if (nextLevel == NULL)
 			{
 				return NULL;
 			};
 
-			memZeroPage(nextLevel);
+			komCounterAdd(KOM_COUNTER_PAGE_TABLES, PAGE_SIZE);
 
 			// all intermediate levels are mapped as WRITE, USER, PRESENT, and with NOEXEC,
 			// so that we can set these per-page without worrying about the higher levels
@@ -216,17 +428,43 @@ static PageNodeEntry* _procGetPageTableEntry(user_addr_t addr)
 
 			// invalidate the next node to apply the above
 			invlpg(nodes[i+1]);
+		}
+		else if (node->value & PT_HUGE)
+		{
+			if (_procSplitLargePage(node, nodes[i+1]) != 0)
+			{
+				return NULL;
+			};
+		}
+		else if (i == 2 && (node->value & PT_SHARED))
+		{
+			Process *proc = schedGetCurrentThread()->proc;
+			if (_procUnshareTable(proc, addr & ~(LARGE_PAGE_SIZE-1), node) != 0)
+			{
+				return NULL;
+			};
 		};
 	};
 
-	return nodes[3];
+	return nodes[level];
+};
+
+/**
+ * Get the page table entry for memory address `addr`. Call this only when the pagemap lock is acquired.
+ * If the PTE does not yet exist, it will be as unmapped. NULL is returned if the PTE does not exist and
+ * we have furthermore ran out of memory.
+ */
+static PageNodeEntry* _procGetPageTableEntry(user_addr_t addr)
+{
+	return _procGetPageNode(addr, 3);
 };
 
 /**
- * Gets a useable pointer to the PTE for `addr` in a different address space. This is only used while
- * cloning page tables. Returns NULL if we ran out of memory trying to allocate paging structures.
+ * Gets a useable pointer to the page table node at the specified level for `addr` in a different address
+ * space. This is only used while cloning page tables. Returns NULL if we ran out of memory trying to allocate
+ * paging structures.
  */
-static PageNodeEntry* _procGetForeignPageTableEntry(void *pml4, user_addr_t addr)
+static PageNodeEntry* _procGetForeignPageNode(void *pml4, user_addr_t addr, int level)
 {
 	int indexes[4];
 	indexes[3] = (addr >> (12)) & 0x1FF;
@@ -241,18 +479,18 @@ static PageNodeEntry* _procGetForeignPageTableEntry(void *pml4, user_addr_t addr
 	{
 		PageNodeEntry *ent = (PageNodeEntry*) table + indexes[i];
 
-		// if we are at the final level, just return it (it's the PTE)
-		if (i == 3) return ent;
+		// if we are at the requested level, just return it
+		if (i == level) return ent;
 
 		if (ent->value == 0)
 		{
-			void *nextLevel = komAllocBlock(KOM_BUCKET_PAGE, KOM_POOLBIT_ALL);
+			void *nextLevel = zpoolAlloc();
 			if (nextLevel == NULL)
 			{
 				return NULL;
 			};
 
-			memZeroPage(nextLevel);
+			komCounterAdd(KOM_COUNTER_PAGE_TABLES, PAGE_SIZE);
 
 			// all intermediate levels are mapped as WRITE, USER, PRESENT, and with NOEXEC,
 			// so that we can set these per-page without worrying about the higher levels
@@ -272,57 +510,166 @@ static PageNodeEntry* _procGetForeignPageTableEntry(void *pml4, user_addr_t addr
 	return NULL;
 };
 
-static void _procPageCloneWalkCallback(TreeMap *parentTree, uint32_t index, void *value_, void *context_)
+/**
+ * Look up the PTE for `addr` in a different address space, without allocating anything. Returns NULL if
+ * there is no page table for `addr`, if it is in a large page, or, unless `shared` is nonzero, if it is in
+ * a page table shared with other processes (which must not be changed in place).
+ */
+static PageNodeEntry* _procLookupForeignPageTableEntry(void *pml4, user_addr_t addr, int shared)
 {
-	PageCloneContext *ctx = (PageCloneContext*) context_;
-	ProcessMapping *mapping = (ProcessMapping*) value_;
-	user_addr_t addr = ((user_addr_t) index) << 12;
-	PageNodeEntry *parentPTE = _procGetPageTableEntry(addr);
-	PageNodeEntry *childPTE = _procGetForeignPageTableEntry(ctx->childPageTable, addr);
-	
-	if (parentPTE == NULL || childPTE == NULL)
+	uint64_t *table = (uint64_t*) pml4;
+
+	int level;
+	for (level=0; level<3; level++)
 	{
-		ctx->err = ENOMEM;
-		return;
+		uint64_t ent = table[(addr >> (39 - 9 * level)) & 0x1FF];
+		if ((ent & PT_PRESENT) == 0 || (ent & PT_HUGE))
+		{
+			return NULL;
+		};
+
+		if (level == 2 && !shared && (ent & PT_SHARED))
+		{
+			return NULL;
+		};
+
+		table = (uint64_t*) komPhysToVirt(ent & PT_PHYS_MASK);
+		ASSERT(table != NULL);
 	};
 
-	// copy the mapping into the new table
-	if (treemapSet(ctx->childTree, index, mapping) != 0)
+	return (PageNodeEntry*) table + ((addr >> 12) & 0x1FF);
+};
+
+/**
+ * Callback for `_procWalkPages()`. `ent` is a non-empty PTE (`level` 3), or a PDE (`level` 2) of a large page
+ * (`PT_HUGE`) or of a page table, and `addr` is the address it maps. Return nonzero to stop the walk.
+ */
+typedef int (*PageWalkCallback)(Process *proc, user_addr_t addr, PageNodeEntry *ent, int level, void *context);
+
+static int _procWalkPagesRecur(Process *proc, uint64_t *table, int level, user_addr_t base, user_addr_t start,
+				user_addr_t end, PageWalkCallback callback, void *context)
+{
+	int shift = 39 - 9 * level;
+	int i = start > base ? (int) ((start - base) >> shift) : 0;
+
+	for (; i<512; i++)
 	{
-		ctx->err = ENOMEM;
-		return;
+		user_addr_t addr = base + ((user_addr_t) i << shift);
+		if (addr >= end) break;
+
+		PageNodeEntry *ent = (PageNodeEntry*) &table[i];
+		if (ent->value == 0) continue;
+
+		if (level == 3 || (ent->value & PT_HUGE))
+		{
+			if (callback(proc, addr, ent, level, context) != 0) return 1;
+		}
+		else
+		{
+			if (level == 2)
+			{
+				// the callback sees the page table first, and may share, unshare or remove it
+				if (callback(proc, addr, ent, level, context) != 0) return 1;
+				if (ent->value == 0 || (ent->value & PT_SHARED)) continue;
+			};
+
+			uint64_t *sub = (uint64_t*) komPhysToVirt(ent->value & PT_PHYS_MASK);
+			ASSERT(sub != NULL);
+
+			if (_procWalkPagesRecur(proc, sub, level+1, addr, start, end, callback, context) != 0) return 1;
+		};
 	};
 
-	// successful, increment refcount
-	procMappingDup(mapping);
+	return 0;
+};
+
+/**
+ * Call `callback` on every page mapped or swapped out between `start` and `end` in the address space of `proc`,
+ * in address order. Missing page tables are skipped whole, so this costs time in proportion to how much of
+ * the range was ever touched, rather than to its size. A large page is passed whole, even if it is only partly
+ * in the range. The walk does not go into page tables which are shared (`PT_SHARED`) after the callback has
+ * seen their PDE. Call this with the `mapLock` of `proc` held. Returns nonzero if the callback stopped the walk.
+ */
+static int _procWalkPages(Process *proc, user_addr_t start, user_addr_t end, PageWalkCallback callback, void *context)
+{
+	return _procWalkPagesRecur(proc, (uint64_t*) proc->pagetabVirt, 0, 0, start, end, callback, context);
+};
+
+/**
+ * Return the glidix permission bits (`PT_PROT_*`) corresponding to the protection `prot`.
+ */
+static uint64_t _procProtBits(int prot)
+{
+	uint64_t bits = 0;
+	if (prot & PROT_READ) bits |= PT_PROT_READ;
+	if (prot & PROT_WRITE) bits |= PT_PROT_WRITE;
+	if (prot & PROT_EXEC) bits |= PT_PROT_EXEC;
+	return bits;
+};
 
-	// if this is a private mapping, and we have PROT_WRITE permission, and the page is mapped writeable,
-	// we must turn it into copy-on-write
-	if ((mapping->mflags & MAP_PRIVATE) && (parentPTE->value & PT_PRESENT)
-		&& (parentPTE->value & PT_PROT_WRITE))
+static int _procPageCloneCallback(Process *proc, user_addr_t addr, PageNodeEntry *parentEnt, int level, void *context_)
+{
+	PageCloneContext *ctx = (PageCloneContext*) context_;
+
+	// we never go into page tables, as they are shared
+	ASSERT(level == 2);
+
+	PageNodeEntry *childEnt = _procGetForeignPageNode(ctx->childPageTable, addr, level);
+	if (childEnt == NULL)
 	{
-		// mark non-writeable, copy-on-write for parent
-		parentPTE->value &= ~(PT_WRITE);
-		parentPTE->value |= PT_COW;
+		ctx->err = ENOMEM;
+		return 1;
+	};
 
-		// inform any other CPUs running this process that this happened
-		invlpg((void*) addr);
-		cpuInvalidatePage(ctx->parent->cr3, (void*) addr);
+	// a page table or large page may be reached again from the next area, if it lies in both
+	if (childEnt->value != 0)
+	{
+		return 0;
 	};
 
-	// if the page is present, increase its refcount
-	if (parentPTE->value & PT_PRESENT)
+	if (parentEnt->value & PT_HUGE)
 	{
-		void *page = komPhysToVirt(parentPTE->value & PT_PHYS_MASK);
+		// large pages are shared whole; only anonymous private memory gets large pages
+		if (ctx->vma->prot & PROT_WRITE)
+		{
+			parentEnt->value &= ~(PT_WRITE);
+			parentEnt->value |= PT_COW;
+			cpuBatchAdd(&ctx->tlb, (void*) addr);
+		};
+
+		void *page = komPhysToVirt(parentEnt->value & PT_PHYS_MASK);
 		ASSERT(page != NULL);
-		komUserPageDup(page);
+		komUserLargePageDup(page);
+
+		childEnt->value = parentEnt->value;
+		ctx->rss += KOM_LARGE_PAGE_PAGES;
+		return 0;
 	};
 
-	// map into the new table
-	childPTE->value = parentPTE->value;
+	// page tables are shared read-only, and copied by whichever process first changes one (see
+	// `_procUnshareTable()`), so the pages in them need not be touched now
+	uint64_t *table = (uint64_t*) komPhysToVirt(parentEnt->value & PT_PHYS_MASK);
+	ASSERT(table != NULL);
+
+	if (parentEnt->value & PT_SHARED)
+	{
+		__sync_add_and_fetch(&komGetPageDesc(table)->refcount, 1);
+	}
+	else
+	{
+		komGetPageDesc(table)->refcount = 2;
+		parentEnt->value = (parentEnt->value & ~PT_WRITE) | PT_SHARED;
+
+		// other CPUs running this process are told once the whole address space was cloned
+		cpuBatchAddRange(&ctx->tlb, (void*) addr, LARGE_PAGE_SIZE);
+	};
+
+	childEnt->value = parentEnt->value;
+	ctx->rss += _procCountTablePages(table);
+	return 0;
 };
 
-pid_t procCreate(KernelThreadFunc func, void *param)
+pid_t procCreate(KernelThreadFunc func, void *param, int flags)
 {
 	Thread *me = schedGetCurrentThread();
 
@@ -338,7 +685,7 @@ pid_t procCreate(KernelThreadFunc func, void *param)
 	info->param = param;
 
 	// allocate the process struct
-	Process *child = (Process*) kmalloc(sizeof(Process));
+	Process *child = (Process*) kmemCacheAlloc(procCache);
 	if (child == NULL)
 	{
 		kfree(info);
@@ -351,17 +698,7 @@ pid_t procCreate(KernelThreadFunc func, void *param)
 	TreeMap *threads = treemapNew();
 	if (threads == NULL)
 	{
-		kfree(child);
-		kfree(info);
-		return -ENOMEM;
-	};
-
-	// allocate the mapping tree
-	TreeMap *mappingTree = treemapNew();
-	if (mappingTree == NULL)
-	{
-		treemapDestroy(threads);
-		kfree(child);
+		kmemCacheFree(procCache, child);
 		kfree(info);
 		return -ENOMEM;
 	};
@@ -369,9 +706,8 @@ pid_t procCreate(KernelThreadFunc func, void *param)
 	// pre-allocate memory for the '1' entry
 	if (treemapSet(threads, 1, NULL) != 0)
 	{
-		treemapDestroy(mappingTree);
 		treemapDestroy(threads);
-		kfree(child);
+		kmemCacheFree(procCache, child);
 		kfree(info);
 		return -ENOMEM;
 	};
@@ -384,24 +720,23 @@ pid_t procCreate(KernelThreadFunc func, void *param)
 
 	if (newPML4 == NULL)
 	{
-		treemapDestroy(mappingTree);
 		treemapDestroy(threads);
-		kfree(child);
+		kmemCacheFree(procCache, child);
 		kfree(info);
 		return -ENOMEM;
 	};
 
 	memZeroPage(newPML4);
+	komCounterAdd(KOM_COUNTER_PAGE_TABLES, PAGE_SIZE);
 
 	newPML4[509] = myPML4[509];
 	newPML4[510] = myPML4[510];
-	newPML4[511] = pagetabGetPhys(myPML4) | PT_PRESENT | PT_WRITE | PT_NOEXEC;
+	newPML4[511] = pagetabGetPhys(newPML4) | PT_PRESENT | PT_WRITE | PT_NOEXEC;
 
 	// fill out the process structure
 	memset(child, 0, sizeof(Process));
-	child->cr3 = pagetabGetPhys(myPML4);
+	child->cr3 = pagetabGetPhys(newPML4);
 	child->pagetabVirt = newPML4;
-	child->mappingTree = mappingTree;
 	child->parent = me->proc == NULL ? 1 : me->proc->pid;
 
 	child->rootDir = vfsPathWalkerGetRoot();
@@ -423,21 +758,36 @@ pid_t procCreate(KernelThreadFunc func, void *param)
 		child->sid = me->proc->sid;
 		child->pgid = me->proc->pgid;
 
-		PageCloneContext ctx;
-		ctx.parent = me->proc;
-		ctx.childPageTable = newPML4;
-		ctx.childTree = mappingTree;
-		ctx.err = 0;
+		if ((flags & PROC_CREATE_EMPTY) == 0)
+		{
+			PageCloneContext ctx;
+			ctx.parent = me->proc;
+			ctx.childPageTable = newPML4;
+			ctx.err = 0;
+			ctx.rss = 0;
+			cpuBatchInit(&ctx.tlb, me->proc->cr3);
+
+			mutexLock(&me->proc->mapLock);
+			ctx.err = vmaTreeClone(&child->vmas, &me->proc->vmas);
+
+			VMA *vma;
+			for (vma=vmaFindAfter(&me->proc->vmas, 0); vma != NULL && ctx.err == 0; vma=vmaNext(&me->proc->vmas, vma))
+			{
+				ctx.vma = vma;
+				_procWalkPages(me->proc, vma->start, vma->end, _procPageCloneCallback, &ctx);
+			};
 
-		mutexLock(&me->proc->mapLock);
-		treemapWalk(me->proc->mappingTree, _procPageCloneWalkCallback, &ctx);
-		mutexUnlock(&me->proc->mapLock);
+			cpuBatchFlush(&ctx.tlb);
+			mutexUnlock(&me->proc->mapLock);
 
-		if (ctx.err != 0)
-		{
-			procUnref(child);
-			kfree(info);
-			return -ctx.err;
+			child->rss = ctx.rss;
+
+			if (ctx.err != 0)
+			{
+				procUnref(child);
+				kfree(info);
+				return -ctx.err;
+			};
 		};
 
 		mutexLock(&me->proc->fileTableLock);
@@ -497,6 +847,273 @@ pid_t procCreate(KernelThreadFunc func, void *param)
 	return pid;
 };
 
+/**
+ * If a large page or a shared page table crosses `addr` in the address space of the calling process, split or
+ * unshare it, so that the pages on either side can be changed separately. Call this with the `mapLock` held.
+ * Returns 0 on success, or ENOMEM.
+ */
+static errno_t _procSplitAt(Process *proc, user_addr_t addr)
+{
+	if ((addr & (LARGE_PAGE_SIZE-1)) == 0 || addr >= PROC_USER_ADDR_MAX)
+	{
+		return 0;
+	};
+
+	PageNodeEntry *nodes[4];
+	pagetabGetNodes((void*) addr, nodes);
+
+	if ((nodes[0]->value & PT_PRESENT) == 0 || (nodes[1]->value & PT_PRESENT) == 0)
+	{
+		return 0;
+	};
+
+	if (nodes[2]->value & PT_HUGE)
+	{
+		return _procSplitLargePage(nodes[2], nodes[3]);
+	};
+
+	if (nodes[2]->value & PT_SHARED)
+	{
+		return _procUnshareTable(proc, addr & ~(LARGE_PAGE_SIZE-1), nodes[2]);
+	};
+
+	return 0;
+};
+
+/**
+ * Make sure that no area crosses `start` or `end`, so that the areas between them can be changed without
+ * affecting the ones around them. Returns 0 on success, or ENOMEM.
+ */
+static errno_t _procSplitAreas(Process *proc, user_addr_t start, user_addr_t end)
+{
+	VMA *vma = vmaFind(&proc->vmas, start);
+	if (vma != NULL && vma->start < start && vmaSplit(&proc->vmas, vma, start) != 0)
+	{
+		return ENOMEM;
+	};
+
+	vma = vmaFind(&proc->vmas, end);
+	if (vma != NULL && vma->start < end && vmaSplit(&proc->vmas, vma, end) != 0)
+	{
+		return ENOMEM;
+	};
+
+	return 0;
+};
+
+/**
+ * Like `_procSplitAreas()`, but large pages and shared page tables crossing `start` or `end` are split or
+ * unshared too, so that the pages in the range can be changed as well. Only for the calling process.
+ */
+static errno_t _procSplitRange(Process *proc, user_addr_t start, user_addr_t end)
+{
+	if (_procSplitAt(proc, start) != 0 || _procSplitAt(proc, end) != 0)
+	{
+		return ENOMEM;
+	};
+
+	return _procSplitAreas(proc, start, end);
+};
+
+/**
+ * Returns nonzero if every page between `start` and `end` belongs to some area.
+ */
+static int _procIsMapped(Process *proc, user_addr_t start, user_addr_t end)
+{
+	VMA *vma = vmaFind(&proc->vmas, start);
+	while (vma != NULL && vma->end < end)
+	{
+		VMA *next = vmaNext(&proc->vmas, vma);
+		if (next == NULL || next->start != vma->end)
+		{
+			return 0;
+		};
+
+		vma = next;
+	};
+
+	return vma != NULL;
+};
+
+/**
+ * Merge the areas between `start` and `end` with each other and with the areas around them, where possible,
+ * after they have been changed.
+ */
+static void _procMergeRange(Process *proc, user_addr_t start, user_addr_t end)
+{
+	VMA *vma = vmaFindAfter(&proc->vmas, start);
+	while (vma != NULL && vma->start < end)
+	{
+		vma = vmaMerge(&proc->vmas, vma);
+		vma = vmaNext(&proc->vmas, vma);
+	};
+};
+
+/**
+ * Return the end of the range of `len` bytes starting at the page-aligned `addr`, rounded up to a page boundary
+ * and clamped to `PROC_USER_ADDR_MAX`.
+ */
+static user_addr_t _procRangeEnd(user_addr_t addr, size_t len)
+{
+	if (addr >= PROC_USER_ADDR_MAX || len > PROC_USER_ADDR_MAX - addr)
+	{
+		return PROC_USER_ADDR_MAX;
+	};
+
+	return (addr + len + 0xFFF) & ~0xFFFUL;
+};
+
+/**
+ * Pages unmapped from an address space. They may only be released once their TLB entries were invalidated
+ * on every CPU, so they are kept here until the TLB batch is flushed.
+ */
+typedef struct
+{
+	/**
+	 * The TLB invalidations.
+	 */
+	TLBBatch tlb;
+
+	/**
+	 * The pages to release, with the lowest bit set for large pages and the next one for shared page
+	 * tables, and how many there are.
+	 */
+	void *pages[PROC_GATHER_PAGES];
+	int numPages;
+} PageGather;
+
+static void _procGatherInit(PageGather *gather, Process *proc)
+{
+	cpuBatchInit(&gather->tlb, proc->cr3);
+	gather->numPages = 0;
+};
+
+/**
+ * Invalidate the gathered pages on all CPUs, then release them.
+ */
+static void _procGatherFlush(PageGather *gather)
+{
+	cpuBatchFlush(&gather->tlb);
+
+	int i;
+	for (i=0; i<gather->numPages; i++)
+	{
+		uint64_t page = (uint64_t) gather->pages[i];
+		if (page & 1) komUserLargePageUnref((void*) (page & ~1UL));
+		else if (page & 2) _procTableUnref((void*) (page & ~2UL));
+		else komUserPageUnref((void*) page);
+	};
+
+	gather->numPages = 0;
+};
+
+/**
+ * Add a page which was unmapped from `addr` to the gather, so that it is released after the next flush.
+ */
+static void _procGatherPage(PageGather *gather, user_addr_t addr, void *page, int large)
+{
+	if (gather->numPages == PROC_GATHER_PAGES)
+	{
+		_procGatherFlush(gather);
+	};
+
+	cpuBatchAdd(&gather->tlb, (void*) addr);
+	gather->pages[gather->numPages++] = (void*) ((uint64_t) page | (large ? 1 : 0));
+};
+
+/**
+ * Add a shared page table which was unmapped from the 2 MB at `addr` to the gather, so that our reference to
+ * it is dropped after the next flush.
+ */
+static void _procGatherTable(PageGather *gather, user_addr_t addr, void *table)
+{
+	if (gather->numPages == PROC_GATHER_PAGES)
+	{
+		_procGatherFlush(gather);
+	};
+
+	// the pages it mapped, and the table itself in the recursive mapping
+	PageNodeEntry *nodes[4];
+	pagetabGetNodes((void*) addr, nodes);
+
+	cpuBatchAddRange(&gather->tlb, (void*) addr, LARGE_PAGE_SIZE);
+	cpuBatchAdd(&gather->tlb, nodes[3]);
+	gather->pages[gather->numPages++] = (void*) ((uint64_t) table | 2);
+};
+
+static int _procUnmapPageCallback(Process *proc, user_addr_t addr, PageNodeEntry *ent, int level, void *context)
+{
+	PageGather *gather = (PageGather*) context;
+
+	if (level == 2 && (ent->value & PT_HUGE))
+	{
+		// the range was split at large page boundaries, so this large page is entirely inside it
+		void *page = komPhysToVirt(ent->value & PT_PHYS_MASK & ~(LARGE_PAGE_SIZE-1));
+		ASSERT(page != NULL);
+
+		ent->value = 0;
+		proc->rss -= KOM_LARGE_PAGE_PAGES;
+		_procGatherPage(gather, addr, page, 1);
+	}
+	else if (level == 2)
+	{
+		// shared page tables crossing the ends of the range were unshared, so this one is entirely inside
+		// it, and can be dropped whole; a table of our own is walked into instead
+		if (ent->value & PT_SHARED)
+		{
+			uint64_t *table = (uint64_t*) komPhysToVirt(ent->value & PT_PHYS_MASK);
+			ASSERT(table != NULL);
+
+			ent->value = 0;
+			proc->rss -= _procCountTablePages(table);
+			_procGatherTable(gather, addr, table);
+		};
+	}
+	else if (ent->value & PT_PRESENT)
+	{
+		void *canon = komPhysToVirt(ent->value & PT_PHYS_MASK);
+		ASSERT(canon != NULL);
+
+		ent->value = 0;
+		proc->rss--;
+		_procGatherPage(gather, addr, canon, 0);
+	}
+	else if (ent->value & PT_SWAP)
+	{
+		zramFree(PT_SWAP_SLOT(ent->value));
+		ent->value = 0;
+	};
+
+	return 0;
+};
+
+/**
+ * Unmap everything between `start` and `end` in the address space of the calling process; call this with the
+ * `mapLock` held. Returns 0 on success, or ENOMEM if an area or a large page crossing the ends of the range
+ * could not be split, in which case nothing was unmapped.
+ */
+static errno_t _procUnmapRange(Process *proc, user_addr_t start, user_addr_t end)
+{
+	if (_procSplitRange(proc, start, end) != 0)
+	{
+		return ENOMEM;
+	};
+
+	VMA *vma;
+	while ((vma = vmaFindAfter(&proc->vmas, start)) != NULL && vma->start < end)
+	{
+		vmaRemove(&proc->vmas, vma);
+		vmaDelete(vma);
+	};
+
+	// only pages inside areas are ever mapped, so this catches all of them
+	PageGather gather;
+	_procGatherInit(&gather, proc);
+	_procWalkPages(proc, start, end, _procUnmapPageCallback, &gather);
+	_procGatherFlush(&gather);
+	return 0;
+};
+
 user_addr_t procMap(user_addr_t addr, size_t length, int prot, int flags, File *fp, off_t offset, errno_t *err)
 {
 	if ((addr & 0xFFF) || (offset & 0xFFF) || length > PROC_USER_ADDR_MAX || addr > PROC_USER_ADDR_MAX
@@ -507,6 +1124,10 @@ user_addr_t procMap(user_addr_t addr, size_t length, int prot, int flags, File *
 		return MAP_FAILED;
 	};
 
+	// the mapping always covers whole pages; this cannot go past PROC_USER_ADDR_MAX, since it is
+	// page-aligned itself
+	length = (length + 0xFFF) & ~0xFFFUL;
+
 	if ((prot & PROT_ALL) != prot)
 	{
 		// invalid prot set
@@ -564,162 +1185,148 @@ user_addr_t procMap(user_addr_t addr, size_t length, int prot, int flags, File *
 	// get the current process
 	Process *proc = schedGetCurrentThread()->proc;
 
-	// figure out what mapping to use; for anonymous, we use the global 'anonymous' mapping as
-	// it's identical in all contexts, otherwise allocate our own mapping description
-	ProcessMapping *mapping;
+	// anonymous memory is described the same way whatever was requested, so that neighbouring anonymous
+	// mappings can always be merged
+	VMA *vma;
 	if (fp == NULL)
 	{
-		mapping = procMappingDup(&procAnonMapping);
+		vma = vmaNew(addr, addr+length, prot, MAP_PRIVATE | MAP_ANON, O_RDWR, NULL, 0);
 	}
 	else
 	{
-		mapping = (ProcessMapping*) kmalloc(sizeof(ProcessMapping));
-		if (mapping == NULL)
-		{
-			if (err != NULL) *err = ENOMEM;
-			return MAP_FAILED;
-		};
-
-		mapping->refcount = 1;
-		mapping->addr = addr;
-		mapping->offset = offset;
-		mapping->oflags = fp->oflags;
-		mapping->inode = vfsInodeDup(fp->walker.current);
-		mapping->mflags = flags;
+		vma = vmaNew(addr, addr+length, prot, flags, fp->oflags, fp->walker.current, offset);
 	};
 
-	// now we map
-	user_addr_t scan;
-	errno_t status = 0;
+	if (vma == NULL)
+	{
+		if (err != NULL) *err = ENOMEM;
+		return MAP_FAILED;
+	};
 
 	mutexLock(&proc->mapLock);
 	if (addr == 0 && (flags & MAP_FIXED) == 0)
 	{
-		addr = (PROC_USER_ADDR_MAX - length) & ~0xFFFUL;
-		
-		while (1)
-		{
-			for (scan=addr;scan<addr+length; scan+=PAGE_SIZE)
-			{
-				uint32_t pageIndex = (scan >> 12);
-				ProcessMapping *colliding = (ProcessMapping*) treemapGet(proc->mappingTree, pageIndex);
-
-				if (colliding != NULL)
-				{
-					if (colliding->addr < length)
-					{
-						mutexUnlock(&proc->mapLock);
-						procMappingUnref(mapping);
-
-						if (err != NULL) *err = ENOMEM;
-						return MAP_FAILED;
-					};
+		// anonymous mappings which could hold a large page are placed on a large page boundary
+		uint64_t alignMask = 0xFFFUL;
+		if (fp == NULL && length >= LARGE_PAGE_SIZE) alignMask = LARGE_PAGE_SIZE - 1;
 
-					addr = (colliding->addr - length) & 0xFFFUL;
-					break;
-				};
-			};
+		// take the highest hole which is big enough
+		addr = vmaFindFree(&proc->vmas, length, alignMask, 0, PROC_USER_ADDR_MAX);
+		if (addr == VMA_NO_SPACE)
+		{
+			mutexUnlock(&proc->mapLock);
+			vmaDelete(vma);
 
-			if (scan > addr)
-			{
-				// we've scanned and there were no pages so we can use this
-				break;
-			};
+			if (err != NULL) *err = ENOMEM;
+			return MAP_FAILED;
 		};
+
+		vma->start = addr;
+		vma->end = addr + length;
 	};
 
-	for (scan=addr; scan<addr+length; scan+=PAGE_SIZE)
+	// anything already mapped in the range is replaced
+	errno_t status = _procUnmapRange(proc, addr, addr+length);
+	if (status != 0)
 	{
-		// get the page and fail with ENOMEM if we can't
-		PageNodeEntry *pte = _procGetPageTableEntry(scan);
-		if (pte == NULL)
-		{
-			status = ENOMEM;
-			break;
-		};
-
-		if (pte->value & PT_PRESENT)
-		{
-			void *page = komPhysToVirt(pte->value & PT_PHYS_MASK);
-			ASSERT(page != NULL);
+		mutexUnlock(&proc->mapLock);
+		vmaDelete(vma);
 
-			pte->value = 0;
+		if (err != NULL) *err = status;
+		return MAP_FAILED;
+	};
 
-			// inform other CPUs that the page was unmapped
-			invlpg((void*) scan);
-			cpuInvalidatePage(proc->cr3, (void*) scan);
+	vmaInsert(&proc->vmas, vma);
+	vmaMerge(&proc->vmas, vma);
+	mutexUnlock(&proc->mapLock);
 
-			komUserPageUnref(page);
-		};
+	return addr;
+};
 
-		// specify the access bits
-		if (prot & PROT_READ) pte->value |= PT_PROT_READ;
-		if (prot & PROT_WRITE) pte->value |= PT_PROT_WRITE;
-		if (prot & PROT_EXEC) pte->value |= PT_PROT_EXEC;
+int procUnmap(user_addr_t addr, size_t len)
+{
+	Process *proc = schedGetCurrentThread()->proc;
 
-		// try to map into the page mapping tree
-		uint32_t pageIndex = (scan >> 12);
-		ProcessMapping *old = (ProcessMapping*) treemapGet(proc->mappingTree, pageIndex);
-		status = treemapSet(proc->mappingTree, pageIndex, mapping);
-		if (status != 0) break;
+	if ((addr & 0xFFF) || len == 0)
+	{
+		return -EINVAL;
+	};
 
-		// upref the new mapping and downref the old
-		procMappingDup(mapping);
-		if (old != NULL) procMappingUnref(old);
+	if (addr >= PROC_USER_ADDR_MAX)
+	{
+		return 0;
 	};
+
+	mutexLock(&proc->mapLock);
+	errno_t status = _procUnmapRange(proc, addr, _procRangeEnd(addr, len));
 	mutexUnlock(&proc->mapLock);
 
-	// get rid of our initial reference
-	procMappingUnref(mapping);
+	return -status;
+};
 
-	if (status != 0)
+static int _procUnshareCallback(Process *proc, user_addr_t addr, PageNodeEntry *ent, int level, void *context)
+{
+	errno_t *statusOut = (errno_t*) context;
+	if (level != 2 || (ent->value & (PT_HUGE | PT_SHARED)) != PT_SHARED)
 	{
-		// an error occured
-		if (err != NULL) *err = status;
-		return MAP_FAILED;
+		return 0;
 	};
 
-	return addr;
+	*statusOut = _procUnshareTable(proc, addr, ent);
+	return *statusOut;
 };
 
-int procUnmap(user_addr_t addr, size_t len)
+/**
+ * Context of the page walk in `procProtect()`.
+ */
+typedef struct
 {
-	Process *proc = schedGetCurrentThread()->proc;
+	/**
+	 * The area whose pages are being changed.
+	 */
+	VMA *vma;
+
+	/**
+	 * The TLB invalidations.
+	 */
+	TLBBatch tlb;
+} ProtectContext;
+
+static int _procProtectPageCallback(Process *proc, user_addr_t addr, PageNodeEntry *ent, int level, void *context)
+{
+	ProtectContext *ctx = (ProtectContext*) context;
+	VMA *vma = ctx->vma;
 
-	if (len == 0)
+	// page tables are walked into; none are shared anymore
+	if (level == 2 && (ent->value & PT_HUGE) == 0)
 	{
-		return -EINVAL;
+		return 0;
 	};
 
-	int status = 0;
-	mutexLock(&proc->mapLock);
-	user_addr_t scan;
-	for (scan=addr; scan<addr+len; scan+=PAGE_SIZE)
+	// pages which are swapped out get their protection from the area when they are faulted back in
+	if ((ent->value & PT_PRESENT) == 0)
 	{
-		if (scan >= PROC_USER_ADDR_MAX) break;
+		return 0;
+	};
 
-		ProcessMapping *mapping = treemapGet(proc->mappingTree, scan >> 12);
-		if (mapping == NULL) continue;
+	uint64_t value = (ent->value & ~(PT_PROT_MASK | PT_WRITE | PT_NOEXEC)) | _procProtBits(vma->prot);
+	if ((vma->prot & PROT_EXEC) == 0) value |= PT_NOEXEC;
 
-		PageNodeEntry *pte = _procGetPageTableEntry(scan);
-		if (pte != NULL && pte->value & PT_PRESENT)
-		{
-			void *canon = komPhysToVirt(pte->value & PT_PHYS_MASK);
-			ASSERT(canon != NULL);
-
-			pte->value = 0;
-			invlpg((void*) scan);
-			cpuInvalidatePage(proc->cr3, (void*) scan);
-			
-			komUserPageUnref(canon);
-		};
+	if (vma->prot & PROT_WRITE)
+	{
+		// a page of a private mapping which was read-only might be shared with another process, so it
+		// can only be written to after copying
+		if ((ent->value & PT_WRITE) || (vma->mflags & MAP_SHARED)) value |= PT_WRITE;
+		else value |= PT_COW;
+	};
 
-		treemapSet(proc->mappingTree, scan >> 12, NULL);
-		procMappingUnref(mapping);
+	if (value != ent->value)
+	{
+		ent->value = value;
+		cpuBatchAdd(&ctx->tlb, (void*) addr);
 	};
-	mutexUnlock(&proc->mapLock);
 
-	return status;
+	return 0;
 };
 
 int procProtect(user_addr_t addr, size_t len, int prot)
@@ -730,85 +1337,139 @@ int procProtect(user_addr_t addr, size_t len, int prot)
 		return -EINVAL;
 	};
 
-	if (len == 0)
+	if ((addr & 0xFFF) || len == 0)
 	{
 		return -EINVAL;
 	};
 
-	int status = 0;
+	if (addr >= PROC_USER_ADDR_MAX || len > PROC_USER_ADDR_MAX - addr)
+	{
+		return -ENOMEM;
+	};
+
+	user_addr_t end = _procRangeEnd(addr, len);
+
 	mutexLock(&proc->mapLock);
-	user_addr_t scan;
-	for (scan=addr; scan<addr+len; scan+=PAGE_SIZE)
+	if (!_procIsMapped(proc, addr, end))
 	{
-		ProcessMapping *mapping = treemapGet(proc->mappingTree, scan >> 12);
-		if (mapping == NULL)
-		{
-			status = -ENOMEM;
-			break;
-		};
+		mutexUnlock(&proc->mapLock);
+		return -ENOMEM;
+	};
 
+	VMA *vma;
+	for (vma=vmaFind(&proc->vmas, addr); vma != NULL && vma->start < end; vma=vmaNext(&proc->vmas, vma))
+	{
 		int allowedPerms = PROT_READ | PROT_EXEC;
-		if (mapping->mflags & MAP_PRIVATE || mapping->oflags & O_WRONLY)
+		if (vma->mflags & MAP_PRIVATE || vma->oflags & O_WRONLY)
 		{
 			allowedPerms |= PROT_WRITE;
 		};
 
 		if ((prot & allowedPerms) != prot)
 		{
-			status = -EACCES;
-			break;
+			mutexUnlock(&proc->mapLock);
+			return -EACCES;
 		};
+	};
 
-		int setPermBits = 0;
-		if (prot & PROT_READ) setPermBits |= PT_PROT_READ;
-		if (prot & PROT_WRITE) setPermBits |= PT_PROT_WRITE;
-		if (prot & PROT_EXEC) setPermBits |= PT_PROT_EXEC;
+	if (_procSplitRange(proc, addr, end) != 0)
+	{
+		mutexUnlock(&proc->mapLock);
+		return -ENOMEM;
+	};
 
-		PageNodeEntry *pte = _procGetPageTableEntry(scan);
-		if (pte == NULL)
-		{
-			status = -ENOMEM;
-			break;
-		};
+	// the entries are changed in place, so page tables still shared since fork must be copied first
+	errno_t status = 0;
+	if (_procWalkPages(proc, addr, end, _procUnshareCallback, &status) != 0)
+	{
+		_procMergeRange(proc, addr, end);
+		mutexUnlock(&proc->mapLock);
+		return -status;
+	};
 
-		pte->value = (pte->value & ~PT_PROT_MASK) | setPermBits;
-		if ((prot & PROT_EXEC) == 0) pte->value = PT_NOEXEC;
-		if ((prot & PROT_WRITE) == 0) pte->value &= ~PT_WRITE;
+	ProtectContext ctx;
+	cpuBatchInit(&ctx.tlb, proc->cr3);
 
-		invlpg((void*) scan);
-		cpuInvalidatePage(proc->cr3, (void*) scan);
+	for (vma=vmaFind(&proc->vmas, addr); vma != NULL && vma->start < end; vma=vmaNext(&proc->vmas, vma))
+	{
+		vma->prot = prot;
+		ctx.vma = vma;
+		_procWalkPages(proc, vma->start, vma->end, _procProtectPageCallback, &ctx);
 	};
+
+	cpuBatchFlush(&ctx.tlb);
+
+	_procMergeRange(proc, addr, end);
 	mutexUnlock(&proc->mapLock);
 
-	return status;
+	return 0;
 };
 
-static void _procUnmapWalkCallback(TreeMap *mappingTree, uint32_t pageIndex, void *value, void *context)
+static int _procAdviseSplitCallback(Process *proc, user_addr_t addr, PageNodeEntry *ent, int level, void *context)
 {
-	Process *proc = (Process*) context;
-	ProcessMapping *mapping = (ProcessMapping*) value;
+	errno_t *statusOut = (errno_t*) context;
+	if (level != 2 || (ent->value & PT_HUGE) == 0)
+	{
+		return 0;
+	};
 
-	// remove from the mapping tree
-	treemapSet(mappingTree, pageIndex, NULL);
+	PageNodeEntry *nodes[4];
+	pagetabGetNodes((void*) addr, nodes);
 
-	// unref it
-	procMappingUnref(mapping);
+	*statusOut = _procSplitLargePage(ent, nodes[3]);
+	return *statusOut;
+};
 
-	// if the PTE is mapped, unmap it, unref the page, invalidate
-	user_addr_t userAddr = ((user_addr_t) pageIndex) << 12;
-	PageNodeEntry *pte = _procGetPageTableEntry(userAddr);
+int procAdvise(user_addr_t addr, size_t len, int advice)
+{
+	Process *proc = schedGetCurrentThread()->proc;
+	if ((addr & 0xFFF) || len == 0)
+	{
+		return -EINVAL;
+	};
+
+	if (advice != MADV_NORMAL && advice != MADV_HUGEPAGE && advice != MADV_NOHUGEPAGE)
+	{
+		return -EINVAL;
+	};
+
+	if (advice == MADV_NORMAL)
+	{
+		return 0;
+	};
+
+	if (addr >= PROC_USER_ADDR_MAX || len > PROC_USER_ADDR_MAX - addr)
+	{
+		return -ENOMEM;
+	};
+
+	user_addr_t end = _procRangeEnd(addr, len);
+
+	mutexLock(&proc->mapLock);
+	if (!_procIsMapped(proc, addr, end) || _procSplitAreas(proc, addr, end) != 0)
+	{
+		mutexUnlock(&proc->mapLock);
+		return -ENOMEM;
+	};
+
+	VMA *vma;
+	for (vma=vmaFind(&proc->vmas, addr); vma != NULL && vma->start < end; vma=vmaNext(&proc->vmas, vma))
+	{
+		if (advice == MADV_HUGEPAGE) vma->flags &= ~VMA_NOHUGE;
+		else vma->flags |= VMA_NOHUGE;
+	};
 
-	if (pte != NULL && pte->value & PT_PRESENT)
+	// with MADV_NOHUGEPAGE, large pages already in the range are split
+	errno_t status = 0;
+	if (advice == MADV_NOHUGEPAGE)
 	{
-		void *canon = komPhysToVirt(pte->value & PT_PHYS_MASK);
-		ASSERT(canon != NULL);
-
-		pte->value = 0;
-		invlpg((void*) userAddr);
-		cpuInvalidatePage(proc->cr3, (void*) userAddr);
-		
-		komUserPageUnref(canon);
+		_procWalkPages(proc, addr, end, _procAdviseSplitCallback, &status);
 	};
+
+	_procMergeRange(proc, addr, end);
+	mutexUnlock(&proc->mapLock);
+
+	return -status;
 };
 
 void procBeginExec()
@@ -838,9 +1499,9 @@ void procBeginExec()
 	};
 	mutexUnlock(&proc->fileTableLock);
 	
-	// unmap all userspace pages
+	// unmap all userspace pages; the whole range needs no splitting, so this can't fail
 	mutexLock(&proc->mapLock);
-	treemapWalk(proc->mappingTree, _procUnmapWalkCallback, proc);
+	_procUnmapRange(proc, 0, PROC_USER_ADDR_MAX);
 	mutexUnlock(&proc->mapLock);
 };
 
@@ -862,6 +1523,155 @@ static int _procPageFaultInvalid(Process *proc, user_addr_t addr, ksiginfo_t *si
 	return -1;
 };
 
+/**
+ * Return nonzero if the large page mapped by `pde` is not mapped by anyone else, nor pinned by the kernel,
+ * so that a write to it needs no copy.
+ */
+static int _procLargePageExclusive(PageNodeEntry *pde)
+{
+	void *page = komPhysToVirt(pde->value & PT_PHYS_MASK);
+	ASSERT(page != NULL);
+
+	KOM_PageDesc *desc = komGetPageDesc(page);
+
+	int i;
+	for (i=0; i<KOM_LARGE_PAGE_PAGES; i++)
+	{
+		if (desc[i].refcount != 1)
+		{
+			return 0;
+		};
+	};
+
+	return 1;
+};
+
+/**
+ * Try to handle a fault on anonymous memory at `addr`, in the area `vma`, by mapping a whole large page.
+ * This is only done if the area covers the whole large-page-aligned range around `addr`, none of which was
+ * faulted in yet, the area is anonymous and without `MADV_NOHUGEPAGE`, and a free large block is available.
+ * The page table for `addr` must already exist. Returns 0 if the large page was mapped, or -1 if the caller
+ * should fall back to a 4 KB page.
+ */
+static int _procMapLargePage(Process *proc, VMA *vma, user_addr_t addr)
+{
+	user_addr_t base = addr & ~(LARGE_PAGE_SIZE-1);
+	if (vma->inode != NULL || (vma->flags & VMA_NOHUGE) || base < vma->start || base + LARGE_PAGE_SIZE > vma->end)
+	{
+		return -1;
+	};
+
+	PageNodeEntry *nodes[4];
+	pagetabGetNodes((void*) base, nodes);
+
+	// `base` is aligned, so this is the start of the page table
+	uint64_t *pt = (uint64_t*) nodes[3];
+
+	int i;
+	for (i=0; i<KOM_LARGE_PAGE_PAGES; i++)
+	{
+		if (pt[i] != 0)
+		{
+			return -1;
+		};
+	};
+
+	void *page = komAllocUserLargePage();
+	if (page == NULL)
+	{
+		return -1;
+	};
+
+	memset(page, 0, LARGE_PAGE_SIZE);
+
+	uint64_t permsSet = _procProtBits(vma->prot);
+	uint64_t newPDE = pagetabGetPhys(page) | PT_PRESENT | PT_USER | PT_HUGE | permsSet;
+	ASSERT((newPDE & PT_PHYS_MASK & (LARGE_PAGE_SIZE-1)) == 0);
+
+	if (permsSet & PT_PROT_WRITE) newPDE |= PT_WRITE;
+	if ((permsSet & PT_PROT_EXEC) == 0) newPDE |= PT_NOEXEC;
+
+	// replace the (empty) page table with the large page, and make sure no CPU keeps a recursive
+	// mapping of the old table before releasing it
+	void *oldTable = komPhysToVirt(nodes[2]->value & PT_PHYS_MASK);
+	ASSERT(oldTable != NULL);
+
+	nodes[2]->value = newPDE;
+	invlpg(nodes[3]);
+	cpuInvalidatePage(proc->cr3, nodes[3]);
+
+	komReleaseBlock(oldTable, KOM_BUCKET_PAGE);
+	komCounterAdd(KOM_COUNTER_PAGE_TABLES, -PAGE_SIZE);
+
+	proc->rss += KOM_LARGE_PAGE_PAGES;
+	return 0;
+};
+
+/**
+ * After a read fault on the file page at `addr` in `vma`, map the pages of the aligned fault-around window
+ * containing it which are already in the page cache, so that accessing them later does not fault; nothing is
+ * loaded, and entries which are already in use are left alone. `pte` is the entry of `addr`, in a page table
+ * which is not shared, and `permsSet` the protection bits of the area. Call this with the `mapLock` held.
+ */
+static void _procFaultAround(Process *proc, VMA *vma, user_addr_t addr, PageNodeEntry *pte, uint64_t permsSet)
+{
+	int window = procFaultAroundPages;
+	if (window <= 1)
+	{
+		return;
+	};
+
+	// the window is a power of 2 no larger than a page table, so it lies in the same one as `addr`
+	user_addr_t start = addr & ~((user_addr_t) window * PAGE_SIZE - 1);
+	user_addr_t end = start + (user_addr_t) window * PAGE_SIZE;
+	if (start < vma->start) start = vma->start;
+	if (end > vma->end) end = vma->end;
+
+	int count = (int) ((end - start) >> 12);
+	PageNodeEntry *first = pte - ((addr - start) >> 12);
+
+	void *pages[PROC_FAULT_AROUND_MAX];
+	if (vfsInodeGetCachedPages(vma->inode, vma->offset + start - vma->start, count, pages) == 0)
+	{
+		return;
+	};
+
+	uint64_t bits = PT_PRESENT | PT_USER | permsSet;
+	if (permsSet & PT_PROT_WRITE)
+	{
+		bits |= (vma->mflags & MAP_SHARED) ? PT_WRITE : PT_COW;
+	};
+
+	if ((permsSet & PT_PROT_EXEC) == 0)
+	{
+		bits |= PT_NOEXEC;
+	};
+
+	// the entries were not present, so no TLB can hold them
+	int mapped = 0;
+	int i;
+	for (i=0; i<count; i++)
+	{
+		if (pages[i] == NULL)
+		{
+			continue;
+		};
+
+		if (first[i].value != 0)
+		{
+			komUserPageUnref(pages[i]);
+			continue;
+		};
+
+		first[i].value = pagetabGetPhys(pages[i]) | bits;
+		mapped++;
+	};
+
+	proc->rss += mapped;
+	__sync_fetch_and_add(&procFaultAroundStats.faults, 1);
+	__sync_fetch_and_add(&procFaultAroundStats.pagesMapped, mapped);
+};
+
 static int _procPageFault(user_addr_t addr, int faultFlags, ksiginfo_t *siginfo)
 {
 	Process *proc = schedGetCurrentThread()->proc;
@@ -872,35 +1682,111 @@ static int _procPageFault(user_addr_t addr, int faultFlags, ksiginfo_t *siginfo)
 		return _procPageFaultInvalid(proc, addr, siginfo, SIGSEGV, SEGV_MAPERR);
 	};
 
-	// get the mapping at that location
+	// get the area at that location
 	uint32_t pageIndex = addr >> 12;
-	ProcessMapping *mapping = (ProcessMapping*) treemapGet(proc->mappingTree, pageIndex);
-	if (mapping == NULL)
+	VMA *vma = vmaFind(&proc->vmas, addr);
+	if (vma == NULL)
 	{
 		// no mapping at this address!
 		return _procPageFaultInvalid(proc, addr, siginfo, SIGSEGV, SEGV_MAPERR);
 	};
 
-	// mapping exists, now get the page itself
-	PageNodeEntry *pte = _procGetPageTableEntry(addr);
-
 	// check if we have the required permissions
 	uint64_t requiredPerms = PT_PROT_READ;
 	if (faultFlags & PF_WRITE) requiredPerms |= PT_PROT_WRITE;
 	if (faultFlags & PF_FETCH) requiredPerms |= PT_PROT_EXEC;
 
-	uint64_t permsSet = pte->value & PT_PROT_MASK;
+	uint64_t permsSet = _procProtBits(vma->prot);
 	if ((permsSet & requiredPerms) != requiredPerms)
 	{
 		// not all permissions were granted
 		return _procPageFaultInvalid(proc, addr, siginfo, SIGSEGV, SEGV_ACCERR);
 	};
 
-	// if it's not yet called into memory, call it in now
+	// reading a page which is already mapped changes nothing; check this first, so that a page table
+	// shared since fork is not copied just because the kernel reads user memory through it
+	if ((faultFlags & PF_WRITE) == 0)
+	{
+		PageNodeEntry *pte = _procLookupForeignPageTableEntry(proc->pagetabVirt, addr, 1);
+		if (pte != NULL && (pte->value & PT_PRESENT))
+		{
+			invlpg((void*) addr);
+			return 0;
+		};
+	};
+
+	// if the address is in a large page, there is nothing to do unless we are writing to a copy-on-write
+	// large page; if nobody else uses it, just make it writeable, otherwise split it, and only copy the
+	// 4 KB page being written to
+	PageNodeEntry *pde = _procGetPageNode(addr, 2);
+	if (pde == NULL)
+	{
+		return _procPageFaultInvalid(proc, addr, siginfo, SIGBUS, BUS_ADRERR);
+	};
+
+	if (pde->value & PT_HUGE)
+	{
+		if ((faultFlags & PF_WRITE) == 0 || (pde->value & PT_COW) == 0)
+		{
+			invlpg((void*) addr);
+			return 0;
+		};
+
+		if (_procLargePageExclusive(pde))
+		{
+			pde->value = (pde->value & ~PT_COW) | PT_WRITE;
+			invlpg((void*) addr);
+			return 0;
+		};
+	};
+
+	// mapping exists, now get the page itself
+	PageNodeEntry *pte = _procGetPageTableEntry(addr);
+	if (pte == NULL)
+	{
+		return _procPageFaultInvalid(proc, addr, siginfo, SIGBUS, BUS_ADRERR);
+	};
+
+	// if the page was swapped out, bring it back in
+	if ((pte->value & (PT_PRESENT | PT_SWAP)) == PT_SWAP)
+	{
+		void *page = komAllocUserPage();
+		if (page == NULL)
+		{
+			return _procPageFaultInvalid(proc, addr, siginfo, SIGBUS, BUS_ADRERR);
+		};
+
+		uint64_t slot = PT_SWAP_SLOT(pte->value);
+		if (zramLoad(slot, page) != 0)
+		{
+			komUserPageUnref(page);
+			return _procPageFaultInvalid(proc, addr, siginfo, SIGBUS, BUS_OBJERR);
+		};
+
+		zramFree(slot);
+		komSetPageOwner(page, KOM_PAGE_ANON, proc->pid, pageIndex);
+
+		// only anonymous memory is swapped out, so the page is ours to write to
+		uint64_t newPTE = pagetabGetPhys(page) | PT_PRESENT | PT_USER | permsSet;
+		if (permsSet & PT_PROT_WRITE) newPTE |= PT_WRITE;
+		if ((permsSet & PT_PROT_EXEC) == 0) newPTE |= PT_NOEXEC;
+
+		pte->value = newPTE;
+		proc->rss++;
+	};
+
+	// if it's not yet called into memory, call it in now; anonymous memory gets a whole large page
+	// at once if possible
+	if ((pte->value & PT_PRESENT) == 0 && vma->inode == NULL && _procMapLargePage(proc, vma, addr) == 0)
+	{
+		invlpg((void*) addr);
+		return 0;
+	};
+
 	if ((pte->value & PT_PRESENT) == 0)
 	{
-		off_t offset = (mapping->offset + addr - mapping->addr) & ~0xFFFUL;
-		void *page = vfsInodeGetPage(mapping->inode, offset);
+		off_t offset = (vma->offset + addr - vma->start) & ~0xFFFUL;
+		void *page = vfsInodeGetPage(vma->inode, offset);
 
 		if (page == NULL)
 		{
@@ -909,7 +1795,7 @@ static int _procPageFault(user_addr_t addr, int faultFlags, ksiginfo_t *siginfo)
 		};
 
 		uint64_t newPTE = pagetabGetPhys(page) | PT_PRESENT | PT_USER | permsSet;
-		if (mapping->inode == NULL)
+		if (vma->inode == NULL)
 		{
 			// anonymous mapping, so allow writing to it even whether private or shared,
 			// if we have write permission; we don't need to copy-on-write as this is
@@ -918,8 +1804,10 @@ static int _procPageFault(user_addr_t addr, int faultFlags, ksiginfo_t *siginfo)
 			{
 				newPTE |= PT_WRITE;
 			};
+
+			komSetPageOwner(page, KOM_PAGE_ANON, proc->pid, pageIndex);
 		}
-		else if (mapping->mflags & MAP_SHARED)
+		else if (vma->mflags & MAP_SHARED)
 		{
 			// shared mapping, so if we have write permission, allow code to write to
 			// this page directly
@@ -945,14 +1833,33 @@ static int _procPageFault(user_addr_t addr, int faultFlags, ksiginfo_t *siginfo)
 
 		// set it
 		pte->value = newPTE;
+		proc->rss++;
+
+		// map the cached pages around it as well, so that reading through the file does not fault
+		// on every page
+		if (vma->inode != NULL && (faultFlags & PF_WRITE) == 0)
+		{
+			_procFaultAround(proc, vma, addr, pte, permsSet);
+		};
 	};
 
-	// if we are trying to write, and the page is copy-on-write, copy it
+	// if we are trying to write, and the page is copy-on-write, copy it; unless nobody else maps it
+	// anymore (the other processes wrote to it or went away), in which case it is simply ours now. page
+	// cache pages are always copied, as the file still has them
 	if ((faultFlags & PF_WRITE) && (pte->value & PT_COW))
 	{
 		void *oldPage = komPhysToVirt(pte->value & PT_PHYS_MASK);
 		ASSERT(oldPage != NULL);
 
+		KOM_PageDesc *desc = komGetPageDesc(oldPage);
+		if (desc->refcount == 1 && (desc->flags & KOM_PAGE_CACHE) == 0)
+		{
+			komSetPageOwner(oldPage, KOM_PAGE_ANON, proc->pid, pageIndex);
+			pte->value = (pte->value & ~PT_COW) | PT_WRITE;
+			invlpg((void*) addr);
+			return 0;
+		};
+
 		void *newPage = komAllocUserPage();
 		if (newPage == NULL)
 		{
@@ -960,8 +1867,9 @@ static int _procPageFault(user_addr_t addr, int faultFlags, ksiginfo_t *siginfo)
 			return _procPageFaultInvalid(proc, addr, siginfo, SIGBUS, BUS_ADRERR);
 		};
 
-		// copy to the new page
+		// copy to the new page; it is now anonymous memory, whatever the mapping is
 		memcpy(newPage, oldPage, PAGE_SIZE);
+		komSetPageOwner(newPage, KOM_PAGE_ANON, proc->pid, pageIndex);
 
 		// create the new, writeable PTE, mark it no-exec if we don't hav exec permission
 		uint64_t newPTE = pagetabGetPhys(newPage) | PT_PRESENT | PT_USER | PT_WRITE | permsSet;
@@ -1117,6 +2025,32 @@ Process* procByPID(pid_t pid)
 	return proc;
 };
 
+/**
+ * Context of `procWalk()`.
+ */
+typedef struct
+{
+	ProcWalkCallback callback;
+	void *context;
+} ProcWalkContext;
+
+static void _procWalkCallback(TreeMap *treemap, uint32_t index, void *value, void *context_)
+{
+	ProcWalkContext *ctx = (ProcWalkContext*) context_;
+	ctx->callback((Process*) value, ctx->context);
+};
+
+void procWalk(ProcWalkCallback callback, void *context)
+{
+	ProcWalkContext ctx;
+	ctx.callback = callback;
+	ctx.context = context;
+
+	mutexLock(&procTableLock);
+	treemapWalk(procTable, _procWalkCallback, &ctx);
+	mutexUnlock(&procTableLock);
+};
+
 Process* procDup(Process *proc)
 {
 	__sync_add_and_fetch(&proc->refcount, 1);
@@ -1289,8 +2223,14 @@ noreturn void procExitThread(thretval_t retval)
 	Thread *thread = schedGetCurrentThread();
 	Process *proc = thread->proc;
 
-	// if we are a detached thread, remove us from the thread table
+	// move our CPU time into the process totals, and if we are a detached thread,
+	// remove us from the thread table
 	mutexLock(&proc->threadTableLock);
+	schedAccountSystem();
+	proc->utime += thread->utime;
+	proc->stime += thread->stime;
+	thread->utime = thread->stime = 0;
+
 	if (thread->isDetached)
 	{
 		treemapSet(proc->threads, thread->thid, NULL);
@@ -1453,6 +2393,13 @@ pid_t procWait(pid_t pid, int *wstatus, int flags)
 		proc->childWaiter = NULL;
 	};
 
+	// the reaped child's CPU time now counts towards our children's time
+	if (ctx.child != NULL)
+	{
+		proc->cutime += ctx.child->utime + ctx.child->cutime;
+		proc->cstime += ctx.child->stime + ctx.child->cstime;
+	};
+
 	mutexUnlock(&procTableLock);
 	if (ctx.child != NULL) procUnref(ctx.child);
 	if (wstatus != NULL) *wstatus = ctx.wstatus;
@@ -1462,6 +2409,7 @@ pid_t procWait(pid_t pid, int *wstatus, int flags)
 static void _procWakeThreadsWalkCallback(TreeMap *map, uint32_t thid, void *th_, void *context_)
 {
 	Thread *thread = (Thread*) th_;
+	schedPostWork(thread, THREAD_WORK_SIGNAL);
 	schedWake(thread);
 };
 
@@ -1472,6 +2420,40 @@ void procWakeThreads(Process *proc)
 	mutexUnlock(&proc->threadTableLock);
 };
 
+static void _procSumCPUTimesWalkCallback(TreeMap *map, uint32_t thid, void *th_, void *context_)
+{
+	Thread *thread = (Thread*) th_;
+	ProcCPUTimes *ticks = (ProcCPUTimes*) context_;
+
+	ticks->utime += thread->utime;
+	ticks->stime += thread->stime;
+};
+
+void procGetCPUTimes(ProcCPUTimes *times)
+{
+	Process *proc = schedGetCurrentThread()->proc;
+	ProcCPUTimes ticks;
+
+	// bring our own counters up to date
+	schedAccountSystem();
+
+	mutexLock(&proc->threadTableLock);
+	ticks.utime = proc->utime;
+	ticks.stime = proc->stime;
+	treemapWalk(proc->threads, _procSumCPUTimesWalkCallback, &ticks);
+	mutexUnlock(&proc->threadTableLock);
+
+	mutexLock(&procTableLock);
+	ticks.cutime = proc->cutime;
+	ticks.cstime = proc->cstime;
+	mutexUnlock(&procTableLock);
+
+	times->utime = schedTicksToNanos(ticks.utime);
+	times->stime = schedTicksToNanos(ticks.stime);
+	times->cutime = schedTicksToNanos(ticks.cutime);
+	times->cstime = schedTicksToNanos(ticks.cstime);
+};
+
 static void _procFindGroupWalkCallback(TreeMap *tm, uint32_t pid, void *value_, void *context_)
 {
 	int *resultOut = (int*) context_;
@@ -1670,4 +2652,211 @@ void* procGetUserPage(user_addr_t addr, int faultFlags)
 
 	mutexUnlock(&proc->mapLock);
 	return page;
+};
+
+/**
+ * Context of the swap-out walks.
+ */
+typedef struct
+{
+	/**
+	 * The processes to scan (referenced), and how many there are.
+	 */
+	Process *procs[ZRAM_SCAN_PROCS];
+	int numProcs;
+
+	/**
+	 * Number of pages to swap out, swapped out so far, and scanned in the current process.
+	 */
+	size_t target;
+	size_t swapped;
+	size_t scanned;
+
+	/**
+	 * Set when the compressed pool is full, to stop scanning.
+	 */
+	int full;
+} SwapOutContext;
+
+static void _procSwapCollectCallback(TreeMap *treemap, uint32_t pid, void *value, void *context)
+{
+	SwapOutContext *ctx = (SwapOutContext*) context;
+	if ((pid_t) pid <= procSwapCursor || ctx->numProcs == ZRAM_SCAN_PROCS)
+	{
+		return;
+	};
+
+	ctx->procs[ctx->numProcs++] = procDup((Process*) value);
+};
+
+static int _procSwapOutPageCallback(Process *proc, user_addr_t addr, PageNodeEntry *pte, int level, void *context)
+{
+	SwapOutContext *ctx = (SwapOutContext*) context;
+
+	if (ctx->full || ctx->swapped >= ctx->target || ctx->scanned >= ZRAM_SCAN_PAGES)
+	{
+		return 1;
+	};
+
+	// large pages are never swapped out, nor are pages in page tables shared since fork (which are not
+	// walked into); other page tables are
+	if (level != 3)
+	{
+		if (pte->value & (PT_HUGE | PT_SHARED)) proc->swapCursor = (addr >> 12) + KOM_LARGE_PAGE_PAGES;
+		return 0;
+	};
+
+	proc->swapCursor = (addr >> 12) + 1;
+	ctx->scanned++;
+
+	if ((pte->value & PT_PRESENT) == 0)
+	{
+		return 0;
+	};
+
+	// CLOCK: a page which was accessed since the last scan gets another chance. We don't flush the
+	// TLB here, so a CPU may keep using the page without setting the bit again; that only makes it
+	// more likely to be swapped out next time
+	uint64_t ent = __sync_fetch_and_and(&pte->value, ~PT_ACCESSED);
+	if (ent & PT_ACCESSED)
+	{
+		return 0;
+	};
+
+	// pages shared with other processes (or pinned by the kernel) stay
+	void *page = komPhysToVirt(ent & PT_PHYS_MASK);
+	ASSERT(page != NULL);
+	if (komGetPageDesc(page)->refcount != 1)
+	{
+		return 0;
+	};
+
+	// unmap it before compressing, so that the contents can no longer change
+	ent = __sync_fetch_and_and(&pte->value, ~PT_PRESENT);
+	invlpg((void*) addr);
+	cpuInvalidatePage(proc->cr3, (void*) addr);
+
+	uint64_t slot;
+	errno_t status = zramStore(page, &slot);
+	if (status != 0)
+	{
+		pte->value = ent;
+		if (status != EINVAL) ctx->full = 1;
+		return 0;
+	};
+
+	pte->value = PT_SWAP | (slot << PT_SWAP_SHIFT);
+	proc->rss--;
+	komUserPageUnref(page);
+
+	ctx->swapped++;
+	return 0;
+};
+
+size_t procSwapOut(size_t numPages)
+{
+	SwapOutContext ctx;
+	ctx.numProcs = 0;
+	ctx.target = numPages;
+	ctx.swapped = 0;
+	ctx.full = 0;
+
+	// pick the next few processes
+	if (mutexTryLockForReclaim(&procTableLock) != 0)
+	{
+		return 0;
+	};
+
+	treemapWalk(procTable, _procSwapCollectCallback, &ctx);
+	if (ctx.numProcs == ZRAM_SCAN_PROCS) procSwapCursor = ctx.procs[ctx.numProcs-1]->pid;
+	else procSwapCursor = 0;
+
+	mutexUnlock(&procTableLock);
+
+	int i;
+	for (i=0; i<ctx.numProcs; i++)
+	{
+		Process *proc = ctx.procs[i];
+		if (ctx.swapped < ctx.target && !ctx.full && mutexTryLockForReclaim(&proc->mapLock) == 0)
+		{
+			ctx.scanned = 0;
+
+			// continue where the previous scan of this process stopped, and only look at anonymous memory
+			user_addr_t cursor = ((user_addr_t) proc->swapCursor) << 12;
+			VMA *vma;
+			for (vma=vmaFindAfter(&proc->vmas, cursor); vma != NULL; vma=vmaNext(&proc->vmas, vma))
+			{
+				if (vma->inode != NULL) continue;
+
+				user_addr_t start = vma->start > cursor ? vma->start : cursor;
+				if (_procWalkPages(proc, start, vma->end, _procSwapOutPageCallback, &ctx) != 0) break;
+			};
+
+			// start from the beginning next time if we got to the end
+			if (ctx.scanned < ZRAM_SCAN_PAGES && ctx.swapped < ctx.target && !ctx.full)
+			{
+				proc->swapCursor = 0;
+			};
+
+			__sync_fetch_and_add(&reclaimStats.anonScanned, ctx.scanned);
+			mutexUnlock(&proc->mapLock);
+		};
+
+		procUnref(proc);
+	};
+
+	__sync_fetch_and_add(&reclaimStats.anonSwapped, ctx.swapped);
+	return ctx.swapped;
+};
+
+errno_t procMigratePage(void *page, void *newPage)
+{
+	KOM_PageDesc *desc = komGetPageDesc(page);
+	uint64_t owner, index;
+	komGetPageOwner(page, &owner, &index);
+	pid_t pid = (pid_t) owner;
+	uint32_t pageIndex = (uint32_t) index;
+
+	if (mutexTryLockForReclaim(&procTableLock) != 0)
+	{
+		return EAGAIN;
+	};
+
+	Process *proc = (Process*) treemapGet(procTable, pid);
+	if (proc != NULL) procDup(proc);
+	mutexUnlock(&procTableLock);
+
+	if (proc == NULL)
+	{
+		return ESRCH;
+	};
+
+	errno_t status = EAGAIN;
+	if (mutexTryLockForReclaim(&proc->mapLock) == 0)
+	{
+		// the owner in the reverse map is only a hint; make sure the page is still mapped there, and
+		// by nothing else
+		user_addr_t addr = ((user_addr_t) pageIndex) << 12;
+		PageNodeEntry *pte = _procLookupForeignPageTableEntry(proc->pagetabVirt, addr, 0);
+		if (pte != NULL && (pte->value & PT_PRESENT) && (pte->value & PT_PHYS_MASK) == komVirtToPhys(page)
+			&& desc->refcount == 1)
+		{
+			// unmap it while copying, so that the contents can't change under us
+			uint64_t ent = __sync_fetch_and_and(&pte->value, ~PT_PRESENT);
+			invlpg((void*) addr);
+			cpuInvalidatePage(proc->cr3, (void*) addr);
+
+			memcpy(newPage, page, PAGE_SIZE);
+			komSetPageOwner(newPage, KOM_PAGE_ANON, pid, pageIndex);
+
+			pte->value = (ent & ~PT_PHYS_MASK) | komVirtToPhys(newPage);
+			komUserPageUnref(page);
+			status = 0;
+		};
+
+		mutexUnlock(&proc->mapLock);
+	};
+
+	procUnref(proc);
+	return status;
 };
\ No newline at end of file
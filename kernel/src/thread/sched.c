@@ -37,7 +37,9 @@
 #include <glidix/hw/idt.h>
 #include <glidix/hw/pagetab.h>
 #include <glidix/hw/msr.h>
+#include <glidix/hw/irq.h>
 #include <glidix/thread/process.h>
+#include <glidix/util/kmem.h>
 
 /**
  * The userspace aux code for returning from a signal handler.
@@ -64,6 +66,11 @@ static Runqueue runqueues[SCHED_NUM_QUEUES];
  */
 static Thread* schedGlobalCleanupThread;
 
+/**
+ * The cache of thread descriptions.
+ */
+static KmemCache* schedThreadCache;
+
 /**
  * The head of the 'detached thread list', where threads are added when they
  * are detached, so the cleanup thread can scan them.
@@ -71,9 +78,36 @@ static Thread* schedGlobalCleanupThread;
 static Thread* schedDetHead;
 
 /**
- * A quantum of time.
+ * A quantum of time. This is in APIC timer ticks, or in TSC ticks if `schedUseDeadline`
+ * is set.
+ */
+static uint64_t schedQuantum;
+
+/**
+ * Set to nonzero if we use the APIC timer in TSC-deadline mode.
+ */
+static int schedUseDeadline;
+
+/**
+ * Number of TSC ticks in a quantum (`SCHED_QUANTUM_NANO`), used to convert CPU times to
+ * nanoseconds.
+ */
+static uint64_t schedTSCQuantum;
+
+/**
+ * Start a new quantum on the calling CPU.
  */
-static uint32_t schedQuantum;
+static void schedResetTimer()
+{
+	if (schedUseDeadline)
+	{
+		wrmsr(MSR_TSC_DEADLINE, rdtsc() + schedQuantum);
+	}
+	else
+	{
+		apicWrite(APIC_REG(timerInitCount), (uint32_t) schedQuantum);
+	};
+};
 
 /**
  * In sched.asm: The code to jump to when entering a new thread.
@@ -112,8 +146,10 @@ void _schedUpdateTSS(void *kernelStack);
  */
 static void schedDestroyThread(Thread *thread)
 {
+	kfree(thread->execArgs);
 	kfree(thread->kernelStack);
-	kfree(thread);
+	komCounterAdd(KOM_COUNTER_KERNEL_STACKS, -(int64_t) thread->kernelStackSize);
+	kmemCacheFree(schedThreadCache, thread);
 };
 
 /**
@@ -163,6 +199,12 @@ static void schedCleanup()
 
 void schedInitGlobal()
 {
+	schedThreadCache = kmemCacheCreate("thread", sizeof(Thread), NULL);
+	if (schedThreadCache == NULL)
+	{
+		panic("Failed to create the thread cache!");
+	};
+
 	schedGlobalCleanupThread = schedCreateKernelThread(schedCleanup, NULL, NULL);
 };
 
@@ -170,7 +212,7 @@ void schedInitLocal()
 {
 	CPU *cpu = cpuGetCurrent();
 
-	Thread *initThread = (Thread*) kmalloc(sizeof(Thread));
+	Thread *initThread = (Thread*) kmemCacheAlloc(schedThreadCache);
 	if (initThread == NULL)
 	{
 		panic("ran out of memory while initializing scheduling locally!\n");
@@ -187,10 +229,8 @@ void schedInitLocal()
 	// activate the APIC timer if necessary
 	if (schedQuantum != 0)
 	{
-		apic.lvtTimer = I_APIC_TIMER;
-		__sync_synchronize();
-		apic.timerInitCount = schedQuantum;
-		__sync_synchronize();
+		apicWrite(APIC_REG(lvtTimer), I_APIC_TIMER | (schedUseDeadline ? APIC_LVT_TIMER_TSC_DEADLINE : APIC_LVT_TIMER_ONESHOT));
+		schedResetTimer();
 	};
 };
 
@@ -230,6 +270,10 @@ noreturn void _schedNext(void *stack)
 	CPU *cpu = cpuGetCurrent();
 	cpu->currentThread->retstack = stack;
 
+	// the thread we are switching away from was in the kernel since its last accounting point
+	uint64_t now = rdtsc();
+	cpu->currentThread->stime += now - cpu->currentThread->acctStamp;
+
 	int myCpuIndex = cpuGetMyIndex();
 	schedIdling[myCpuIndex] = 0;
 
@@ -244,6 +288,7 @@ noreturn void _schedNext(void *stack)
 			if (q->first == NULL) q->last = NULL;
 
 			cpu->currentThread = nextThread;
+			nextThread->acctStamp = now;
 
 			// switch to the correct CR3
 			if (nextThread->proc != NULL)
@@ -267,7 +312,7 @@ noreturn void _schedNext(void *stack)
 			spinlockRelease(&schedLock, 0);
 
 			// reset the timer
-			if (schedQuantum != 0) apic.timerInitCount = schedQuantum;
+			if (schedQuantum != 0) schedResetTimer();
 
 			// return into the thread
 			_schedReturn(nextThread->retstack);
@@ -277,6 +322,7 @@ noreturn void _schedNext(void *stack)
 	// release the spinlock, but keep interrupts disabled, then go into the
 	// idle state (which will enable interrupts)
 	cpu->currentThread = &cpu->idleThread;
+	cpu->idleThread.acctStamp = now;
 	cpu->idleThread.wakeCounter = 1;
 	schedIdling[myCpuIndex] = 1;
 	pagetabSetCR3(cpu->kernelCR3);
@@ -298,8 +344,7 @@ static void _schedWake(Thread *thread)
 	// we will be at the end of a runqueue
 	thread->next = NULL;
 
-	// TODO: determine priority and therefore which queue to use
-	Runqueue *q = &runqueues[0];
+	Runqueue *q = &runqueues[thread->priority];
 	if (q->last == NULL)
 	{
 		q->first = q->last = thread;
@@ -344,7 +389,7 @@ Thread* schedCreateKernelThread(KernelThreadFunc func, void *param, void *resv)
 		return NULL;
 	};
 
-	Thread *thread = (Thread*) kmalloc(sizeof(Thread));
+	Thread *thread = (Thread*) kmemCacheAlloc(schedThreadCache);
 	if (thread == NULL)
 	{
 		kfree(kernelStack);
@@ -355,6 +400,11 @@ Thread* schedCreateKernelThread(KernelThreadFunc func, void *param, void *resv)
 
 	thread->kernelStack = kernelStack;
 	thread->kernelStackSize = stackSize;
+	komCounterAdd(KOM_COUNTER_KERNEL_STACKS, stackSize);
+
+	// the thread may be joining a process with signals already pending, so make sure
+	// it checks for them
+	thread->workPending = THREAD_WORK_SIGNAL;
 
 	// create the initial stack frame
 	uint64_t rsp = (uint64_t) kernelStack + stackSize;
@@ -448,28 +498,56 @@ void schedDetachKernelThread(Thread *thread)
 #include <glidix/util/log.h>
 void schedInitTimer()
 {
-	apic.timerDivide = 3;
-	__sync_synchronize();
-	apic.timerInitCount = 0xFFFFFFFF;
-	__sync_synchronize();
-	
-	nanoseconds_t start = timeGetUptime();
-	while (timeGetUptime() < start+SCHED_QUANTUM_NANO);
+	if (apicHasTSCDeadline)
+	{
+		// measure how many TSC ticks make up a quantum
+		nanoseconds_t start = timeGetUptime();
+		uint64_t startTSC = rdtsc();
+		while (timeGetUptime() < start+SCHED_QUANTUM_NANO);
+		uint64_t quantum = rdtsc() - startTSC;
+		schedTSCQuantum = quantum;
 
-	apic.lvtTimer = 0;
-	__sync_synchronize();
-	schedQuantum = 0xFFFFFFFF - apic.timerCurrentCount;
-	__sync_synchronize();
-	apic.timerInitCount = 0;
-	__sync_synchronize();
+		// put the timer in TSC-deadline mode at the appropriate interrupt vector.
+		apicWrite(APIC_REG(lvtTimer), I_APIC_TIMER | APIC_LVT_TIMER_TSC_DEADLINE);
+		schedUseDeadline = 1;
+		schedQuantum = quantum;
 
-	// put the timer in single-shot mode at the appropriate interrupt vector.
-	apic.lvtTimer = I_APIC_TIMER;
-	__sync_synchronize();
+		kprintf("Using the TSC-deadline timer (quantum is %lu TSC ticks)\n", quantum);
+	}
+	else
+	{
+		apicWrite(APIC_REG(timerDivide), 3);
+		apicWrite(APIC_REG(timerInitCount), 0xFFFFFFFF);
+
+		nanoseconds_t start = timeGetUptime();
+		uint64_t startTSC = rdtsc();
+		while (timeGetUptime() < start+SCHED_QUANTUM_NANO);
+		schedTSCQuantum = rdtsc() - startTSC;
+
+		apicWrite(APIC_REG(lvtTimer), 0);
+		uint64_t quantum = 0xFFFFFFFF - apicRead(APIC_REG(timerCurrentCount));
+		apicWrite(APIC_REG(timerInitCount), 0);
+
+		// put the timer in single-shot mode at the appropriate interrupt vector.
+		apicWrite(APIC_REG(lvtTimer), I_APIC_TIMER | APIC_LVT_TIMER_ONESHOT);
+		schedQuantum = quantum;
+	};
 
 	// now perform the initial activation of the timer
-	apic.timerInitCount = schedQuantum;
-	__sync_synchronize();
+	schedResetTimer();
+};
+
+int schedTimerExpired()
+{
+	if (schedUseDeadline)
+	{
+		// the deadline MSR is cleared once the timer fires
+		return rdmsr(MSR_TSC_DEADLINE) == 0;
+	}
+	else
+	{
+		return apicRead(APIC_REG(timerCurrentCount)) == 0;
+	};
 };
 
 void schedPreempt()
@@ -480,9 +558,8 @@ void schedPreempt()
 	if (cpu->currentThread != &cpu->idleThread)
 	{
 		// if we are not the idle thread, add us to the end of
-		// the runqueue
-		// TODO: chooose runqueue based on priority etc
-		Runqueue *q = &runqueues[0];
+		// the runqueue for our priority
+		Runqueue *q = &runqueues[cpu->currentThread->priority];
 		cpu->currentThread->next = NULL;
 
 		if (q->first == NULL)
@@ -499,20 +576,80 @@ void schedPreempt()
 	_schedYield(irqState);
 };
 
-int schedHaveReadySigs()
+/**
+ * Set or clear the `THREAD_WORK_SIGNAL` bit of the calling thread depending on whether any
+ * signals are ready, and return the ready set. Call this only while holding the schedLock!
+ */
+static ksigset_t _schedUpdateSignalWork(Thread *me)
 {
-	Thread *me = schedGetCurrentThread();
-	IrqState irqState = spinlockAcquire(&schedLock);
-
 	ksigset_t pending = me->sigPending;
 	if (me->proc != NULL) pending |= me->proc->sigPending;
 
 	ksigset_t ready = pending & ~me->sigBlocked;
+	if (ready)
+	{
+		__atomic_or_fetch(&me->workPending, THREAD_WORK_SIGNAL, __ATOMIC_RELEASE);
+	}
+	else
+	{
+		__atomic_and_fetch(&me->workPending, ~THREAD_WORK_SIGNAL, __ATOMIC_RELEASE);
+	};
+
+	return ready;
+};
+
+int schedHaveReadySigs()
+{
+	Thread *me = schedGetCurrentThread();
+	if ((__atomic_load_n(&me->workPending, __ATOMIC_ACQUIRE) & THREAD_WORK_SIGNAL) == 0)
+	{
+		// no signals can be ready, so don't bother with the lock
+		return 0;
+	};
+
+	IrqState irqState = spinlockAcquire(&schedLock);
+	ksigset_t ready = _schedUpdateSignalWork(me);
 	spinlockRelease(&schedLock, irqState);
 
 	return !!ready;
 };
 
+void schedAccountUser()
+{
+	IrqState irqState = irqDisable();
+	Thread *me = schedGetCurrentThread();
+	uint64_t now = rdtsc();
+	me->utime += now - me->acctStamp;
+	me->acctStamp = now;
+	irqRestore(irqState);
+};
+
+void schedAccountSystem()
+{
+	IrqState irqState = irqDisable();
+	Thread *me = schedGetCurrentThread();
+	uint64_t now = rdtsc();
+	me->stime += now - me->acctStamp;
+	me->acctStamp = now;
+	irqRestore(irqState);
+};
+
+uint64_t schedTicksToNanos(uint64_t ticks)
+{
+	if (schedTSCQuantum == 0)
+	{
+		// not calibrated yet
+		return 0;
+	};
+
+	return (uint64_t) ((unsigned __int128) ticks * SCHED_QUANTUM_NANO / schedTSCQuantum);
+};
+
+void schedPostWork(Thread *thread, uint32_t bits)
+{
+	__atomic_or_fetch(&thread->workPending, bits, __ATOMIC_RELEASE);
+};
+
 uid_t schedGetEffectiveUID()
 {
 	Thread *me = schedGetCurrentThread();
@@ -677,12 +814,15 @@ void schedDispatchSignal(kmcontext_gpr_t *gprs, FPURegs *fpuRegs, ksiginfo_t *si
 int schedCheckSignals(ksiginfo_t *si)
 {
 	Thread *me = schedGetCurrentThread();
-	IrqState irqState = spinlockAcquire(&schedLock);
+	if ((__atomic_load_n(&me->workPending, __ATOMIC_ACQUIRE) & THREAD_WORK_SIGNAL) == 0)
+	{
+		// no signals can be ready, so don't bother with the lock
+		return -1;
+	};
 
-	ksigset_t pending = me->sigPending;
-	if (me->proc != NULL) pending |= me->proc->sigPending;
+	IrqState irqState = spinlockAcquire(&schedLock);
 
-	ksigset_t ready = pending & ~me->sigBlocked;
+	ksigset_t ready = _schedUpdateSignalWork(me);
 	int i;
 	for (i=1; i<SIG_NUM; i++)
 	{
@@ -694,6 +834,7 @@ int schedCheckSignals(ksiginfo_t *si)
 				{
 					memcpy(si, &me->proc->sigInfo[i], sizeof(ksiginfo_t));
 					me->proc->sigPending &= ~(1UL << i);
+					_schedUpdateSignalWork(me);
 					spinlockRelease(&schedLock, irqState);
 					return 0;
 				};
@@ -703,6 +844,7 @@ int schedCheckSignals(ksiginfo_t *si)
 			{
 				memcpy(si, &me->sigInfo[i], sizeof(ksiginfo_t));
 				me->sigPending &= ~(1UL << i);
+				_schedUpdateSignalWork(me);
 				spinlockRelease(&schedLock, irqState);
 				return 0;
 			};
@@ -782,6 +924,7 @@ void schedDeliverSignalToThread(Thread *thread, ksiginfo_t *si)
 	{
 		memcpy(&thread->sigInfo[si->si_signo], si, sizeof(ksiginfo_t));
 		thread->sigPending |= mask;
+		schedPostWork(thread, THREAD_WORK_SIGNAL);
 		signalled = 1;
 	};
 
@@ -0,0 +1,450 @@
+/*
+	Glidix kernel
+
+	Copyright (c) 2021, Madd Games.
+	All rights reserved.
+	
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+	
+	* Redistributions of source code must retain the above copyright notice, this
+	  list of conditions and the following disclaimer.
+	
+	* Redistributions in binary form must reproduce the above copyright notice,
+	  this list of conditions and the following disclaimer in the documentation
+	  and/or other materials provided with the distribution.
+	
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+	DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+	FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+	DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+	SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+	CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+	OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+	OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <glidix/thread/vma.h>
+#include <glidix/util/kmem.h>
+#include <glidix/util/init.h>
+#include <glidix/util/panic.h>
+#include <glidix/util/string.h>
+
+/**
+ * The cache of memory area descriptions.
+ */
+static KmemCache *vmaCache;
+
+static void vmaInit()
+{
+	vmaCache = kmemCacheCreate("vma", sizeof(VMA), NULL);
+	if (vmaCache == NULL)
+	{
+		panic("Failed to create the VMA cache!");
+	};
+};
+
+KERNEL_INIT_ACTION(vmaInit, KIA_VMA_INIT);
+
+VMA* vmaNew(user_addr_t start, user_addr_t end, int prot, int mflags, int oflags, Inode *inode, off_t offset)
+{
+	ASSERT((start & 0xFFF) == 0 && (end & 0xFFF) == 0);
+
+	VMA *vma = (VMA*) kmemCacheAlloc(vmaCache);
+	if (vma == NULL)
+	{
+		return NULL;
+	};
+
+	memset(vma, 0, sizeof(VMA));
+	vma->start = start;
+	vma->end = end;
+	vma->prot = prot;
+	vma->mflags = mflags;
+	vma->oflags = oflags;
+	vma->offset = offset;
+
+	if (inode != NULL)
+	{
+		vma->inode = vfsInodeDup(inode);
+	};
+
+	return vma;
+};
+
+void vmaDelete(VMA *vma)
+{
+	if (vma->inode != NULL)
+	{
+		vfsInodeUnref(vma->inode);
+	};
+
+	kmemCacheFree(vmaCache, vma);
+};
+
+static int _vmaHeight(VMA *vma)
+{
+	return vma == NULL ? 0 : vma->height;
+};
+
+/**
+ * Recompute the height and the gap information of `vma` from its children.
+ */
+static void _vmaRecompute(VMA *vma)
+{
+	int leftHeight = _vmaHeight(vma->left);
+	int rightHeight = _vmaHeight(vma->right);
+	vma->height = 1 + (leftHeight > rightHeight ? leftHeight : rightHeight);
+
+	user_addr_t maxGap = 0;
+	vma->subtreeStart = vma->start;
+	vma->subtreeEnd = vma->end;
+
+	if (vma->left != NULL)
+	{
+		vma->subtreeStart = vma->left->subtreeStart;
+		maxGap = vma->left->maxGap;
+		if (vma->start - vma->left->subtreeEnd > maxGap) maxGap = vma->start - vma->left->subtreeEnd;
+	};
+
+	if (vma->right != NULL)
+	{
+		vma->subtreeEnd = vma->right->subtreeEnd;
+		if (vma->right->maxGap > maxGap) maxGap = vma->right->maxGap;
+		if (vma->right->subtreeStart - vma->end > maxGap) maxGap = vma->right->subtreeStart - vma->end;
+	};
+
+	vma->maxGap = maxGap;
+};
+
+static VMA* _vmaRotateRight(VMA *vma)
+{
+	VMA *top = vma->left;
+	vma->left = top->right;
+	top->right = vma;
+
+	_vmaRecompute(vma);
+	_vmaRecompute(top);
+	return top;
+};
+
+static VMA* _vmaRotateLeft(VMA *vma)
+{
+	VMA *top = vma->right;
+	vma->right = top->left;
+	top->left = vma;
+
+	_vmaRecompute(vma);
+	_vmaRecompute(top);
+	return top;
+};
+
+/**
+ * Recompute `vma` after one of its subtrees changed, and rebalance it. Returns the new root of the subtree.
+ */
+static VMA* _vmaBalance(VMA *vma)
+{
+	_vmaRecompute(vma);
+
+	int balance = _vmaHeight(vma->left) - _vmaHeight(vma->right);
+	if (balance > 1)
+	{
+		if (_vmaHeight(vma->left->left) < _vmaHeight(vma->left->right))
+		{
+			vma->left = _vmaRotateLeft(vma->left);
+		};
+
+		return _vmaRotateRight(vma);
+	}
+	else if (balance < -1)
+	{
+		if (_vmaHeight(vma->right->right) < _vmaHeight(vma->right->left))
+		{
+			vma->right = _vmaRotateRight(vma->right);
+		};
+
+		return _vmaRotateLeft(vma);
+	};
+
+	return vma;
+};
+
+static VMA* _vmaInsert(VMA *node, VMA *vma)
+{
+	if (node == NULL)
+	{
+		vma->left = vma->right = NULL;
+		_vmaRecompute(vma);
+		return vma;
+	};
+
+	ASSERT(vma->end <= node->start || vma->start >= node->end);
+	if (vma->start < node->start)
+	{
+		node->left = _vmaInsert(node->left, vma);
+	}
+	else
+	{
+		node->right = _vmaInsert(node->right, vma);
+	};
+
+	return _vmaBalance(node);
+};
+
+/**
+ * Detach the lowest area in the subtree rooted at `node`, storing it in `*minOut`. Returns the new root of
+ * the subtree.
+ */
+static VMA* _vmaRemoveMin(VMA *node, VMA **minOut)
+{
+	if (node->left == NULL)
+	{
+		*minOut = node;
+		return node->right;
+	};
+
+	node->left = _vmaRemoveMin(node->left, minOut);
+	return _vmaBalance(node);
+};
+
+static VMA* _vmaRemove(VMA *node, VMA *vma)
+{
+	ASSERT(node != NULL);
+
+	if (node == vma)
+	{
+		if (node->left == NULL) return node->right;
+		if (node->right == NULL) return node->left;
+
+		VMA *successor;
+		VMA *right = _vmaRemoveMin(node->right, &successor);
+		successor->left = node->left;
+		successor->right = right;
+		return _vmaBalance(successor);
+	};
+
+	if (vma->start < node->start)
+	{
+		node->left = _vmaRemove(node->left, vma);
+	}
+	else
+	{
+		node->right = _vmaRemove(node->right, vma);
+	};
+
+	return _vmaBalance(node);
+};
+
+/**
+ * Recompute the areas on the path to `vma`, after its `end` changed.
+ */
+static void _vmaUpdatePath(VMA *node, VMA *vma)
+{
+	if (node != vma)
+	{
+		_vmaUpdatePath(vma->start < node->start ? node->left : node->right, vma);
+	};
+
+	_vmaRecompute(node);
+};
+
+VMA* vmaFind(VMATree *tree, user_addr_t addr)
+{
+	VMA *node = tree->root;
+	while (node != NULL)
+	{
+		if (addr < node->start) node = node->left;
+		else if (addr >= node->end) node = node->right;
+		else return node;
+	};
+
+	return NULL;
+};
+
+VMA* vmaFindAfter(VMATree *tree, user_addr_t addr)
+{
+	VMA *node = tree->root;
+	VMA *result = NULL;
+
+	while (node != NULL)
+	{
+		if (node->end > addr)
+		{
+			result = node;
+			node = node->left;
+		}
+		else
+		{
+			node = node->right;
+		};
+	};
+
+	return result;
+};
+
+VMA* vmaNext(VMATree *tree, VMA *vma)
+{
+	return vmaFindAfter(tree, vma->end);
+};
+
+void vmaInsert(VMATree *tree, VMA *vma)
+{
+	tree->root = _vmaInsert(tree->root, vma);
+};
+
+void vmaRemove(VMATree *tree, VMA *vma)
+{
+	tree->root = _vmaRemove(tree->root, vma);
+};
+
+static user_addr_t _vmaFindFree(VMA *node, size_t length, user_addr_t alignMask, user_addr_t low, user_addr_t high)
+{
+	if (high < low || high - low < length)
+	{
+		return VMA_NO_SPACE;
+	};
+
+	if (node == NULL)
+	{
+		user_addr_t addr = (high - length) & ~alignMask;
+		return addr >= low ? addr : VMA_NO_SPACE;
+	};
+
+	// skip the subtree if no hole in it, or on either side of it, is big enough
+	if (node->maxGap < length
+		&& (node->subtreeStart <= low || node->subtreeStart - low < length)
+		&& (node->subtreeEnd >= high || high - node->subtreeEnd < length))
+	{
+		return VMA_NO_SPACE;
+	};
+
+	// try the higher addresses first
+	user_addr_t addr = _vmaFindFree(node->right, length, alignMask, node->end > low ? node->end : low, high);
+	if (addr != VMA_NO_SPACE)
+	{
+		return addr;
+	};
+
+	return _vmaFindFree(node->left, length, alignMask, low, node->start < high ? node->start : high);
+};
+
+user_addr_t vmaFindFree(VMATree *tree, size_t length, user_addr_t alignMask, user_addr_t low, user_addr_t high)
+{
+	return _vmaFindFree(tree->root, length, alignMask, low, high);
+};
+
+errno_t vmaSplit(VMATree *tree, VMA *vma, user_addr_t addr)
+{
+	ASSERT(addr > vma->start && addr < vma->end);
+	ASSERT((addr & 0xFFF) == 0);
+
+	VMA *upper = (VMA*) kmemCacheAlloc(vmaCache);
+	if (upper == NULL)
+	{
+		return ENOMEM;
+	};
+
+	memcpy(upper, vma, sizeof(VMA));
+	upper->start = addr;
+	upper->offset += addr - vma->start;
+	if (upper->inode != NULL) vfsInodeDup(upper->inode);
+
+	vma->end = addr;
+	_vmaUpdatePath(tree->root, vma);
+	vmaInsert(tree, upper);
+	return 0;
+};
+
+/**
+ * Returns nonzero if `next` directly follows `vma` and is mapped the same way, so that they can be merged.
+ */
+static int _vmaCanMerge(VMA *vma, VMA *next)
+{
+	if (vma->end != next->start || vma->prot != next->prot || vma->flags != next->flags
+		|| vma->oflags != next->oflags || vma->mflags != next->mflags || vma->inode != next->inode)
+	{
+		return 0;
+	};
+
+	return vma->inode == NULL || vma->offset + (off_t) (vma->end - vma->start) == next->offset;
+};
+
+VMA* vmaMerge(VMATree *tree, VMA *vma)
+{
+	VMA *next;
+	while ((next = vmaNext(tree, vma)) != NULL && _vmaCanMerge(vma, next))
+	{
+		vmaRemove(tree, next);
+		vma->end = next->end;
+		_vmaUpdatePath(tree->root, vma);
+		vmaDelete(next);
+	};
+
+	VMA *prev = vma->start == 0 ? NULL : vmaFind(tree, vma->start - 1);
+	if (prev != NULL && _vmaCanMerge(prev, vma))
+	{
+		vmaRemove(tree, vma);
+		prev->end = vma->end;
+		_vmaUpdatePath(tree->root, prev);
+		vmaDelete(vma);
+		vma = prev;
+	};
+
+	return vma;
+};
+
+static void _vmaDestroy(VMA *node)
+{
+	if (node == NULL) return;
+
+	_vmaDestroy(node->left);
+	_vmaDestroy(node->right);
+	vmaDelete(node);
+};
+
+/**
+ * Copy the subtree rooted at `node`; the shape is kept, so the copy is balanced too. If we run out of memory,
+ * `*err` is set and some subtrees are left out.
+ */
+static VMA* _vmaClone(VMA *node, errno_t *err)
+{
+	if (node == NULL || *err != 0) return NULL;
+
+	VMA *copy = (VMA*) kmemCacheAlloc(vmaCache);
+	if (copy == NULL)
+	{
+		*err = ENOMEM;
+		return NULL;
+	};
+
+	memcpy(copy, node, sizeof(VMA));
+	if (copy->inode != NULL) vfsInodeDup(copy->inode);
+
+	copy->left = _vmaClone(node->left, err);
+	copy->right = _vmaClone(node->right, err);
+	return copy;
+};
+
+errno_t vmaTreeClone(VMATree *dest, VMATree *src)
+{
+	ASSERT(dest->root == NULL);
+
+	errno_t err = 0;
+	VMA *root = _vmaClone(src->root, &err);
+	if (err != 0)
+	{
+		_vmaDestroy(root);
+		return err;
+	};
+
+	dest->root = root;
+	return 0;
+};
+
+void vmaTreeDestroy(VMATree *tree)
+{
+	_vmaDestroy(tree->root);
+	tree->root = NULL;
+};
\ No newline at end of file
@@ -0,0 +1,487 @@
+/*
+	Glidix kernel
+
+	Copyright (c) 2021, Madd Games.
+	All rights reserved.
+	
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+	
+	* Redistributions of source code must retain the above copyright notice, this
+	  list of conditions and the following disclaimer.
+	
+	* Redistributions in binary form must reproduce the above copyright notice,
+	  this list of conditions and the following disclaimer in the documentation
+	  and/or other materials provided with the distribution.
+	
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+	DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+	FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+	DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+	SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+	CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+	OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+	OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include <glidix/util/allocprof.h>
+#include <glidix/util/symtab.h>
+#include <glidix/util/init.h>
+#include <glidix/util/string.h>
+#include <glidix/util/time.h>
+#include <glidix/util/panic.h>
+#include <glidix/util/log.h>
+#include <glidix/thread/spinlock.h>
+#include <glidix/thread/mutex.h>
+#include <glidix/thread/sched.h>
+#include <glidix/hw/meminfo.h>
+#include <glidix/hw/vmalloc.h>
+#include <glidix/fs/vfs.h>
+
+volatile int allocprofActive;
+
+/**
+ * Names of the allocation kinds, as shown in the report.
+ */
+static const char *allocprofKindNames[ALLOCPROF_NUM_KINDS] = {
+	"kmalloc",
+	"kom",
+};
+
+/**
+ * Protects the tables below. The hooks may be called from any context, so this is a spinlock.
+ */
+static Spinlock allocprofLock;
+
+/**
+ * Serializes turning profiling on and off, and generating reports.
+ */
+static Mutex allocprofControlLock;
+
+/**
+ * The call site table (open addressing, keyed by the stack and kind), the live allocation records,
+ * and the hash table of live allocations. They are allocated the first time profiling is turned on.
+ */
+static AllocSite *allocprofSites;
+static AllocLive *allocprofLive;
+static AllocLive **allocprofHash;
+
+/**
+ * Unused live allocation records.
+ */
+static AllocLive *allocprofFreeList;
+
+/**
+ * Number of allocations which could not be tracked because a table was full.
+ */
+static uint64_t allocprofDropped;
+
+/**
+ * Uptime at which the data was last cleared.
+ */
+static nanoseconds_t allocprofStartTime;
+
+/**
+ * Get the call stack of an allocation made on behalf of `caller`.
+ */
+static void allocprofGetStack(uint64_t *stack, void *caller)
+{
+	memset(stack, 0, sizeof(uint64_t) * ALLOCPROF_DEPTH);
+	stack[0] = (uint64_t) caller;
+
+#ifdef CONFIG_FRAME_POINTER
+	Thread *me = schedGetCurrentThread();
+	if (me == NULL || me->kernelStack == NULL)
+	{
+		return;
+	};
+
+	uint64_t bottom = (uint64_t) me->kernelStack;
+	uint64_t top = bottom + me->kernelStackSize;
+
+	// the first frame up is that of the allocator, whose return address is `caller`
+	uint64_t *frame = (uint64_t*) __builtin_frame_address(0);
+	int skip = 1;
+	int depth = 1;
+	while (depth < ALLOCPROF_DEPTH)
+	{
+		uint64_t next = frame[0];
+		if (next <= (uint64_t) frame || next < bottom || next + 16 > top)
+		{
+			break;
+		};
+
+		frame = (uint64_t*) next;
+		if (skip != 0)
+		{
+			skip--;
+			continue;
+		};
+
+		stack[depth++] = frame[1];
+	};
+#endif
+};
+
+/**
+ * Find or create the site with the given kind and stack. Returns NULL if the table is full. Call this
+ * with the lock held.
+ */
+static AllocSite* allocprofGetSite(int kind, const uint64_t *stack)
+{
+	uint64_t hash = kind;
+	int i;
+	for (i=0; i<ALLOCPROF_DEPTH; i++)
+	{
+		hash = (hash ^ stack[i]) * 0x100000001B3UL;
+	};
+
+	uint64_t index = (hash ^ (hash >> 32)) & (ALLOCPROF_MAX_SITES - 1);
+	uint64_t probes;
+	for (probes=0; probes<ALLOCPROF_MAX_SITES; probes++)
+	{
+		AllocSite *site = &allocprofSites[index];
+		if (site->stack[0] == 0)
+		{
+			memcpy(site->stack, stack, sizeof(site->stack));
+			site->kind = kind;
+			return site;
+		};
+
+		if (site->kind == kind && memcmp(site->stack, stack, sizeof(site->stack)) == 0)
+		{
+			return site;
+		};
+
+		index = (index + 1) & (ALLOCPROF_MAX_SITES - 1);
+	};
+
+	return NULL;
+};
+
+static uint64_t allocprofHashPointer(const void *ptr)
+{
+	return ((uint64_t) ptr >> 4) & (ALLOCPROF_HASH_SIZE - 1);
+};
+
+void allocprofAlloc(int kind, const void *ptr, size_t size, void *caller)
+{
+	uint64_t stack[ALLOCPROF_DEPTH];
+	allocprofGetStack(stack, caller);
+
+	IrqState irqState = spinlockAcquire(&allocprofLock);
+	if (!allocprofActive)
+	{
+		spinlockRelease(&allocprofLock, irqState);
+		return;
+	};
+
+	AllocSite *site = allocprofGetSite(kind, stack);
+	AllocLive *live = allocprofFreeList;
+	if (site == NULL || live == NULL)
+	{
+		allocprofDropped++;
+		spinlockRelease(&allocprofLock, irqState);
+		return;
+	};
+
+	allocprofFreeList = live->next;
+
+	uint64_t bucket = allocprofHashPointer(ptr);
+	live->ptr = ptr;
+	live->size = size;
+	live->site = site;
+	live->next = allocprofHash[bucket];
+	allocprofHash[bucket] = live;
+
+	site->liveBytes += size;
+	site->liveCount++;
+	site->allocs++;
+	site->allocBytes += size;
+
+	spinlockRelease(&allocprofLock, irqState);
+};
+
+void allocprofFree(const void *ptr)
+{
+	IrqState irqState = spinlockAcquire(&allocprofLock);
+	if (!allocprofActive)
+	{
+		spinlockRelease(&allocprofLock, irqState);
+		return;
+	};
+
+	AllocLive **link = &allocprofHash[allocprofHashPointer(ptr)];
+	while (*link != NULL)
+	{
+		AllocLive *live = *link;
+		if (live->ptr == ptr)
+		{
+			*link = live->next;
+
+			live->site->liveBytes -= live->size;
+			live->site->liveCount--;
+			live->site->frees++;
+
+			live->next = allocprofFreeList;
+			allocprofFreeList = live;
+			break;
+		};
+
+		link = &live->next;
+	};
+
+	spinlockRelease(&allocprofLock, irqState);
+};
+
+/**
+ * Clear all data. Call this with the lock held.
+ */
+static void allocprofClear()
+{
+	memset(allocprofSites, 0, sizeof(AllocSite) * ALLOCPROF_MAX_SITES);
+	memset(allocprofHash, 0, sizeof(AllocLive*) * ALLOCPROF_HASH_SIZE);
+
+	allocprofFreeList = NULL;
+	int i;
+	for (i=ALLOCPROF_MAX_LIVE-1; i>=0; i--)
+	{
+		allocprofLive[i].next = allocprofFreeList;
+		allocprofFreeList = &allocprofLive[i];
+	};
+
+	allocprofDropped = 0;
+	allocprofStartTime = timeGetUptime();
+};
+
+/**
+ * Start profiling, clearing any previous data. Returns 0 on success, or an error number.
+ */
+static int allocprofStart()
+{
+	if (allocprofSites == NULL)
+	{
+		allocprofSites = (AllocSite*) vmalloc(sizeof(AllocSite) * ALLOCPROF_MAX_SITES);
+		allocprofLive = (AllocLive*) vmalloc(sizeof(AllocLive) * ALLOCPROF_MAX_LIVE);
+		allocprofHash = (AllocLive**) vmalloc(sizeof(AllocLive*) * ALLOCPROF_HASH_SIZE);
+
+		if (allocprofSites == NULL || allocprofLive == NULL || allocprofHash == NULL)
+		{
+			if (allocprofSites != NULL) vfree(allocprofSites);
+			if (allocprofLive != NULL) vfree(allocprofLive);
+			if (allocprofHash != NULL) vfree(allocprofHash);
+			allocprofSites = NULL;
+			allocprofLive = NULL;
+			allocprofHash = NULL;
+			return ENOMEM;
+		};
+	};
+
+	IrqState irqState = spinlockAcquire(&allocprofLock);
+	allocprofClear();
+	allocprofActive = 1;
+	spinlockRelease(&allocprofLock, irqState);
+
+	return 0;
+};
+
+/**
+ * Print an address, symbolized if possible.
+ */
+static void allocprofPrintAddr(MemInfoText *text, uint64_t addr)
+{
+	uint64_t offset;
+	const char *name = symLookup(addr, &offset);
+	if (name == NULL)
+	{
+		meminfoPrintf(text, "0x%016lx", addr);
+	}
+	else
+	{
+		meminfoPrintf(text, "%s+0x%lx", name, offset);
+	};
+};
+
+/**
+ * Sort sites in descending order of the value at offset `keyOffset` in `AllocSite`.
+ */
+static void allocprofSort(AllocSite **sites, int count, size_t keyOffset)
+{
+	int gap, i, j;
+	for (gap=count/2; gap>0; gap/=2)
+	{
+		for (i=gap; i<count; i++)
+		{
+			AllocSite *site = sites[i];
+			uint64_t key = *((uint64_t*) ((char*) site + keyOffset));
+
+			for (j=i; j>=gap && *((uint64_t*) ((char*) sites[j-gap] + keyOffset)) < key; j-=gap)
+			{
+				sites[j] = sites[j-gap];
+			};
+
+			sites[j] = site;
+		};
+	};
+};
+
+/**
+ * Print the top sites according to the specified key.
+ */
+static void allocprofPrintSites(MemInfoText *text, const char *title, AllocSite **sites, int count, size_t keyOffset, nanoseconds_t elapsed)
+{
+	allocprofSort(sites, count, keyOffset);
+	if (count > ALLOCPROF_REPORT_TOP) count = ALLOCPROF_REPORT_TOP;
+
+	meminfoPrintf(text, "\n%s:\n", title);
+	meminfoPrintf(text, "  LiveBytes  LiveCount     Allocs  Allocs/s      Frees  Kind     Site\n");
+
+	int i;
+	for (i=0; i<count; i++)
+	{
+		AllocSite *site = sites[i];
+		uint64_t rate = elapsed == 0 ? 0 : site->allocs * NANOS_PER_SEC / elapsed;
+
+		meminfoPrintf(text, "%11lu %10lu %10lu %9lu %10lu  %-7s  ",
+			site->liveBytes, site->liveCount, site->allocs, rate, site->frees,
+			allocprofKindNames[site->kind]);
+		allocprofPrintAddr(text, site->stack[0]);
+		meminfoPrintf(text, "\n");
+
+		int depth;
+		for (depth=1; depth<ALLOCPROF_DEPTH && site->stack[depth] != 0; depth++)
+		{
+			meminfoPrintf(text, "%66s<- ", "");
+			allocprofPrintAddr(text, site->stack[depth]);
+			meminfoPrintf(text, "\n");
+		};
+	};
+};
+
+static void allocprofGenReport(MemInfoText *text)
+{
+	mutexLock(&allocprofControlLock);
+	if (allocprofSites == NULL)
+	{
+		meminfoPrintf(text, "Allocation profiling is off; write 'on' to %s to start it.\n", ALLOCPROF_PATH);
+		mutexUnlock(&allocprofControlLock);
+		return;
+	};
+
+	// take a snapshot, so that we do not hold the lock (and block allocations) while formatting
+	AllocSite *snapshot = (AllocSite*) vmalloc(sizeof(AllocSite) * ALLOCPROF_MAX_SITES);
+	AllocSite **sites = (AllocSite**) vmalloc(sizeof(AllocSite*) * ALLOCPROF_MAX_SITES);
+	if (snapshot == NULL || sites == NULL)
+	{
+		if (snapshot != NULL) vfree(snapshot);
+		if (sites != NULL) vfree(sites);
+		text->failed = 1;
+		mutexUnlock(&allocprofControlLock);
+		return;
+	};
+
+	IrqState irqState = spinlockAcquire(&allocprofLock);
+	memcpy(snapshot, allocprofSites, sizeof(AllocSite) * ALLOCPROF_MAX_SITES);
+	uint64_t dropped = allocprofDropped;
+	int active = allocprofActive;
+	nanoseconds_t elapsed = timeGetUptime() - allocprofStartTime;
+	spinlockRelease(&allocprofLock, irqState);
+
+	int count = 0;
+	uint64_t liveBytes[ALLOCPROF_NUM_KINDS] = {0};
+	int i;
+	for (i=0; i<ALLOCPROF_MAX_SITES; i++)
+	{
+		if (snapshot[i].stack[0] != 0)
+		{
+			sites[count++] = &snapshot[i];
+			liveBytes[snapshot[i].kind] += snapshot[i].liveBytes;
+		};
+	};
+
+	meminfoPrintf(text, "Profiling:      %s\n", active ? "on" : "off");
+	meminfoPrintf(text, "Duration:       %lu ms\n", elapsed / TIME_MILLI(1));
+	meminfoPrintf(text, "Sites:          %d\n", count);
+	meminfoPrintf(text, "Dropped:        %lu\n", dropped);
+	for (i=0; i<ALLOCPROF_NUM_KINDS; i++)
+	{
+		meminfoPrintf(text, "Live %-10s%lu bytes\n", allocprofKindNames[i], liveBytes[i]);
+	};
+
+	allocprofPrintSites(text, "Top sites by live bytes", sites, count, offsetof(AllocSite, liveBytes), elapsed);
+	allocprofPrintSites(text, "Top sites by allocations", sites, count, offsetof(AllocSite, allocs), elapsed);
+
+	vfree(snapshot);
+	vfree(sites);
+	mutexUnlock(&allocprofControlLock);
+};
+
+static ssize_t allocprofRead(Inode *inode, void *buffer, size_t size, off_t pos)
+{
+	return meminfoRead(allocprofGenReport, buffer, size, pos);
+};
+
+static ssize_t allocprofWrite(Inode *inode, const void *buffer, size_t size, off_t pos)
+{
+	char cmd[16];
+	if (size >= sizeof(cmd))
+	{
+		return -EINVAL;
+	};
+
+	memcpy(cmd, buffer, size);
+	cmd[size] = 0;
+	if (size != 0 && cmd[size-1] == '\n') cmd[size-1] = 0;
+
+	int status = 0;
+	mutexLock(&allocprofControlLock);
+	if (strcmp(cmd, "on") == 0)
+	{
+		status = allocprofStart();
+	}
+	else if (strcmp(cmd, "off") == 0)
+	{
+		allocprofActive = 0;
+	}
+	else if (strcmp(cmd, "reset") == 0)
+	{
+		if (allocprofSites != NULL)
+		{
+			IrqState irqState = spinlockAcquire(&allocprofLock);
+			allocprofClear();
+			spinlockRelease(&allocprofLock, irqState);
+		};
+	}
+	else
+	{
+		status = EINVAL;
+	};
+	mutexUnlock(&allocprofControlLock);
+
+	if (status != 0)
+	{
+		return -status;
+	};
+
+	return size;
+};
+
+static InodeOps allocprofOps = {
+	.pread = allocprofRead,
+	.pwrite = allocprofWrite,
+	.inodeFlags = VFS_INODE_SEEKABLE,
+};
+
+static void __init allocprofInit()
+{
+	mutexInit(&allocprofControlLock);
+	if (vfsCreateCharDev(NULL, ALLOCPROF_PATH, 0644, &allocprofOps) != 0)
+	{
+		panic("Failed to create %s!", ALLOCPROF_PATH);
+	};
+};
+
+KERNEL_INIT_ACTION(allocprofInit, KIA_ALLOCPROF, KIA_MEMINFO);
\ No newline at end of file
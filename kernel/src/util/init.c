@@ -43,6 +43,17 @@
 #include <glidix/hw/pagetab.h>
 #include <glidix/thread/process.h>
 #include <glidix/int/exec.h>
+#include <glidix/util/treemap.h>
+#include <glidix/fs/file.h>
+#include <glidix/fs/initrd.h>
+
+/**
+ * Bounds of the `__init` code and the `__initdata` data, defined in `kernel.ld`.
+ */
+extern char __initTextBegin[];
+extern char __initTextEnd[];
+extern char __initDataBegin[];
+extern char __initDataEnd[];
 
 /**
  * The terminator of the kernel init action list, see `kernel.ld` for an
@@ -100,6 +111,22 @@ static void kiaRun(const char *name)
 	kia->complete = 1;
 };
 
+/**
+ * Release memory which was only needed during boot: the initrd image (whose files have been copied
+ * into the root tmpfs by now), and the `__init` code and data. This is called once all init actions
+ * have run.
+ */
+static void freeInitMemory()
+{
+	// the bootloader may have placed something else in the last, partial page of the initrd
+	size_t initrdBytes = komReleaseBootMemory(initrdImage, bootInfo->initrdSize & ~0xFFFUL);
+	size_t initBytes = komReleaseBootMemory(__initTextBegin, __initTextEnd - __initTextBegin)
+		+ komReleaseBootMemory(__initDataBegin, __initDataEnd - __initDataBegin);
+
+	kprintf("Freed %lu KB of boot memory (initrd: %lu KB, init code and data: %lu KB)\n",
+		(initrdBytes + initBytes) >> 10, initrdBytes >> 10, initBytes >> 10);
+};
+
 static void userspaceInit()
 {
 	static const char *initArgv[] = {"-init", NULL};
@@ -137,6 +164,11 @@ void kmain(KernelBootInfo *info)
 	kprintf("Initializing the Kernel Object Manager (KOM)...\n");
 	komInit();
 
+	// create the object caches for core kernel structures
+	kprintf("Creating kernel object caches...\n");
+	treemapInit();
+	vfsInitFileCache();
+
 	// re-map the framebuffer
 	kprintf("Remapping the console framebuffer...\n");
 	conRemapFramebuffers();
@@ -181,9 +213,12 @@ void kmain(KernelBootInfo *info)
 		kiaRun(kia->links[0]);
 	};
 
+	kprintf("Freeing boot memory...\n");
+	freeInitMemory();
+
 	kprintf("Kernel init done, starting userspace init...\n");
 
-	pid_t pid = procCreate(userspaceInit, NULL);
+	pid_t pid = procCreate(userspaceInit, NULL, 0);
 	if (pid < 0)
 	{
 		panic("Failed to create init process: error %d", -pid);
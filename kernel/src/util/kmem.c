@@ -0,0 +1,467 @@
+/*
+	Glidix kernel
+
+	Copyright (c) 2021, Madd Games.
+	All rights reserved.
+	
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+	
+	* Redistributions of source code must retain the above copyright notice, this
+	  list of conditions and the following disclaimer.
+	
+	* Redistributions in binary form must reproduce the above copyright notice,
+	  this list of conditions and the following disclaimer in the documentation
+	  and/or other materials provided with the distribution.
+	
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+	DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+	FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+	DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+	SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+	CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+	OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+	OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include <glidix/util/kmem.h>
+#include <glidix/util/memory.h>
+#include <glidix/util/string.h>
+#include <glidix/util/panic.h>
+#include <glidix/hw/kom.h>
+#include <glidix/hw/cpu.h>
+#include <glidix/hw/reclaim.h>
+#include <glidix/util/init.h>
+
+/**
+ * Lock protecting the cache list.
+ */
+static Spinlock kmemListLock;
+
+/**
+ * List of all caches.
+ */
+static KmemCache *kmemCacheList;
+
+/**
+ * Set to 1 once the bootstrap CPU has a valid GS base, so that we can use the magazines.
+ */
+static int kmemMagazinesReady;
+
+void kmemInitLocal()
+{
+	kmemMagazinesReady = 1;
+};
+
+/**
+ * Get the calling CPU's magazine for the specified cache, allocating it on first use. Returns NULL
+ * if magazines are not available yet, or the magazine could not be allocated. Interrupts must be
+ * disabled.
+ */
+static KmemMagazine* kmemGetLocalMagazine(KmemCache *cache)
+{
+	if (!kmemMagazinesReady)
+	{
+		return NULL;
+	};
+
+	KmemMagazine **magptr = &cache->mags[cpuGetCurrent()->index];
+	if (*magptr == NULL)
+	{
+		KmemMagazine *mag = (KmemMagazine*) kmalloc(sizeof(KmemMagazine));
+		if (mag == NULL)
+		{
+			return NULL;
+		};
+
+		mag->count = 0;
+		*magptr = mag;
+	};
+
+	return *magptr;
+};
+
+/**
+ * Get the list which a slab belongs on, based on how many of its objects are free.
+ */
+static KmemSlab** kmemGetSlabList(KmemCache *cache, KmemSlab *slab)
+{
+	if (slab->numFree == 0) return &cache->full;
+	else if (slab->numFree == cache->objsPerSlab) return &cache->empty;
+	else return &cache->partial;
+};
+
+static void kmemUnlinkSlab(KmemSlab **list, KmemSlab *slab)
+{
+	if (slab->prev == NULL) *list = slab->next;
+	else slab->prev->next = slab->next;
+
+	if (slab->next != NULL) slab->next->prev = slab->prev;
+};
+
+static void kmemLinkSlab(KmemSlab **list, KmemSlab *slab)
+{
+	slab->prev = NULL;
+	slab->next = *list;
+	if (slab->next != NULL) slab->next->prev = slab;
+	*list = slab;
+};
+
+KmemCache* kmemCacheCreate(const char *name, size_t objSize, KmemConstructor ctor)
+{
+	KmemCache *cache = (KmemCache*) kmalloc(sizeof(KmemCache));
+	if (cache == NULL)
+	{
+		return NULL;
+	};
+
+	memset(cache, 0, sizeof(KmemCache));
+	strncpy(cache->name, name, KMEM_NAME_MAX-1);
+	cache->objSize = objSize;
+	cache->ctor = ctor;
+
+	// objects are 16-byte aligned, and objects of at least a cache line are aligned to
+	// cache lines
+	size_t align = 16;
+	if (objSize >= KMEM_CACHE_LINE) align = KMEM_CACHE_LINE;
+	cache->stride = (objSize + align - 1) & ~(align - 1);
+
+	// find the smallest slab size which fits enough objects
+	int bucket;
+	int numObjs = 0;
+	size_t headerSize = 0;
+	for (bucket=KOM_BUCKET_PAGE; bucket<=KMEM_SLAB_MAX_BUCKET; bucket++)
+	{
+		size_t slabSize = KOM_BUCKET_SIZE(bucket);
+		numObjs = (slabSize - sizeof(KmemSlab)) / (cache->stride + sizeof(uint16_t));
+
+		while (numObjs != 0)
+		{
+			headerSize = (sizeof(KmemSlab) + sizeof(uint16_t) * numObjs + align - 1) & ~(align - 1);
+			if (headerSize + cache->stride * numObjs <= slabSize) break;
+			numObjs--;
+		};
+
+		if (numObjs >= KMEM_MIN_OBJS_PER_SLAB) break;
+	};
+
+	if (bucket > KMEM_SLAB_MAX_BUCKET) bucket = KMEM_SLAB_MAX_BUCKET;
+	if (numObjs == 0)
+	{
+		kfree(cache);
+		return NULL;
+	};
+
+	cache->slabBucket = bucket;
+	cache->objsPerSlab = numObjs;
+	cache->headerSize = headerSize;
+	cache->colourMax = KOM_BUCKET_SIZE(bucket) - headerSize - cache->stride * numObjs;
+
+	IrqState irqState = spinlockAcquire(&kmemListLock);
+	cache->next = kmemCacheList;
+	if (cache->next != NULL) cache->next->prev = cache;
+	kmemCacheList = cache;
+	spinlockRelease(&kmemListLock, irqState);
+
+	return cache;
+};
+
+/**
+ * Return an object to its slab. The cache lock must be held.
+ */
+static void _kmemPutObject(KmemCache *cache, void *obj)
+{
+	KmemSlab *slab = (KmemSlab*) komGetBlockBase(obj, cache->slabBucket);
+	KmemSlab **oldList = kmemGetSlabList(cache, slab);
+
+	slab->freeStack[slab->numFree++] = ((char*) obj - slab->objs) / cache->stride;
+	cache->numActive--;
+
+	KmemSlab **newList = kmemGetSlabList(cache, slab);
+	if (newList != oldList)
+	{
+		kmemUnlinkSlab(oldList, slab);
+
+		// keep at most one empty slab around
+		if (newList == &cache->empty && cache->empty != NULL)
+		{
+			cache->numSlabs--;
+			komReleaseBlock(slab, cache->slabBucket);
+			komCounterAdd(KOM_COUNTER_SLAB, -(int64_t) KOM_BUCKET_SIZE(cache->slabBucket));
+		}
+		else
+		{
+			kmemLinkSlab(newList, slab);
+		};
+	};
+};
+
+/**
+ * Take up to `count` objects out of the slabs, and store them in `out`. Returns the number of
+ * objects taken. The cache lock must be held.
+ */
+static int _kmemTakeObjects(KmemCache *cache, void **out, int count)
+{
+	int got = 0;
+	while (got < count)
+	{
+		KmemSlab *slab = cache->partial;
+		if (slab == NULL) slab = cache->empty;
+		if (slab == NULL) break;
+
+		KmemSlab **oldList = kmemGetSlabList(cache, slab);
+		while (got < count && slab->numFree != 0)
+		{
+			out[got++] = slab->objs + cache->stride * slab->freeStack[--slab->numFree];
+		};
+
+		KmemSlab **newList = kmemGetSlabList(cache, slab);
+		if (newList != oldList)
+		{
+			kmemUnlinkSlab(oldList, slab);
+			kmemLinkSlab(newList, slab);
+		};
+	};
+
+	cache->numActive += got;
+	return got;
+};
+
+/**
+ * Allocate and construct a new slab, and add it to the cache. Returns 0 on success, or -1 if
+ * we ran out of memory.
+ */
+static int kmemGrow(KmemCache *cache)
+{
+	KmemSlab *slab = (KmemSlab*) komAllocBlock(cache->slabBucket, KOM_POOLBIT_ALL);
+	if (slab == NULL)
+	{
+		return -1;
+	};
+
+	komCounterAdd(KOM_COUNTER_SLAB, KOM_BUCKET_SIZE(cache->slabBucket));
+
+	IrqState irqState = spinlockAcquire(&cache->lock);
+	size_t colour = cache->nextColour;
+	cache->nextColour += (cache->stride >= KMEM_CACHE_LINE ? KMEM_CACHE_LINE : 16);
+	if (cache->nextColour > cache->colourMax) cache->nextColour = 0;
+	spinlockRelease(&cache->lock, irqState);
+
+	slab->objs = (char*) slab + cache->headerSize + colour;
+	slab->numFree = cache->objsPerSlab;
+
+	// objects are handed out from the top of the stack, so put them in reverse order
+	int i;
+	for (i=0; i<cache->objsPerSlab; i++)
+	{
+		slab->freeStack[i] = cache->objsPerSlab - 1 - i;
+		if (cache->ctor != NULL) cache->ctor(slab->objs + cache->stride * i);
+	};
+
+	irqState = spinlockAcquire(&cache->lock);
+	kmemLinkSlab(&cache->empty, slab);
+	cache->numSlabs++;
+	spinlockRelease(&cache->lock, irqState);
+
+	return 0;
+};
+
+void* kmemCacheAlloc(KmemCache *cache)
+{
+	IrqState irqState = irqDisable();
+	KmemMagazine *mag = kmemGetLocalMagazine(cache);
+	if (mag != NULL)
+	{
+		if (mag->count == 0)
+		{
+			IrqState lockState = spinlockAcquire(&cache->lock);
+			mag->count = _kmemTakeObjects(cache, mag->objs, KMEM_MAG_SIZE/2);
+			spinlockRelease(&cache->lock, lockState);
+		};
+
+		if (mag->count != 0)
+		{
+			void *obj = mag->objs[--mag->count];
+			irqRestore(irqState);
+			return obj;
+		};
+	};
+	irqRestore(irqState);
+
+	// either this CPU has no magazine yet, or refilling it found the slabs exhausted; take an object
+	// from the slab lists directly, and if there are none, add a new slab and take one out of that
+	void *obj;
+	irqState = spinlockAcquire(&cache->lock);
+	int got = _kmemTakeObjects(cache, &obj, 1);
+	spinlockRelease(&cache->lock, irqState);
+
+	if (got != 0) return obj;
+
+	while (1)
+	{
+		if (kmemGrow(cache) != 0)
+		{
+			return NULL;
+		};
+
+		irqState = spinlockAcquire(&cache->lock);
+		got = _kmemTakeObjects(cache, &obj, 1);
+		spinlockRelease(&cache->lock, irqState);
+
+		if (got != 0) return obj;
+	};
+};
+
+void kmemCacheFree(KmemCache *cache, void *obj)
+{
+	IrqState irqState = irqDisable();
+	KmemMagazine *mag = kmemGetLocalMagazine(cache);
+	if (mag != NULL)
+	{
+		if (mag->count == KMEM_MAG_SIZE)
+		{
+			// return the older half of the magazine to the slabs
+			IrqState lockState = spinlockAcquire(&cache->lock);
+			int i;
+			for (i=0; i<KMEM_MAG_SIZE/2; i++)
+			{
+				_kmemPutObject(cache, mag->objs[i]);
+			};
+			spinlockRelease(&cache->lock, lockState);
+
+			for (i=0; i<KMEM_MAG_SIZE/2; i++)
+			{
+				mag->objs[i] = mag->objs[i + KMEM_MAG_SIZE/2];
+			};
+
+			mag->count = KMEM_MAG_SIZE/2;
+		};
+
+		mag->objs[mag->count++] = obj;
+		irqRestore(irqState);
+		return;
+	};
+	irqRestore(irqState);
+
+	irqState = spinlockAcquire(&cache->lock);
+	_kmemPutObject(cache, obj);
+	spinlockRelease(&cache->lock, irqState);
+};
+
+void kmemCacheDestroy(KmemCache *cache)
+{
+	IrqState irqState = spinlockAcquire(&kmemListLock);
+	if (cache->prev == NULL) kmemCacheList = cache->next;
+	else cache->prev->next = cache->next;
+	if (cache->next != NULL) cache->next->prev = cache->prev;
+	spinlockRelease(&kmemListLock, irqState);
+
+	irqState = spinlockAcquire(&cache->lock);
+
+	int i;
+	for (i=0; i<CPU_MAX; i++)
+	{
+		KmemMagazine *mag = cache->mags[i];
+		if (mag != NULL)
+		{
+			while (mag->count != 0)
+			{
+				_kmemPutObject(cache, mag->objs[--mag->count]);
+			};
+
+			kfree(mag);
+		};
+	};
+
+	if (cache->partial != NULL || cache->full != NULL)
+	{
+		panic("Destroying object cache `%s' which still has objects in use", cache->name);
+	};
+
+	while (cache->empty != NULL)
+	{
+		KmemSlab *slab = cache->empty;
+		cache->empty = slab->next;
+		komReleaseBlock(slab, cache->slabBucket);
+		komCounterAdd(KOM_COUNTER_SLAB, -(int64_t) KOM_BUCKET_SIZE(cache->slabBucket));
+	};
+
+	spinlockRelease(&cache->lock, irqState);
+	kfree(cache);
+};
+
+void kmemWalkCaches(KmemCacheWalkCallback callback, void *context)
+{
+	IrqState irqState = spinlockAcquire(&kmemListLock);
+
+	KmemCache *cache;
+	for (cache=kmemCacheList; cache!=NULL; cache=cache->next)
+	{
+		KmemCacheInfo info;
+		info.name = cache->name;
+		info.objSize = cache->objSize;
+		info.slabSize = KOM_BUCKET_SIZE(cache->slabBucket);
+
+		IrqState cacheState = spinlockAcquire(&cache->lock);
+		info.numSlabs = cache->numSlabs;
+		info.numActive = cache->numActive;
+		spinlockRelease(&cache->lock, cacheState);
+
+		info.numTotal = info.numSlabs * cache->objsPerSlab;
+		callback(&info, context);
+	};
+
+	spinlockRelease(&kmemListLock, irqState);
+};
+
+/**
+ * The slab shrinker: releases the spare empty slab which each cache keeps around.
+ */
+static size_t kmemShrink(size_t numPages)
+{
+	size_t freed = 0;
+	uint64_t released = 0;
+
+	IrqState irqState = spinlockAcquire(&kmemListLock);
+
+	KmemCache *cache;
+	for (cache=kmemCacheList; cache!=NULL && freed<numPages; cache=cache->next)
+	{
+		IrqState cacheState = spinlockAcquire(&cache->lock);
+		while (cache->empty != NULL)
+		{
+			KmemSlab *slab = cache->empty;
+			kmemUnlinkSlab(&cache->empty, slab);
+			cache->numSlabs--;
+
+			komReleaseBlock(slab, cache->slabBucket);
+			komCounterAdd(KOM_COUNTER_SLAB, -(int64_t) KOM_BUCKET_SIZE(cache->slabBucket));
+			freed += KOM_BUCKET_SIZE(cache->slabBucket) >> 12;
+			released++;
+		};
+		spinlockRelease(&cache->lock, cacheState);
+	};
+
+	spinlockRelease(&kmemListLock, irqState);
+
+	__sync_fetch_and_add(&reclaimStats.slabsReleased, released);
+	return freed;
+};
+
+/**
+ * The slab shrinker object.
+ */
+static Shrinker kmemShrinker = {
+	.name = "slab",
+	.shrink = kmemShrink,
+};
+
+static void kmemInitShrinker()
+{
+	reclaimRegisterShrinker(&kmemShrinker);
+};
+
+KERNEL_INIT_ACTION(kmemInitShrinker, KIA_KMEM_SHRINKER);
\ No newline at end of file
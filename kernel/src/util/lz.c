@@ -0,0 +1,196 @@
+/*
+	Glidix kernel
+
+	Copyright (c) 2021, Madd Games.
+	All rights reserved.
+	
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+	
+	* Redistributions of source code must retain the above copyright notice, this
+	  list of conditions and the following disclaimer.
+	
+	* Redistributions in binary form must reproduce the above copyright notice,
+	  this list of conditions and the following disclaimer in the documentation
+	  and/or other materials provided with the distribution.
+	
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+	DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+	FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+	DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+	SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+	CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+	OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+	OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include <glidix/util/lz.h>
+#include <glidix/util/string.h>
+
+static uint32_t lzRead32(const uint8_t *ptr)
+{
+	uint32_t value;
+	memcpy(&value, ptr, 4);
+	return value;
+};
+
+static uint32_t lzHash(uint32_t value)
+{
+	return (value * 2654435761U) >> (32 - LZ_HASH_BITS);
+};
+
+/**
+ * Write the extra bytes of a length which did not fit in its nibble. Returns the new output pointer,
+ * or NULL if the output is full.
+ */
+static uint8_t* lzPutLength(uint8_t *op, uint8_t *oend, size_t len)
+{
+	while (len >= 255)
+	{
+		if (op == oend) return NULL;
+		*op++ = 255;
+		len -= 255;
+	};
+
+	if (op == oend) return NULL;
+	*op++ = (uint8_t) len;
+	return op;
+};
+
+/**
+ * Read the extra bytes of a length whose nibble was 15. Returns the new input pointer, or NULL if the
+ * input ends first.
+ */
+static const uint8_t* lzGetLength(const uint8_t *ip, const uint8_t *iend, size_t *len)
+{
+	uint8_t byte;
+	do
+	{
+		if (ip == iend) return NULL;
+		byte = *ip++;
+		*len += byte;
+	} while (byte == 255);
+
+	return ip;
+};
+
+/**
+ * Emit a block with the literals from `anchor` to `ip`, followed by a match of `matchLen` bytes at
+ * `offset` back (if `matchLen` is nonzero). Returns the new output pointer, or NULL if the output is full.
+ */
+static uint8_t* lzEmit(uint8_t *op, uint8_t *oend, const uint8_t *anchor, const uint8_t *ip, size_t offset, size_t matchLen)
+{
+	size_t litLen = ip - anchor;
+	size_t matchCode = matchLen == 0 ? 0 : matchLen - LZ_MIN_MATCH;
+
+	if (op == oend) return NULL;
+	uint8_t *token = op++;
+	*token = ((litLen >= 15 ? 15 : litLen) << 4) | (matchCode >= 15 ? 15 : matchCode);
+
+	if (litLen >= 15 && (op = lzPutLength(op, oend, litLen - 15)) == NULL) return NULL;
+	if ((size_t) (oend - op) < litLen) return NULL;
+	memcpy(op, anchor, litLen);
+	op += litLen;
+
+	if (matchLen != 0)
+	{
+		if (oend - op < 2) return NULL;
+		*op++ = (uint8_t) offset;
+		*op++ = (uint8_t) (offset >> 8);
+
+		if (matchCode >= 15 && (op = lzPutLength(op, oend, matchCode - 15)) == NULL) return NULL;
+	};
+
+	return op;
+};
+
+size_t lzCompress(const void *src, size_t size, void *dst, size_t dstSize)
+{
+	const uint8_t *base = (const uint8_t*) src;
+	const uint8_t *ip = base;
+	const uint8_t *anchor = base;
+	const uint8_t *iend = base + size;
+	uint8_t *op = (uint8_t*) dst;
+	uint8_t *oend = op + dstSize;
+
+	uint16_t table[1 << LZ_HASH_BITS];
+	memset(table, 0, sizeof(table));
+
+	while (iend - ip >= LZ_MIN_MATCH)
+	{
+		uint32_t seq = lzRead32(ip);
+		uint32_t hash = lzHash(seq);
+		const uint8_t *ref = base + table[hash];
+		table[hash] = ip - base;
+
+		if (ref >= ip || ip - ref > 0xFFFF || lzRead32(ref) != seq)
+		{
+			ip++;
+			continue;
+		};
+
+		const uint8_t *end = ip + LZ_MIN_MATCH;
+		ref += LZ_MIN_MATCH;
+		while (end < iend && *end == *ref)
+		{
+			end++;
+			ref++;
+		};
+
+		op = lzEmit(op, oend, anchor, ip, end - ref, end - ip);
+		if (op == NULL) return 0;
+
+		ip = anchor = end;
+	};
+
+	op = lzEmit(op, oend, anchor, iend, 0, 0);
+	if (op == NULL) return 0;
+
+	return op - (uint8_t*) dst;
+};
+
+ssize_t lzDecompress(const void *src, size_t size, void *dst, size_t dstSize)
+{
+	const uint8_t *ip = (const uint8_t*) src;
+	const uint8_t *iend = ip + size;
+	uint8_t *ostart = (uint8_t*) dst;
+	uint8_t *op = ostart;
+	uint8_t *oend = op + dstSize;
+
+	while (1)
+	{
+		if (ip == iend) return -1;
+		uint8_t token = *ip++;
+
+		size_t litLen = token >> 4;
+		if (litLen == 15 && (ip = lzGetLength(ip, iend, &litLen)) == NULL) return -1;
+		if ((size_t) (iend - ip) < litLen || (size_t) (oend - op) < litLen) return -1;
+
+		memcpy(op, ip, litLen);
+		op += litLen;
+		ip += litLen;
+
+		// the last block has no match
+		if (ip == iend) break;
+
+		if (iend - ip < 2) return -1;
+		size_t offset = ip[0] | ((size_t) ip[1] << 8);
+		ip += 2;
+
+		if (offset == 0 || offset > (size_t) (op - ostart)) return -1;
+
+		size_t matchLen = token & 15;
+		if (matchLen == 15 && (ip = lzGetLength(ip, iend, &matchLen)) == NULL) return -1;
+		matchLen += LZ_MIN_MATCH;
+		if ((size_t) (oend - op) < matchLen) return -1;
+
+		// the match may overlap the output, so copy byte by byte
+		const uint8_t *ref = op - offset;
+		while (matchLen--) *op++ = *ref++;
+	};
+
+	return op - ostart;
+};
\ No newline at end of file
@@ -29,8 +29,9 @@
 #include <glidix/util/memory.h>
 #include <glidix/hw/kom.h>
 #include <glidix/util/string.h>
+#include <glidix/util/allocprof.h>
 
-void* kmalloc(size_t size)
+static void* _kmalloc(size_t size)
 {
 	if (size == 0)
 	{
@@ -50,7 +51,7 @@ void* kmalloc(size_t size)
 		return NULL;
 	};
 
-	HeapHeader *header = (HeapHeader*) komAllocBlock(i, KOM_POOLBIT_ALL);
+	HeapHeader *header = (HeapHeader*) komAllocBlockUntracked(i, KOM_POOLBIT_ALL);
 	if (header == NULL)
 	{
 		return NULL;
@@ -62,6 +63,22 @@ void* kmalloc(size_t size)
 	return &header[1];
 };
 
+static void _kfree(void *ptr)
+{
+	if (ptr != NULL)
+	{
+		HeapHeader *header = (HeapHeader*) ptr - 1;
+		komReleaseBlockUntracked(header, header->bucket);
+	};
+};
+
+void* kmalloc(size_t size)
+{
+	void *result = _kmalloc(size);
+	if (result != NULL) ALLOCPROF_ALLOC(ALLOCPROF_KMALLOC, result, size);
+	return result;
+};
+
 void* krealloc(void *ptr, size_t newSize)
 {
 	if (newSize == 0)
@@ -71,7 +88,9 @@ void* krealloc(void *ptr, size_t newSize)
 
 	if (ptr == NULL)
 	{
-		return kmalloc(newSize);
+		void *result = _kmalloc(newSize);
+		if (result != NULL) ALLOCPROF_ALLOC(ALLOCPROF_KMALLOC, result, newSize);
+		return result;
 	};
 
 	size_t totalNewSize = sizeof(HeapHeader) + newSize;
@@ -93,7 +112,7 @@ void* krealloc(void *ptr, size_t newSize)
 			{
 				// the previous bucket can fit us, move down
 				char *otherHalf = (char*) header + prevBucketSize;
-				komReleaseBlock(otherHalf, header->bucket-1);
+				komReleaseBlockUntracked(otherHalf, header->bucket-1);
 				header->bucket--;
 			}
 			else
@@ -111,23 +130,22 @@ void* krealloc(void *ptr, size_t newSize)
 	};
 
 	// worst case: have to do a full reallocation
-	void *result = kmalloc(newSize);
+	void *result = _kmalloc(newSize);
 	if (result == NULL)
 	{
 		return NULL;
 	};
 
 	memcpy(result, ptr, header->actualSize);
-	kfree(ptr);
+	ALLOCPROF_FREE(ptr);
+	_kfree(ptr);
 
+	ALLOCPROF_ALLOC(ALLOCPROF_KMALLOC, result, newSize);
 	return result;
 };
 
 void kfree(void *ptr)
 {
-	if (ptr != NULL)
-	{
-		HeapHeader *header = (HeapHeader*) ptr - 1;
-		komReleaseBlock(header, header->bucket);
-	};
+	ALLOCPROF_FREE(ptr);
+	_kfree(ptr);
 };
\ No newline at end of file
@@ -0,0 +1,134 @@
+/*
+	Glidix kernel
+
+	Copyright (c) 2021, Madd Games.
+	All rights reserved.
+	
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+	
+	* Redistributions of source code must retain the above copyright notice, this
+	  list of conditions and the following disclaimer.
+	
+	* Redistributions in binary form must reproduce the above copyright notice,
+	  this list of conditions and the following disclaimer in the documentation
+	  and/or other materials provided with the distribution.
+	
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+	DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+	FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+	DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+	SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+	CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+	OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+	OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include <glidix/util/symtab.h>
+#include <glidix/util/init.h>
+#include <glidix/util/string.h>
+#include <glidix/util/log.h>
+#include <glidix/fs/initrd.h>
+#include <glidix/int/elf64.h>
+#include <glidix/hw/vmalloc.h>
+
+/**
+ * The function symbols, sorted by address, and the number of them.
+ */
+static KernelSymbol *symTable;
+static uint64_t symCount;
+
+static void __init symInit()
+{
+	const Elf64_Sym *symtab = (const Elf64_Sym*) (initrdImage + bootInfo->initrdSymtabOffset);
+	const char *strtab = (const char*) (initrdImage + bootInfo->initrdStrtabOffset);
+
+	// count the functions and the space needed for their names
+	uint64_t count = 0;
+	size_t namesSize = 0;
+	uint64_t i;
+	for (i=0; i<bootInfo->numSymbols; i++)
+	{
+		if (ELF64_ST_TYPE(symtab[i].st_info) == STT_FUNC && symtab[i].st_value != 0)
+		{
+			count++;
+			namesSize += strlen(strtab + symtab[i].st_name) + 1;
+		};
+	};
+
+	if (count == 0)
+	{
+		kprintf("symtab: no kernel symbols found\n");
+		return;
+	};
+
+	KernelSymbol *table = (KernelSymbol*) vmalloc(sizeof(KernelSymbol) * count);
+	char *names = (char*) vmalloc(namesSize);
+	if (table == NULL || names == NULL)
+	{
+		kprintf("symtab: not enough memory for the kernel symbol table\n");
+		if (table != NULL) vfree(table);
+		if (names != NULL) vfree(names);
+		return;
+	};
+
+	uint64_t index = 0;
+	for (i=0; i<bootInfo->numSymbols; i++)
+	{
+		const Elf64_Sym *sym = &symtab[i];
+		if (ELF64_ST_TYPE(sym->st_info) != STT_FUNC || sym->st_value == 0)
+		{
+			continue;
+		};
+
+		// insertion sort; there are only a few thousand functions, and this runs once
+		uint64_t j = index++;
+		while (j != 0 && table[j-1].addr > sym->st_value)
+		{
+			table[j] = table[j-1];
+			j--;
+		};
+
+		strcpy(names, strtab + sym->st_name);
+		table[j].addr = sym->st_value;
+		table[j].size = sym->st_size;
+		table[j].name = names;
+		names += strlen(names) + 1;
+	};
+
+	symTable = table;
+	symCount = count;
+	kprintf("symtab: loaded %lu kernel function symbols\n", count);
+};
+
+KERNEL_INIT_ACTION(symInit, KIA_SYMTAB);
+
+const char* symLookup(uint64_t addr, uint64_t *offsetOut)
+{
+	// find the last symbol at or below `addr`
+	uint64_t lo = 0;
+	uint64_t hi = symCount;
+	while (lo < hi)
+	{
+		uint64_t mid = (lo + hi) / 2;
+		if (symTable[mid].addr <= addr) lo = mid + 1;
+		else hi = mid;
+	};
+
+	if (lo == 0)
+	{
+		return NULL;
+	};
+
+	const KernelSymbol *sym = &symTable[lo-1];
+	if (sym->size != 0 && addr - sym->addr >= sym->size)
+	{
+		return NULL;
+	};
+
+	*offsetOut = addr - sym->addr;
+	return sym->name;
+};
\ No newline at end of file
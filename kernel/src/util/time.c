@@ -27,13 +27,22 @@
 */
 
 #include <glidix/util/time.h>
+#include <glidix/util/init.h>
+#include <glidix/util/log.h>
+#include <glidix/util/string.h>
 #include <glidix/thread/spinlock.h>
+#include <glidix/hw/port.h>
 
 /**
  * The number of nanoseconds we've been up for.
  */
 static volatile nanoseconds_t uptime;
 
+/**
+ * Wall-clock time (nanoseconds since the epoch) at uptime 0, as read from the RTC.
+ */
+static nanoseconds_t realtimeBase;
+
 /**
  * The spinlock protecting the timed event list.
  */
@@ -49,6 +58,114 @@ nanoseconds_t timeGetUptime()
 	return uptime;
 };
 
+nanoseconds_t timeGetRealtime()
+{
+	return realtimeBase + uptime;
+};
+
+/**
+ * Read a CMOS register.
+ */
+static uint8_t timeReadCMOS(uint8_t reg)
+{
+	outb(CMOS_PORT_INDEX, reg);
+	return inb(CMOS_PORT_DATA);
+};
+
+/**
+ * Read the date and time registers of the RTC into `regs` (indexed by register number), once no
+ * update is in progress.
+ */
+static void timeReadRTC(uint8_t *regs)
+{
+	while (timeReadCMOS(CMOS_RTC_STATUS_A) & CMOS_RTC_UPDATING);
+
+	regs[CMOS_RTC_SECONDS] = timeReadCMOS(CMOS_RTC_SECONDS);
+	regs[CMOS_RTC_MINUTES] = timeReadCMOS(CMOS_RTC_MINUTES);
+	regs[CMOS_RTC_HOURS] = timeReadCMOS(CMOS_RTC_HOURS);
+	regs[CMOS_RTC_DAY] = timeReadCMOS(CMOS_RTC_DAY);
+	regs[CMOS_RTC_MONTH] = timeReadCMOS(CMOS_RTC_MONTH);
+	regs[CMOS_RTC_YEAR] = timeReadCMOS(CMOS_RTC_YEAR);
+};
+
+/**
+ * Convert a BCD value from the RTC to binary.
+ */
+static int timeFromBCD(uint8_t value)
+{
+	return (value & 0xF) + (value >> 4) * 10;
+};
+
+/**
+ * Return the number of days from the epoch to the specified date (with `month` from 1 to 12).
+ */
+static int64_t timeDaysFromCivil(int64_t year, int month, int day)
+{
+	year -= (month <= 2);
+	int64_t era = (year >= 0 ? year : year - 399) / 400;
+	int64_t yoe = year - era * 400;
+	int64_t doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+	int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+	return era * 146097 + doe - 719468;
+};
+
+static void timeInitRTC()
+{
+	// read the registers until we get the same values twice in a row, so that we never see a
+	// half-updated time
+	uint8_t regs[CMOS_RTC_YEAR+1];
+	uint8_t last[CMOS_RTC_YEAR+1];
+	timeReadRTC(regs);
+	do
+	{
+		memcpy(last, regs, sizeof(regs));
+		timeReadRTC(regs);
+	} while (memcmp(last, regs, sizeof(regs)) != 0);
+
+	nanoseconds_t now = uptime;
+	uint8_t statusB = timeReadCMOS(CMOS_RTC_STATUS_B);
+
+	int pm = regs[CMOS_RTC_HOURS] & 0x80;
+	regs[CMOS_RTC_HOURS] &= 0x7F;
+
+	int second, minute, hour, day, month, year;
+	if (statusB & CMOS_RTC_BINARY)
+	{
+		second = regs[CMOS_RTC_SECONDS];
+		minute = regs[CMOS_RTC_MINUTES];
+		hour = regs[CMOS_RTC_HOURS];
+		day = regs[CMOS_RTC_DAY];
+		month = regs[CMOS_RTC_MONTH];
+		year = regs[CMOS_RTC_YEAR];
+	}
+	else
+	{
+		second = timeFromBCD(regs[CMOS_RTC_SECONDS]);
+		minute = timeFromBCD(regs[CMOS_RTC_MINUTES]);
+		hour = timeFromBCD(regs[CMOS_RTC_HOURS]);
+		day = timeFromBCD(regs[CMOS_RTC_DAY]);
+		month = timeFromBCD(regs[CMOS_RTC_MONTH]);
+		year = timeFromBCD(regs[CMOS_RTC_YEAR]);
+	};
+
+	if ((statusB & CMOS_RTC_24HOUR) == 0)
+	{
+		// 12-hour clock: 12 AM is hour 0, and PM hours are 12 later
+		hour %= 12;
+		if (pm) hour += 12;
+	};
+
+	// the century register is not reliably present; assume the 21st century
+	year += 2000;
+
+	int64_t seconds = timeDaysFromCivil(year, month, day) * 86400 + hour * 3600 + minute * 60 + second;
+	realtimeBase = (nanoseconds_t) seconds * NANOS_PER_SEC - now;
+
+	kprintf("RTC time: %04d-%02d-%02d %02d:%02d:%02d UTC\n", year, month, day, hour, minute, second);
+};
+
+KERNEL_INIT_ACTION(timeInitRTC, KIA_TIME_RTC);
+
 void timeIncrease(nanoseconds_t nanos)
 {
 	__sync_fetch_and_add(&uptime, nanos);
@@ -29,10 +29,27 @@
 #include <glidix/util/treemap.h>
 #include <glidix/util/memory.h>
 #include <glidix/util/string.h>
+#include <glidix/util/kmem.h>
+#include <glidix/util/panic.h>
+
+/**
+ * The cache of treemap nodes. A `TreeMap` consists of just its master node, so maps are
+ * allocated from here too.
+ */
+static KmemCache *treemapNodeCache;
+
+void treemapInit()
+{
+	treemapNodeCache = kmemCacheCreate("treemap_node", sizeof(TreeMapNode), NULL);
+	if (treemapNodeCache == NULL)
+	{
+		panic("Failed to create the treemap node cache!");
+	};
+};
 
 TreeMap* treemapNew()
 {
-	TreeMap *map = (TreeMap*) kmalloc(sizeof(TreeMap));
+	TreeMap *map = (TreeMap*) kmemCacheAlloc(treemapNodeCache);
 	if (map == NULL)
 	{
 		return map;
@@ -53,14 +70,14 @@ static void _treemapReleaseNode(TreeMapNode *node, int depth)
 	for (i=0; i<TREEMAP_NUM_CHILDREN; i++)
 	{
 		_treemapReleaseNode(node->children[i], depth+1);
-		kfree(node->children[i]);
+		if (node->children[i] != NULL) kmemCacheFree(treemapNodeCache, node->children[i]);
 	};
 };
 
 void treemapDestroy(TreeMap *map)
 {
 	_treemapReleaseNode(&map->masterNode, 0);
-	kfree(map);
+	kmemCacheFree(treemapNodeCache, map);
 };
 
 void* treemapGet(TreeMap *map, uint32_t index)
@@ -94,7 +111,7 @@ errno_t treemapSet(TreeMap *map, uint32_t index, void *ptr)
 		uint32_t indexIntoNode = index & (TREEMAP_NUM_CHILDREN-1);
 		if (node->children[indexIntoNode] == NULL)
 		{
-			void *sub = kmalloc(sizeof(TreeMapNode));
+			void *sub = kmemCacheAlloc(treemapNodeCache);
 			if (sub == NULL)
 			{
 				return ENOMEM;
@@ -23,6 +23,22 @@ _exit:
 	// no return
 .size _exit, .-_exit
 
+.globl getpid
+.type getpid, @function
+getpid:
+	mov $10, %rax
+	syscall
+	ret
+.size getpid, .-getpid
+
+.globl getppid
+.type getppid, @function
+getppid:
+	mov $11, %rax
+	syscall
+	ret
+.size getppid, .-getppid
+
 .globl pthread_self
 .type pthread_self, @function
 pthread_self:
@@ -274,4 +290,121 @@ __thsignal:
 	mov $27, %rax
 	syscall
 	ret
-.size __thsignal, .-__thsignal
\ No newline at end of file
+.size __thsignal, .-__thsignal
+
+.globl getrusage
+.type getrusage, @function
+getrusage:
+	mov $28, %rax
+	syscall
+
+	// if return value was zero, return now
+	test %eax, %eax
+	jz getrusage_ret
+
+	// nonzero return value: negated error number.
+	// store it in errno (fs+0x18)
+	neg %eax
+	mov %eax, %fs:(0x18)
+	mov $-1, %eax
+
+getrusage_ret:
+	ret
+.size getrusage, .-getrusage
+
+.globl times
+.type times, @function
+times:
+	mov $29, %rax
+	syscall
+
+	// if return value is non-negative, return it
+	mov $0x8000000000000000, %rcx
+	test %rcx, %rax
+	jz times_ret
+
+	// negative return value; set errno
+	neg %rax
+	mov %eax, %fs:(0x18)
+	mov $-1, %rax
+
+times_ret:
+	ret
+.size times, .-times
+
+.globl clock_gettime
+.type clock_gettime, @function
+clock_gettime:
+	mov $30, %rax
+	syscall
+
+	// if return value was zero, return now
+	test %eax, %eax
+	jz clock_gettime_ret
+
+	// nonzero return value: negated error number.
+	// store it in errno (fs+0x18)
+	neg %eax
+	mov %eax, %fs:(0x18)
+	mov $-1, %eax
+
+clock_gettime_ret:
+	ret
+.size clock_gettime, .-clock_gettime
+
+.globl fork
+.type fork, @function
+fork:
+	mov $3, %rax
+	syscall
+
+	// if return value is non-negative, return it
+	test %eax, %eax
+	jns fork_ret
+
+	// negative return value; set errno
+	neg %eax
+	mov %eax, %fs:(0x18)
+	mov $-1, %eax
+
+fork_ret:
+	ret
+.size fork, .-fork
+
+.globl waitpid
+.type waitpid, @function
+waitpid:
+	mov $12, %rax
+	syscall
+
+	// if return value is non-negative, return it
+	test %eax, %eax
+	jns waitpid_ret
+
+	// negative return value; set errno
+	neg %eax
+	mov %eax, %fs:(0x18)
+	mov $-1, %eax
+
+waitpid_ret:
+	ret
+.size waitpid, .-waitpid
+
+.globl madvise
+.type madvise, @function
+madvise:
+	mov $31, %rax
+	syscall
+
+	mov $0x80000000, %ecx
+	test %ecx, %eax
+	jz madvise_ret
+
+	// negative return value; set errno
+	neg %eax
+	mov %eax, %fs:(0x18)
+	mov $-1, %eax
+
+madvise_ret:
+	ret
+.size madvise, .-madvise
\ No newline at end of file
@@ -0,0 +1,98 @@
+/*
+	Glidix Standard C Library (libc)
+	
+	Copyright (c) 2021, Madd Games.
+	All rights reserved.
+	
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+	
+	* Redistributions of source code must retain the above copyright notice, this
+	  list of conditions and the following disclaimer.
+	
+	* Redistributions in binary form must reproduce the above copyright notice,
+	  this list of conditions and the following disclaimer in the documentation
+	  and/or other materials provided with the distribution.
+	
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+	DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+	FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+	DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+	SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+	CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+	OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+	OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef _SPAWN_H
+#define _SPAWN_H
+
+#include <sys/types.h>
+#include <signal.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Flags for posix_spawnattr_setflags(). Only the ones below are supported.
+ */
+#define	POSIX_SPAWN_SETPGROUP		(1 << 1)
+#define	POSIX_SPAWN_SETSID		(1 << 7)
+
+/**
+ * Maximum number of file actions (the kernel limit).
+ */
+#define	__SPAWN_ACTIONS_MAX		64
+
+/**
+ * A file action, in the format expected by the kernel.
+ */
+struct __spawn_action
+{
+	int				__action;
+	int				__fd;
+	int				__newfd;
+	int				__oflags;
+	mode_t				__mode;
+	const char*			__path;
+};
+
+typedef struct
+{
+	int				__count;
+	struct __spawn_action*		__actions;
+} posix_spawn_file_actions_t;
+
+typedef struct
+{
+	int				__flags;
+	pid_t				__pgroup;
+} posix_spawnattr_t;
+
+int	posix_spawn(pid_t *pid, const char *path, const posix_spawn_file_actions_t *file_actions,
+		const posix_spawnattr_t *attrp, char *const argv[], char *const envp[]);
+int	posix_spawnp(pid_t *pid, const char *file, const posix_spawn_file_actions_t *file_actions,
+		const posix_spawnattr_t *attrp, char *const argv[], char *const envp[]);
+
+int	posix_spawn_file_actions_init(posix_spawn_file_actions_t *file_actions);
+int	posix_spawn_file_actions_destroy(posix_spawn_file_actions_t *file_actions);
+int	posix_spawn_file_actions_addclose(posix_spawn_file_actions_t *file_actions, int fd);
+int	posix_spawn_file_actions_adddup2(posix_spawn_file_actions_t *file_actions, int fd, int newfd);
+int	posix_spawn_file_actions_addopen(posix_spawn_file_actions_t *file_actions, int fd, const char *path,
+		int oflag, mode_t mode);
+
+int	posix_spawnattr_init(posix_spawnattr_t *attr);
+int	posix_spawnattr_destroy(posix_spawnattr_t *attr);
+int	posix_spawnattr_getflags(const posix_spawnattr_t *attr, short *flags);
+int	posix_spawnattr_setflags(posix_spawnattr_t *attr, short flags);
+int	posix_spawnattr_getpgroup(const posix_spawnattr_t *attr, pid_t *pgroup);
+int	posix_spawnattr_setpgroup(posix_spawnattr_t *attr, pid_t pgroup);
+
+#ifdef __cplusplus
+}	/* extern "C" */
+#endif
+
+#endif
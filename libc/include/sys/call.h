@@ -59,6 +59,11 @@
 #define	__SYS_pthread_detach						25
 #define	__SYS_thwait							26
 #define	__SYS_thsignal							27
+#define	__SYS_getrusage							28
+#define	__SYS_times							29
+#define	__SYS_clock_gettime						30
+#define	__SYS_madvise							31
+#define	__SYS_spawn							32
 
 // TODO
 #define	__SYS_sockerr							255
@@ -49,7 +49,12 @@ extern "C" {
 
 #define	MAP_FAILED			((void*)-1)
 
+#define	MADV_NORMAL			0
+#define	MADV_HUGEPAGE			14
+#define	MADV_NOHUGEPAGE			15
+
 int mprotect(void *addr, size_t len, int prot);
+int madvise(void *addr, size_t len, int advice);
 int munmap(void *addr, size_t len);
 void* mmap(void *addr, size_t len, int prot, int flags, int fd, off_t offset);
 
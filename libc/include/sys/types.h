@@ -58,6 +58,7 @@ typedef	int64_t				off_t;
 typedef	int64_t				ssize_t;
 typedef int				pid_t;
 typedef	int64_t				suseconds_t;
+typedef	int				clockid_t;
 typedef	uint64_t			socklen_t;
 typedef	uint16_t			sa_family_t;
 typedef uint16_t			in_port_t;
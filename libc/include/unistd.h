@@ -43,6 +43,7 @@ extern "C" {
 #define	_SC_PAGE_SIZE				3 // {
 #define	_SC_NGROUPS_MAX				4
 #define	_SC_OPEN_MAX				5
+#define	_SC_CLK_TCK				6
 
 #define	LOGIN_NAME_MAX				127
 #define	PAGESIZE				0x1000
@@ -0,0 +1,156 @@
+/*
+	Glidix Standard C Library (libc)
+	
+	Copyright (c) 2021, Madd Games.
+	All rights reserved.
+	
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+	
+	* Redistributions of source code must retain the above copyright notice, this
+	  list of conditions and the following disclaimer.
+	
+	* Redistributions in binary form must reproduce the above copyright notice,
+	  this list of conditions and the following disclaimer in the documentation
+	  and/or other materials provided with the distribution.
+	
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+	DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+	FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+	DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+	SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+	CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+	OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+	OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <spawn.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+/* the kernel's codes for the actions */
+enum
+{
+	__SPAWN_FA_CLOSE,
+	__SPAWN_FA_DUP2,
+	__SPAWN_FA_OPEN
+};
+
+/**
+ * Add a new action to the end of the list, and return it; or return NULL if there is no room.
+ */
+static struct __spawn_action* __spawn_add_action(posix_spawn_file_actions_t *file_actions)
+{
+	if (file_actions->__count == __SPAWN_ACTIONS_MAX)
+	{
+		return NULL;
+	};
+	
+	struct __spawn_action *newList = (struct __spawn_action*) realloc(file_actions->__actions,
+					sizeof(struct __spawn_action) * (file_actions->__count + 1));
+	if (newList == NULL)
+	{
+		return NULL;
+	};
+	
+	file_actions->__actions = newList;
+	return &newList[file_actions->__count++];
+};
+
+int posix_spawn_file_actions_init(posix_spawn_file_actions_t *file_actions)
+{
+	file_actions->__count = 0;
+	file_actions->__actions = NULL;
+	return 0;
+};
+
+int posix_spawn_file_actions_destroy(posix_spawn_file_actions_t *file_actions)
+{
+	int i;
+	for (i=0; i<file_actions->__count; i++)
+	{
+		free((char*) file_actions->__actions[i].__path);
+	};
+	
+	free(file_actions->__actions);
+	file_actions->__actions = NULL;
+	file_actions->__count = 0;
+	return 0;
+};
+
+int posix_spawn_file_actions_addclose(posix_spawn_file_actions_t *file_actions, int fd)
+{
+	if (fd < 0)
+	{
+		return EBADF;
+	};
+	
+	struct __spawn_action *act = __spawn_add_action(file_actions);
+	if (act == NULL)
+	{
+		return ENOMEM;
+	};
+	
+	act->__action = __SPAWN_FA_CLOSE;
+	act->__fd = fd;
+	act->__newfd = -1;
+	act->__oflags = 0;
+	act->__mode = 0;
+	act->__path = NULL;
+	return 0;
+};
+
+int posix_spawn_file_actions_adddup2(posix_spawn_file_actions_t *file_actions, int fd, int newfd)
+{
+	if (fd < 0 || newfd < 0)
+	{
+		return EBADF;
+	};
+	
+	struct __spawn_action *act = __spawn_add_action(file_actions);
+	if (act == NULL)
+	{
+		return ENOMEM;
+	};
+	
+	act->__action = __SPAWN_FA_DUP2;
+	act->__fd = fd;
+	act->__newfd = newfd;
+	act->__oflags = 0;
+	act->__mode = 0;
+	act->__path = NULL;
+	return 0;
+};
+
+int posix_spawn_file_actions_addopen(posix_spawn_file_actions_t *file_actions, int fd, const char *path,
+		int oflag, mode_t mode)
+{
+	if (fd < 0)
+	{
+		return EBADF;
+	};
+	
+	char *pathdup = strdup(path);
+	if (pathdup == NULL)
+	{
+		return ENOMEM;
+	};
+	
+	struct __spawn_action *act = __spawn_add_action(file_actions);
+	if (act == NULL)
+	{
+		free(pathdup);
+		return ENOMEM;
+	};
+	
+	act->__action = __SPAWN_FA_OPEN;
+	act->__fd = fd;
+	act->__newfd = -1;
+	act->__oflags = oflag;
+	act->__mode = mode;
+	act->__path = pathdup;
+	return 0;
+};
@@ -0,0 +1,84 @@
+/*
+	Glidix Standard C Library (libc)
+	
+	Copyright (c) 2021, Madd Games.
+	All rights reserved.
+	
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+	
+	* Redistributions of source code must retain the above copyright notice, this
+	  list of conditions and the following disclaimer.
+	
+	* Redistributions in binary form must reproduce the above copyright notice,
+	  this list of conditions and the following disclaimer in the documentation
+	  and/or other materials provided with the distribution.
+	
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+	DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+	FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+	DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+	SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+	CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+	OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+	OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <sys/call.h>
+#include <spawn.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+
+/* unistd/exec.c */
+int __find_command(char *path, char *cmd);
+
+int posix_spawn(pid_t *pid, const char *path, const posix_spawn_file_actions_t *file_actions,
+		const posix_spawnattr_t *attrp, char *const argv[], char *const envp[])
+{
+	const struct __spawn_action *actions = NULL;
+	int numActions = 0;
+	
+	if (file_actions != NULL)
+	{
+		actions = file_actions->__actions;
+		numActions = file_actions->__count;
+	};
+	
+	pid_t child = (pid_t) __syscall(__SYS_spawn, path, argv, envp, actions, numActions, attrp);
+	if (child < 0)
+	{
+		return -child;
+	};
+	
+	if (pid != NULL) *pid = child;
+	return 0;
+};
+
+int posix_spawnp(pid_t *pid, const char *file, const posix_spawn_file_actions_t *file_actions,
+		const posix_spawnattr_t *attrp, char *const argv[], char *const envp[])
+{
+	if (strchr(file, '/') != NULL)
+	{
+		return posix_spawn(pid, file, file_actions, attrp, argv, envp);
+	};
+	
+	char path[256];
+	char *filedup = strdup(file);
+	if (filedup == NULL)
+	{
+		return ENOMEM;
+	};
+	
+	int ok = __find_command(path, filedup);
+	free(filedup);
+	
+	if (ok == -1)
+	{
+		return ENOENT;
+	};
+	
+	return posix_spawn(pid, path, file_actions, attrp, argv, envp);
+};
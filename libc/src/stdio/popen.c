@@ -33,6 +33,7 @@
 #include <errno.h>
 #include <string.h>
 #include <stdlib.h>
+#include <spawn.h>
 
 enum
 {
@@ -43,6 +44,8 @@ enum
 /* internal/file.c */
 void __fd_flush(FILE *fp);
 
+extern char **environ;
+
 FILE *popen(const char *cmd, const char *mode)
 {
 	int m;
@@ -66,57 +69,81 @@ FILE *popen(const char *cmd, const char *mode)
 		return NULL;
 	};
 	
-	pid_t pid = fork();
-	if (pid == -1)
-	{
-		return NULL;
-	};
+	// the child gets one end of the pipe in place of its stdout and stderr, or its stdin; it
+	// must not keep the other descriptors, or the pipe would never report end-of-file
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
 	
-	if (pid == 0)
+	int error;
+	if (m == __MODE_READ)
 	{
-		if (m == __MODE_READ)
+		// they're reading from our stdout/stderr
+		if ((error = posix_spawn_file_actions_adddup2(&actions, pipefd[1], 1)) == 0)
 		{
-			// they're reading from our stdout/stderr
-			close(1);
-			close(2);
-			dup2(pipefd[1], 1);
-			dup2(pipefd[1], 2);
-		}
-		else
-		{
-			// they're writing to out stdin
-			close(0);
-			dup2(pipefd[0], 0);
+			error = posix_spawn_file_actions_adddup2(&actions, pipefd[1], 2);
 		};
-		
-		execl("/bin/sh", "sh", "-c", cmd, NULL);
-		_exit(127);
 	}
 	else
 	{
-		FILE *fp = (FILE*) malloc(sizeof(FILE));
-		fp->_buf = &fp->_nanobuf;
-		fp->_rdbuf = fp->_buf;
-		fp->_wrbuf = fp->_buf;
-		fp->_bufsiz = 1;
-		fp->_bufsiz_org = 1;
-		fp->_trigger = 0;
-		fp->_flush = __fd_flush;
-		if (m == __MODE_READ)
-		{
-			fp->_fd = pipefd[0];
-			fp->_flags = __FILE_READ;
-		}
-		else
+		// they're writing to our stdin
+		error = posix_spawn_file_actions_adddup2(&actions, pipefd[0], 0);
+	};
+	
+	if (error == 0 && (error = posix_spawn_file_actions_addclose(&actions, pipefd[0])) == 0)
+	{
+		error = posix_spawn_file_actions_addclose(&actions, pipefd[1]);
+	};
+	
+	pid_t pid;
+	if (error == 0)
+	{
+		char *argv[] = {"sh", "-c", (char*) cmd, NULL};
+		error = posix_spawn(&pid, "/bin/sh", &actions, NULL, argv, environ);
+	};
+	
+	posix_spawn_file_actions_destroy(&actions);
+	
+	FILE *fp = NULL;
+	if (error == 0)
+	{
+		fp = (FILE*) malloc(sizeof(FILE));
+		if (fp == NULL)
 		{
-			fp->_fd = pipefd[1];
-			fp->_flags = __FILE_WRITE;
+			error = ENOMEM;
 		};
-		fp->_ungot = -1;
-		fp->_pid = pid;
-		
-		return fp;
 	};
+	
+	if (error != 0)
+	{
+		close(pipefd[0]);
+		close(pipefd[1]);
+		errno = error;
+		return NULL;
+	};
+	
+	fp->_buf = &fp->_nanobuf;
+	fp->_rdbuf = fp->_buf;
+	fp->_wrbuf = fp->_buf;
+	fp->_bufsiz = 1;
+	fp->_bufsiz_org = 1;
+	fp->_trigger = 0;
+	fp->_flush = __fd_flush;
+	if (m == __MODE_READ)
+	{
+		fp->_fd = pipefd[0];
+		fp->_flags = __FILE_READ;
+		close(pipefd[1]);
+	}
+	else
+	{
+		fp->_fd = pipefd[1];
+		fp->_flags = __FILE_WRITE;
+		close(pipefd[0]);
+	};
+	fp->_ungot = -1;
+	fp->_pid = pid;
+	
+	return fp;
 };
 
 int pclose(FILE *fp)
@@ -31,6 +31,9 @@
 #include <signal.h>
 #include <unistd.h>
 #include <errno.h>
+#include <spawn.h>
+
+extern char **environ;
 
 int system(const char *cmd)
 {
@@ -49,17 +52,14 @@ int system(const char *cmd)
 	sigaction(SIGINT, &sa, &savintr);
 	sigaction(SIGQUIT, &sa, &savequit);
 	
-	if ((pid = fork()) == 0)
-	{
-		sigaction(SIGINT, &savintr, NULL);
-		sigaction(SIGQUIT, &savequit, NULL);
-		execl(shell, "sh", "-c", cmd, NULL);
-		_exit(127);
-	};
-	
-	if (pid == -1)
+	// spawn the shell rather than forking, so that the cost doesn't depend on the size of our
+	// address space; the child gets the default signal dispositions when it execs
+	char *argv[] = {"sh", "-c", (char*) cmd, NULL};
+	int error = posix_spawn(&pid, shell, NULL, NULL, argv, environ);
+	if (error != 0)
 	{
-		stat = -1; /* errno comes from fork() */
+		errno = error;
+		stat = -1;
 	}
 	else
 	{
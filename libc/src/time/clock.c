@@ -30,5 +30,11 @@
 
 clock_t clock()
 {
-	return _glidix_nanotime() / 1000;
+	struct timespec ts;
+	if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts) != 0)
+	{
+		return (clock_t) -1;
+	};
+
+	return ts.tv_sec * CLOCKS_PER_SEC + ts.tv_nsec / (1000000000 / CLOCKS_PER_SEC);
 };
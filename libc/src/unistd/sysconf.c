@@ -29,6 +29,7 @@
 #include <unistd.h>
 #include <pwd.h>
 #include <errno.h>
+#include <time.h>
 
 long sysconf(int name)
 {
@@ -46,6 +47,8 @@ long sysconf(int name)
 		return NGROUPS_MAX;
 	case _SC_OPEN_MAX:
 		return OPEN_MAX;
+	case _SC_CLK_TCK:
+		return CLK_TCK;
 	default:
 		errno = EINVAL;
 		return -1;